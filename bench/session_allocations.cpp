@@ -0,0 +1,106 @@
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <new>
+#include <rxcpp/rx.hpp>
+
+#include "papaya/concurrent/thread_pool.hpp"
+#include "papaya/coro/task.hpp"
+#include "papaya/factory/fl_factory.hpp"
+
+// Its own binary because it replaces the global operator new: every
+// allocation, on any thread, is counted, so rx and coroutine sessions are
+// compared on the same terms.
+namespace detail
+{
+  std::atomic<size_t> allocation_count{0};
+
+  void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) noexcept
+  {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = size == 0 ? 1 : size;
+    if (alignment <= alignof(std::max_align_t))
+    {
+      return std::malloc(size);
+    }
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  }
+} // namespace detail
+
+// Every replaceable form is replaced so allocation and deallocation always
+// pair up through malloc/free.
+void *operator new(std::size_t size)
+{
+  if (auto *p = detail::allocate(size))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+  if (auto *p = detail::allocate(size, static_cast<std::size_t>(alignment)))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) { return ::operator new(size, alignment); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return detail::allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return detail::allocate(size); }
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return detail::allocate(size, static_cast<std::size_t>(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return detail::allocate(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+
+TEST_CASE("Allocations per rx vs coroutine fl session", "[coroutine][rx][!benchmark]")
+{
+  pa::concurrent::thread_pool pool{1};
+  pa::fl_factory factory;
+
+  auto rx_session = [&]
+  {
+    pa::fl_factory::input input;
+    return factory.create(input)
+        .subscribe_on(rxcpp::observe_on_event_loop())
+        .as_blocking()
+        .first();
+  };
+  auto coroutine_session = [&]
+  {
+    return pa::coro::sync_wait(factory.co_create(pa::fl_factory::input{}, pool));
+  };
+
+  const auto sessions = 1000;
+  auto allocations_per_session = [&](auto &&session)
+  {
+    // The first session warms up thread-locals and the event loop.
+    session();
+    auto before = detail::allocation_count.load();
+    for (auto i = 0; i < sessions; ++i)
+    {
+      session();
+    }
+    return static_cast<double>(detail::allocation_count.load() - before) / sessions;
+  };
+  auto rx = allocations_per_session(rx_session);
+  auto coroutine = allocations_per_session(coroutine_session);
+  WARN("allocations per session: rx=" << rx << " coroutine=" << coroutine);
+}
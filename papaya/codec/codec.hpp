@@ -0,0 +1,727 @@
+#pragma once
+
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace pa
+{
+  namespace codec
+  {
+    /**
+     * @brief Opt-in reflection: specialize with the members to encode, in
+     * wire order, e.g.
+     *
+     *   template <>
+     *   struct schema<point>
+     *   {
+     *     static constexpr auto fields = std::make_tuple(&point::x, &point::y);
+     *   };
+     *
+     * The wire format has no field names, tags or lengths, and decode()
+     * rejects trailing bytes, so no schema change is compatible: encoder and
+     * decoder must be built from the same schemas.
+     */
+    template <typename T>
+    struct schema;
+
+    /**
+     * @brief Specialize for every enum a schema encodes with its largest
+     * valid value, e.g.
+     *
+     *   template <>
+     *   struct enum_max<color>
+     *   {
+     *     static constexpr auto value = color::blue;
+     *   };
+     *
+     * decode() rejects values above it or below zero, so a decoded enum is
+     * always one of its enumerators.
+     */
+    template <typename T>
+    struct enum_max;
+
+    /**
+     * @brief Appends to a caller-provided buffer. Running out of room isn't an
+     * error until ok() is asked; a writer without a buffer just counts bytes.
+     */
+    class writer final
+    {
+    public:
+      writer() = default;
+      explicit writer(std::span<char> buffer) : begin_(buffer.data()), end_(buffer.data() + buffer.size()) {}
+
+      void varint(uint64_t value)
+      {
+        char bytes[10];
+        size_t n = 0;
+        while (value >= 0x80)
+        {
+          bytes[n++] = static_cast<char>((value & 0x7F) | 0x80);
+          value >>= 7;
+        }
+        bytes[n++] = static_cast<char>(value);
+        write(bytes, n);
+      }
+
+      void write(const char *data, size_t size)
+      {
+        if (begin_ != nullptr && size_ + size <= static_cast<size_t>(end_ - begin_))
+        {
+          std::memcpy(begin_ + size_, data, size);
+        }
+        else if (begin_ != nullptr)
+        {
+          overflow_ = true;
+        }
+        size_ += size;
+      }
+
+      // Fixed-width little-endian bytes of an arithmetic value.
+      template <typename T>
+      void fixed(T value)
+      {
+        static_assert(std::endian::native == std::endian::little, "only little-endian hosts are supported");
+        write(reinterpret_cast<const char *>(&value), sizeof(value));
+      }
+
+      bool ok() const { return !overflow_; }
+      size_t size() const { return size_; }
+
+    private:
+      char *begin_ = nullptr;
+      char *end_ = nullptr;
+      size_t size_ = 0;
+      bool overflow_ = false;
+    };
+
+    /**
+     * @brief Consumes a buffer front to back. Every read fails (returns false)
+     * instead of reading past the end.
+     */
+    class reader final
+    {
+    public:
+      explicit reader(std::span<const char> buffer) : cursor_(buffer.data()), end_(buffer.data() + buffer.size()) {}
+
+      bool varint(uint64_t &value)
+      {
+        value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7)
+        {
+          if (cursor_ == end_)
+          {
+            return false;
+          }
+          auto byte = static_cast<uint8_t>(*cursor_++);
+          value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+          if ((byte & 0x80) == 0)
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      bool read(size_t size, const char *&data)
+      {
+        if (static_cast<size_t>(end_ - cursor_) < size)
+        {
+          return false;
+        }
+        data = cursor_;
+        cursor_ += size;
+        return true;
+      }
+
+      template <typename T>
+      bool fixed(T &value)
+      {
+        const char *data;
+        if (!read(sizeof(T), data))
+        {
+          return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        return true;
+      }
+
+      const char *position() const { return cursor_; }
+      bool at_end() const { return cursor_ == end_; }
+
+    private:
+      const char *cursor_;
+      const char *end_;
+    };
+
+    template <typename T>
+    struct view_of;
+    // What decode<T>() hands out: T itself for scalars, views into the
+    // source buffer for everything that owns memory.
+    template <typename T>
+    using view_t = typename view_of<std::remove_cv_t<T>>::type;
+
+    template <typename T>
+    bool decode_value(reader &in, view_t<T> &out);
+
+    /**
+     * @brief Lazily decoded range of Ts in the source buffer. Iterating it
+     * doesn't allocate; decode() already validated every element.
+     */
+    template <typename T>
+    class sequence_view final
+    {
+    public:
+      class iterator final
+      {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = view_t<T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type *;
+        using reference = const value_type &;
+
+        iterator() : in_(std::span<const char>{}) {}
+        iterator(std::span<const char> bytes, size_t remaining) : in_(bytes), remaining_(remaining) { advance(); }
+
+        reference operator*() const { return current_; }
+        pointer operator->() const { return &current_; }
+        iterator &operator++()
+        {
+          advance();
+          return *this;
+        }
+        void operator++(int) { advance(); }
+        bool operator==(const iterator &other) const { return done_ == other.done_ && (done_ || in_.position() == other.in_.position()); }
+
+      private:
+        void advance()
+        {
+          if (remaining_ == 0 || !decode_value<T>(in_, current_))
+          {
+            done_ = true;
+            return;
+          }
+          done_ = false;
+          --remaining_;
+        }
+
+        reader in_;
+        size_t remaining_ = 0;
+        value_type current_{};
+        bool done_ = true;
+      };
+
+      sequence_view() = default;
+      sequence_view(std::span<const char> bytes, size_t count) : bytes_(bytes), count_(count) {}
+
+      iterator begin() const { return iterator(bytes_, count_); }
+      iterator end() const { return iterator(); }
+      size_t size() const { return count_; }
+      bool empty() const { return count_ == 0; }
+
+    private:
+      std::span<const char> bytes_;
+      size_t count_ = 0;
+    };
+
+    namespace detail
+    {
+      template <typename T, typename = void>
+      struct has_schema : std::false_type
+      {
+      };
+      template <typename T>
+      struct has_schema<T, std::void_t<decltype(schema<T>::fields)>> : std::true_type
+      {
+      };
+
+      template <typename T>
+      struct is_variant : std::false_type
+      {
+      };
+      template <typename... Ts>
+      struct is_variant<std::variant<Ts...>> : std::true_type
+      {
+      };
+
+      template <typename T>
+      struct is_pair : std::false_type
+      {
+      };
+      template <typename A, typename B>
+      struct is_pair<std::pair<A, B>> : std::true_type
+      {
+      };
+
+      template <typename T>
+      struct is_optional : std::false_type
+      {
+      };
+      template <typename T>
+      struct is_optional<std::optional<T>> : std::true_type
+      {
+      };
+
+      template <typename T>
+      struct is_duration : std::false_type
+      {
+      };
+      template <typename Rep, typename Period>
+      struct is_duration<std::chrono::duration<Rep, Period>> : std::true_type
+      {
+      };
+
+      template <typename T>
+      struct is_time_point : std::false_type
+      {
+      };
+      template <typename Clock, typename Duration>
+      struct is_time_point<std::chrono::time_point<Clock, Duration>> : std::true_type
+      {
+      };
+
+      // vector, set, unordered_map, ...: anything with value_type, size()
+      // and insert() at the end, except strings.
+      template <typename T, typename = void>
+      struct is_container : std::false_type
+      {
+      };
+      template <typename T>
+      struct is_container<T, std::void_t<typename T::value_type,
+                                         decltype(std::declval<const T &>().size()),
+                                         decltype(std::declval<T &>().insert(std::declval<T &>().end(), std::declval<typename T::value_type>()))>>
+          : std::bool_constant<!std::is_same<T, std::string>::value>
+      {
+      };
+
+      template <typename C, typename F>
+      F member_type(F C::*);
+
+      template <typename T, typename Fields>
+      struct fields_view;
+      template <typename T, typename... Members>
+      struct fields_view<T, std::tuple<Members...>>
+      {
+        using type = std::tuple<view_t<decltype(member_type(std::declval<Members>()))>...>;
+      };
+
+      template <typename T>
+      uint64_t zigzag(T value)
+      {
+        using U = std::make_unsigned_t<T>;
+        return (static_cast<U>(value) << 1) ^ static_cast<U>(value >> (sizeof(T) * 8 - 1));
+      }
+
+      template <typename T>
+      T unzigzag(uint64_t value)
+      {
+        return static_cast<T>((value >> 1) ^ (~(value & 1) + 1));
+      }
+    }
+
+    template <typename T>
+    struct view_of
+    {
+      static auto pick()
+      {
+        if constexpr (std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                      detail::is_duration<T>::value || detail::is_time_point<T>::value)
+        {
+          return T{};
+        }
+        else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+        {
+          return std::string_view{};
+        }
+        else if constexpr (detail::is_pair<T>::value)
+        {
+          return std::pair<view_t<typename T::first_type>, view_t<typename T::second_type>>{};
+        }
+        else if constexpr (detail::is_container<T>::value)
+        {
+          return sequence_view<typename T::value_type>{};
+        }
+        else if constexpr (detail::has_schema<T>::value)
+        {
+          return typename detail::fields_view<T, std::remove_cv_t<decltype(schema<T>::fields)>>::type{};
+        }
+        else
+        {
+          static_assert(sizeof(T) == 0, "pa::codec: no encoding for this type; specialize pa::codec::schema<T>");
+        }
+      }
+
+      using type = decltype(pick());
+    };
+
+    template <typename... Ts>
+    struct view_of<std::variant<Ts...>>
+    {
+      using type = std::variant<view_t<Ts>...>;
+    };
+
+    template <typename T>
+    struct view_of<std::optional<T>>
+    {
+      using type = std::optional<view_t<T>>;
+    };
+
+    template <typename T>
+    void encode_value(writer &out, const T &value)
+    {
+      if constexpr (std::is_same<T, bool>::value)
+      {
+        out.varint(value ? 1 : 0);
+      }
+      else if constexpr (std::is_enum<T>::value)
+      {
+        encode_value(out, static_cast<std::underlying_type_t<T>>(value));
+      }
+      else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value)
+      {
+        out.varint(detail::zigzag(value));
+      }
+      else if constexpr (std::is_integral<T>::value)
+      {
+        out.varint(value);
+      }
+      else if constexpr (std::is_floating_point<T>::value)
+      {
+        out.fixed(value);
+      }
+      else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+      {
+        out.varint(value.size());
+        out.write(value.data(), value.size());
+      }
+      else if constexpr (detail::is_duration<T>::value)
+      {
+        encode_value(out, value.count());
+      }
+      else if constexpr (detail::is_time_point<T>::value)
+      {
+        // Only meaningful to a reader on the same clock, e.g. steady_clock
+        // across processes of one host.
+        encode_value(out, value.time_since_epoch());
+      }
+      else if constexpr (detail::is_optional<T>::value)
+      {
+        out.varint(value ? 1 : 0);
+        if (value)
+        {
+          encode_value(out, *value);
+        }
+      }
+      else if constexpr (detail::is_pair<T>::value)
+      {
+        encode_value(out, value.first);
+        encode_value(out, value.second);
+      }
+      else if constexpr (detail::is_variant<T>::value)
+      {
+        out.varint(value.index());
+        std::visit([&out](const auto &alternative)
+                   { encode_value(out, alternative); },
+                   value);
+      }
+      else if constexpr (detail::is_container<T>::value)
+      {
+        out.varint(value.size());
+        for (const auto &element : value)
+        {
+          encode_value(out, element);
+        }
+      }
+      else
+      {
+        std::apply([&](auto... members)
+                   { (encode_value(out, value.*members), ...); },
+                   schema<T>::fields);
+      }
+    }
+
+    namespace detail
+    {
+      template <typename Variant, size_t... Is>
+      bool decode_alternative(reader &in, uint64_t index, view_t<Variant> &out, std::index_sequence<Is...>)
+      {
+        auto decoded = false;
+        ((index == Is ? (decoded = decode_value<std::variant_alternative_t<Is, Variant>>(in, out.template emplace<Is>()), true) : false) || ...);
+        return decoded;
+      }
+    }
+
+    template <typename T>
+    bool decode_value(reader &in, view_t<T> &out)
+    {
+      if constexpr (std::is_same<T, bool>::value)
+      {
+        uint64_t v;
+        if (!in.varint(v) || v > 1)
+        {
+          return false;
+        }
+        out = v == 1;
+        return true;
+      }
+      else if constexpr (std::is_enum<T>::value)
+      {
+        using underlying_t = std::underlying_type_t<T>;
+        underlying_t underlying;
+        if (!decode_value<underlying_t>(in, underlying) ||
+            underlying > static_cast<underlying_t>(enum_max<T>::value))
+        {
+          return false;
+        }
+        if constexpr (std::is_signed<underlying_t>::value)
+        {
+          if (underlying < 0)
+          {
+            return false;
+          }
+        }
+        out = static_cast<T>(underlying);
+        return true;
+      }
+      else if constexpr (std::is_integral<T>::value)
+      {
+        uint64_t v;
+        if (!in.varint(v))
+        {
+          return false;
+        }
+        if constexpr (std::is_signed<T>::value)
+        {
+          out = detail::unzigzag<T>(v);
+          return detail::zigzag(out) == v;
+        }
+        else
+        {
+          out = static_cast<T>(v);
+          return out == v;
+        }
+      }
+      else if constexpr (std::is_floating_point<T>::value)
+      {
+        return in.fixed(out);
+      }
+      else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+      {
+        uint64_t size;
+        const char *data;
+        if (!in.varint(size) || !in.read(size, data))
+        {
+          return false;
+        }
+        out = std::string_view(data, size);
+        return true;
+      }
+      else if constexpr (detail::is_duration<T>::value)
+      {
+        typename T::rep count;
+        if (!decode_value<typename T::rep>(in, count))
+        {
+          return false;
+        }
+        out = T(count);
+        return true;
+      }
+      else if constexpr (detail::is_time_point<T>::value)
+      {
+        typename T::duration since_epoch;
+        if (!decode_value<typename T::duration>(in, since_epoch))
+        {
+          return false;
+        }
+        out = T(since_epoch);
+        return true;
+      }
+      else if constexpr (detail::is_optional<T>::value)
+      {
+        uint64_t present;
+        if (!in.varint(present) || present > 1)
+        {
+          return false;
+        }
+        if (present == 0)
+        {
+          out.reset();
+          return true;
+        }
+        return decode_value<typename T::value_type>(in, out.emplace());
+      }
+      else if constexpr (detail::is_pair<T>::value)
+      {
+        return decode_value<std::remove_cv_t<typename T::first_type>>(in, out.first) &&
+               decode_value<typename T::second_type>(in, out.second);
+      }
+      else if constexpr (detail::is_variant<T>::value)
+      {
+        uint64_t index;
+        if (!in.varint(index) || index >= std::variant_size<T>::value)
+        {
+          return false;
+        }
+        return detail::decode_alternative<T>(in, index, out, std::make_index_sequence<std::variant_size<T>::value>{});
+      }
+      else if constexpr (detail::is_container<T>::value)
+      {
+        uint64_t count;
+        if (!in.varint(count))
+        {
+          return false;
+        }
+        // Validate every element now, so iterating the view can't fail.
+        auto *begin = in.position();
+        view_t<typename T::value_type> element{};
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          if (!decode_value<typename T::value_type>(in, element))
+          {
+            return false;
+          }
+        }
+        out = sequence_view<typename T::value_type>({begin, static_cast<size_t>(in.position() - begin)}, count);
+        return true;
+      }
+      else
+      {
+        return std::apply([&](auto... members)
+                          {
+          auto decode_field = [&](auto member, auto &field)
+          {
+            using field_type = decltype(detail::member_type(member));
+            return decode_value<field_type>(in, field);
+          };
+          return std::apply([&](auto &...fields)
+                            { return (decode_field(members, fields) && ...); },
+                            out); },
+                          schema<T>::fields);
+      }
+    }
+
+    template <typename T>
+    T materialize(const view_t<T> &view);
+
+    namespace detail
+    {
+      template <typename Variant, size_t... Is>
+      Variant materialize_alternative(const view_t<Variant> &view, std::index_sequence<Is...>)
+      {
+        std::optional<Variant> result;
+        ((view.index() == Is ? (result.emplace(std::in_place_index<Is>, materialize<std::variant_alternative_t<Is, Variant>>(std::get<Is>(view))), true) : false) || ...);
+        return std::move(*result);
+      }
+    }
+
+    /**
+     * @brief Copies a view out of the source buffer into an owning T.
+     */
+    template <typename T>
+    T materialize(const view_t<T> &view)
+    {
+      if constexpr (std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                    detail::is_duration<T>::value || detail::is_time_point<T>::value)
+      {
+        return view;
+      }
+      else if constexpr (detail::is_optional<T>::value)
+      {
+        return view ? T(materialize<typename T::value_type>(*view)) : T();
+      }
+      else if constexpr (std::is_same<T, std::string>::value)
+      {
+        return std::string(view);
+      }
+      else if constexpr (detail::is_pair<T>::value)
+      {
+        return T(materialize<std::remove_cv_t<typename T::first_type>>(view.first),
+                 materialize<typename T::second_type>(view.second));
+      }
+      else if constexpr (detail::is_variant<T>::value)
+      {
+        return detail::materialize_alternative<T>(view, std::make_index_sequence<std::variant_size<T>::value>{});
+      }
+      else if constexpr (detail::is_container<T>::value)
+      {
+        T result;
+        for (const auto &element : view)
+        {
+          result.insert(result.end(), materialize<std::remove_cv_t<typename T::value_type>>(element));
+        }
+        return result;
+      }
+      else
+      {
+        T result{};
+        std::apply([&](auto... members)
+                   {
+          auto assign = [&](auto member, const auto &field)
+          {
+            using field_type = decltype(detail::member_type(member));
+            result.*member = materialize<field_type>(field);
+          };
+          std::apply([&](const auto &...fields)
+                     { (assign(members, fields), ...); },
+                     view); },
+                   schema<T>::fields);
+        return result;
+      }
+    }
+
+    /**
+     * @brief Writes value into buffer without allocating.
+     *
+     * @return The number of bytes written, or nullopt if buffer is too small.
+     */
+    template <typename T>
+    std::optional<size_t> encode(const T &value, std::span<char> buffer)
+    {
+      writer out(buffer);
+      encode_value(out, value);
+      if (!out.ok())
+      {
+        return std::nullopt;
+      }
+      return out.size();
+    }
+
+    template <typename T>
+    size_t encoded_size(const T &value)
+    {
+      writer counter;
+      encode_value(counter, value);
+      return counter.size();
+    }
+
+    /**
+     * @brief Decodes a T that spans all of buffer into a view of it.
+     *
+     * Strings come back as std::string_view and containers as sequence_view,
+     * so the buffer must outlive the result. Returns nullopt if the buffer is
+     * truncated, malformed or has trailing bytes.
+     */
+    template <typename T>
+    std::optional<view_t<T>> decode(std::span<const char> buffer)
+    {
+      reader in(buffer);
+      view_t<T> view{};
+      if (!decode_value<T>(in, view) || !in.at_end())
+      {
+        return std::nullopt;
+      }
+      return view;
+    }
+  }
+}
@@ -0,0 +1,464 @@
+#include "papaya/codec/delta.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "papaya/codec/codec.hpp"
+
+namespace pa
+{
+  namespace codec
+  {
+    namespace detail
+    {
+      // Payload: version, quantization, varint weights, then per chunk
+      // varint weights, varint plain size, method, varint body size, body.
+      constexpr char version = 1;
+      constexpr char stored = 0;
+      constexpr char compressed = 1;
+
+      constexpr size_t hash_bits = 14;
+      constexpr size_t min_match = 4;
+      constexpr size_t max_offset = 65535;
+
+      void put_varint(std::string &out, uint64_t value)
+      {
+        while (value >= 0x80)
+        {
+          out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+          value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+      }
+
+      template <typename T>
+      void put_fixed(std::string &out, T value)
+      {
+        static_assert(std::endian::native == std::endian::little, "only little-endian hosts are supported");
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+      }
+
+      // 15 in a token nibble means more length follows, in bytes of up to
+      // 255.
+      void put_length(std::string &out, size_t length)
+      {
+        for (; length >= 255; length -= 255)
+        {
+          out.push_back(static_cast<char>(255));
+        }
+        out.push_back(static_cast<char>(length));
+      }
+
+      void put_sequence(std::string &out, std::string_view literals, size_t offset, size_t match)
+      {
+        auto extra = match == 0 ? 0 : match - min_match;
+        out.push_back(static_cast<char>((std::min<size_t>(literals.size(), 15) << 4) | std::min<size_t>(extra, 15)));
+        if (literals.size() >= 15)
+        {
+          put_length(out, literals.size() - 15);
+        }
+        out.append(literals);
+        if (match == 0)
+        {
+          return;
+        }
+        put_fixed(out, static_cast<uint16_t>(offset));
+        if (extra >= 15)
+        {
+          put_length(out, extra - 15);
+        }
+      }
+
+      // LZ4-style: a token of literal and match lengths, the literals, then
+      // a 16-bit back-reference. The last sequence has literals only. Runs
+      // of bytes that don't match are skipped through faster the longer
+      // they get.
+      void lz_compress(std::string_view in, std::string &out, std::vector<uint32_t> &table)
+      {
+        table.assign(size_t{1} << hash_bits, 0);
+        size_t anchor = 0;
+        size_t pos = 0;
+        while (pos + min_match <= in.size())
+        {
+          uint32_t sequence;
+          std::memcpy(&sequence, in.data() + pos, sizeof(sequence));
+          auto hash = (sequence * 2654435761u) >> (32 - hash_bits);
+          // Positions are stored plus one so 0 means empty.
+          size_t candidate = table[hash];
+          table[hash] = static_cast<uint32_t>(pos + 1);
+          if (candidate != 0 && pos - (candidate - 1) <= max_offset &&
+              std::memcmp(in.data() + candidate - 1, in.data() + pos, min_match) == 0)
+          {
+            auto match = candidate - 1;
+            auto length = min_match;
+            while (pos + length < in.size() && in[match + length] == in[pos + length])
+            {
+              ++length;
+            }
+            put_sequence(out, in.substr(anchor, pos - anchor), pos - match, length);
+            pos += length;
+            anchor = pos;
+          }
+          else
+          {
+            pos += 1 + ((pos - anchor) >> 6);
+          }
+        }
+        put_sequence(out, in.substr(anchor), 0, 0);
+      }
+
+      bool get_length(reader &in, size_t &length)
+      {
+        uint8_t byte;
+        do
+        {
+          if (!in.fixed(byte))
+          {
+            return false;
+          }
+          length += byte;
+        } while (byte == 255);
+        return true;
+      }
+
+      void lz_decompress(std::string_view body, std::span<char> out)
+      {
+        reader in(std::span<const char>(body.data(), body.size()));
+        size_t size = 0;
+        while (!in.at_end())
+        {
+          uint8_t token;
+          in.fixed(token);
+          size_t literals = token >> 4;
+          const char *data;
+          if ((literals == 15 && !get_length(in, literals)) || literals > out.size() - size || !in.read(literals, data))
+          {
+            throw delta_error("corrupt delta chunk");
+          }
+          std::memcpy(out.data() + size, data, literals);
+          size += literals;
+          if (in.at_end())
+          {
+            break;
+          }
+          uint16_t offset;
+          size_t length = (token & 0x0F) + min_match;
+          if (!in.fixed(offset) || ((token & 0x0F) == 15 && !get_length(in, length)) || offset == 0 || offset > size ||
+              length > out.size() - size)
+          {
+            throw delta_error("corrupt delta chunk");
+          }
+          // Byte by byte, as the match may overlap what it produces.
+          for (size_t i = 0; i < length; ++i, ++size)
+          {
+            out[size] = out[size - offset];
+          }
+        }
+        if (size != out.size())
+        {
+          throw delta_error("corrupt delta chunk");
+        }
+      }
+
+      // Byte i of every weight goes to plane i, which puts the sign and
+      // exponent bytes that barely change next to each other.
+      void shuffle(std::span<const float> weights, std::string &out)
+      {
+        auto n = weights.size();
+        out.resize(n * sizeof(float));
+        auto *bytes = reinterpret_cast<const unsigned char *>(weights.data());
+        for (size_t i = 0; i < n; ++i)
+        {
+          for (size_t plane = 0; plane < sizeof(float); ++plane)
+          {
+            out[plane * n + i] = static_cast<char>(bytes[i * sizeof(float) + plane]);
+          }
+        }
+      }
+
+      void unshuffle(std::string_view in, std::span<float> weights)
+      {
+        auto n = weights.size();
+        auto *bytes = reinterpret_cast<unsigned char *>(weights.data());
+        for (size_t i = 0; i < n; ++i)
+        {
+          for (size_t plane = 0; plane < sizeof(float); ++plane)
+          {
+            bytes[i * sizeof(float) + plane] = static_cast<unsigned char>(in[plane * n + i]);
+          }
+        }
+      }
+
+      float xor_bits(float a, float b)
+      {
+        return std::bit_cast<float>(std::bit_cast<uint32_t>(a) ^ std::bit_cast<uint32_t>(b));
+      }
+
+      template <typename T>
+      T get_fixed(reader &in)
+      {
+        T value;
+        if (!in.fixed(value))
+        {
+          throw delta_error("corrupt delta chunk");
+        }
+        return value;
+      }
+
+      uint64_t get_varint(reader &in)
+      {
+        uint64_t value;
+        if (!in.varint(value))
+        {
+          throw delta_error("corrupt delta payload");
+        }
+        return value;
+      }
+    }
+
+    delta_encoder::delta_encoder(std::span<const float> base, delta_options options)
+        : base_(base), options_(options)
+    {
+      options_.chunk_weights = std::max<size_t>(options_.chunk_weights, 1);
+      options_.top_k_fraction = std::clamp(options_.top_k_fraction, 0.0f, 1.0f);
+      chunk_.reserve(options_.chunk_weights);
+      payload_.push_back(detail::version);
+      payload_.push_back(static_cast<char>(options_.quantize));
+      detail::put_varint(payload_, base_.size());
+    }
+
+    void delta_encoder::update(std::span<const float> weights)
+    {
+      auto start = std::chrono::steady_clock::now();
+      if (weights.size() > base_.size() - consumed_)
+      {
+        throw delta_error("updated model has more weights than its base");
+      }
+      auto exact = options_.quantize == delta_options::quantization::none;
+      for (auto weight : weights)
+      {
+        auto base = base_[consumed_++];
+        chunk_.push_back(exact ? detail::xor_bits(weight, base) : weight - base);
+        if (chunk_.size() == options_.chunk_weights)
+        {
+          encode_chunk();
+        }
+      }
+      stats_.raw_bytes += weights.size() * sizeof(float);
+      stats_.encode_time += std::chrono::steady_clock::now() - start;
+    }
+
+    std::string delta_encoder::finish()
+    {
+      if (consumed_ != base_.size())
+      {
+        throw delta_error("updated model has fewer weights than its base");
+      }
+      auto start = std::chrono::steady_clock::now();
+      if (!chunk_.empty())
+      {
+        encode_chunk();
+      }
+      stats_.encode_time += std::chrono::steady_clock::now() - start;
+      stats_.encoded_bytes = payload_.size();
+      return std::move(payload_);
+    }
+
+    void delta_encoder::encode_chunk()
+    {
+      auto n = chunk_.size();
+      plain_.clear();
+      switch (options_.quantize)
+      {
+      case delta_options::quantization::none:
+        detail::shuffle(chunk_, plain_);
+        break;
+      case delta_options::quantization::int8:
+      {
+        float largest = 0;
+        for (auto d : chunk_)
+        {
+          largest = std::max(largest, std::fabs(d));
+        }
+        auto scale = largest / 127;
+        detail::put_fixed(plain_, scale);
+        for (auto d : chunk_)
+        {
+          plain_.push_back(static_cast<char>(scale == 0 ? 0 : std::lround(d / scale)));
+        }
+        break;
+      }
+      case delta_options::quantization::top_k:
+      {
+        auto k = std::min(n, static_cast<size_t>(std::ceil(options_.top_k_fraction * n)));
+        indices_.resize(n);
+        std::iota(indices_.begin(), indices_.end(), 0);
+        std::nth_element(indices_.begin(), indices_.begin() + k, indices_.end(), [this](uint32_t a, uint32_t b)
+                         { return std::fabs(chunk_[a]) > std::fabs(chunk_[b]); });
+        indices_.resize(k);
+        std::sort(indices_.begin(), indices_.end());
+        detail::put_varint(plain_, k);
+        uint32_t previous = 0;
+        for (auto i : indices_)
+        {
+          detail::put_varint(plain_, i - previous);
+          previous = i;
+        }
+        for (auto i : indices_)
+        {
+          detail::put_fixed(plain_, chunk_[i]);
+        }
+        break;
+      }
+      }
+
+      detail::put_varint(payload_, n);
+      detail::put_varint(payload_, plain_.size());
+      auto method_at = payload_.size();
+      payload_.push_back(detail::compressed);
+      // Reserves room for the size, which is written once it's known.
+      auto size_at = payload_.size();
+      payload_.append(5, '\0');
+      detail::lz_compress(plain_, payload_, hash_table_);
+      auto body_size = payload_.size() - size_at - 5;
+      if (body_size >= plain_.size())
+      {
+        payload_.resize(size_at + 5);
+        payload_.append(plain_);
+        payload_[method_at] = detail::stored;
+        body_size = plain_.size();
+      }
+      // A varint padded to 5 bytes with continuation bits.
+      for (size_t i = 0; i < 5; ++i)
+      {
+        payload_[size_at + i] = static_cast<char>(((body_size >> (7 * i)) & 0x7F) | (i < 4 ? 0x80 : 0));
+      }
+      chunk_.clear();
+    }
+
+    std::vector<float> apply_delta(std::span<const float> base, std::string_view payload)
+    {
+      reader in(std::span<const char>(payload.data(), payload.size()));
+      auto version = detail::get_fixed<char>(in);
+      auto quantize = static_cast<delta_options::quantization>(detail::get_fixed<char>(in));
+      if (version != detail::version || quantize > delta_options::quantization::top_k)
+      {
+        throw delta_error("unsupported delta payload");
+      }
+      if (detail::get_varint(in) != base.size())
+      {
+        throw delta_error("delta payload is for a model of a different size");
+      }
+
+      std::vector<float> updated(base.begin(), base.end());
+      std::string plain;
+      size_t offset = 0;
+      while (!in.at_end())
+      {
+        auto n = detail::get_varint(in);
+        auto plain_size = detail::get_varint(in);
+        auto method = detail::get_fixed<char>(in);
+        auto body_size = detail::get_varint(in);
+        const char *body;
+        if (n > updated.size() - offset || !in.read(body_size, body) || (method != detail::stored && method != detail::compressed))
+        {
+          throw delta_error("corrupt delta payload");
+        }
+        if (method == detail::stored)
+        {
+          if (body_size != plain_size)
+          {
+            throw delta_error("corrupt delta payload");
+          }
+          plain.assign(body, body_size);
+        }
+        else
+        {
+          // The plain form of n weights is at most 4 bytes and a varint each.
+          if (plain_size > n * (sizeof(float) + 10) + 10)
+          {
+            throw delta_error("corrupt delta payload");
+          }
+          plain.resize(plain_size);
+          detail::lz_decompress(std::string_view(body, body_size), plain);
+        }
+
+        std::span<float> chunk(updated.data() + offset, n);
+        reader chunk_in(std::span<const char>(plain.data(), plain.size()));
+        switch (quantize)
+        {
+        case delta_options::quantization::none:
+        {
+          const char *planes;
+          if (!chunk_in.read(n * sizeof(float), planes))
+          {
+            throw delta_error("corrupt delta chunk");
+          }
+          std::vector<float> bits(n);
+          detail::unshuffle(std::string_view(planes, n * sizeof(float)), bits);
+          for (size_t i = 0; i < n; ++i)
+          {
+            chunk[i] = detail::xor_bits(chunk[i], bits[i]);
+          }
+          break;
+        }
+        case delta_options::quantization::int8:
+        {
+          auto scale = detail::get_fixed<float>(chunk_in);
+          for (auto &weight : chunk)
+          {
+            weight += detail::get_fixed<int8_t>(chunk_in) * scale;
+          }
+          break;
+        }
+        case delta_options::quantization::top_k:
+        {
+          auto k = detail::get_varint(chunk_in);
+          if (k > n)
+          {
+            throw delta_error("corrupt delta chunk");
+          }
+          std::vector<uint64_t> indices(k);
+          uint64_t index = 0;
+          for (auto &i : indices)
+          {
+            index += detail::get_varint(chunk_in);
+            if (index >= n)
+            {
+              throw delta_error("corrupt delta chunk");
+            }
+            i = index;
+          }
+          for (auto i : indices)
+          {
+            chunk[i] += detail::get_fixed<float>(chunk_in);
+          }
+          break;
+        }
+        }
+        if (!chunk_in.at_end())
+        {
+          throw delta_error("corrupt delta chunk");
+        }
+        offset += n;
+      }
+      if (offset != updated.size())
+      {
+        throw delta_error("truncated delta payload");
+      }
+      return updated;
+    }
+
+    std::span<const float> weights_of(std::string_view model)
+    {
+      if (model.size() % sizeof(float) != 0 || reinterpret_cast<uintptr_t>(model.data()) % alignof(float) != 0)
+      {
+        throw delta_error("model graph isn't an aligned float32 array");
+      }
+      return std::span<const float>(reinterpret_cast<const float *>(model.data()), model.size() / sizeof(float));
+    }
+  }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pa
+{
+  namespace codec
+  {
+    // Thrown for a payload that doesn't decode, or an encoder given a model
+    // of the wrong size.
+    class delta_error : public std::runtime_error
+    {
+    public:
+      using std::runtime_error::runtime_error;
+    };
+
+    struct delta_options
+    {
+      enum class quantization
+      {
+        // Bitwise XOR against the base, so decoding is exact.
+        none,
+        // The difference from the base, 8 bits per weight scaled to each
+        // chunk's largest difference.
+        int8,
+        // Only the top_k_fraction largest differences of each chunk.
+        top_k
+      };
+      quantization quantize = quantization::none;
+      float top_k_fraction = 0.01f;
+      // Weights encoded (and held) at a time.
+      size_t chunk_weights = size_t{1} << 16;
+    };
+
+    struct delta_stats
+    {
+      uint64_t raw_bytes = 0;
+      uint64_t encoded_bytes = 0;
+      std::chrono::nanoseconds encode_time{0};
+
+      double compression_ratio() const { return encoded_bytes == 0 ? 0 : static_cast<double>(raw_bytes) / encoded_bytes; }
+      double bytes_per_second() const
+      {
+        return encode_time.count() == 0 ? 0 : raw_bytes / std::chrono::duration<double>(encode_time).count();
+      }
+    };
+
+    /**
+     * @brief Encodes an updated model as its difference from the base model
+     * the session started from, chunk by chunk: the difference of each chunk
+     * is quantized per the options and compressed with an LZ77 codec before
+     * the next one is looked at, so the updated model never has to be
+     * materialized next to its delta.
+     *
+     * Models are arrays of little-endian float32 weights; weights_of() views
+     * a model graph as one.
+     */
+    class delta_encoder final
+    {
+    public:
+      // base must stay valid until finish().
+      explicit delta_encoder(std::span<const float> base, delta_options options = {});
+
+      // The next weights of the updated model, in any slices.
+      void update(std::span<const float> weights);
+      // The payload. Throws delta_error unless exactly as many weights as
+      // the base has were given.
+      std::string finish();
+
+      const delta_stats &stats() const { return stats_; }
+
+    private:
+      void encode_chunk();
+
+      std::span<const float> base_;
+      delta_options options_;
+      std::string payload_;
+      size_t consumed_ = 0;
+      // Differences (or XORed bits) of the chunk being filled.
+      std::vector<float> chunk_;
+      // Reused across chunks.
+      std::string plain_;
+      std::vector<uint32_t> indices_;
+      std::vector<uint32_t> hash_table_;
+      delta_stats stats_;
+    };
+
+    // The updated model a payload was encoded from; approximate when it was
+    // quantized.
+    std::vector<float> apply_delta(std::span<const float> base, std::string_view payload);
+
+    // A model graph as float32 weights. Throws delta_error unless its size is
+    // a multiple of 4 and its bytes are aligned for float.
+    std::span<const float> weights_of(std::string_view model);
+
+    // One-shot encoding of a whole model.
+    inline std::string encode_delta(std::span<const float> base, std::span<const float> updated, delta_options options = {},
+                                    delta_stats *stats = nullptr)
+    {
+      delta_encoder encoder(base, options);
+      encoder.update(updated);
+      auto payload = encoder.finish();
+      if (stats != nullptr)
+      {
+        *stats = encoder.stats();
+      }
+      return payload;
+    }
+  }
+}
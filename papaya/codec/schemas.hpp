@@ -0,0 +1,105 @@
+#pragma once
+
+#include <tuple>
+
+#include "papaya/codec/codec.hpp"
+#include "papaya/executor/executor.hpp"
+#include "papaya/factory/fl_factory.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/papaya.hpp"
+
+// Wire schemas of the messages crossing papaya's boundaries. Messages carry
+// no version, so both ends must be built from the same tree.
+namespace pa
+{
+  namespace codec
+  {
+    template <>
+    struct enum_max<restriction>
+    {
+      static constexpr auto value = is_cable_charged;
+    };
+
+    template <>
+    struct enum_max<run_priority>
+    {
+      static constexpr auto value = run_priority::critical;
+    };
+
+    template <>
+    struct schema<papaya::input>
+    {
+      static constexpr auto fields = std::make_tuple(
+          &papaya::input::restrictions,
+          &papaya::input::request_id,
+          &papaya::input::priority,
+          &papaya::input::deadline);
+    };
+
+    template <>
+    struct schema<papaya::output>
+    {
+      static constexpr auto fields = std::make_tuple(&papaya::output::task_name, &papaya::output::metrics);
+    };
+
+    template <>
+    struct schema<fl_factory::input>
+    {
+      static constexpr auto fields = std::make_tuple(&fl_factory::input::restrictions);
+    };
+
+    template <>
+    struct schema<fl_factory::output>
+    {
+      // model_update_stats is local to the process.
+      static constexpr auto fields = std::make_tuple(&fl_factory::output::model_update);
+    };
+
+    template <>
+    struct schema<match::input>
+    {
+      static constexpr auto fields = std::make_tuple(&match::input::restrictions);
+    };
+
+    template <>
+    struct schema<match::output>
+    {
+      static constexpr auto fields = std::make_tuple();
+    };
+
+    template <>
+    struct schema<IExecutor::Input>
+    {
+      static constexpr auto fields = std::make_tuple(
+          &IExecutor::Input::executionConfig,
+          &IExecutor::Input::dataset,
+          &IExecutor::Input::localInfo,
+          &IExecutor::Input::modelGraph,
+          &IExecutor::Input::dataDirectoryPath);
+    };
+
+    template <>
+    struct schema<IExecutor::Evaluation>
+    {
+      static constexpr auto fields = std::make_tuple(&IExecutor::Evaluation::records,
+                                                     &IExecutor::Evaluation::lossSum,
+                                                     &IExecutor::Evaluation::correct,
+                                                     &IExecutor::Evaluation::squaredError,
+                                                     &IExecutor::Evaluation::predictionSum,
+                                                     &IExecutor::Evaluation::predictionMin,
+                                                     &IExecutor::Evaluation::predictionMax);
+    };
+
+    template <>
+    struct schema<IExecutor::Success>
+    {
+      static constexpr auto fields = std::make_tuple(&IExecutor::Success::evaluation, &IExecutor::Success::trainedModel);
+    };
+
+    template <>
+    struct schema<IExecutor::Failure>
+    {
+      static constexpr auto fields = std::make_tuple(&IExecutor::Failure::errorCode);
+    };
+  }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Priority queue with a bucket per priority level and earliest
+     * deadline first within a bucket.
+     *
+     * Each bucket is a 4-ary min-heap ordered by (deadline, arrival), behind
+     * its own lock, so producers of different priorities don't contend. A
+     * bitmask of non-empty buckets lets pop() skip the empty ones without
+     * locking them. Entries without a deadline sort after every deadline, in
+     * arrival order.
+     *
+     * Starvation guard: each pop() served from a higher bucket counts against
+     * every non-empty lower bucket; a bucket passed over starvation_limit
+     * times in a row is served next. So under sustained overload a bucket
+     * still gets at least one of every starvation_limit + 1 pops.
+     *
+     * @tparam T Movable element type.
+     * @tparam priorities Number of priority levels; higher is more urgent.
+     */
+    template <typename T, size_t priorities>
+    class deadline_queue final
+    {
+      static_assert(priorities > 0 && priorities <= 32);
+
+    public:
+      using clock = std::chrono::steady_clock;
+
+      explicit deadline_queue(uint32_t starvation_limit = 8) : starvation_limit_(starvation_limit) {}
+
+      deadline_queue(const deadline_queue &) = delete;
+      deadline_queue &operator=(const deadline_queue &) = delete;
+
+      // priority is clamped to priorities - 1.
+      void push(T value, size_t priority, std::optional<clock::time_point> deadline = std::nullopt)
+      {
+        priority = priority < priorities ? priority : priorities - 1;
+        auto &bucket = buckets_[priority];
+        {
+          std::lock_guard<std::mutex> lock(bucket.mutex);
+          if (bucket.heap.empty())
+          {
+            // A pick() racing with the pop that emptied it may have counted
+            // it once more.
+            bucket.passed_over.store(0, std::memory_order_relaxed);
+          }
+          bucket.heap.push_back(node{
+              deadline ? *deadline : clock::time_point::max(),
+              arrivals_.fetch_add(1, std::memory_order_relaxed),
+              std::move(value)});
+          sift_up(bucket.heap, bucket.heap.size() - 1);
+          // Counted before it's visible to pop(), so size() never wraps.
+          size_.fetch_add(1, std::memory_order_release);
+          non_empty_.fetch_or(uint32_t{1} << priority, std::memory_order_release);
+        }
+      }
+
+      bool pop(T &value)
+      {
+        while (true)
+        {
+          auto mask = non_empty_.load(std::memory_order_acquire);
+          if (mask == 0)
+          {
+            return false;
+          }
+          if (try_pop(pick(mask), value))
+          {
+            return true;
+          }
+          // Lost a race for the last element of that bucket; look again.
+        }
+      }
+
+      // Moves every element out, in unspecified order.
+      std::vector<T> drain()
+      {
+        std::vector<T> values;
+        for (size_t priority = 0; priority < priorities; ++priority)
+        {
+          auto &bucket = buckets_[priority];
+          std::lock_guard<std::mutex> lock(bucket.mutex);
+          for (auto &node : bucket.heap)
+          {
+            values.push_back(std::move(node.value));
+          }
+          size_.fetch_sub(bucket.heap.size(), std::memory_order_release);
+          bucket.heap.clear();
+          bucket.passed_over.store(0, std::memory_order_relaxed);
+          non_empty_.fetch_and(~(uint32_t{1} << priority), std::memory_order_release);
+        }
+        return values;
+      }
+
+      size_t size() const { return size_.load(std::memory_order_acquire); }
+      bool empty() const { return size() == 0; }
+
+    private:
+      struct node
+      {
+        clock::time_point deadline;
+        uint64_t arrival;
+        T value;
+
+        bool operator<(const node &other) const
+        {
+          return deadline != other.deadline ? deadline < other.deadline : arrival < other.arrival;
+        }
+      };
+
+      struct alignas(64) bucket
+      {
+        std::mutex mutex;
+        std::vector<node> heap;
+        // pop()s in a row that passed this bucket over while it had entries;
+        // reset when it's served or goes empty.
+        std::atomic<uint32_t> passed_over{0};
+      };
+
+      static constexpr size_t arity = 4;
+
+      // The bucket to serve given the non-empty mask: the highest one, unless
+      // a lower one has been passed over too often.
+      size_t pick(uint32_t mask)
+      {
+        auto highest = static_cast<size_t>(31 - __builtin_clz(mask));
+        auto chosen = highest;
+        for (size_t priority = 0; priority < highest; ++priority)
+        {
+          if ((mask & (uint32_t{1} << priority)) == 0)
+          {
+            continue;
+          }
+          auto passed_over = buckets_[priority].passed_over.fetch_add(1, std::memory_order_relaxed) + 1;
+          if (passed_over > starvation_limit_ && chosen == highest)
+          {
+            chosen = priority;
+          }
+        }
+        buckets_[chosen].passed_over.store(0, std::memory_order_relaxed);
+        return chosen;
+      }
+
+      bool try_pop(size_t priority, T &value)
+      {
+        auto &bucket = buckets_[priority];
+        std::lock_guard<std::mutex> lock(bucket.mutex);
+        auto &heap = bucket.heap;
+        if (heap.empty())
+        {
+          return false;
+        }
+        value = std::move(heap.front().value);
+        if (heap.size() > 1)
+        {
+          heap.front() = std::move(heap.back());
+        }
+        heap.pop_back();
+        if (heap.empty())
+        {
+          bucket.passed_over.store(0, std::memory_order_relaxed);
+          non_empty_.fetch_and(~(uint32_t{1} << priority), std::memory_order_release);
+        }
+        else
+        {
+          sift_down(heap, 0);
+        }
+        size_.fetch_sub(1, std::memory_order_release);
+        return true;
+      }
+
+      static void sift_up(std::vector<node> &heap, size_t i)
+      {
+        auto moving = std::move(heap[i]);
+        while (i > 0)
+        {
+          auto parent = (i - 1) / arity;
+          if (!(moving < heap[parent]))
+          {
+            break;
+          }
+          heap[i] = std::move(heap[parent]);
+          i = parent;
+        }
+        heap[i] = std::move(moving);
+      }
+
+      static void sift_down(std::vector<node> &heap, size_t i)
+      {
+        auto moving = std::move(heap[i]);
+        auto size = heap.size();
+        while (true)
+        {
+          auto first_child = i * arity + 1;
+          if (first_child >= size)
+          {
+            break;
+          }
+          auto last_child = first_child + arity < size ? first_child + arity : size;
+          auto smallest = first_child;
+          for (auto child = first_child + 1; child < last_child; ++child)
+          {
+            if (heap[child] < heap[smallest])
+            {
+              smallest = child;
+            }
+          }
+          if (!(heap[smallest] < moving))
+          {
+            break;
+          }
+          heap[i] = std::move(heap[smallest]);
+          i = smallest;
+        }
+        heap[i] = std::move(moving);
+      }
+
+      const uint32_t starvation_limit_;
+      std::array<bucket, priorities> buckets_;
+      alignas(64) std::atomic<uint32_t> non_empty_{0};
+      std::atomic<size_t> size_{0};
+      std::atomic<uint64_t> arrivals_{0};
+    };
+  }
+}
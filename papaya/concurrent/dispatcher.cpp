@@ -0,0 +1,86 @@
+#include "papaya/concurrent/dispatcher.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    dispatcher::dispatcher(std::shared_ptr<metrics::registry> metrics)
+        : queue_depth_(metrics->make_gauge(
+              "papaya_dispatcher_queue_depth", "Callbacks waiting for the dispatcher thread.")),
+          batch_size_(metrics->make_histogram(
+              "papaya_dispatcher_batch_size", "Callbacks run per dispatcher wake-up.")),
+          job_exceptions_(metrics->make_counter(
+              "papaya_dispatcher_callback_exceptions_total", "Callbacks that threw; the exception is dropped.")),
+          worker_([this]
+                  { loop(); }) {}
+
+    dispatcher::~dispatcher() noexcept
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      wake_.notify_one();
+      worker_.join();
+    }
+
+    void dispatcher::post(job job)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+        ++posted_;
+        queue_depth_->set(static_cast<int64_t>(queue_.size()));
+      }
+      wake_.notify_one();
+    }
+
+    void dispatcher::flush()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto target = posted_;
+      drained_.wait(lock, [&]
+                    { return done_ >= target; });
+    }
+
+    void dispatcher::loop()
+    {
+      std::vector<job> batch;
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          wake_.wait(lock, [&]
+                     { return stopping_ || !queue_.empty(); });
+          if (queue_.empty())
+          {
+            return;
+          }
+          batch.swap(queue_);
+          queue_depth_->set(0);
+        }
+
+        batch_size_->record(batch.size());
+        for (auto &job : batch)
+        {
+          try
+          {
+            job();
+          }
+          catch (...)
+          {
+            job_exceptions_->increment();
+          }
+        }
+        auto ran = batch.size();
+        batch.clear();
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          done_ += ran;
+        }
+        drained_.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "papaya/metrics/metrics.hpp"
+#include "papaya/util/unique_function.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Runs posted jobs in FIFO order on one dedicated thread.
+     *
+     * papaya delivers user callbacks through it so a slow callback never
+     * stalls the pipeline threads. The worker takes every queued job in one
+     * wake-up and runs them outside the lock.
+     */
+    class dispatcher final
+    {
+    public:
+      using job = util::unique_function<void()>;
+
+      explicit dispatcher(
+          std::shared_ptr<metrics::registry> metrics = std::make_shared<metrics::registry>());
+      // Runs the jobs that are still queued, then joins the worker.
+      ~dispatcher() noexcept;
+
+      dispatcher(const dispatcher &) = delete;
+      dispatcher &operator=(const dispatcher &) = delete;
+
+      void post(job job);
+      // Blocks until every job posted before the call has run. Must not be
+      // called from a job.
+      void flush();
+
+    private:
+      void loop();
+
+      std::mutex mutex_;
+      std::condition_variable wake_;
+      std::condition_variable drained_;
+      // Swapped with the worker's batch on every wake-up so both vectors keep
+      // their capacity and posting doesn't allocate in the steady state.
+      std::vector<job> queue_;
+      uint64_t posted_ = 0;
+      uint64_t done_ = 0;
+      bool stopping_ = false;
+
+      std::shared_ptr<metrics::gauge> queue_depth_;
+      std::shared_ptr<metrics::histogram> batch_size_;
+      std::shared_ptr<metrics::counter> job_exceptions_;
+
+      std::thread worker_;
+    };
+  }
+}
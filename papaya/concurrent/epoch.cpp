@@ -0,0 +1,257 @@
+#include "papaya/concurrent/epoch.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    struct alignas(64) epoch_domain::participant
+    {
+      // 0 while unpinned, else the epoch seen at pin() | 1.
+      std::atomic<uint64_t> state{0};
+      std::atomic<bool> in_use{true};
+      participant *next = nullptr;
+      // Only touched by the owning thread.
+      uint32_t nesting = 0;
+      uint32_t retires_since_collect = 0;
+      std::vector<epoch_domain::retired> retired;
+    };
+
+    namespace detail
+    {
+      // Domains alive right now, so a thread exiting after a domain died
+      // doesn't touch its participants.
+      std::mutex &domains_mutex()
+      {
+        static std::mutex mutex;
+        return mutex;
+      }
+
+      std::unordered_map<uint64_t, epoch_domain *> &live_domains()
+      {
+        static std::unordered_map<uint64_t, epoch_domain *> domains;
+        return domains;
+      }
+
+      std::atomic<uint64_t> next_domain_id{1};
+    }
+
+    // The calling thread's participant in each domain it used, released on
+    // thread exit.
+    struct epoch_domain::thread_state
+    {
+      struct entry
+      {
+        uint64_t domain_id;
+        epoch_domain::participant *participant;
+      };
+      std::vector<entry> entries;
+
+      ~thread_state()
+      {
+        std::lock_guard<std::mutex> lock(detail::domains_mutex());
+        for (auto &entry : entries)
+        {
+          auto domain = detail::live_domains().find(entry.domain_id);
+          if (domain != detail::live_domains().end())
+          {
+            domain->second->release(*entry.participant);
+          }
+        }
+      }
+    };
+
+    epoch_domain::epoch_domain()
+        : id_(detail::next_domain_id.fetch_add(1, std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(detail::domains_mutex());
+      detail::live_domains().emplace(id_, this);
+    }
+
+    epoch_domain::~epoch_domain()
+    {
+      {
+        std::lock_guard<std::mutex> lock(detail::domains_mutex());
+        detail::live_domains().erase(id_);
+      }
+      auto *p = participants_.load(std::memory_order_acquire);
+      while (p != nullptr)
+      {
+        for (auto &r : p->retired)
+        {
+          r.deleter(r.object);
+        }
+        auto *next = p->next;
+        delete p;
+        p = next;
+      }
+      for (auto &r : orphans_)
+      {
+        r.deleter(r.object);
+      }
+    }
+
+    epoch_domain &epoch_domain::global()
+    {
+      // Leaked: threads may still retire into it during static destruction.
+      static auto *domain = new epoch_domain();
+      return *domain;
+    }
+
+    epoch_domain::participant &epoch_domain::local()
+    {
+      thread_local thread_state state;
+      // Most threads use one or two domains.
+      for (auto &entry : state.entries)
+      {
+        if (entry.domain_id == id_)
+        {
+          return *entry.participant;
+        }
+      }
+
+      participant *mine = nullptr;
+      for (auto *p = participants_.load(std::memory_order_acquire); p != nullptr; p = p->next)
+      {
+        auto expected = false;
+        if (!p->in_use.load(std::memory_order_relaxed) &&
+            p->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          mine = p;
+          break;
+        }
+      }
+      if (mine == nullptr)
+      {
+        mine = new participant();
+        auto *head = participants_.load(std::memory_order_relaxed);
+        do
+        {
+          mine->next = head;
+        } while (!participants_.compare_exchange_weak(head, mine, std::memory_order_release, std::memory_order_relaxed));
+      }
+      {
+        // Drop the entries of domains that died since.
+        std::lock_guard<std::mutex> lock(detail::domains_mutex());
+        std::erase_if(state.entries, [](const thread_state::entry &entry)
+                      { return detail::live_domains().count(entry.domain_id) == 0; });
+      }
+      state.entries.push_back({id_, mine});
+      return *mine;
+    }
+
+    epoch_domain::guard epoch_domain::pin()
+    {
+      auto &self = local();
+      if (self.nesting++ == 0)
+      {
+        self.state.store(epoch_.load(std::memory_order_relaxed) | 1, std::memory_order_relaxed);
+        // Orders the store before this thread's reads of shared pointers,
+        // and pairs with the fence in try_advance().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+      return guard(&self);
+    }
+
+    epoch_domain::guard::guard(guard &&other) noexcept
+        : participant_(std::exchange(other.participant_, nullptr))
+    {
+    }
+
+    epoch_domain::guard::~guard()
+    {
+      if (participant_ == nullptr)
+      {
+        return;
+      }
+      auto &self = *static_cast<participant *>(participant_);
+      if (--self.nesting == 0)
+      {
+        // release: this thread's reads happen before anyone frees what it
+        // read.
+        self.state.store(0, std::memory_order_release);
+      }
+    }
+
+    void epoch_domain::retire(void *object, deleter deleter)
+    {
+      auto &self = local();
+      // The epoch must be read after object was unlinked: threads pinned in
+      // it or the one before may still see the object, later ones can't.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      self.retired.push_back({object, deleter, epoch_.load(std::memory_order_seq_cst)});
+      if (++self.retires_since_collect >= collect_interval)
+      {
+        collect();
+      }
+    }
+
+    bool epoch_domain::try_advance(uint64_t epoch)
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      for (auto *p = participants_.load(std::memory_order_acquire); p != nullptr; p = p->next)
+      {
+        auto state = p->state.load(std::memory_order_acquire);
+        if ((state & 1) != 0 && (state & ~uint64_t{1}) != epoch)
+        {
+          return false;
+        }
+      }
+      return epoch_.compare_exchange_strong(epoch, epoch + 2, std::memory_order_acq_rel);
+    }
+
+    size_t epoch_domain::free_expired(std::vector<retired> &list, uint64_t epoch)
+    {
+      // Two advances past the retire epoch: any thread pinned back then has
+      // since unpinned.
+      auto expired = std::stable_partition(list.begin(), list.end(), [epoch](const retired &r)
+                                           { return r.epoch + 4 > epoch; });
+      // Deleters may retire more, so take the expired ones out first.
+      std::vector<retired> freeing(std::make_move_iterator(expired), std::make_move_iterator(list.end()));
+      list.erase(expired, list.end());
+      for (auto &r : freeing)
+      {
+        r.deleter(r.object);
+      }
+      return freeing.size();
+    }
+
+    size_t epoch_domain::collect()
+    {
+      auto &self = local();
+      self.retires_since_collect = 0;
+      // Two advances are what it takes to free the newest entries, and are
+      // cheap when nobody is pinned.
+      auto epoch = epoch_.load(std::memory_order_acquire);
+      for (int advances = 0; advances < 2 && try_advance(epoch); ++advances)
+      {
+        epoch += 2;
+      }
+      epoch = epoch_.load(std::memory_order_acquire);
+      auto freed = free_expired(self.retired, epoch);
+
+      std::unique_lock<std::mutex> lock(orphans_mutex_, std::try_to_lock);
+      if (lock.owns_lock() && !orphans_.empty())
+      {
+        freed += free_expired(orphans_, epoch);
+      }
+      return freed;
+    }
+
+    void epoch_domain::release(participant &participant) noexcept
+    {
+      {
+        std::lock_guard<std::mutex> lock(orphans_mutex_);
+        orphans_.insert(orphans_.end(), participant.retired.begin(), participant.retired.end());
+      }
+      participant.retired.clear();
+      participant.retires_since_collect = 0;
+      participant.nesting = 0;
+      participant.state.store(0, std::memory_order_release);
+      participant.in_use.store(false, std::memory_order_release);
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Epoch-based reclamation for lock-free structures.
+     *
+     * Readers pin() the domain while they dereference shared pointers;
+     * writers retire() what they unlinked instead of deleting it. A retired
+     * object is freed once every thread that was pinned when it was retired
+     * has unpinned, which the domain learns by advancing a global epoch: the
+     * epoch moves on only when all pinned threads have seen the current one,
+     * so an object retired in epoch e is unreachable from e + 2.
+     *
+     * Pinning is a thread-local store and a fence, so it suits short
+     * traversals. A thread that stays pinned holds back every free in the
+     * domain; references held across blocking calls should use a
+     * hazard_domain instead.
+     *
+     * Each thread keeps its own retire list and frees from it every
+     * collect_interval retires. When a thread exits, whatever it couldn't
+     * free yet is handed to the domain and freed by a later collect().
+     */
+    class epoch_domain final
+    {
+    public:
+      using deleter = void (*)(void *);
+
+      static constexpr size_t collect_interval = 64;
+
+      epoch_domain();
+      // Frees everything still retired. No thread may be pinned.
+      ~epoch_domain();
+
+      epoch_domain(const epoch_domain &) = delete;
+      epoch_domain &operator=(const epoch_domain &) = delete;
+
+      // The domain shared by papaya's structures; idle thread_pool workers
+      // collect() it.
+      static epoch_domain &global();
+
+      class guard final
+      {
+      public:
+        guard(guard &&other) noexcept;
+        guard &operator=(guard &&) = delete;
+        ~guard();
+
+      private:
+        friend class epoch_domain;
+        explicit guard(void *participant) noexcept : participant_(participant) {}
+
+        void *participant_;
+      };
+
+      // Pins the calling thread until the guard is destroyed. Guards nest.
+      [[nodiscard]] guard pin();
+
+      template <typename T>
+      void retire(T *object)
+      {
+        retire(object, [](void *p)
+               { delete static_cast<T *>(p); });
+      }
+      void retire(void *object, deleter deleter);
+
+      // Tries to advance the epoch, then frees what the calling thread and
+      // exited threads retired that no pinned thread can still see. Returns
+      // how many objects were freed.
+      size_t collect();
+
+      uint64_t epoch() const noexcept { return epoch_.load(std::memory_order_relaxed); }
+
+    private:
+      struct retired
+      {
+        void *object;
+        epoch_domain::deleter deleter;
+        uint64_t epoch;
+      };
+      struct participant;
+      struct thread_state;
+
+      participant &local();
+      bool try_advance(uint64_t epoch);
+      // Frees the entries of list retired at least two epochs before epoch.
+      static size_t free_expired(std::vector<retired> &list, uint64_t epoch);
+      // Called at thread exit. Hands participant's retire list to orphans_
+      // and frees it for another thread.
+      void release(participant &participant) noexcept;
+
+      const uint64_t id_;
+      // Even; bumped by 2 per advance.
+      alignas(64) std::atomic<uint64_t> epoch_{2};
+      // Grow-only list; released participants are reused.
+      std::atomic<participant *> participants_{nullptr};
+
+      std::mutex orphans_mutex_;
+      std::vector<retired> orphans_;
+    };
+  }
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Thread-safe lock-free queue.
+     *
+     * Producers and consumers claim a position with a CAS on write_pos_ or
+     * read_pos_. Each slot carries a sequence number telling whether it's
+     * ready to be written (== position) or read (== position + 1), so a
+     * consumer never reads a slot whose producer claimed it but hasn't
+     * stored the element yet.
+     *
+     * @tparam T Trivially copyable type (guard by std::is_trivially_copyable).
+     * @tparam size fixed size of the ring buffer under the hood.
+     */
+    template <typename T, size_t size>
+    class ConcurrentFixedSizeQueue
+    {
+      static_assert(std::is_trivially_copyable<T>::value);
+      static_assert(size > 0);
+
+    public:
+      using value_type = T;
+      static constexpr size_t capacity = size;
+
+      ConcurrentFixedSizeQueue()
+      {
+        for (size_t i = 0; i < buffer_size_; ++i)
+        {
+          ring_buffer_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+      }
+
+      bool push(const T &newElement)
+      {
+        auto pos = write_pos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+          auto &slot = ring_buffer_[pos % buffer_size_];
+          auto sequence = slot.sequence.load(std::memory_order_acquire);
+          auto lag = static_cast<std::ptrdiff_t>(sequence - pos);
+          if (lag < 0)
+          {
+            // The slot still holds an element from the previous lap.
+            return false;
+          }
+          if (lag > 0)
+          {
+            // Another producer took pos; retry with the latest one.
+            pos = write_pos_.load(std::memory_order_relaxed);
+            continue;
+          }
+          // One slot is always left free, so at most `size` elements fit.
+          if (pos - read_pos_.load(std::memory_order_acquire) >= size)
+          {
+            return false;
+          }
+          if (write_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            slot.value = newElement;
+            slot.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        }
+      }
+
+      bool pop(T &returnedElement)
+      {
+        auto pos = read_pos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+          auto &slot = ring_buffer_[pos % buffer_size_];
+          auto sequence = slot.sequence.load(std::memory_order_acquire);
+          auto lag = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+          if (lag < 0)
+          {
+            // Nothing was written at pos yet, it's empty.
+            return false;
+          }
+          if (lag > 0)
+          {
+            pos = read_pos_.load(std::memory_order_relaxed);
+            continue;
+          }
+          if (read_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            returnedElement = slot.value;
+            // Hand the slot to the producer of the next lap.
+            slot.sequence.store(pos + buffer_size_, std::memory_order_release);
+            return true;
+          }
+        }
+      }
+
+      bool is_empty()
+      {
+        return read_pos_.load() == write_pos_.load();
+      }
+
+      size_t effective_size()
+      {
+        auto read_pos = read_pos_.load();
+        auto write_pos = write_pos_.load();
+        // Both positions only grow, but they're loaded one after the other.
+        if (write_pos <= read_pos)
+        {
+          return 0;
+        }
+        return write_pos - read_pos < size ? write_pos - read_pos : size;
+      }
+
+    private:
+      struct slot
+      {
+        std::atomic<size_t> sequence;
+        T value;
+      };
+
+      static constexpr size_t buffer_size_ = size + 1;
+      // The positions only grow; the slot of a position is pos % buffer_size_.
+      alignas(64) std::atomic<size_t> read_pos_{0};
+      alignas(64) std::atomic<size_t> write_pos_{0};
+      alignas(64) std::array<slot, buffer_size_> ring_buffer_;
+
+    private:
+      template <typename FRIEND_T, size_t friend_size>
+      friend class Verifier;
+    };
+
+    /**
+     * @brief A helper to verify the content of ConcurrentFixedSizeQueue.
+     */
+    template <typename T, size_t size>
+    class Verifier
+    {
+    public:
+      /**
+       * @brief Validate function that takes index and element.
+       *
+       * @param i The index of the element in testee's std::array.
+       * @param element The element on the index.
+       */
+      template <typename TT>
+      using ValidateElementFn = std::function<void(const size_t, const TT &)>;
+
+      Verifier(const ConcurrentFixedSizeQueue<T, size> &queue, ValidateElementFn<T> ValidateFn)
+      {
+        auto read_pos = queue.read_pos_.load();
+        auto write_pos = queue.write_pos_.load();
+        for (auto pos = read_pos; pos < write_pos; ++pos)
+        {
+          auto i = pos % queue.buffer_size_;
+          ValidateFn(i, queue.ring_buffer_[i].value);
+        }
+      }
+    };
+  }
+}
@@ -0,0 +1,106 @@
+#include "papaya/concurrent/hazard_pointer.hpp"
+
+#include <algorithm>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    hazard_domain::~hazard_domain()
+    {
+      for (auto &r : retired_)
+      {
+        r.deleter(r.object);
+      }
+      auto *slot = slots_.load(std::memory_order_acquire);
+      while (slot != nullptr)
+      {
+        auto *next = slot->next;
+        delete slot;
+        slot = next;
+      }
+    }
+
+    hazard_domain &hazard_domain::global()
+    {
+      // Leaked, like epoch_domain::global().
+      static auto *domain = new hazard_domain();
+      return *domain;
+    }
+
+    detail::hazard_slot *hazard_domain::acquire()
+    {
+      for (auto *slot = slots_.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+      {
+        auto expected = false;
+        if (!slot->in_use.load(std::memory_order_relaxed) &&
+            slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          return slot;
+        }
+      }
+      auto *slot = new detail::hazard_slot();
+      auto *head = slots_.load(std::memory_order_relaxed);
+      do
+      {
+        slot->next = head;
+      } while (!slots_.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+      slot_count_.fetch_add(1, std::memory_order_relaxed);
+      return slot;
+    }
+
+    hazard_domain::holder::holder(hazard_domain &domain)
+        : slot_(domain.acquire())
+    {
+    }
+
+    hazard_domain::holder::~holder()
+    {
+      slot_->pointer.store(nullptr, std::memory_order_release);
+      slot_->in_use.store(false, std::memory_order_release);
+    }
+
+    void hazard_domain::retire(void *object, deleter deleter)
+    {
+      std::unique_lock<std::mutex> lock(retired_mutex_);
+      retired_.push_back({object, deleter});
+      if (retired_.size() >= 2 * slot_count_.load(std::memory_order_relaxed) + 64)
+      {
+        scan(lock);
+      }
+    }
+
+    size_t hazard_domain::collect()
+    {
+      std::unique_lock<std::mutex> lock(retired_mutex_);
+      return scan(lock);
+    }
+
+    size_t hazard_domain::scan(std::unique_lock<std::mutex> &lock)
+    {
+      // Pairs with the fence in protect().
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::vector<const void *> hazards;
+      for (auto *slot = slots_.load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+      {
+        if (auto *p = slot->pointer.load(std::memory_order_acquire))
+        {
+          hazards.push_back(p);
+        }
+      }
+      std::sort(hazards.begin(), hazards.end());
+
+      auto unprotected = std::stable_partition(retired_.begin(), retired_.end(), [&](const retired &r)
+                                               { return std::binary_search(hazards.begin(), hazards.end(), r.object); });
+      std::vector<retired> freeing(unprotected, retired_.end());
+      retired_.erase(unprotected, retired_.end());
+      // Deleters may retire more.
+      lock.unlock();
+      for (auto &r : freeing)
+      {
+        r.deleter(r.object);
+      }
+      return freeing.size();
+    }
+  }
+}
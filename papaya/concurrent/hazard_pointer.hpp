@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace pa
+{
+  namespace concurrent
+  {
+    namespace detail
+    {
+      struct alignas(64) hazard_slot
+      {
+        std::atomic<const void *> pointer{nullptr};
+        std::atomic<bool> in_use{true};
+        hazard_slot *next = nullptr;
+      };
+    }
+
+    /**
+     * @brief Hazard pointers, for references held longer than an
+     * epoch_domain pin should last.
+     *
+     * A holder publishes the one pointer its thread is using; retire()d
+     * objects are freed by a scan that skips every published pointer. Unlike
+     * epochs, a stalled reader only keeps its own object alive, at the cost
+     * of a store, a fence and a re-load per protect().
+     *
+     * Retired objects are batched per domain and scanned once there are
+     * more of them than about twice the number of hazard slots, so each
+     * scan frees at least half of what it looks at.
+     */
+    class hazard_domain final
+    {
+    public:
+      using deleter = void (*)(void *);
+
+      hazard_domain() = default;
+      // Frees everything still retired. No holder may be alive.
+      ~hazard_domain();
+
+      hazard_domain(const hazard_domain &) = delete;
+      hazard_domain &operator=(const hazard_domain &) = delete;
+
+      static hazard_domain &global();
+
+      /**
+       * @brief Owns one hazard slot of the domain while alive.
+       */
+      class holder final
+      {
+      public:
+        explicit holder(hazard_domain &domain = hazard_domain::global());
+        ~holder();
+
+        holder(const holder &) = delete;
+        holder &operator=(const holder &) = delete;
+
+        // Loads source and publishes it until the next protect() or reset().
+        // The returned object won't be freed meanwhile, even if it's
+        // unlinked and retired.
+        template <typename T>
+        T *protect(const std::atomic<T *> &source) noexcept
+        {
+          auto *p = source.load(std::memory_order_relaxed);
+          while (true)
+          {
+            slot_->pointer.store(p, std::memory_order_relaxed);
+            // Pairs with the fence in scan(): either the scan sees the
+            // hazard, or this re-load sees the pointer was unlinked.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto *again = source.load(std::memory_order_acquire);
+            if (again == p)
+            {
+              return p;
+            }
+            p = again;
+          }
+        }
+
+        void reset() noexcept { slot_->pointer.store(nullptr, std::memory_order_release); }
+
+      private:
+        detail::hazard_slot *slot_;
+      };
+
+      template <typename T>
+      void retire(T *object)
+      {
+        retire(object, [](void *p)
+               { delete static_cast<T *>(p); });
+      }
+      void retire(void *object, deleter deleter);
+
+      // Frees every retired object no holder protects. Returns how many.
+      size_t collect();
+
+    private:
+      struct retired
+      {
+        void *object;
+        hazard_domain::deleter deleter;
+      };
+
+      detail::hazard_slot *acquire();
+      size_t scan(std::unique_lock<std::mutex> &lock);
+
+      // Grow-only list; slots are reused once their holder is gone.
+      std::atomic<detail::hazard_slot *> slots_{nullptr};
+      std::atomic<size_t> slot_count_{0};
+
+      std::mutex retired_mutex_;
+      std::vector<retired> retired_;
+    };
+  }
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <rxcpp/rx.hpp>
+#include <stdexcept>
+#include <thread>
+
+#include "papaya/concurrent/fixed_size_queue.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief What queue_channel::offer() does when the queue is full.
+     */
+    enum class overflow_policy
+    {
+      // Wait until the consumer makes room. This is the backpressure mode:
+      // the producer's on_next doesn't return until the element is queued.
+      block,
+      // Evict the oldest queued element to make room for the new one.
+      drop_oldest,
+      // Discard the new element.
+      drop_newest,
+      // Discard the new element and fail the publishing observable.
+      fail
+    };
+
+    class queue_full_error final : public std::runtime_error
+    {
+    public:
+      queue_full_error() : std::runtime_error("queue_channel is full") {}
+    };
+
+    namespace detail
+    {
+      // Spins briefly, then yields, then sleeps, so a waiting thread doesn't
+      // burn a core when the other side is slow.
+      class backoff final
+      {
+      public:
+        void pause() noexcept
+        {
+          if (attempts_ < 64)
+          {
+            ++attempts_;
+          }
+          else if (attempts_ < 128)
+          {
+            ++attempts_;
+            std::this_thread::yield();
+          }
+          else
+          {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+          }
+        }
+
+        void reset() noexcept { attempts_ = 0; }
+
+      private:
+        uint32_t attempts_ = 0;
+      };
+    }
+
+    /**
+     * @brief Bounded hand-off between one rx pipeline and another, usually
+     * on different threads, over a ConcurrentFixedSizeQueue.
+     *
+     * Unlike observe_on, whose queue grows without bound, a full channel
+     * applies its overflow_policy. Use publish_to() on the producer side and
+     * drain() on the consumer side.
+     */
+    template <typename T, size_t size>
+    class queue_channel final
+    {
+    public:
+      explicit queue_channel(overflow_policy policy) : policy_(policy) {}
+
+      queue_channel(const queue_channel &) = delete;
+      queue_channel &operator=(const queue_channel &) = delete;
+
+      /**
+       * @brief Queues value according to the overflow policy.
+       *
+       * @return false when the value was rejected under overflow_policy::fail.
+       */
+      bool offer(const T &value)
+      {
+        detail::backoff backoff;
+        while (!queue_.push(value))
+        {
+          switch (policy_)
+          {
+          case overflow_policy::block:
+            if (cancelled_.load(std::memory_order_acquire))
+            {
+              // Nobody will ever make room.
+              dropped_.fetch_add(1, std::memory_order_relaxed);
+              return true;
+            }
+            backoff.pause();
+            break;
+          case overflow_policy::drop_oldest:
+          {
+            T evicted;
+            if (queue_.pop(evicted))
+            {
+              dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+          }
+          case overflow_policy::drop_newest:
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          case overflow_policy::fail:
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+        }
+        published_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+
+      bool poll(T &value)
+      {
+        return queue_.pop(value);
+      }
+
+      // Marks the end of the stream; drain() completes (or fails with error)
+      // once the queue is empty.
+      void close(std::exception_ptr error = nullptr)
+      {
+        error_ = error;
+        closed_.store(true, std::memory_order_release);
+      }
+
+      // The consumer went away; producers blocked on a full queue give up.
+      void cancel()
+      {
+        cancelled_.store(true, std::memory_order_release);
+      }
+
+      bool is_closed() const { return closed_.load(std::memory_order_acquire); }
+      // Only meaningful once is_closed() returned true.
+      std::exception_ptr error() const { return error_; }
+
+      uint64_t published() const { return published_.load(std::memory_order_relaxed); }
+      uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+      size_t queued() { return queue_.effective_size(); }
+
+    private:
+      const overflow_policy policy_;
+      ConcurrentFixedSizeQueue<T, size> queue_;
+      std::atomic<bool> closed_{false};
+      std::atomic<bool> cancelled_{false};
+      // Written once before closed_ is released.
+      std::exception_ptr error_;
+      std::atomic<uint64_t> published_{0};
+      std::atomic<uint64_t> dropped_{0};
+    };
+
+    /**
+     * @brief rx operator that moves every element of the source into channel.
+     *
+     * The returned observable emits nothing; it completes when the source
+     * completes, and fails when the source fails or when the channel rejects
+     * an element under overflow_policy::fail (with queue_full_error). Either
+     * way the channel gets closed.
+     *
+     * e.g. events | publish_to(channel) | subscribe<T>();
+     */
+    template <typename T, size_t size>
+    auto publish_to(std::shared_ptr<queue_channel<T, size>> channel)
+    {
+      return [channel](auto source)
+      {
+        return rxcpp::observable<>::create<T>(
+            [channel, source](rxcpp::subscriber<T> out)
+            {
+              source.subscribe(
+                  out.get_subscription(),
+                  [channel, out](const T &value)
+                  {
+                    if (!channel->offer(value))
+                    {
+                      auto error = std::make_exception_ptr(queue_full_error());
+                      channel->close(error);
+                      out.on_error(error);
+                    }
+                  },
+                  [channel, out](std::exception_ptr error)
+                  {
+                    channel->close(error);
+                    out.on_error(error);
+                  },
+                  [channel, out]()
+                  {
+                    channel->close();
+                    out.on_completed();
+                  });
+            });
+      };
+    }
+
+    /**
+     * @brief Source that emits what's queued in channel until it's closed and
+     * empty.
+     *
+     * It polls on the thread it's subscribed on, backing off while the queue
+     * is empty, so subscribe it with subscribe_on() onto the consumer thread.
+     * Unsubscribing cancels the channel, which unblocks producers.
+     */
+    template <typename T, size_t size>
+    auto drain(std::shared_ptr<queue_channel<T, size>> channel) -> rxcpp::observable<T>
+    {
+      return rxcpp::observable<>::create<T>(
+          [channel](rxcpp::subscriber<T> out)
+          {
+            out.add([channel]()
+                    { channel->cancel(); });
+
+            detail::backoff backoff;
+            T value;
+            while (out.is_subscribed())
+            {
+              if (channel->poll(value))
+              {
+                backoff.reset();
+                out.on_next(value);
+                continue;
+              }
+              // Check closed before the last poll so nothing published right
+              // before close() is missed.
+              if (channel->is_closed())
+              {
+                if (channel->poll(value))
+                {
+                  out.on_next(value);
+                  continue;
+                }
+                if (auto error = channel->error())
+                {
+                  out.on_error(error);
+                }
+                else
+                {
+                  out.on_completed();
+                }
+                return;
+              }
+              backoff.pause();
+            }
+          });
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+
+#include "papaya/util/unique_function.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Where papaya runs its work: session coroutines resume on it and
+     * executors fan out onto it.
+     */
+    class scheduler
+    {
+    public:
+      using job = util::unique_function<void()>;
+
+      virtual ~scheduler() = default;
+
+      // Runs job at some point on one of the scheduler's threads.
+      virtual void schedule(job job) = 0;
+
+      // The time papaya stamps admissions and checks deadlines against.
+      // Simulated schedulers return their virtual time.
+      virtual std::chrono::steady_clock::time_point now() const { return std::chrono::steady_clock::now(); }
+    };
+  }
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "papaya/concurrent/epoch.hpp"
+#include "papaya/concurrent/fixed_size_queue.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Unbounded lock-free MPMC queue of linked fixed-size segments.
+     *
+     * The segments form a Michael-Scott list. Inside one, producers and
+     * consumers claim cells with a fetch_add on enqueue_index / dequeue_index
+     * instead of a CAS loop, like Ramalhete and Correia's FAAArrayQueue. A
+     * consumer that gets to a cell before its producer marks it taken, and
+     * the producer moves on to the next cell. When a segment runs out of
+     * cells, the first producer to notice links a new one.
+     *
+     * Consumers retire drained segments into the queue's epoch_domain. Once
+     * no thread can still be in one, it's reset and parked in a ring of
+     * spares, so a queue whose length stays bounded stops allocating after
+     * warm-up. The domain frees retired segments in batches of about
+     * collect_interval, hence the default number of spares.
+     *
+     * push() never fails. Unlike ConcurrentFixedSizeQueue, T only has to be
+     * move-constructible.
+     *
+     * @tparam segment_size Cells per segment.
+     * @tparam spare_segments Drained segments kept for reuse; the rest are
+     * deleted.
+     */
+    template <typename T, size_t segment_size = 256, size_t spare_segments = 2 * epoch_domain::collect_interval>
+    class ConcurrentSegmentedQueue
+    {
+      static_assert(std::is_move_constructible<T>::value);
+      static_assert(segment_size > 0);
+
+    public:
+      using value_type = T;
+
+      ConcurrentSegmentedQueue()
+          : domain_(std::make_unique<epoch_domain>())
+      {
+        auto *first = acquire_segment();
+        head_.store(first, std::memory_order_relaxed);
+        tail_.store(first, std::memory_order_relaxed);
+      }
+
+      ~ConcurrentSegmentedQueue()
+      {
+        for (auto *segment = head_.load(std::memory_order_relaxed); segment != nullptr;)
+        {
+          auto *next = segment->next.load(std::memory_order_relaxed);
+          segment->destroy_values();
+          delete segment;
+          segment = next;
+        }
+        // Parks the retired segments in spares_, so delete them after.
+        domain_.reset();
+        segment *spare;
+        while (spares_.pop(spare))
+        {
+          delete spare;
+        }
+      }
+
+      ConcurrentSegmentedQueue(const ConcurrentSegmentedQueue &) = delete;
+      ConcurrentSegmentedQueue &operator=(const ConcurrentSegmentedQueue &) = delete;
+
+      // Always succeeds; returns bool like ConcurrentFixedSizeQueue::push().
+      bool push(const T &newElement) { return emplace(newElement); }
+      bool push(T &&newElement) { return emplace(std::move(newElement)); }
+
+      bool pop(T &returnedElement)
+      {
+        auto guard = domain_->pin();
+        while (true)
+        {
+          auto *head = head_.load(std::memory_order_acquire);
+          auto dequeue = head->dequeue_index.load(std::memory_order_relaxed);
+          if (dequeue >= segment_size || dequeue >= head->enqueue_index.load(std::memory_order_acquire))
+          {
+            // Every cell of head is claimed, or nothing was pushed past it.
+            auto *next = head->next.load(std::memory_order_acquire);
+            if (next == nullptr)
+            {
+              return false;
+            }
+            if (dequeue < segment_size)
+            {
+              // A producer linked next after this check started; look again.
+              continue;
+            }
+            if (head_.compare_exchange_strong(head, next, std::memory_order_acq_rel))
+            {
+              domain_->retire(head, &recycle);
+            }
+            continue;
+          }
+
+          auto index = head->dequeue_index.fetch_add(1, std::memory_order_acq_rel);
+          if (index >= segment_size)
+          {
+            continue;
+          }
+          auto &cell = head->cells[index];
+          auto state = cell.state.load(std::memory_order_acquire);
+          if (state == cell_state::empty &&
+              cell.state.compare_exchange_strong(state, cell_state::taken, std::memory_order_acq_rel))
+          {
+            // Its producer will try the next cell.
+            continue;
+          }
+          // The producer claimed the cell first; wait for it to finish the
+          // construction it's in the middle of.
+          while (state == cell_state::writing)
+          {
+            std::this_thread::yield();
+            state = cell.state.load(std::memory_order_acquire);
+          }
+          auto *value = cell.value();
+          returnedElement = std::move(*value);
+          value->~T();
+          cell.state.store(cell_state::taken, std::memory_order_relaxed);
+          return true;
+        }
+      }
+
+      bool is_empty() { return effective_size() == 0; }
+
+      // Exact when no push() or pop() runs concurrently.
+      size_t effective_size()
+      {
+        auto guard = domain_->pin();
+        size_t size = 0;
+        for (auto *segment = head_.load(std::memory_order_acquire); segment != nullptr;
+             segment = segment->next.load(std::memory_order_acquire))
+        {
+          auto enqueue = std::min(segment->enqueue_index.load(std::memory_order_acquire), segment_size);
+          auto dequeue = std::min(segment->dequeue_index.load(std::memory_order_acquire), segment_size);
+          if (enqueue > dequeue)
+          {
+            size += enqueue - dequeue;
+          }
+        }
+        return size;
+      }
+
+      // Segments allocated so far, recycled ones not counted again.
+      size_t allocated_segments() const { return allocated_.load(std::memory_order_relaxed); }
+
+    private:
+      enum class cell_state : uint8_t
+      {
+        empty,
+        writing,
+        full,
+        // Consumed, or skipped by a consumer that came first.
+        taken
+      };
+
+      struct cell
+      {
+        std::atomic<cell_state> state{cell_state::empty};
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *value() { return std::launder(reinterpret_cast<T *>(storage)); }
+      };
+
+      struct segment
+      {
+        explicit segment(ConcurrentSegmentedQueue &owner) : owner(owner) {}
+
+        void reset()
+        {
+          for (auto &cell : cells)
+          {
+            cell.state.store(cell_state::empty, std::memory_order_relaxed);
+          }
+          enqueue_index.store(0, std::memory_order_relaxed);
+          dequeue_index.store(0, std::memory_order_relaxed);
+          next.store(nullptr, std::memory_order_relaxed);
+        }
+
+        // For the destructor; nothing runs concurrently.
+        void destroy_values()
+        {
+          for (auto &cell : cells)
+          {
+            if (cell.state.load(std::memory_order_relaxed) == cell_state::full)
+            {
+              cell.value()->~T();
+            }
+          }
+        }
+
+        ConcurrentSegmentedQueue &owner;
+        alignas(64) std::atomic<size_t> enqueue_index{0};
+        alignas(64) std::atomic<size_t> dequeue_index{0};
+        alignas(64) std::atomic<segment *> next{nullptr};
+        std::array<cell, segment_size> cells;
+      };
+
+      template <typename U>
+      bool emplace(U &&newElement)
+      {
+        auto guard = domain_->pin();
+        while (true)
+        {
+          auto *tail = tail_.load(std::memory_order_acquire);
+          auto index = tail->enqueue_index.fetch_add(1, std::memory_order_acq_rel);
+          if (index < segment_size)
+          {
+            auto &cell = tail->cells[index];
+            auto expected = cell_state::empty;
+            if (cell.state.compare_exchange_strong(expected, cell_state::writing, std::memory_order_acq_rel))
+            {
+              new (cell.storage) T(std::forward<U>(newElement));
+              cell.state.store(cell_state::full, std::memory_order_release);
+              return true;
+            }
+            // A consumer skipped the cell.
+            continue;
+          }
+
+          // tail is full: help move tail_ on, linking a new segment if
+          // nobody has yet.
+          auto *next = tail->next.load(std::memory_order_acquire);
+          if (next == nullptr)
+          {
+            auto *fresh = acquire_segment();
+            if (tail->next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel))
+            {
+              next = fresh;
+            }
+            else
+            {
+              release_segment(fresh);
+            }
+          }
+          tail_.compare_exchange_strong(tail, next, std::memory_order_acq_rel);
+        }
+      }
+
+      segment *acquire_segment()
+      {
+        segment *spare;
+        if (spares_.pop(spare))
+        {
+          return spare;
+        }
+        // Segments retired by this thread may be free to reuse by now.
+        if (domain_->collect() > 0 && spares_.pop(spare))
+        {
+          return spare;
+        }
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+        return new segment(*this);
+      }
+
+      void release_segment(segment *segment)
+      {
+        segment->reset();
+        if (!spares_.push(segment))
+        {
+          delete segment;
+        }
+      }
+
+      // epoch_domain deleter: no thread can be in the segment any more.
+      static void recycle(void *retired)
+      {
+        auto *drained = static_cast<segment *>(retired);
+        drained->owner.release_segment(drained);
+      }
+
+      alignas(64) std::atomic<segment *> head_{nullptr};
+      alignas(64) std::atomic<segment *> tail_{nullptr};
+      std::atomic<size_t> allocated_{0};
+      ConcurrentFixedSizeQueue<segment *, spare_segments> spares_;
+      // Declared after spares_ and reset first in the destructor, as its
+      // destructor recycles into spares_.
+      std::unique_ptr<epoch_domain> domain_;
+    };
+  }
+}
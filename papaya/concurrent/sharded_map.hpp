@@ -0,0 +1,367 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "papaya/concurrent/epoch.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Concurrent hash map split into shards by the high bits of the
+     * key's hash, each an open-addressing table with linear probing.
+     *
+     * Writers lock their shard. Readers take no lock and never retry: a
+     * slot holds a hash and a pointer to an immutable key/value node, and
+     * writers only ever swap that pointer or fill a slot, hash first. A
+     * slot's hash never goes back to 0, so a probe can't stop short of a key
+     * that stays put, and a rehash builds a new table instead of moving
+     * entries under readers. Replaced and erased nodes, and outgrown tables,
+     * are retired into the map's epoch_domain, so readers may dereference
+     * whatever they find while pinned.
+     *
+     * Erased slots stay as tombstones until the shard rehashes; a shard
+     * rehashes when its live and tombstone slots pass half its capacity,
+     * doubling only if the live ones alone pass a quarter.
+     *
+     * @tparam shard_count A power of two. Writers to different shards never
+     * contend.
+     */
+    template <typename Key, typename T, typename Hash = std::hash<Key>, size_t shard_count = 64>
+    class ConcurrentShardedMap
+    {
+      static_assert(shard_count > 0 && (shard_count & (shard_count - 1)) == 0, "shard_count must be a power of two");
+
+    public:
+      using key_type = Key;
+      using mapped_type = T;
+
+      explicit ConcurrentShardedMap(size_t initial_capacity = 0)
+          : domain_(std::make_unique<epoch_domain>())
+      {
+        auto per_shard = std::bit_ceil(std::max<size_t>(min_capacity, 2 * initial_capacity / shard_count));
+        for (auto &shard : shards_)
+        {
+          shard.current.store(new table(per_shard), std::memory_order_relaxed);
+        }
+      }
+
+      ~ConcurrentShardedMap()
+      {
+        // Retired nodes and tables first; the live ones aren't retired.
+        domain_.reset();
+        for (auto &shard : shards_)
+        {
+          auto *current = shard.current.load(std::memory_order_relaxed);
+          for (size_t i = 0; i <= current->mask; ++i)
+          {
+            delete current->slots[i].entry.load(std::memory_order_relaxed);
+          }
+          delete current;
+        }
+      }
+
+      ConcurrentShardedMap(const ConcurrentShardedMap &) = delete;
+      ConcurrentShardedMap &operator=(const ConcurrentShardedMap &) = delete;
+
+      // Calls fn with the value of key, if any, and returns whether it did.
+      // The value can't be freed while fn runs, but fn shouldn't block.
+      template <typename Fn>
+      bool visit(const Key &key, Fn &&fn) const
+      {
+        auto hash = hash_of(key);
+        const auto &shard = shard_of(hash);
+        auto guard = domain_->pin();
+        const auto *found = probe(shard.current.load(std::memory_order_acquire), hash, key);
+        if (found == nullptr)
+        {
+          return false;
+        }
+        fn(found->value);
+        return true;
+      }
+
+      std::optional<T> find(const Key &key) const
+      {
+        std::optional<T> value;
+        visit(key, [&](const T &found)
+              { value.emplace(found); });
+        return value;
+      }
+
+      bool contains(const Key &key) const
+      {
+        return visit(key, [](const T &) {});
+      }
+
+      // Returns false, leaving the map alone, if key is already there.
+      bool insert(Key key, T value)
+      {
+        auto hash = hash_of(key);
+        auto &shard = shard_of(hash);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return put_locked(shard, hash, std::move(key), std::move(value), false);
+      }
+
+      // Returns true if key was new.
+      bool insert_or_assign(Key key, T value)
+      {
+        auto hash = hash_of(key);
+        auto &shard = shard_of(hash);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return put_locked(shard, hash, std::move(key), std::move(value), true);
+      }
+
+      bool erase(const Key &key)
+      {
+        auto hash = hash_of(key);
+        auto &shard = shard_of(hash);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return erase_locked(shard, hash, key);
+      }
+
+      // insert_or_assign() of each pair, taking each shard's lock once.
+      // Returns how many keys were new.
+      size_t assign_batch(std::vector<std::pair<Key, T>> entries)
+      {
+        size_t added = 0;
+        for_each_shard(entries.size(), [&](size_t i)
+                       { return hash_of(entries[i].first); },
+                       [&](shard &shard, size_t i, uint64_t hash)
+                       { added += put_locked(shard, hash, std::move(entries[i].first), std::move(entries[i].second), true); });
+        return added;
+      }
+
+      // erase() of each key, taking each shard's lock once. Returns how many
+      // were there.
+      size_t erase_batch(std::span<const Key> keys)
+      {
+        size_t erased = 0;
+        for_each_shard(keys.size(), [&](size_t i)
+                       { return hash_of(keys[i]); },
+                       [&](shard &shard, size_t i, uint64_t hash)
+                       { erased += erase_locked(shard, hash, keys[i]); });
+        return erased;
+      }
+
+      // Exact when no writer is running.
+      size_t size() const
+      {
+        size_t total = 0;
+        for (const auto &shard : shards_)
+        {
+          total += shard.size.load(std::memory_order_relaxed);
+        }
+        return total;
+      }
+
+    private:
+      static constexpr size_t min_capacity = 8;
+      static constexpr int shard_bits = std::countr_zero(shard_count);
+
+      struct node
+      {
+        Key key;
+        T value;
+      };
+
+      // Empty while hash is 0. A slot with a hash and no entry is a
+      // tombstone, which probes go past.
+      struct slot
+      {
+        std::atomic<uint64_t> hash{0};
+        std::atomic<node *> entry{nullptr};
+      };
+
+      struct table
+      {
+        explicit table(size_t capacity) : mask(capacity - 1), slots(new slot[capacity]) {}
+
+        const size_t mask;
+        std::unique_ptr<slot[]> slots;
+      };
+
+      struct alignas(64) shard
+      {
+        std::mutex mutex;
+        std::atomic<table *> current{nullptr};
+        std::atomic<size_t> size{0};
+        // Guarded by mutex.
+        size_t tombstones = 0;
+      };
+
+      // The hash, never 0, whose high bits pick the shard and low bits the
+      // first slot.
+      static uint64_t hash_of(const Key &key)
+      {
+        auto h = static_cast<uint64_t>(Hash{}(key));
+        // splitmix64's finalizer, as std::hash of integers is the identity.
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h == 0 ? 1 : h;
+      }
+
+      static size_t shard_index(uint64_t hash) { return shard_bits == 0 ? 0 : hash >> (64 - shard_bits); }
+      shard &shard_of(uint64_t hash) { return shards_[shard_index(hash)]; }
+      const shard &shard_of(uint64_t hash) const { return shards_[shard_index(hash)]; }
+
+      static const node *probe(const table *table, uint64_t hash, const Key &key)
+      {
+        for (auto i = hash & table->mask;; i = (i + 1) & table->mask)
+        {
+          const auto &slot = table->slots[i];
+          auto slot_hash = slot.hash.load(std::memory_order_acquire);
+          if (slot_hash == 0)
+          {
+            return nullptr;
+          }
+          if (slot_hash != hash)
+          {
+            continue;
+          }
+          const auto *entry = slot.entry.load(std::memory_order_acquire);
+          if (entry != nullptr && entry->key == key)
+          {
+            return entry;
+          }
+        }
+      }
+
+      // The caller must hold shard.mutex.
+      bool put_locked(shard &shard, uint64_t hash, Key &&key, T &&value, bool assign)
+      {
+        auto *current = shard.current.load(std::memory_order_relaxed);
+        slot *free = nullptr;
+        for (auto i = hash & current->mask;; i = (i + 1) & current->mask)
+        {
+          auto &slot = current->slots[i];
+          auto slot_hash = slot.hash.load(std::memory_order_relaxed);
+          auto *entry = slot.entry.load(std::memory_order_relaxed);
+          if (slot_hash == 0)
+          {
+            free = free != nullptr ? free : &slot;
+            break;
+          }
+          if (entry == nullptr)
+          {
+            free = free != nullptr ? free : &slot;
+          }
+          else if (slot_hash == hash && entry->key == key)
+          {
+            if (assign)
+            {
+              slot.entry.store(new node{std::move(key), std::move(value)}, std::memory_order_release);
+              domain_->retire(entry);
+            }
+            return false;
+          }
+        }
+
+        auto tombstone = free->hash.load(std::memory_order_relaxed) != 0;
+        // Readers that see the new hash before the entry skip the slot.
+        free->hash.store(hash, std::memory_order_release);
+        free->entry.store(new node{std::move(key), std::move(value)}, std::memory_order_release);
+        shard.tombstones -= tombstone;
+        auto size = shard.size.load(std::memory_order_relaxed) + 1;
+        shard.size.store(size, std::memory_order_relaxed);
+        auto capacity = current->mask + 1;
+        if ((size + shard.tombstones) * 2 > capacity)
+        {
+          rehash_locked(shard, size * 4 > capacity ? 2 * capacity : capacity);
+        }
+        return true;
+      }
+
+      bool erase_locked(shard &shard, uint64_t hash, const Key &key)
+      {
+        auto *current = shard.current.load(std::memory_order_relaxed);
+        for (auto i = hash & current->mask;; i = (i + 1) & current->mask)
+        {
+          auto &slot = current->slots[i];
+          auto slot_hash = slot.hash.load(std::memory_order_relaxed);
+          if (slot_hash == 0)
+          {
+            return false;
+          }
+          auto *entry = slot.entry.load(std::memory_order_relaxed);
+          if (slot_hash == hash && entry != nullptr && entry->key == key)
+          {
+            slot.entry.store(nullptr, std::memory_order_release);
+            domain_->retire(entry);
+            ++shard.tombstones;
+            shard.size.store(shard.size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            return true;
+          }
+        }
+      }
+
+      // Moves the live entries to a new table of capacity slots.
+      void rehash_locked(shard &shard, size_t capacity)
+      {
+        auto *old = shard.current.load(std::memory_order_relaxed);
+        auto *fresh = new table(capacity);
+        for (size_t i = 0; i <= old->mask; ++i)
+        {
+          auto *entry = old->slots[i].entry.load(std::memory_order_relaxed);
+          if (entry == nullptr)
+          {
+            continue;
+          }
+          auto hash = old->slots[i].hash.load(std::memory_order_relaxed);
+          auto j = hash & fresh->mask;
+          while (fresh->slots[j].hash.load(std::memory_order_relaxed) != 0)
+          {
+            j = (j + 1) & fresh->mask;
+          }
+          fresh->slots[j].hash.store(hash, std::memory_order_relaxed);
+          fresh->slots[j].entry.store(entry, std::memory_order_relaxed);
+        }
+        shard.current.store(fresh, std::memory_order_release);
+        shard.tombstones = 0;
+        domain_->retire(old);
+      }
+
+      // Calls apply(shard, i, hash) for i in [0, count), grouped by shard,
+      // each group under one lock.
+      template <typename HashOf, typename Apply>
+      void for_each_shard(size_t count, HashOf &&hash_of_entry, Apply &&apply)
+      {
+        std::vector<std::pair<uint64_t, size_t>> order(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+          order[i] = {hash_of_entry(i), i};
+        }
+        // Stable so repeated keys apply in the order given.
+        std::stable_sort(order.begin(), order.end(), [](const auto &a, const auto &b)
+                         { return shard_index(a.first) < shard_index(b.first); });
+        for (size_t begin = 0; begin < count;)
+        {
+          auto &shard = shard_of(order[begin].first);
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          auto end = begin;
+          for (; end < count && shard_index(order[end].first) == shard_index(order[begin].first); ++end)
+          {
+            apply(shard, order[end].second, order[end].first);
+          }
+          begin = end;
+        }
+      }
+
+      std::unique_ptr<epoch_domain> domain_;
+      shard shards_[shard_count];
+    };
+  }
+}
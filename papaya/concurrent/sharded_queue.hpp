@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "papaya/concurrent/fixed_size_queue.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    namespace detail
+    {
+      // The calling thread's home shard before the modulo. Threads are
+      // numbered round-robin on first use, so up to shard_count threads get
+      // a shard of their own.
+      inline size_t this_thread_home() noexcept
+      {
+        static std::atomic<size_t> next_home{0};
+        thread_local const size_t home = next_home.fetch_add(1, std::memory_order_relaxed);
+        return home;
+      }
+
+      // xorshift64, per thread, for picking victim shards.
+      inline uint64_t this_thread_random() noexcept
+      {
+        thread_local uint64_t state = 0x9e3779b97f4a7c15ull * (this_thread_home() + 1);
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+      }
+    }
+
+    /**
+     * @brief Multi-queue of one ConcurrentFixedSizeQueue per shard, so
+     * producers on different shards don't fight over one write position.
+     *
+     * A thread pushes to its home shard and pops from it first. When the
+     * home shard is empty, a consumer samples two other shards and pops from
+     * the longer one (power-of-two choices), then falls back to a sweep of
+     * all shards, so pop() only fails when every shard looked empty. A push
+     * that finds its home shard full spills over the same way, to the
+     * shorter of two, then to any shard with room.
+     *
+     * Ordering is relaxed: elements a thread pushes to its home shard come
+     * out in push order relative to each other, but there is no order across
+     * shards, and spilled pushes or stolen pops can overtake. Use it where
+     * any consumer may take any element and only throughput matters.
+     *
+     * @tparam shard_size Capacity of each shard's ring.
+     */
+    template <typename T, size_t shard_size>
+    class ConcurrentShardedQueue
+    {
+    public:
+      using value_type = T;
+
+      // One shard per hardware thread by default.
+      explicit ConcurrentShardedQueue(size_t shard_count = std::thread::hardware_concurrency())
+          : shard_count_(std::max<size_t>(shard_count, 1)), shards_(new shard[shard_count_])
+      {
+      }
+
+      ConcurrentShardedQueue(const ConcurrentShardedQueue &) = delete;
+      ConcurrentShardedQueue &operator=(const ConcurrentShardedQueue &) = delete;
+
+      // Returns false if the home shard and every other one was full.
+      bool push(const T &newElement)
+      {
+        auto home = home_shard();
+        if (shards_[home].ring.push(newElement))
+        {
+          return true;
+        }
+        if (shard_count_ == 1)
+        {
+          return false;
+        }
+        auto [a, b] = sample(home);
+        if (shards_[b].ring.effective_size() < shards_[a].ring.effective_size())
+        {
+          std::swap(a, b);
+        }
+        if (shards_[a].ring.push(newElement) || shards_[b].ring.push(newElement))
+        {
+          return true;
+        }
+        return sweep(home, [&](shard &shard)
+                     { return shard.ring.push(newElement); });
+      }
+
+      // Returns false if the home shard and every other one was empty.
+      bool pop(T &returnedElement)
+      {
+        auto home = home_shard();
+        if (shards_[home].ring.pop(returnedElement))
+        {
+          return true;
+        }
+        if (shard_count_ == 1)
+        {
+          return false;
+        }
+        auto [a, b] = sample(home);
+        if (shards_[b].ring.effective_size() > shards_[a].ring.effective_size())
+        {
+          std::swap(a, b);
+        }
+        if (shards_[a].ring.pop(returnedElement) || shards_[b].ring.pop(returnedElement))
+        {
+          return true;
+        }
+        return sweep(home, [&](shard &shard)
+                     { return shard.ring.pop(returnedElement); });
+      }
+
+      // Sums the shards one after the other, so it's only exact when no
+      // thread is pushing or popping.
+      bool is_empty() { return effective_size() == 0; }
+
+      size_t effective_size()
+      {
+        size_t size = 0;
+        for (size_t i = 0; i < shard_count_; ++i)
+        {
+          size += shards_[i].ring.effective_size();
+        }
+        return size;
+      }
+
+      size_t shard_count() const noexcept { return shard_count_; }
+
+      // Total capacity over all shards.
+      size_t capacity() const noexcept { return shard_count_ * shard_size; }
+
+    private:
+      // The ring aligns its positions to cache lines already; this keeps the
+      // end of one shard's buffer and the next shard's read position apart.
+      struct alignas(64) shard
+      {
+        ConcurrentFixedSizeQueue<T, shard_size> ring;
+      };
+
+      size_t home_shard() const noexcept { return detail::this_thread_home() % shard_count_; }
+
+      // Two shards other than home, distinct when there are more than two.
+      std::pair<size_t, size_t> sample(size_t home) const noexcept
+      {
+        auto random = detail::this_thread_random();
+        auto others = shard_count_ - 1;
+        auto a = random % others;
+        auto b = others > 1 ? (a + 1 + (random >> 32) % (others - 1)) % others : a;
+        // Skip over home.
+        return {a + (a >= home), b + (b >= home)};
+      }
+
+      // Tries fn on each shard but home, starting after it, until one
+      // succeeds.
+      template <typename Fn>
+      bool sweep(size_t home, Fn &&fn)
+      {
+        for (size_t i = 1; i < shard_count_; ++i)
+        {
+          if (fn(shards_[(home + i) % shard_count_]))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      const size_t shard_count_;
+      std::unique_ptr<shard[]> shards_;
+    };
+  }
+}
@@ -0,0 +1,72 @@
+#include "papaya/concurrent/thread_pool.hpp"
+
+#include <algorithm>
+
+#include "papaya/concurrent/epoch.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    thread_pool::thread_pool(size_t thread_count)
+    {
+      thread_count = std::max<size_t>(1, thread_count);
+      workers_.reserve(thread_count);
+      for (size_t i = 0; i < thread_count; ++i)
+      {
+        workers_.emplace_back([this]
+                              { loop(); });
+      }
+    }
+
+    thread_pool::~thread_pool() noexcept
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      wake_.notify_all();
+      for (auto &worker : workers_)
+      {
+        worker.join();
+      }
+    }
+
+    void thread_pool::schedule(job job)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+      }
+      wake_.notify_one();
+    }
+
+    void thread_pool::loop()
+    {
+      while (true)
+      {
+        job next;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          if (queue_.empty() && !stopping_)
+          {
+            // About to sleep: free what this worker's jobs retired, so it
+            // doesn't wait for the worker's next retire().
+            lock.unlock();
+            epoch_domain::global().collect();
+            lock.lock();
+          }
+          wake_.wait(lock, [&]
+                     { return stopping_ || !queue_.empty(); });
+          if (queue_.empty())
+          {
+            return;
+          }
+          next = std::move(queue_.front());
+          queue_.pop_front();
+        }
+        next();
+      }
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/scheduler.hpp"
+
+namespace pa
+{
+  namespace concurrent
+  {
+    /**
+     * @brief Fixed set of worker threads sharing one FIFO job queue.
+     *
+     * Workers collect() epoch_domain::global() before going to sleep.
+     */
+    class thread_pool final : public scheduler
+    {
+    public:
+      explicit thread_pool(size_t thread_count = std::thread::hardware_concurrency());
+      // Runs the jobs that are still queued, then joins the workers.
+      ~thread_pool() noexcept override;
+
+      thread_pool(const thread_pool &) = delete;
+      thread_pool &operator=(const thread_pool &) = delete;
+
+      void schedule(job job) override;
+
+      size_t size() const noexcept { return workers_.size(); }
+
+    private:
+      void loop();
+
+      std::mutex mutex_;
+      std::condition_variable wake_;
+      std::deque<job> queue_;
+      bool stopping_ = false;
+      std::vector<std::thread> workers_;
+    };
+  }
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "papaya/concurrent/scheduler.hpp"
+
+namespace pa
+{
+  namespace coro
+  {
+    template <typename T = void>
+    class task;
+
+    namespace detail
+    {
+      struct promise_base
+      {
+        // Resumes whoever co_awaited the task once it finishes.
+        struct final_awaiter
+        {
+          bool await_ready() const noexcept { return false; }
+
+          template <typename Promise>
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept
+          {
+            return self.promise().continuation;
+          }
+
+          void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        final_awaiter final_suspend() const noexcept { return {}; }
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr error;
+      };
+
+      template <typename T>
+      struct promise final : promise_base
+      {
+        task<T> get_return_object() noexcept;
+
+        template <typename U>
+        void return_value(U &&value)
+        {
+          value_.emplace(std::forward<U>(value));
+        }
+
+        T result()
+        {
+          if (error)
+          {
+            std::rethrow_exception(error);
+          }
+          return std::move(*value_);
+        }
+
+      private:
+        std::optional<T> value_;
+      };
+
+      template <>
+      struct promise<void> final : promise_base
+      {
+        task<void> get_return_object() noexcept;
+
+        void return_void() const noexcept {}
+
+        void result()
+        {
+          if (error)
+          {
+            std::rethrow_exception(error);
+          }
+        }
+      };
+
+      // Fire-and-forget coroutine that owns its own frame.
+      struct detached
+      {
+        struct promise_type
+        {
+          detached get_return_object() const noexcept { return {}; }
+          std::suspend_never initial_suspend() const noexcept { return {}; }
+          std::suspend_never final_suspend() const noexcept { return {}; }
+          void return_void() const noexcept {}
+          // Every exception is handed to the caller's error callback first.
+          void unhandled_exception() const noexcept { std::terminate(); }
+        };
+      };
+    }
+
+    /**
+     * @brief Lazily started coroutine producing a T.
+     *
+     * The body doesn't run until the task is co_awaited; the awaiting
+     * coroutine is resumed by symmetric transfer when the body finishes, so
+     * chains of tasks don't grow the stack. Exceptions propagate to the
+     * awaiter.
+     */
+    template <typename T>
+    class [[nodiscard]] task final
+    {
+    public:
+      using promise_type = detail::promise<T>;
+
+      explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+      task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+      task &operator=(task &&other) noexcept
+      {
+        if (this != &other)
+        {
+          reset();
+          handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+      }
+      task(const task &) = delete;
+      task &operator=(const task &) = delete;
+      ~task() { reset(); }
+
+      auto operator co_await() && noexcept
+      {
+        struct awaiter
+        {
+          std::coroutine_handle<promise_type> handle;
+
+          bool await_ready() const noexcept { return false; }
+
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+          {
+            handle.promise().continuation = awaiting;
+            return handle;
+          }
+
+          T await_resume() { return handle.promise().result(); }
+        };
+        return awaiter{handle_};
+      }
+
+    private:
+      void reset() noexcept
+      {
+        if (handle_)
+        {
+          handle_.destroy();
+          handle_ = {};
+        }
+      }
+
+      std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace detail
+    {
+      template <typename T>
+      task<T> promise<T>::get_return_object() noexcept
+      {
+        return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+      }
+
+      inline task<void> promise<void>::get_return_object() noexcept
+      {
+        return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+      }
+    }
+
+    /**
+     * @brief co_await resume_on(scheduler) continues the coroutine on one of
+     * the scheduler's threads.
+     */
+    inline auto resume_on(concurrent::scheduler &scheduler) noexcept
+    {
+      struct awaiter
+      {
+        concurrent::scheduler &scheduler;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+          scheduler.schedule([handle]
+                             { handle.resume(); });
+        }
+
+        void await_resume() const noexcept {}
+      };
+      return awaiter{scheduler};
+    }
+
+    /**
+     * @brief Starts task without waiting for it. Exactly one of on_value or
+     * on_error (given a std::exception_ptr) is called on the thread the task
+     * finishes on. on_value takes no argument for task<void>.
+     */
+    template <typename T, typename OnValue, typename OnError>
+    detail::detached spawn(task<T> task, OnValue on_value, OnError on_error)
+    {
+      std::exception_ptr error;
+      if constexpr (std::is_void<T>::value)
+      {
+        try
+        {
+          co_await std::move(task);
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+        if (error)
+        {
+          on_error(error);
+        }
+        else
+        {
+          on_value();
+        }
+      }
+      else
+      {
+        std::optional<T> value;
+        try
+        {
+          value.emplace(co_await std::move(task));
+        }
+        catch (...)
+        {
+          error = std::current_exception();
+        }
+        if (error)
+        {
+          on_error(error);
+        }
+        else
+        {
+          on_value(std::move(*value));
+        }
+      }
+    }
+
+    /**
+     * @brief Blocks the calling thread until task finishes and returns its
+     * value or rethrows its exception.
+     */
+    template <typename T>
+    T sync_wait(task<T> task)
+    {
+      std::mutex mutex;
+      std::condition_variable done_cv;
+      bool done = false;
+      std::exception_ptr error;
+      std::conditional_t<std::is_void<T>::value, bool, std::optional<T>> value{};
+
+      auto finish = [&]
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        done_cv.notify_one();
+      };
+      auto on_error = [&](std::exception_ptr e)
+      {
+        error = e;
+        finish();
+      };
+      if constexpr (std::is_void<T>::value)
+      {
+        spawn(std::move(task), finish, on_error);
+      }
+      else
+      {
+        spawn(
+            std::move(task), [&](T v)
+            {
+              value.emplace(std::move(v));
+              finish(); },
+            on_error);
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      done_cv.wait(lock, [&]
+                   { return done; });
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+      if constexpr (!std::is_void<T>::value)
+      {
+        return std::move(*value);
+      }
+    }
+  }
+}
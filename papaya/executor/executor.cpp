@@ -0,0 +1,284 @@
+#include "papaya/executor/executor.hpp"
+
+#include "papaya/executor/kernels.hpp"
+#include "papaya/trace/tracer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+namespace pa
+{
+  namespace detail
+  {
+    using Evaluation = IExecutor::Evaluation;
+
+    // Calls visit with each non-empty record that starts in [begin, end) of
+    // dataset. A record starts at 0 or right after a newline, so neighbouring
+    // ranges split the records between them without either scanning the
+    // whole dataset.
+    template <typename Visit>
+    void forEachRecord(std::string_view dataset, size_t begin, size_t end, Visit &&visit)
+    {
+      auto start = begin;
+      if (start > 0 && dataset[start - 1] != '\n')
+      {
+        start = dataset.find('\n', start);
+        start = start == std::string_view::npos ? dataset.size() : start + 1;
+      }
+      while (start < end && start < dataset.size())
+      {
+        auto stop = dataset.find('\n', start);
+        stop = stop == std::string_view::npos ? dataset.size() : stop;
+        if (stop > start)
+        {
+          visit(dataset.substr(start, stop - start));
+        }
+        start = stop + 1;
+      }
+    }
+
+    Evaluation evaluateRange(const FlExecutor::Evaluator &evaluator, std::string_view dataset, size_t begin, size_t end)
+    {
+      return util::match(
+          evaluator,
+          [](std::monostate)
+          { return Evaluation{}; },
+          [&](const FlExecutor::RecordEvaluator &evaluate)
+          {
+            Evaluation result;
+            forEachRecord(dataset, begin, end, [&](std::string_view record)
+                          { result += evaluate(record); });
+            return result;
+          },
+          [&](const FlExecutor::PredictionEvaluator &predict)
+          {
+            // Buffered per thread so the kernels get whole shards to chew
+            // on, and the buffers are reused across shards.
+            thread_local std::vector<float> predictions;
+            thread_local std::vector<float> labels;
+            predictions.clear();
+            labels.clear();
+            forEachRecord(dataset, begin, end, [&](std::string_view record)
+                          {
+                            auto [prediction, label] = predict(record);
+                            predictions.push_back(prediction);
+                            labels.push_back(label); });
+
+            Evaluation result;
+            result.records = predictions.size();
+            if (!predictions.empty())
+            {
+              auto [min, max] = kernels::minmax(predictions);
+              result.predictionSum = kernels::sum(predictions);
+              result.predictionMin = min;
+              result.predictionMax = max;
+              result.squaredError = kernels::squared_error(predictions, labels);
+              result.correct = kernels::count_correct(predictions, labels);
+            }
+            return result;
+          });
+    }
+
+    // One execute() spread over the pool. Shards are claimed from a counter
+    // and their results reduced up a binary tree: leaf i is node P + i, node
+    // n's parent is n / 2 and the root is node 1. The first sibling to arrive
+    // at a parent just leaves; the second combines both into the parent and
+    // goes on up.
+    class ShardedEvaluation final
+    {
+    public:
+      ShardedEvaluation(const FlExecutor::Evaluator &evaluate, std::string_view dataset, size_t offset, size_t shardBytes)
+          : evaluate_(evaluate),
+            dataset_(dataset),
+            offset_(offset),
+            shardBytes_(shardBytes),
+            shards_((dataset.size() - offset + shardBytes - 1) / shardBytes),
+            leaves_(std::bit_ceil(std::max<size_t>(shards_, 1))),
+            values_(2 * leaves_),
+            arrivals_(new std::atomic<uint32_t>[leaves_])
+      {
+        for (size_t node = 0; node < leaves_; ++node)
+        {
+          arrivals_[node].store(0, std::memory_order_relaxed);
+        }
+        // Padding leaves are done from the start.
+        for (auto leaf = shards_; leaf < leaves_; ++leaf)
+        {
+          arrive(leaves_ + leaf, Evaluation{});
+        }
+      }
+
+      size_t shards() const { return shards_; }
+
+      // Claims and evaluates shards until none are left.
+      void work()
+      {
+        while (true)
+        {
+          auto shard = next_.fetch_add(1, std::memory_order_relaxed);
+          if (shard >= shards_)
+          {
+            return;
+          }
+          Evaluation result;
+          if (!failed_.load(std::memory_order_relaxed))
+          {
+            auto begin = offset_ + shard * shardBytes_;
+            auto end = std::min(begin + shardBytes_, dataset_.size());
+            auto started = std::chrono::steady_clock::now();
+            try
+            {
+              result = evaluateRange(evaluate_, dataset_, begin, end);
+            }
+            catch (...)
+            {
+              failed_.store(true, std::memory_order_relaxed);
+            }
+            busyNanos_.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count(),
+                std::memory_order_relaxed);
+          }
+          arrive(leaves_ + shard, result);
+        }
+      }
+
+      // Blocks until every shard reached the root.
+      void wait()
+      {
+        done_.wait(false, std::memory_order_acquire);
+      }
+
+      bool failed() const { return failed_.load(std::memory_order_relaxed); }
+      const Evaluation &total() const { return values_[1]; }
+      uint64_t busyNanos() const { return busyNanos_.load(std::memory_order_relaxed); }
+
+    private:
+      void arrive(size_t node, const Evaluation &value)
+      {
+        values_[node] = value;
+        while (node > 1)
+        {
+          auto parent = node / 2;
+          // acq_rel: the second arrival must see the first one's value.
+          if (arrivals_[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+          {
+            return;
+          }
+          values_[parent] = values_[2 * parent];
+          values_[parent] += values_[2 * parent + 1];
+          node = parent;
+        }
+        done_.store(true, std::memory_order_release);
+        done_.notify_all();
+      }
+
+      const FlExecutor::Evaluator &evaluate_;
+      const std::string_view dataset_;
+      const size_t offset_;
+      const size_t shardBytes_;
+      const size_t shards_;
+      const size_t leaves_;
+      std::vector<Evaluation> values_;
+      std::unique_ptr<std::atomic<uint32_t>[]> arrivals_;
+      alignas(64) std::atomic<size_t> next_{0};
+      alignas(64) std::atomic<uint64_t> busyNanos_{0};
+      std::atomic<bool> failed_{false};
+      std::atomic<bool> done_{false};
+    };
+  }
+
+  FlExecutor::FlExecutor(Evaluator evaluate)
+      : evaluate_(std::move(evaluate))
+  {
+  }
+
+  FlExecutor::FlExecutor(Evaluator evaluate, std::shared_ptr<concurrent::thread_pool> pool)
+      : FlExecutor(std::move(evaluate), std::move(pool), ParallelOptions{})
+  {
+  }
+
+  FlExecutor::FlExecutor(Evaluator evaluate, std::shared_ptr<concurrent::thread_pool> pool, ParallelOptions options)
+      : evaluate_(std::move(evaluate)), pool_(std::move(pool)), options_(options)
+  {
+  }
+
+  IExecutor::Output FlExecutor::execute(const Input &input)
+  {
+    trace::span span("FlExecutor::execute");
+    if (std::holds_alternative<std::monostate>(evaluate_))
+    {
+      return Success{};
+    }
+    if (pool_)
+    {
+      return executeParallel(input.dataset);
+    }
+    try
+    {
+      return Success{detail::evaluateRange(evaluate_, input.dataset, 0, input.dataset.size())};
+    }
+    catch (...)
+    {
+      return Failure{EvaluationFailed};
+    }
+  }
+
+  IExecutor::Output FlExecutor::executeParallel(std::string_view dataset)
+  {
+    Evaluation calibration;
+    size_t offset = 0;
+    auto nanosPerByte = nanosPerByte_.load(std::memory_order_relaxed);
+    if (nanosPerByte == 0)
+    {
+      // Nothing measured yet: time the first shard here before sizing the
+      // rest.
+      offset = std::min(dataset.size(), options_.minShardBytes);
+      auto started = std::chrono::steady_clock::now();
+      try
+      {
+        calibration = detail::evaluateRange(evaluate_, dataset, 0, offset);
+      }
+      catch (...)
+      {
+        return Failure{EvaluationFailed};
+      }
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started);
+      nanosPerByte = std::max(1e-3, static_cast<double>(elapsed.count()) / std::max<size_t>(offset, 1));
+    }
+    if (offset >= dataset.size())
+    {
+      nanosPerByte_.store(nanosPerByte, std::memory_order_relaxed);
+      return Success{calibration};
+    }
+
+    auto workers = pool_->size() + 1;
+    auto remaining = dataset.size() - offset;
+    auto target = static_cast<size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(options_.targetShardDuration).count() / nanosPerByte);
+    auto balanced = remaining / (workers * std::max<size_t>(options_.minShardsPerWorker, 1));
+    auto shardBytes = std::max(options_.minShardBytes, std::min(target, balanced));
+
+    auto evaluation = std::make_shared<detail::ShardedEvaluation>(evaluate_, dataset, offset, shardBytes);
+    // Helpers that start after the shards ran out return without touching
+    // the dataset, so it's fine if they outlive this call.
+    auto helpers = std::min(pool_->size(), evaluation->shards() - 1);
+    for (size_t i = 0; i < helpers; ++i)
+    {
+      pool_->schedule([evaluation]
+                      { evaluation->work(); });
+    }
+    evaluation->work();
+    evaluation->wait();
+
+    if (evaluation->failed())
+    {
+      return Failure{EvaluationFailed};
+    }
+    auto measured = static_cast<double>(evaluation->busyNanos()) / remaining;
+    nanosPerByte_.store(std::max(1e-3, (nanosPerByte + measured) / 2), std::memory_order_relaxed);
+
+    auto total = calibration;
+    total += evaluation->total();
+    return Success{total};
+  }
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "papaya/concurrent/thread_pool.hpp"
+#include "papaya/storage/artifact_cache.hpp"
+#include "papaya/util/match.hpp"
+
+namespace pa
+{
+  /// Abstract class that executes the primary training or evaluation loop.
+  class IExecutor
+  {
+  public:
+    struct Input final
+    {
+      std::string executionConfig;
+      std::string dataset;
+      std::string localInfo;
+      std::string modelGraph;
+      std::string dataDirectoryPath;
+      /// Set instead of modelGraph when the graph comes from a
+      /// storage::artifact_cache, so sessions share one read-only mapping
+      /// rather than each holding a copy. Local to the process; the codec
+      /// doesn't encode it.
+      storage::artifact modelArtifact{};
+
+      /// modelArtifact's bytes when it's set, else modelGraph.
+      std::string_view modelGraphBytes() const
+      {
+        return modelArtifact ? modelArtifact.bytes() : std::string_view(modelGraph);
+      }
+    };
+
+    /// Partial result of an evaluation. Shard results are combined with
+    /// operator+=, which must be associative.
+    struct Evaluation final
+    {
+      uint64_t records = 0;
+      double lossSum = 0;
+      /// Filled in by prediction evaluators, see FlExecutor::Prediction.
+      uint64_t correct = 0;
+      double squaredError = 0;
+      double predictionSum = 0;
+      float predictionMin = std::numeric_limits<float>::infinity();
+      float predictionMax = -std::numeric_limits<float>::infinity();
+
+      Evaluation &operator+=(const Evaluation &other)
+      {
+        records += other.records;
+        lossSum += other.lossSum;
+        correct += other.correct;
+        squaredError += other.squaredError;
+        predictionSum += other.predictionSum;
+        predictionMin = predictionMin < other.predictionMin ? predictionMin : other.predictionMin;
+        predictionMax = predictionMax > other.predictionMax ? predictionMax : other.predictionMax;
+        return *this;
+      }
+    };
+
+    struct Success final
+    {
+      Evaluation evaluation;
+      /// The trained model, if the executor trains, in modelGraph's format.
+      /// Empty otherwise. fl_factory encodes it as a delta against the
+      /// model the session started from.
+      std::string trainedModel{};
+    };
+
+    struct Failure final
+    {
+      int32_t errorCode;
+    };
+
+    using Output = std::variant<Success, Failure>;
+
+  public:
+    virtual ~IExecutor() = default;
+
+    virtual Output execute(const Input &) = 0;
+  };
+
+  /// FL (Federated Learning) executor
+  ///
+  /// Input::dataset holds one record per line. Without an evaluator there's
+  /// nothing to run and execute() succeeds right away. With a pool, the
+  /// dataset is cut into byte-range shards that workers claim one at a time;
+  /// each shard's result climbs a lock-free binary tree where the second of
+  /// two siblings to finish combines them, so the last shard to finish
+  /// carries the total to the root.
+  ///
+  /// A PredictionEvaluator only maps records to (prediction, label); the
+  /// executor buffers a shard's worth and computes the metrics with the
+  /// SIMD kernels in papaya/executor/kernels.hpp.
+  ///
+  /// Shards are sized so one takes about ParallelOptions::targetShardDuration,
+  /// from the per-byte cost measured on the previous execute() (or on a
+  /// small calibration shard the first time).
+  class FlExecutor final : public IExecutor
+  {
+  public:
+    /// Evaluates one record (a line, without the newline).
+    using RecordEvaluator = std::function<Evaluation(std::string_view record)>;
+
+    struct Prediction
+    {
+      float prediction;
+      float label;
+    };
+    /// Predicts one record; correct counts predictions on the same side of
+    /// 0.5 as their label.
+    using PredictionEvaluator = std::function<Prediction(std::string_view record)>;
+
+    using Evaluator = std::variant<std::monostate, RecordEvaluator, PredictionEvaluator>;
+
+    struct ParallelOptions
+    {
+      std::chrono::microseconds targetShardDuration{2000};
+      /// Never fewer shards than this per worker, to even out stragglers.
+      size_t minShardsPerWorker = 4;
+      size_t minShardBytes = 4096;
+    };
+
+    /// errorCode of the Failure returned when the evaluator throws.
+    static constexpr int32_t EvaluationFailed = -1;
+
+    FlExecutor() = default;
+    /// Evaluates on the calling thread.
+    explicit FlExecutor(Evaluator evaluate);
+    /// Evaluates on pool's workers and the calling thread.
+    FlExecutor(Evaluator evaluate, std::shared_ptr<concurrent::thread_pool> pool);
+    FlExecutor(Evaluator evaluate, std::shared_ptr<concurrent::thread_pool> pool, ParallelOptions options);
+
+    Output execute(const Input &input) override;
+
+    /// The measured cost the next shard size is derived from, 0 until the
+    /// first execute().
+    double nanosecondsPerByte() const { return nanosPerByte_.load(std::memory_order_relaxed); }
+
+  private:
+    Output executeParallel(std::string_view dataset);
+
+    Evaluator evaluate_;
+    std::shared_ptr<concurrent::thread_pool> pool_;
+    ParallelOptions options_;
+    std::atomic<double> nanosPerByte_{0};
+  };
+
+  /// The error code of a failed execution, or 0 on success.
+  inline int32_t error_code_of(const IExecutor::Output &output)
+  {
+    return util::match(
+        output,
+        [](const IExecutor::Success &)
+        { return int32_t{0}; },
+        [](const IExecutor::Failure &failure)
+        { return failure.errorCode; });
+  }
+}
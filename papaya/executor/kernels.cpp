@@ -0,0 +1,394 @@
+#include "papaya/executor/kernels.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PAPAYA_KERNELS_X86 1
+#endif
+
+namespace pa
+{
+  namespace kernels
+  {
+    namespace detail
+    {
+      // Float lanes are flushed into a double every this many elements, so
+      // long inputs don't lose the small values to the large running sum.
+      constexpr size_t block = 4096;
+      constexpr float inf = std::numeric_limits<float>::infinity();
+
+      double sum_scalar(const float *values, size_t size)
+      {
+        double total = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+          total += values[i];
+        }
+        return total;
+      }
+
+      min_max minmax_scalar(const float *values, size_t size)
+      {
+        min_max result{inf, -inf};
+        for (size_t i = 0; i < size; ++i)
+        {
+          result.min = std::min(result.min, values[i]);
+          result.max = std::max(result.max, values[i]);
+        }
+        return result;
+      }
+
+      double squared_error_scalar(const float *predictions, const float *targets, size_t size)
+      {
+        double total = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+          double d = predictions[i] - targets[i];
+          total += d * d;
+        }
+        return total;
+      }
+
+      uint64_t count_correct_scalar(const float *predictions, const float *labels, size_t size, float threshold)
+      {
+        uint64_t correct = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+          correct += (predictions[i] >= threshold) == (labels[i] >= threshold);
+        }
+        return correct;
+      }
+
+#if PAPAYA_KERNELS_X86
+      // SSE2 is part of x86-64, so these need no target attribute or check.
+
+      double hsum(__m128 v)
+      {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, v);
+        return static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+      }
+
+      double sum_sse2(const float *values, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 16)
+        {
+          auto end = i + std::min(block, (size - i) / 16 * 16);
+          auto a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+          for (; i < end; i += 16)
+          {
+            a0 = _mm_add_ps(a0, _mm_loadu_ps(values + i));
+            a1 = _mm_add_ps(a1, _mm_loadu_ps(values + i + 4));
+            a2 = _mm_add_ps(a2, _mm_loadu_ps(values + i + 8));
+            a3 = _mm_add_ps(a3, _mm_loadu_ps(values + i + 12));
+          }
+          total += hsum(_mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)));
+        }
+        return total + sum_scalar(values + i, size - i);
+      }
+
+      min_max minmax_sse2(const float *values, size_t size)
+      {
+        auto lo = _mm_set1_ps(inf), hi = _mm_set1_ps(-inf);
+        size_t i = 0;
+        for (; size - i >= 4; i += 4)
+        {
+          auto v = _mm_loadu_ps(values + i);
+          lo = _mm_min_ps(lo, v);
+          hi = _mm_max_ps(hi, v);
+        }
+        alignas(16) float los[4], his[4];
+        _mm_store_ps(los, lo);
+        _mm_store_ps(his, hi);
+        auto tail = minmax_scalar(values + i, size - i);
+        return {std::min({tail.min, los[0], los[1], los[2], los[3]}), std::max({tail.max, his[0], his[1], his[2], his[3]})};
+      }
+
+      double squared_error_sse2(const float *predictions, const float *targets, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 8)
+        {
+          auto end = i + std::min(block, (size - i) / 8 * 8);
+          auto a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+          for (; i < end; i += 8)
+          {
+            auto d0 = _mm_sub_ps(_mm_loadu_ps(predictions + i), _mm_loadu_ps(targets + i));
+            auto d1 = _mm_sub_ps(_mm_loadu_ps(predictions + i + 4), _mm_loadu_ps(targets + i + 4));
+            a0 = _mm_add_ps(a0, _mm_mul_ps(d0, d0));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(d1, d1));
+          }
+          total += hsum(_mm_add_ps(a0, a1));
+        }
+        return total + squared_error_scalar(predictions + i, targets + i, size - i);
+      }
+
+      uint64_t count_correct_sse2(const float *predictions, const float *labels, size_t size, float threshold)
+      {
+        auto t = _mm_set1_ps(threshold);
+        uint64_t wrong = 0;
+        size_t i = 0;
+        for (; size - i >= 4; i += 4)
+        {
+          auto p = _mm_cmpge_ps(_mm_loadu_ps(predictions + i), t);
+          auto l = _mm_cmpge_ps(_mm_loadu_ps(labels + i), t);
+          wrong += __builtin_popcount(_mm_movemask_ps(_mm_xor_ps(p, l)));
+        }
+        return (i - wrong) + count_correct_scalar(predictions + i, labels + i, size - i, threshold);
+      }
+
+      __attribute__((target("avx2,fma"))) double hsum(__m256 v)
+      {
+        return hsum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+      }
+
+      __attribute__((target("avx2,fma"))) double sum_avx2(const float *values, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 32)
+        {
+          auto end = i + std::min(block, (size - i) / 32 * 32);
+          auto a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+          for (; i < end; i += 32)
+          {
+            a0 = _mm256_add_ps(a0, _mm256_loadu_ps(values + i));
+            a1 = _mm256_add_ps(a1, _mm256_loadu_ps(values + i + 8));
+            a2 = _mm256_add_ps(a2, _mm256_loadu_ps(values + i + 16));
+            a3 = _mm256_add_ps(a3, _mm256_loadu_ps(values + i + 24));
+          }
+          total += hsum(_mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3)));
+        }
+        return total + sum_sse2(values + i, size - i);
+      }
+
+      __attribute__((target("avx2,fma"))) min_max minmax_avx2(const float *values, size_t size)
+      {
+        auto lo = _mm256_set1_ps(inf), hi = _mm256_set1_ps(-inf);
+        size_t i = 0;
+        for (; size - i >= 8; i += 8)
+        {
+          auto v = _mm256_loadu_ps(values + i);
+          lo = _mm256_min_ps(lo, v);
+          hi = _mm256_max_ps(hi, v);
+        }
+        alignas(32) float los[8], his[8];
+        _mm256_store_ps(los, lo);
+        _mm256_store_ps(his, hi);
+        auto result = minmax_scalar(values + i, size - i);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+          result.min = std::min(result.min, los[lane]);
+          result.max = std::max(result.max, his[lane]);
+        }
+        return result;
+      }
+
+      __attribute__((target("avx2,fma"))) double squared_error_avx2(const float *predictions, const float *targets, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 16)
+        {
+          auto end = i + std::min(block, (size - i) / 16 * 16);
+          auto a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+          for (; i < end; i += 16)
+          {
+            auto d0 = _mm256_sub_ps(_mm256_loadu_ps(predictions + i), _mm256_loadu_ps(targets + i));
+            auto d1 = _mm256_sub_ps(_mm256_loadu_ps(predictions + i + 8), _mm256_loadu_ps(targets + i + 8));
+            a0 = _mm256_fmadd_ps(d0, d0, a0);
+            a1 = _mm256_fmadd_ps(d1, d1, a1);
+          }
+          total += hsum(_mm256_add_ps(a0, a1));
+        }
+        return total + squared_error_scalar(predictions + i, targets + i, size - i);
+      }
+
+      __attribute__((target("avx2,fma"))) uint64_t count_correct_avx2(const float *predictions, const float *labels, size_t size, float threshold)
+      {
+        auto t = _mm256_set1_ps(threshold);
+        uint64_t wrong = 0;
+        size_t i = 0;
+        for (; size - i >= 8; i += 8)
+        {
+          auto p = _mm256_cmp_ps(_mm256_loadu_ps(predictions + i), t, _CMP_GE_OQ);
+          auto l = _mm256_cmp_ps(_mm256_loadu_ps(labels + i), t, _CMP_GE_OQ);
+          wrong += __builtin_popcount(_mm256_movemask_ps(_mm256_xor_ps(p, l)));
+        }
+        return (i - wrong) + count_correct_scalar(predictions + i, labels + i, size - i, threshold);
+      }
+
+      // GCC 12's AVX-512 headers trip -W(maybe-)uninitialized on their own
+      // _mm512_undefined_ps() (GCC bug 105593).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+      __attribute__((target("avx512f"))) double hsum(__m512 v)
+      {
+        alignas(64) float lanes[16];
+        _mm512_store_ps(lanes, v);
+        double total = 0;
+        for (auto lane : lanes)
+        {
+          total += lane;
+        }
+        return total;
+      }
+
+      __attribute__((target("avx512f"))) double sum_avx512(const float *values, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 64)
+        {
+          auto end = i + std::min(block, (size - i) / 64 * 64);
+          auto a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps(), a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+          for (; i < end; i += 64)
+          {
+            a0 = _mm512_add_ps(a0, _mm512_loadu_ps(values + i));
+            a1 = _mm512_add_ps(a1, _mm512_loadu_ps(values + i + 16));
+            a2 = _mm512_add_ps(a2, _mm512_loadu_ps(values + i + 32));
+            a3 = _mm512_add_ps(a3, _mm512_loadu_ps(values + i + 48));
+          }
+          total += hsum(_mm512_add_ps(_mm512_add_ps(a0, a1), _mm512_add_ps(a2, a3)));
+        }
+        return total + sum_avx2(values + i, size - i);
+      }
+
+      __attribute__((target("avx512f"))) min_max minmax_avx512(const float *values, size_t size)
+      {
+        auto lo = _mm512_set1_ps(inf), hi = _mm512_set1_ps(-inf);
+        size_t i = 0;
+        for (; size - i >= 16; i += 16)
+        {
+          auto v = _mm512_loadu_ps(values + i);
+          lo = _mm512_min_ps(lo, v);
+          hi = _mm512_max_ps(hi, v);
+        }
+        auto tail = minmax_scalar(values + i, size - i);
+        return {std::min(tail.min, _mm512_reduce_min_ps(lo)), std::max(tail.max, _mm512_reduce_max_ps(hi))};
+      }
+
+      __attribute__((target("avx512f"))) double squared_error_avx512(const float *predictions, const float *targets, size_t size)
+      {
+        double total = 0;
+        size_t i = 0;
+        while (size - i >= 32)
+        {
+          auto end = i + std::min(block, (size - i) / 32 * 32);
+          auto a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+          for (; i < end; i += 32)
+          {
+            auto d0 = _mm512_sub_ps(_mm512_loadu_ps(predictions + i), _mm512_loadu_ps(targets + i));
+            auto d1 = _mm512_sub_ps(_mm512_loadu_ps(predictions + i + 16), _mm512_loadu_ps(targets + i + 16));
+            a0 = _mm512_fmadd_ps(d0, d0, a0);
+            a1 = _mm512_fmadd_ps(d1, d1, a1);
+          }
+          total += hsum(_mm512_add_ps(a0, a1));
+        }
+        return total + squared_error_scalar(predictions + i, targets + i, size - i);
+      }
+
+      __attribute__((target("avx512f"))) uint64_t count_correct_avx512(const float *predictions, const float *labels, size_t size, float threshold)
+      {
+        auto t = _mm512_set1_ps(threshold);
+        uint64_t wrong = 0;
+        size_t i = 0;
+        for (; size - i >= 16; i += 16)
+        {
+          auto p = _mm512_cmp_ps_mask(_mm512_loadu_ps(predictions + i), t, _CMP_GE_OQ);
+          auto l = _mm512_cmp_ps_mask(_mm512_loadu_ps(labels + i), t, _CMP_GE_OQ);
+          wrong += __builtin_popcount(static_cast<unsigned>(p ^ l));
+        }
+        return (i - wrong) + count_correct_scalar(predictions + i, labels + i, size - i, threshold);
+      }
+#pragma GCC diagnostic pop
+#endif
+
+      constexpr kernel_table scalar_table{isa::scalar, sum_scalar, minmax_scalar, squared_error_scalar, count_correct_scalar};
+#if PAPAYA_KERNELS_X86
+      constexpr kernel_table sse2_table{isa::sse2, sum_sse2, minmax_sse2, squared_error_sse2, count_correct_sse2};
+      constexpr kernel_table avx2_table{isa::avx2, sum_avx2, minmax_avx2, squared_error_avx2, count_correct_avx2};
+      constexpr kernel_table avx512_table{isa::avx512, sum_avx512, minmax_avx512, squared_error_avx512, count_correct_avx512};
+#endif
+
+      const kernel_table &detect()
+      {
+#if PAPAYA_KERNELS_X86
+        __builtin_cpu_init();
+        // The AVX-512 kernels finish their tails with the AVX2 ones.
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+          return avx512_table;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+          return avx2_table;
+        }
+        return sse2_table;
+#else
+        return scalar_table;
+#endif
+      }
+    }
+
+    const char *to_string(isa isa)
+    {
+      switch (isa)
+      {
+      case isa::scalar:
+        return "scalar";
+      case isa::sse2:
+        return "sse2";
+      case isa::avx2:
+        return "avx2";
+      case isa::avx512:
+        return "avx512";
+      }
+      return "unknown";
+    }
+
+    const kernel_table &active()
+    {
+      static const kernel_table &table = detail::detect();
+      return table;
+    }
+
+    const kernel_table *table_for(isa isa)
+    {
+      // Every implementation the active one falls back to is supported too.
+      if (isa > active().isa)
+      {
+        return nullptr;
+      }
+      switch (isa)
+      {
+      case isa::scalar:
+        return &detail::scalar_table;
+#if PAPAYA_KERNELS_X86
+      case isa::sse2:
+        return &detail::sse2_table;
+      case isa::avx2:
+        return &detail::avx2_table;
+      case isa::avx512:
+        return &detail::avx512_table;
+#else
+      default:
+        return nullptr;
+#endif
+      }
+      return nullptr;
+    }
+
+    const kernel_table &scalar()
+    {
+      return detail::scalar_table;
+    }
+  }
+}
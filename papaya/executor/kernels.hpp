@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace pa
+{
+  namespace kernels
+  {
+    /**
+     * @brief Instruction sets the kernels come in, in order of preference.
+     */
+    enum class isa
+    {
+      scalar,
+      sse2,
+      avx2,
+      avx512
+    };
+
+    const char *to_string(isa isa);
+
+    struct min_max
+    {
+      float min;
+      float max;
+    };
+
+    /**
+     * @brief One implementation of every kernel.
+     *
+     * The kernels assume no NaNs in their input. Sums accumulate in float
+     * vector lanes over blocks of a few thousand elements and add each block
+     * to a double, so results may differ from the scalar reference in the
+     * last few bits.
+     */
+    struct kernel_table
+    {
+      kernels::isa isa;
+      double (*sum)(const float *values, size_t size);
+      // {+inf, -inf} when size is 0.
+      min_max (*minmax)(const float *values, size_t size);
+      // Sum of (predictions[i] - targets[i])^2.
+      double (*squared_error)(const float *predictions, const float *targets, size_t size);
+      // How many predictions are on the same side of threshold as their
+      // label, e.g. binary accuracy with probabilities and 0/1 labels.
+      uint64_t (*count_correct)(const float *predictions, const float *labels, size_t size, float threshold);
+    };
+
+    // The best implementation this CPU supports, picked once via CPUID.
+    const kernel_table &active();
+    // The implementation for isa, or nullptr if the CPU (or the build
+    // target) doesn't support it.
+    const kernel_table *table_for(isa isa);
+    // Plain loops, the reference the others are tested against.
+    const kernel_table &scalar();
+
+    inline double sum(std::span<const float> values)
+    {
+      return active().sum(values.data(), values.size());
+    }
+
+    inline double mean(std::span<const float> values)
+    {
+      return values.empty() ? 0 : sum(values) / static_cast<double>(values.size());
+    }
+
+    inline min_max minmax(std::span<const float> values)
+    {
+      return active().minmax(values.data(), values.size());
+    }
+
+    // predictions and targets must be the same size.
+    inline double squared_error(std::span<const float> predictions, std::span<const float> targets)
+    {
+      return active().squared_error(predictions.data(), targets.data(), predictions.size());
+    }
+
+    inline uint64_t count_correct(std::span<const float> predictions, std::span<const float> labels, float threshold = 0.5f)
+    {
+      return active().count_correct(predictions.data(), labels.data(), predictions.size(), threshold);
+    }
+  }
+}
@@ -1,12 +1,68 @@
 #include "papaya/factory/fl_factory.hpp"
 
-// #include "match_factory.hpp"
+#include "papaya/metrics/rx_metrics.hpp"
+#include "papaya/trace/tracer.hpp"
 
 namespace pa {
 
-fl_factory::fl_factory() {
-  // no-op
-}
+struct fl_factory::stages {
+  fl_factory::execution plan;
+  std::shared_ptr<metrics::histogram> execute_duration;
+  std::shared_ptr<metrics::histogram> model_update_duration;
+
+  auto run() const -> fl_factory::output {
+    fl_factory::output output;
+    if (!plan.executor) {
+      return output;
+    }
+    IExecutor::Output result;
+    {
+      metrics::scoped_timer timer(*execute_duration);
+      trace::span span("fl_factory::execute");
+      result = plan.executor->execute(plan.input);
+    }
+    auto* success = std::get_if<IExecutor::Success>(&result);
+    if (success == nullptr) {
+      throw execution_error(error_code_of(result));
+    }
+    if (!success->trainedModel.empty()) {
+      metrics::scoped_timer timer(*model_update_duration);
+      trace::span span("fl_factory::model_update");
+      output.model_update = codec::encode_delta(codec::weights_of(plan.input.modelGraphBytes()),
+                                                codec::weights_of(success->trainedModel),
+                                                plan.model_update,
+                                                &output.model_update_stats);
+    }
+    return output;
+  }
+};
+
+fl_factory::fl_factory(std::shared_ptr<metrics::registry> metrics,
+                       std::shared_ptr<pa::match_factory> match_factory,
+                       stage_hook hook,
+                       execution execution)
+    : metrics_(std::move(metrics)),
+      match_factory_(std::move(match_factory)),
+      hook_(std::move(hook)),
+      session_duration_(metrics_->make_histogram(
+          "fl_factory_stage_duration_nanoseconds",
+          "Time from subscribing to a fl_factory stage until it terminates.",
+          "stage=\"session\"")),
+      match_duration_(metrics_->make_histogram(
+          "fl_factory_stage_duration_nanoseconds",
+          "Time from subscribing to a fl_factory stage until it terminates.",
+          "stage=\"match\"")),
+      stages_(std::make_shared<const stages>(stages{
+          std::move(execution),
+          metrics_->make_histogram(
+              "fl_factory_stage_duration_nanoseconds",
+              "Time from subscribing to a fl_factory stage until it terminates.",
+              "stage=\"execute\""),
+          metrics_->make_histogram(
+              "fl_factory_stage_duration_nanoseconds",
+              "Time from subscribing to a fl_factory stage until it terminates.",
+              "stage=\"model_update\"")})) {}
+
 auto fl_factory::create(fl_factory::input& input) -> rxcpp::observable<fl_factory::output> {
   // TODO:
   //  match_factory_.create(match_input)
@@ -14,7 +70,26 @@ auto fl_factory::create(fl_factory::input& input) -> rxcpp::observable<fl_factor
   //    | flat_map([](auto match_output) { return checkin_factory_.create(to_checkin_input(match_output)); })
   //    | flat_map([](auto checkin_output) { return download::proceed(to_download_input(checkin_output)); })
   //    ...etc
-  return rxcpp::observable<>::just(fl_factory::output {});
+  // Each stage should be wrapped by metrics::timed() with its own stage label.
+  auto session = metrics::timed(match_factory_->create(match::input{input.restrictions}), match_duration_)
+                     .map([stages = stages_](match::output) { return stages->run(); });
+  return metrics::timed(session, session_duration_);
 }
 
-}
\ No newline at end of file
+auto fl_factory::co_create(fl_factory::input input, concurrent::scheduler& scheduler) -> coro::task<fl_factory::output> {
+  co_await coro::resume_on(scheduler);
+  metrics::scoped_timer session_timer(*session_duration_);
+  trace::span session_span("fl_factory::session");
+  if (hook_) {
+    co_await hook_("session");
+  }
+  {
+    metrics::scoped_timer match_timer(*match_duration_);
+    co_await match_factory_->co_create(match::input{std::move(input.restrictions)});
+  }
+  // TODO: Follow create() as stages are added, e.g.
+  //  auto checkin_output = co_await checkin_factory_.co_create(to_checkin_input(match_output));
+  co_return stages_->run();
+}
+
+}
@@ -1,21 +1,85 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <rxcpp/rx.hpp>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "papaya/codec/delta.hpp"
+#include "papaya/concurrent/scheduler.hpp"
+#include "papaya/coro/task.hpp"
+#include "papaya/executor/executor.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/factory/stage_hook.hpp"
+#include "papaya/metrics/metrics.hpp"
 
 namespace pa
 {
+  // Fails a session whose executor returned an IExecutor::Failure.
+  class execution_error : public std::runtime_error
+  {
+  public:
+    explicit execution_error(int32_t error_code)
+        : std::runtime_error("execution failed with error code " + std::to_string(error_code)),
+          error_code_(error_code) {}
+
+    int32_t error_code() const { return error_code_; }
+
+  private:
+    int32_t error_code_;
+  };
+
   class fl_factory final
   {
   public:
     struct input
     {
+      // The run's restrictions, handed on to the match stage.
+      std::set<restriction> restrictions;
     };
     struct output
     {
+      // The trained model as a codec::delta_encoder payload against the
+      // model the session started from, or empty when nothing trained.
+      std::string model_update;
+      codec::delta_stats model_update_stats;
+    };
+
+    // What a session runs after matching. Until a download stage fetches
+    // the plan and model of each session, every session executes input.
+    struct execution
+    {
+      // Without one, sessions end after matching.
+      std::shared_ptr<IExecutor> executor;
+      IExecutor::Input input;
+      codec::delta_options model_update;
     };
 
   public:
-    explicit fl_factory();
+    explicit fl_factory(
+        std::shared_ptr<metrics::registry> metrics = std::make_shared<metrics::registry>(),
+        std::shared_ptr<match_factory> match_factory = std::make_shared<pa::match_factory>(),
+        stage_hook hook = nullptr,
+        execution execution = {});
     auto create(fl_factory::input &input) -> rxcpp::observable<fl_factory::output>;
+    // Coroutine flavor of create(). The session resumes on scheduler, which
+    // must outlive the returned task.
+    auto co_create(fl_factory::input input, concurrent::scheduler &scheduler) -> coro::task<fl_factory::output>;
+
+  private:
+    // The execute stage, then the model update stage: the trained model the
+    // executor returned is encoded as a delta against execution.input's
+    // model. Throws execution_error for an IExecutor::Failure.
+    struct stages;
+
+    std::shared_ptr<metrics::registry> metrics_;
+    std::shared_ptr<pa::match_factory> match_factory_;
+    stage_hook hook_;
+    std::shared_ptr<metrics::histogram> session_duration_;
+    std::shared_ptr<metrics::histogram> match_duration_;
+    // Shared with the rx chains, which may outlive this.
+    std::shared_ptr<const stages> stages_;
   };
-}
\ No newline at end of file
+}
@@ -1,15 +1,29 @@
 #include "papaya/factory/match_factory.hpp"
 
+#include "papaya/trace/rx_trace.hpp"
+#include "papaya/trace/tracer.hpp"
+
 namespace pa
 {
 
-  match_factory::match_factory() {
-    // no-op
+  match_factory::match_factory(stage_hook hook)
+      : hook_(std::move(hook))
+  {
   }
 
   auto match_factory::create(match::input input) -> rxcpp::observable<match::output>
   {
-    return rxcpp::observable<>::just(match::output{});
+    return trace::traced(rxcpp::observable<>::just(match::output{}), "match_factory::create");
+  }
+
+  auto match_factory::co_create(match::input input) -> coro::task<match::output>
+  {
+    trace::span span("match_factory::co_create");
+    if (hook_)
+    {
+      co_await hook_("match");
+    }
+    co_return match::output{};
   }
 
-}
\ No newline at end of file
+}
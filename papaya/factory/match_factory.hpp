@@ -1,13 +1,22 @@
 #pragma once
 
+#include <set>
+
 #include <rxcpp/rx.hpp>
 
+#include "papaya/coro/task.hpp"
+#include "papaya/factory/stage_hook.hpp"
+#include "papaya/restrictions.hpp"
+
 namespace pa
 {
   namespace match
   {
     struct input
     {
+      // Conditions the device must meet to be matched. Not checked yet:
+      // every session is matched.
+      std::set<restriction> restrictions;
     };
     struct output
     {
@@ -17,8 +26,12 @@ namespace pa
   class match_factory final
   {
   public:
-  public:
-    explicit match_factory();
+    explicit match_factory(stage_hook hook = nullptr);
     auto create(match::input input) -> rxcpp::observable<match::output>;
+    // Coroutine flavor of create(), for co_await match_factory.co_create(...)
+    auto co_create(match::input input) -> coro::task<match::output>;
+
+  private:
+    stage_hook hook_;
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+
+#include "papaya/coro/task.hpp"
+
+namespace pa
+{
+  // Called at the start of each stage of a coroutine session with the
+  // stage's name, e.g. by a simulation to add latency or failures. The stage
+  // waits for the returned task and fails with whatever it throws.
+  using stage_hook = std::function<coro::task<void>(std::string_view stage)>;
+}
@@ -1,6 +1,3 @@
 #pragma once
 
-namespace pa
-{
-
-}
\ No newline at end of file
+#include "papaya/io/async_reader.hpp"
@@ -0,0 +1,562 @@
+#include "papaya/io/async_reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+
+#include "papaya/concurrent/thread_pool.hpp"
+
+namespace pa
+{
+  namespace io
+  {
+    namespace detail
+    {
+      int64_t pread_once(int fd, std::span<char> into, uint64_t offset)
+      {
+        while (true)
+        {
+          auto n = ::pread(fd, into.data(), into.size(), static_cast<off_t>(offset));
+          if (n >= 0)
+          {
+            return n;
+          }
+          if (errno != EINTR)
+          {
+            return -errno;
+          }
+        }
+      }
+
+      // Closes fd when read_file() leaves, however it leaves.
+      struct fd_closer
+      {
+        int fd;
+        ~fd_closer() { ::close(fd); }
+      };
+
+      class pooled_reader final : public async_reader
+      {
+      public:
+        explicit pooled_reader(const options &options)
+            : async_reader(options), pool_(options.threads) {}
+
+        backend kind() const noexcept override { return backend::thread_pool; }
+        void submit() override {}
+
+      protected:
+        void enqueue(std::unique_ptr<request> request) override
+        {
+          pool_.schedule([request = std::move(request)]
+                         { request->done(pread_once(request->fd, request->into, request->offset)); });
+        }
+
+      private:
+        concurrent::thread_pool pool_;
+      };
+
+      // The kernel's side of the rings is read and written concurrently, so
+      // every access to a shared index goes through atomic_ref.
+      unsigned load_acquire(unsigned *p) { return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire); }
+      void store_release(unsigned *p, unsigned value) { std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release); }
+
+      int io_uring_setup(unsigned entries, io_uring_params *params)
+      {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+      }
+      int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+      {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+      }
+      int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned count)
+      {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+      }
+
+      class uring_reader final : public async_reader
+      {
+      public:
+        // Throws std::system_error when the kernel won't set up a ring.
+        explicit uring_reader(const options &options)
+            : async_reader(options)
+        {
+          io_uring_params params{};
+          ring_fd_ = io_uring_setup(options.queue_depth, &params);
+          if (ring_fd_ < 0)
+          {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+          }
+          try
+          {
+            map_rings(params);
+          }
+          catch (...)
+          {
+            unmap_rings();
+            ::close(ring_fd_);
+            throw;
+          }
+          if (options.buffer_count > 0)
+          {
+            std::vector<iovec> buffers(options.buffer_count);
+            for (size_t i = 0; i < buffers.size(); ++i)
+            {
+              buffers[i] = iovec{buffer_memory_.get() + i * options.buffer_size, options.buffer_size};
+            }
+            // Fails e.g. over RLIMIT_MEMLOCK; reads into the buffers then
+            // go through plain IORING_OP_READ.
+            fixed_buffers_ = io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                                               static_cast<unsigned>(buffers.size())) == 0;
+          }
+          reaper_ = std::thread([this]
+                                { reap(); });
+        }
+
+        ~uring_reader() override
+        {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            // Wakes the reaper in case nothing is in flight.
+            auto *sqe = next_sqe_locked();
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            publish_sqe_locked();
+            submit_locked();
+          }
+          reaper_.join();
+          unmap_rings();
+          ::close(ring_fd_);
+        }
+
+        backend kind() const noexcept override { return backend::io_uring; }
+
+        void submit() override
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          submit_locked();
+        }
+
+      protected:
+        void enqueue(std::unique_ptr<request> request) override
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          // A completion that reads again mustn't wait for itself, nor fill
+          // the rings while only it can drain them; the reaper starts its
+          // reads once it has reaped.
+          if (std::this_thread::get_id() == reaper_id_)
+          {
+            backlog_.push_back(std::move(request));
+            return;
+          }
+          room_.wait(lock, [this]
+                     { return in_flight_ < options_.queue_depth && backlog_.empty(); });
+          start_locked(std::move(request));
+          if (queued_ >= options_.submit_batch)
+          {
+            submit_locked();
+          }
+        }
+
+      private:
+        void start_locked(std::unique_ptr<request> request)
+        {
+          auto *sqe = next_sqe_locked();
+          auto fixed = fixed_buffers_ && request->buffer_index >= 0;
+          sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+          sqe->fd = request->fd;
+          sqe->addr = reinterpret_cast<uint64_t>(request->into.data());
+          sqe->len = static_cast<uint32_t>(request->into.size());
+          sqe->off = request->offset;
+          sqe->buf_index = fixed ? static_cast<uint16_t>(request->buffer_index) : 0;
+          sqe->user_data = reinterpret_cast<uint64_t>(request.release());
+          publish_sqe_locked();
+          ++in_flight_;
+        }
+
+        void map_rings(const io_uring_params &params)
+        {
+          sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+          cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+          auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+          if (single)
+          {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+          }
+          sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+          if (sq_ring_ == MAP_FAILED)
+          {
+            sq_ring_ = nullptr;
+            throw std::system_error(errno, std::generic_category(), "mmap io_uring sq ring");
+          }
+          if (single)
+          {
+            cq_ring_ = sq_ring_;
+          }
+          else
+          {
+            cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED)
+            {
+              cq_ring_ = nullptr;
+              throw std::system_error(errno, std::generic_category(), "mmap io_uring cq ring");
+            }
+          }
+          sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+          auto *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+          if (sqes == MAP_FAILED)
+          {
+            throw std::system_error(errno, std::generic_category(), "mmap io_uring sqes");
+          }
+          sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+          auto *sq = static_cast<char *>(sq_ring_);
+          sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+          sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+          sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+          sq_entries_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+          sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+          auto *cq = static_cast<char *>(cq_ring_);
+          cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+          cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+          cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+          cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        }
+
+        void unmap_rings() noexcept
+        {
+          if (sqes_ != nullptr)
+          {
+            ::munmap(sqes_, sqes_size_);
+          }
+          if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+          {
+            ::munmap(cq_ring_, cq_ring_size_);
+          }
+          if (sq_ring_ != nullptr)
+          {
+            ::munmap(sq_ring_, sq_ring_size_);
+          }
+        }
+
+        // A zeroed SQE at the tail, submitting what's queued if the ring is
+        // full. The caller must hold mutex_.
+        io_uring_sqe *next_sqe_locked()
+        {
+          auto tail = *sq_tail_;
+          while (tail - load_acquire(sq_head_) == sq_entries_)
+          {
+            submit_locked();
+            if (tail - load_acquire(sq_head_) == sq_entries_)
+            {
+              std::this_thread::yield();
+            }
+          }
+          auto *sqe = &sqes_[tail & sq_mask_];
+          std::memset(sqe, 0, sizeof(*sqe));
+          return sqe;
+        }
+
+        void publish_sqe_locked()
+        {
+          auto tail = *sq_tail_;
+          sq_array_[tail & sq_mask_] = tail & sq_mask_;
+          store_release(sq_tail_, tail + 1);
+          ++queued_;
+        }
+
+        void submit_locked()
+        {
+          while (queued_ > 0)
+          {
+            auto submitted = io_uring_enter(ring_fd_, queued_, 0, 0);
+            if (submitted < 0)
+            {
+              if (errno == EINTR)
+              {
+                continue;
+              }
+              // EAGAIN or EBUSY: the reaper retries after making room.
+              return;
+            }
+            queued_ -= static_cast<unsigned>(submitted);
+          }
+        }
+
+        void reap()
+        {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            reaper_id_ = std::this_thread::get_id();
+          }
+          while (true)
+          {
+            io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+            auto head = *cq_head_;
+            auto tail = load_acquire(cq_tail_);
+            while (head != tail)
+            {
+              auto cqe = cqes_[head & cq_mask_];
+              store_release(cq_head_, ++head);
+              if (cqe.user_data == 0)
+              {
+                continue;
+              }
+              std::unique_ptr<request> done(reinterpret_cast<request *>(cqe.user_data));
+              {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --in_flight_;
+              }
+              done->done(cqe.res);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (!backlog_.empty() && in_flight_ < options_.queue_depth)
+            {
+              start_locked(std::move(backlog_.front()));
+              backlog_.pop_front();
+            }
+            submit_locked();
+            if (in_flight_ < options_.queue_depth && backlog_.empty())
+            {
+              room_.notify_all();
+            }
+            if (stopping_ && in_flight_ == 0)
+            {
+              return;
+            }
+          }
+        }
+
+        int ring_fd_ = -1;
+        void *sq_ring_ = nullptr;
+        size_t sq_ring_size_ = 0;
+        void *cq_ring_ = nullptr;
+        size_t cq_ring_size_ = 0;
+        io_uring_sqe *sqes_ = nullptr;
+        size_t sqes_size_ = 0;
+        unsigned *sq_head_ = nullptr;
+        unsigned *sq_tail_ = nullptr;
+        unsigned *sq_array_ = nullptr;
+        unsigned sq_mask_ = 0;
+        unsigned sq_entries_ = 0;
+        unsigned *cq_head_ = nullptr;
+        unsigned *cq_tail_ = nullptr;
+        io_uring_cqe *cqes_ = nullptr;
+        unsigned cq_mask_ = 0;
+        bool fixed_buffers_ = false;
+
+        std::mutex mutex_;
+        std::condition_variable room_;
+        // SQEs published but not yet handed to the kernel.
+        unsigned queued_ = 0;
+        unsigned in_flight_ = 0;
+        // Reads issued by completions, started by the reaper as room frees.
+        std::deque<std::unique_ptr<request>> backlog_;
+        bool stopping_ = false;
+        std::thread::id reaper_id_;
+        std::thread reaper_;
+      };
+    }
+
+    buffer::buffer(buffer &&other) noexcept
+        : owner_(other.owner_), index_(other.index_), data_(other.data_)
+    {
+      other.owner_ = nullptr;
+    }
+
+    buffer::~buffer()
+    {
+      if (owner_ != nullptr)
+      {
+        owner_->release_buffer(index_);
+      }
+    }
+
+    async_reader::async_reader(const options &options)
+        : options_(options),
+          buffer_memory_(options.buffer_count > 0
+                             ? static_cast<char *>(std::aligned_alloc(4096, (options.buffer_count * options.buffer_size + 4095) / 4096 * 4096))
+                             : nullptr,
+                         &std::free)
+    {
+      if (options.buffer_count > 0 && buffer_memory_ == nullptr)
+      {
+        throw std::bad_alloc();
+      }
+      for (size_t i = options.buffer_count; i > 0; --i)
+      {
+        free_buffers_.push_back(static_cast<uint32_t>(i - 1));
+      }
+    }
+
+    async_reader::~async_reader() = default;
+
+    void async_reader::read(int fd, std::span<char> into, uint64_t offset, completion done)
+    {
+      enqueue(std::make_unique<request>(request{fd, into, offset, -1, std::move(done)}));
+    }
+
+    void async_reader::read(int fd, const io::buffer &into, uint64_t offset, completion done)
+    {
+      enqueue(std::make_unique<request>(request{fd, into.data(), offset, static_cast<int32_t>(into.index_), std::move(done)}));
+    }
+
+    std::optional<io::buffer> async_reader::acquire_buffer()
+    {
+      std::lock_guard<std::mutex> lock(buffers_mutex_);
+      if (free_buffers_.empty())
+      {
+        return std::nullopt;
+      }
+      auto index = free_buffers_.back();
+      free_buffers_.pop_back();
+      return io::buffer(*this, index, std::span<char>(buffer_memory_.get() + index * options_.buffer_size, options_.buffer_size));
+    }
+
+    void async_reader::release_buffer(uint32_t index) noexcept
+    {
+      std::lock_guard<std::mutex> lock(buffers_mutex_);
+      free_buffers_.push_back(index);
+    }
+
+    rxcpp::observable<size_t> async_reader::read_observable(int fd, std::span<char> into, uint64_t offset)
+    {
+      return rxcpp::observable<>::create<size_t>(
+          [this, fd, into, offset](rxcpp::subscriber<size_t> subscriber)
+          {
+            read(fd, into, offset, [subscriber](int64_t bytes)
+                 {
+                   if (bytes < 0)
+                   {
+                     subscriber.on_error(std::make_exception_ptr(
+                         std::system_error(static_cast<int>(-bytes), std::generic_category(), "read")));
+                     return;
+                   }
+                   subscriber.on_next(static_cast<size_t>(bytes));
+                   subscriber.on_completed(); });
+            submit();
+          });
+    }
+
+    std::unique_ptr<async_reader> make_async_reader(const async_reader::options &options)
+    {
+      if (options.use_io_uring)
+      {
+        try
+        {
+          return std::make_unique<detail::uring_reader>(options);
+        }
+        catch (const std::system_error &)
+        {
+          // ENOSYS, or EPERM under seccomp filters that block io_uring.
+        }
+      }
+      return std::make_unique<detail::pooled_reader>(options);
+    }
+
+    std::string read_file(async_reader &reader, const std::string &path, size_t chunk_size)
+    {
+      if (chunk_size == 0)
+      {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), "read " + path + " in chunks of 0 bytes");
+      }
+      auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+      {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+      }
+      detail::fd_closer closer{fd};
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        throw std::system_error(errno, std::generic_category(), "stat " + path);
+      }
+
+      struct state
+      {
+        state(async_reader &reader, int fd, size_t size)
+            : reader(reader), fd(fd), contents(size, '\0') {}
+
+        async_reader &reader;
+        int fd;
+        std::string contents;
+        std::mutex mutex{};
+        std::condition_variable finished{};
+        size_t remaining = 0;
+        int error = 0;
+
+        // Reads the rest of a chunk after a short read.
+        void read(size_t offset, size_t length)
+        {
+          reader.read(fd, std::span<char>(contents.data() + offset, length), offset, [this, offset, length](int64_t bytes)
+                      {
+                        if (bytes > 0 && static_cast<size_t>(bytes) < length)
+                        {
+                          read(offset + bytes, length - bytes);
+                          reader.submit();
+                          return;
+                        }
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (bytes <= 0 && error == 0)
+                        {
+                          // 0 means the file shrank under us.
+                          error = bytes < 0 ? static_cast<int>(-bytes) : EIO;
+                        }
+                        if (--remaining == 0)
+                        {
+                          finished.notify_all();
+                        } });
+        }
+
+        void wait()
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          finished.wait(lock, [this]
+                        { return remaining == 0; });
+        }
+      };
+      state s(reader, fd, static_cast<size_t>(st.st_size));
+      auto size = s.contents.size();
+      s.remaining = (size + chunk_size - 1) / chunk_size;
+      for (size_t offset = 0; offset < size; offset += chunk_size)
+      {
+        try
+        {
+          s.read(offset, std::min(chunk_size, size - offset));
+        }
+        catch (...)
+        {
+          // The reads already issued still write into s and read fd.
+          {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.remaining -= (size - offset + chunk_size - 1) / chunk_size;
+          }
+          reader.submit();
+          s.wait();
+          throw;
+        }
+      }
+      reader.submit();
+      s.wait();
+      if (s.error != 0)
+      {
+        throw std::system_error(s.error, std::generic_category(), "read " + path);
+      }
+      return std::move(s.contents);
+    }
+  }
+}
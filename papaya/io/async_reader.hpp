@@ -0,0 +1,179 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <rxcpp/rx.hpp>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "papaya/util/unique_function.hpp"
+
+namespace pa
+{
+  namespace io
+  {
+    // Bytes read, 0 at end of file, or -errno. Like pread(), a read may
+    // return fewer bytes than asked for.
+    using completion = util::unique_function<void(int64_t)>;
+
+    class async_reader;
+
+    /**
+     * @brief One of an async_reader's fixed buffers. io_uring reads into it
+     * without pinning pages per request. Returns itself to the reader when
+     * destroyed.
+     */
+    class buffer final
+    {
+    public:
+      buffer(buffer &&other) noexcept;
+      buffer &operator=(buffer &&) = delete;
+      ~buffer();
+
+      std::span<char> data() const noexcept { return data_; }
+
+    private:
+      friend class async_reader;
+      buffer(async_reader &owner, uint32_t index, std::span<char> data) noexcept
+          : owner_(&owner), index_(index), data_(data) {}
+
+      async_reader *owner_;
+      uint32_t index_;
+      std::span<char> data_;
+    };
+
+    /**
+     * @brief Positional file reads that complete on a reader-owned thread,
+     * so callers can keep many reads in flight without blocking workers.
+     *
+     * read() only queues a request. Queued reads go to the kernel together
+     * on submit(), or once submit_batch of them are queued. At most
+     * queue_depth reads are in flight; read() blocks beyond that, except
+     * from a completion, whose reads wait in the reader until there's room.
+     *
+     * With io_uring, completions run one at a time on the reader's
+     * completion thread and should be short; the fallback runs them on its
+     * pool threads. Coroutines resumed by read_async() continue there until
+     * they co_await coro::resume_on() elsewhere.
+     */
+    class async_reader
+    {
+    public:
+      enum class backend
+      {
+        io_uring,
+        // pread() on a thread pool, where io_uring isn't available.
+        thread_pool
+      };
+
+      struct options
+      {
+        unsigned queue_depth = 64;
+        unsigned submit_batch = 16;
+        // Buffers handed out by acquire_buffer(), registered with io_uring.
+        size_t buffer_count = 0;
+        size_t buffer_size = size_t{1} << 20;
+        // Threads of the fallback backend.
+        size_t threads = 4;
+        // False forces the fallback, e.g. for comparisons.
+        bool use_io_uring = true;
+      };
+
+      // Backends wait for the reads in flight.
+      virtual ~async_reader();
+
+      async_reader(const async_reader &) = delete;
+      async_reader &operator=(const async_reader &) = delete;
+
+      virtual backend kind() const noexcept = 0;
+
+      // Queues a read of into.size() bytes at offset of fd. into must stay
+      // valid until done runs.
+      void read(int fd, std::span<char> into, uint64_t offset, completion done);
+      // Same, into a buffer from acquire_buffer(); the read can be shorter.
+      void read(int fd, const io::buffer &into, uint64_t offset, completion done);
+      // Hands the queued reads to the kernel.
+      virtual void submit() = 0;
+
+      // A free fixed buffer, if any is left.
+      std::optional<io::buffer> acquire_buffer();
+
+      // co_await read_async(...) reads, submitting right away, and resumes
+      // the coroutine with read()'s result on the completion thread.
+      auto read_async(int fd, std::span<char> into, uint64_t offset)
+      {
+        struct awaiter
+        {
+          async_reader &reader;
+          int fd;
+          std::span<char> into;
+          uint64_t offset;
+          int64_t result = 0;
+
+          bool await_ready() const noexcept { return false; }
+
+          void await_suspend(std::coroutine_handle<> handle)
+          {
+            // The read may finish, and the frame holding this awaiter go
+            // away, before submit() returns.
+            auto &owner = reader;
+            owner.read(fd, into, offset, [this, handle](int64_t bytes)
+                       {
+                         result = bytes;
+                         handle.resume(); });
+            owner.submit();
+          }
+
+          int64_t await_resume() const noexcept { return result; }
+        };
+        return awaiter{*this, fd, into, offset};
+      }
+
+      // Emits the bytes read and completes, or errors with std::system_error.
+      // The read starts on subscribe.
+      rxcpp::observable<size_t> read_observable(int fd, std::span<char> into, uint64_t offset);
+
+    protected:
+      struct request
+      {
+        int fd;
+        std::span<char> into;
+        uint64_t offset;
+        // Index of the fixed buffer into is, or -1.
+        int32_t buffer_index;
+        completion done;
+      };
+
+      explicit async_reader(const options &options);
+
+      // Takes the request; it's queued or started by the time this returns.
+      virtual void enqueue(std::unique_ptr<request> request) = 0;
+
+      const options options_;
+      // Backing of every buffer, buffer_size bytes each, page-aligned.
+      std::unique_ptr<char[], void (*)(void *)> buffer_memory_;
+
+    private:
+      friend class buffer;
+      void release_buffer(uint32_t index) noexcept;
+
+      std::mutex buffers_mutex_;
+      std::vector<uint32_t> free_buffers_;
+    };
+
+    // io_uring when the kernel supports it and options allow, else the
+    // thread-pool backend.
+    std::unique_ptr<async_reader> make_async_reader(const async_reader::options &options);
+    inline std::unique_ptr<async_reader> make_async_reader() { return make_async_reader(async_reader::options{}); }
+
+    // Reads all of path in chunk_size reads, up to queue_depth of them at
+    // once. Throws std::system_error on failure, or when chunk_size is 0.
+    std::string read_file(async_reader &reader, const std::string &path, size_t chunk_size = size_t{1} << 20);
+  }
+}
@@ -0,0 +1,421 @@
+#include "papaya/ipc/shm_transport.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#include "papaya/ipc/spsc_ring.hpp"
+
+namespace pa
+{
+  namespace ipc
+  {
+    namespace detail
+    {
+      constexpr char region_magic[8] = {'P', 'A', 'P', 'A', 'Y', 'A', 'S', '1'};
+      constexpr uint32_t region_version = 1;
+      constexpr size_t page_size = 4096;
+      // Heap allocations start on a cache line.
+      constexpr uint64_t heap_alignment = 64;
+
+      struct descriptor
+      {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t release_to;
+        uint32_t tag;
+      };
+
+      struct lane
+      {
+        spsc_ring<descriptor, shm_endpoint::ring_size> ring;
+        // Bumped after every push; receivers sleep on it with FUTEX_WAIT.
+        alignas(64) std::atomic<uint32_t> signal{0};
+        std::atomic<uint32_t> sleepers{0};
+        // Released by the consumer, read by the producer.
+        alignas(64) std::atomic<uint64_t> heap_tail{0};
+        uint64_t heap_offset;
+        uint64_t heap_size;
+      };
+
+      struct region_header
+      {
+        char magic[8];
+        uint32_t version;
+        uint64_t size;
+        std::atomic<int32_t> owner_pid;
+        std::atomic<int32_t> peer_pid;
+        std::atomic<uint32_t> owner_closed;
+        std::atomic<uint32_t> peer_closed;
+        // Bumped when the peer attaches, for wait_for_peer().
+        std::atomic<uint32_t> attached;
+        lane to_peer;
+        lane to_owner;
+      };
+      static_assert(std::atomic<uint32_t>::is_always_lock_free && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+      [[noreturn]] void throw_errno(const std::string &what)
+      {
+        throw std::system_error(errno, std::generic_category(), what);
+      }
+
+      uint64_t round_up(uint64_t value, uint64_t alignment)
+      {
+        return (value + alignment - 1) / alignment * alignment;
+      }
+
+      uint32_t *futex_word(std::atomic<uint32_t> &word)
+      {
+        return reinterpret_cast<uint32_t *>(&word);
+      }
+
+      // Not FUTEX_PRIVATE_FLAG: the waiter and the waker are different
+      // processes mapping the same page.
+      void futex_wait(std::atomic<uint32_t> &word, uint32_t expected, std::chrono::microseconds timeout)
+      {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        timespec ts{static_cast<time_t>(seconds.count()),
+                    static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count())};
+        ::syscall(SYS_futex, futex_word(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+      }
+
+      void futex_wake_all(std::atomic<uint32_t> &word)
+      {
+        ::syscall(SYS_futex, futex_word(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+      }
+
+      void notify(lane &lane)
+      {
+        lane.signal.fetch_add(1, std::memory_order_seq_cst);
+        if (lane.sleepers.load(std::memory_order_seq_cst) > 0)
+        {
+          futex_wake_all(lane.signal);
+        }
+      }
+
+      char *map_region(int fd, size_t size)
+      {
+        auto *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+          throw_errno("mmap shm region");
+        }
+        return static_cast<char *>(mapping);
+      }
+    }
+
+    std::unique_ptr<shm_endpoint> shm_endpoint::create(size_t heap_bytes)
+    {
+      auto heap_size = detail::round_up(std::max<size_t>(heap_bytes, detail::page_size), detail::page_size);
+      auto header_size = detail::round_up(sizeof(detail::region_header), detail::page_size);
+      auto size = header_size + 2 * heap_size;
+
+      // No MFD_CLOEXEC: the fd is meant to survive exec into the executor.
+      auto fd = static_cast<int>(::syscall(SYS_memfd_create, "papaya-shm", MFD_ALLOW_SEALING));
+      if (fd < 0)
+      {
+        detail::throw_errno("memfd_create");
+      }
+      if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+      {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "size shm region");
+      }
+      // A sandboxed peer must not be able to shrink the file under our
+      // mapping and make us SIGBUS.
+      if (::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+      {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "seal shm region");
+      }
+
+      char *mapping;
+      try
+      {
+        mapping = detail::map_region(fd, size);
+      }
+      catch (...)
+      {
+        ::close(fd);
+        throw;
+      }
+
+      auto *header = new (mapping) detail::region_header{};
+      std::memcpy(header->magic, detail::region_magic, sizeof(header->magic));
+      header->version = detail::region_version;
+      header->size = size;
+      header->to_peer.heap_offset = header_size;
+      header->to_peer.heap_size = heap_size;
+      header->to_owner.heap_offset = header_size + heap_size;
+      header->to_owner.heap_size = heap_size;
+      header->owner_pid.store(::getpid(), std::memory_order_release);
+
+      return std::unique_ptr<shm_endpoint>(new shm_endpoint(fd, mapping, size, true));
+    }
+
+    std::unique_ptr<shm_endpoint> shm_endpoint::attach(int fd)
+    {
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        detail::throw_errno("stat shm region");
+      }
+      auto size = static_cast<size_t>(st.st_size);
+      if (size < sizeof(detail::region_header))
+      {
+        throw std::runtime_error("not a papaya shm region");
+      }
+
+      // The endpoint owns its own descriptor of the region.
+      auto own_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+      if (own_fd < 0)
+      {
+        detail::throw_errno("dup shm fd");
+      }
+      char *mapping;
+      try
+      {
+        mapping = detail::map_region(own_fd, size);
+      }
+      catch (...)
+      {
+        ::close(own_fd);
+        throw;
+      }
+
+      auto fail = [&](const char *what)
+      {
+        ::munmap(mapping, size);
+        ::close(own_fd);
+        throw std::runtime_error(what);
+      };
+      auto *header = reinterpret_cast<detail::region_header *>(mapping);
+      if (std::memcmp(header->magic, detail::region_magic, sizeof(header->magic)) != 0 || header->size != size)
+      {
+        fail("not a papaya shm region");
+      }
+      if (header->version != detail::region_version)
+      {
+        fail("unsupported papaya shm region version");
+      }
+      int32_t no_peer = 0;
+      if (!header->peer_pid.compare_exchange_strong(no_peer, ::getpid(), std::memory_order_acq_rel))
+      {
+        fail("papaya shm region already has a peer");
+      }
+      header->attached.fetch_add(1, std::memory_order_seq_cst);
+      detail::futex_wake_all(header->attached);
+
+      return std::unique_ptr<shm_endpoint>(new shm_endpoint(own_fd, mapping, size, false));
+    }
+
+    shm_endpoint::shm_endpoint(int fd, char *mapping, size_t size, bool owner)
+        : fd_(fd), mapping_(mapping), size_(size), owner_(owner), header_(reinterpret_cast<detail::region_header *>(mapping))
+    {
+    }
+
+    shm_endpoint::~shm_endpoint() noexcept
+    {
+      (owner_ ? header_->owner_closed : header_->peer_closed).store(1, std::memory_order_release);
+      detail::notify(outbound());
+      if (peer_pidfd_ >= 0)
+      {
+        ::close(peer_pidfd_);
+      }
+      ::munmap(mapping_, size_);
+      ::close(fd_);
+    }
+
+    bool shm_endpoint::wait_for_peer(std::chrono::milliseconds timeout)
+    {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      while (header_->attached.load(std::memory_order_acquire) == 0)
+      {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+        {
+          return false;
+        }
+        detail::futex_wait(header_->attached, 0, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+      }
+      return true;
+    }
+
+    bool shm_endpoint::peer_alive()
+    {
+      auto &closed = owner_ ? header_->peer_closed : header_->owner_closed;
+      auto pid = (owner_ ? header_->peer_pid : header_->owner_pid).load(std::memory_order_acquire);
+      if (pid == 0 || closed.load(std::memory_order_acquire) != 0)
+      {
+        return false;
+      }
+      if (peer_pidfd_ < 0)
+      {
+        peer_pidfd_ = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+        if (peer_pidfd_ < 0)
+        {
+          // No pidfds (pre-5.3 kernel); an exited but unreaped child still
+          // counts as alive here.
+          return ::kill(pid, 0) == 0 || errno == EPERM;
+        }
+      }
+      // A pidfd turns readable once the process exited, reaped or not.
+      pollfd fd{peer_pidfd_, POLLIN, 0};
+      return ::poll(&fd, 1, 0) == 0;
+    }
+
+    detail::lane &shm_endpoint::inbound() const
+    {
+      return owner_ ? header_->to_owner : header_->to_peer;
+    }
+
+    detail::lane &shm_endpoint::outbound() const
+    {
+      return owner_ ? header_->to_peer : header_->to_owner;
+    }
+
+    char *shm_endpoint::heap_of(const detail::lane &lane) const
+    {
+      return mapping_ + lane.heap_offset;
+    }
+
+    std::span<char> shm_endpoint::reserve(size_t size)
+    {
+      auto &lane = outbound();
+      auto capacity = lane.heap_size;
+      auto need = detail::round_up(std::max<uint64_t>(size, 1), detail::heap_alignment);
+      if (need > capacity || lane.ring.is_full())
+      {
+        return {};
+      }
+
+      // Payloads are contiguous: skip the heap's end if it doesn't fit there.
+      auto head = send_head_;
+      auto offset = head % capacity;
+      if (offset + need > capacity)
+      {
+        head += capacity - offset;
+        offset = 0;
+      }
+      if (head + need - lane.heap_tail.load(std::memory_order_acquire) > capacity)
+      {
+        return {};
+      }
+      reserved_ = reservation{offset, size, head + need};
+      return {heap_of(lane) + offset, size};
+    }
+
+    void shm_endpoint::commit(uint32_t tag)
+    {
+      auto &lane = outbound();
+      // reserve() checked the ring has room, and only we push.
+      lane.ring.push(detail::descriptor{reserved_->offset, reserved_->size, reserved_->end, tag});
+      send_head_ = reserved_->end;
+      reserved_.reset();
+      detail::notify(lane);
+    }
+
+    bool shm_endpoint::try_send(std::span<const char> payload, uint32_t tag)
+    {
+      auto buffer = reserve(payload.size());
+      if (buffer.data() == nullptr)
+      {
+        return false;
+      }
+      if (!payload.empty())
+      {
+        std::memcpy(buffer.data(), payload.data(), payload.size());
+      }
+      commit(tag);
+      return true;
+    }
+
+    std::optional<message> shm_endpoint::try_receive()
+    {
+      auto &lane = inbound();
+      detail::descriptor descriptor;
+      if (!lane.ring.pop(descriptor))
+      {
+        return std::nullopt;
+      }
+      // Don't trust the peer with our address space.
+      if (descriptor.offset > lane.heap_size || descriptor.size > lane.heap_size - descriptor.offset)
+      {
+        throw std::runtime_error("papaya shm descriptor out of bounds");
+      }
+      return message{descriptor.tag, {heap_of(lane) + descriptor.offset, descriptor.size}, descriptor.release_to};
+    }
+
+    std::optional<message> shm_endpoint::receive(std::chrono::microseconds timeout)
+    {
+      auto &lane = inbound();
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+
+      // Most replies come within microseconds; a futex round trip costs more.
+      for (int i = 0; i < 256; ++i)
+      {
+        if (auto message = try_receive())
+        {
+          return message;
+        }
+        std::this_thread::yield();
+      }
+
+      while (true)
+      {
+        lane.sleepers.fetch_add(1, std::memory_order_seq_cst);
+        auto signal = lane.signal.load(std::memory_order_seq_cst);
+        auto message = try_receive();
+        if (!message)
+        {
+          auto now = std::chrono::steady_clock::now();
+          if (now < deadline)
+          {
+            // Wake up now and then to notice a peer that died without
+            // closing its end.
+            auto slice = std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(10));
+            detail::futex_wait(lane.signal, signal, std::chrono::duration_cast<std::chrono::microseconds>(slice));
+          }
+        }
+        lane.sleepers.fetch_sub(1, std::memory_order_seq_cst);
+
+        if (message || (message = try_receive()))
+        {
+          return message;
+        }
+        if (!peer_alive())
+        {
+          throw peer_lost_error();
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+          return std::nullopt;
+        }
+      }
+    }
+
+    void shm_endpoint::release(const message &message)
+    {
+      if (message.release_to > released_to_)
+      {
+        released_to_ = message.release_to;
+        inbound().heap_tail.store(released_to_, std::memory_order_release);
+      }
+    }
+  }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <sys/types.h>
+
+#include "papaya/codec/codec.hpp"
+
+namespace pa
+{
+  namespace ipc
+  {
+    namespace detail
+    {
+      struct region_header;
+      struct lane;
+    }
+
+    class peer_lost_error final : public std::runtime_error
+    {
+    public:
+      peer_lost_error() : std::runtime_error("the shm peer process went away") {}
+    };
+
+    /**
+     * @brief A message in the receiving endpoint's inbound heap. payload
+     * stays valid until the message (or a later one) is released.
+     */
+    struct message
+    {
+      uint32_t tag;
+      std::span<const char> payload;
+      // Where the heap's free space starts once this message is released.
+      uint64_t release_to;
+    };
+
+    /**
+     * @brief One end of a shared-memory channel between papaya and an
+     * out-of-process executor on the same host.
+     *
+     * A memfd region holds, per direction, an spsc_ring of descriptors and a
+     * payload heap. Senders write payloads into the heap once (encode straight
+     * into reserve()d space) and push a descriptor with its offset; receivers
+     * read the payload in place. Heap space is handed out and released in
+     * FIFO order, as messages are consumed in order.
+     *
+     * The owner creates the region and hands fd() to the child (inherited
+     * across fork/exec, e.g. as an argv number), which attach()es to it. Each
+     * side publishes its pid; peer_alive() watches the other pid with a pidfd,
+     * so this only works between processes of the same pid namespace.
+     * Payloads are codec-encoded without a version, so both processes must
+     * be built from the same tree.
+     *
+     * Each endpoint must be used by one thread at a time.
+     */
+    class shm_endpoint final
+    {
+    public:
+      // Descriptors in flight per direction.
+      static constexpr size_t ring_size = 256;
+
+      // Creates a region with heap_bytes of payload space per direction.
+      // Throws std::system_error when it can't be created or mapped.
+      static std::unique_ptr<shm_endpoint> create(size_t heap_bytes);
+      // Attaches to a region created by another process, whose fd was
+      // inherited. Throws std::system_error when fd can't be mapped and
+      // std::runtime_error when it isn't a fresh papaya region.
+      static std::unique_ptr<shm_endpoint> attach(int fd);
+
+      // Marks this side closed and wakes a peer waiting on it.
+      ~shm_endpoint() noexcept;
+
+      shm_endpoint(const shm_endpoint &) = delete;
+      shm_endpoint &operator=(const shm_endpoint &) = delete;
+
+      // The memfd, to be passed to the peer process.
+      int fd() const { return fd_; }
+      bool is_owner() const { return owner_; }
+
+      // Owner side: waits until a peer attached. false on timeout.
+      bool wait_for_peer(std::chrono::milliseconds timeout);
+      // Whether the peer attached and neither closed its end nor exited.
+      bool peer_alive();
+
+      /**
+       * @brief Reserves size bytes in the outbound heap for the caller to fill
+       * before commit(). Only one reservation may be outstanding.
+       *
+       * @return An empty span when the heap or the ring is full for now.
+       */
+      std::span<char> reserve(size_t size);
+      // Publishes the reserved payload under tag.
+      void commit(uint32_t tag);
+      // reserve(), copy, commit(). false when full for now.
+      bool try_send(std::span<const char> payload, uint32_t tag);
+
+      // Encodes value straight into the shared heap.
+      template <typename T>
+      bool try_send_encoded(const T &value, uint32_t tag)
+      {
+        auto buffer = reserve(codec::encoded_size(value));
+        if (buffer.data() == nullptr)
+        {
+          return false;
+        }
+        codec::encode(value, buffer);
+        commit(tag);
+        return true;
+      }
+
+      std::optional<message> try_receive();
+      /**
+       * @brief Waits up to timeout for a message, sleeping on a futex in the
+       * shared region once spinning didn't help.
+       *
+       * Throws peer_lost_error when the peer goes away with nothing queued.
+       */
+      std::optional<message> receive(std::chrono::microseconds timeout);
+      // Hands the heap space of message, and of all before it, back to the
+      // sender.
+      void release(const message &message);
+
+    private:
+      shm_endpoint(int fd, char *mapping, size_t size, bool owner);
+
+      detail::lane &inbound() const;
+      detail::lane &outbound() const;
+      char *heap_of(const detail::lane &lane) const;
+
+      const int fd_;
+      char *const mapping_;
+      const size_t size_;
+      const bool owner_;
+      detail::region_header *const header_;
+
+      // Producer-private end of the outbound heap's used space.
+      uint64_t send_head_ = 0;
+      struct reservation
+      {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t end;
+      };
+      std::optional<reservation> reserved_;
+
+      // Consumer-private start of the inbound heap's used space.
+      uint64_t released_to_ = 0;
+
+      int peer_pidfd_ = -1;
+    };
+
+    template <typename T>
+    std::optional<codec::view_t<T>> decode(const message &message)
+    {
+      return codec::decode<T>(message.payload);
+    }
+  }
+}
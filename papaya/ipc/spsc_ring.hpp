@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace pa
+{
+  namespace ipc
+  {
+    /**
+     * @brief Single-producer single-consumer ring that works across processes
+     * when placed in shared memory.
+     *
+     * The single-producer cut of concurrent::ConcurrentFixedSizeQueue: the
+     * same monotonic read and write positions on their own cache lines, but
+     * each is only ever written by one side, so there's no CAS and no per-slot
+     * sequence number. It has no pointers and only address-free atomics, so
+     * two processes can map it at different addresses.
+     *
+     * @tparam T Trivially copyable type (guard by std::is_trivially_copyable).
+     * @tparam size fixed size of the ring buffer under the hood.
+     */
+    template <typename T, size_t size>
+    class spsc_ring final
+    {
+      static_assert(std::is_trivially_copyable<T>::value);
+      static_assert(size > 0);
+      static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring must not need a process-local lock");
+
+    public:
+      using value_type = T;
+      static constexpr size_t capacity = size;
+
+      // Only called by the producer.
+      bool push(const T &newElement)
+      {
+        auto write_pos = write_pos_.load(std::memory_order_relaxed);
+        if (write_pos - read_pos_.load(std::memory_order_acquire) >= size)
+        {
+          return false;
+        }
+        ring_buffer_[write_pos % size] = newElement;
+        write_pos_.store(write_pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      // Only called by the consumer.
+      bool pop(T &returnedElement)
+      {
+        auto read_pos = read_pos_.load(std::memory_order_relaxed);
+        if (read_pos == write_pos_.load(std::memory_order_acquire))
+        {
+          return false;
+        }
+        returnedElement = ring_buffer_[read_pos % size];
+        read_pos_.store(read_pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      // Only meaningful to the producer, which is the only one filling it.
+      bool is_full() const
+      {
+        return write_pos_.load(std::memory_order_relaxed) - read_pos_.load(std::memory_order_acquire) >= size;
+      }
+
+      bool is_empty() const
+      {
+        return read_pos_.load(std::memory_order_acquire) == write_pos_.load(std::memory_order_acquire);
+      }
+
+    private:
+      alignas(64) std::atomic<uint64_t> read_pos_{0};
+      alignas(64) std::atomic<uint64_t> write_pos_{0};
+      alignas(64) std::array<T, size> ring_buffer_;
+    };
+  }
+}
@@ -0,0 +1,355 @@
+#include "papaya/metrics/metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace pa
+{
+  namespace metrics
+  {
+    namespace detail
+    {
+      size_t this_thread_shard() noexcept
+      {
+        static std::atomic<size_t> next_shard{0};
+        thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+        return shard;
+      }
+
+      void write_json_string(std::ostream &out, const std::string &s)
+      {
+        out << '"';
+        for (auto c : s)
+        {
+          switch (c)
+          {
+          case '"':
+            out << "\\\"";
+            break;
+          case '\\':
+            out << "\\\\";
+            break;
+          case '\n':
+            out << "\\n";
+            break;
+          default:
+            out << c;
+          }
+        }
+        out << '"';
+      }
+
+      // Prometheus wants `name{labels}`, or just `name` without labels.
+      void write_series(std::ostream &out, const std::string &name, const std::string &labels,
+                        const std::string &extra_label = {})
+      {
+        out << name;
+        if (labels.empty() && extra_label.empty())
+        {
+          return;
+        }
+        out << '{' << labels;
+        if (!labels.empty() && !extra_label.empty())
+        {
+          out << ',';
+        }
+        out << extra_label << '}';
+      }
+
+      template <typename E>
+      void write_header(std::ostream &out, const E &entry, const char *type, const std::string &last_name)
+      {
+        // Series with different labels share one HELP/TYPE block.
+        if (entry.name == last_name)
+        {
+          return;
+        }
+        if (!entry.help.empty())
+        {
+          out << "# HELP " << entry.name << ' ' << entry.help << '\n';
+        }
+        out << "# TYPE " << entry.name << ' ' << type << '\n';
+      }
+    }
+
+    uint64_t counter::value() const noexcept
+    {
+      uint64_t total = 0;
+      for (const auto &shard : shards_)
+      {
+        total += shard.value.load(std::memory_order_relaxed);
+      }
+      return total;
+    }
+
+    size_t histogram::bucket_of(uint64_t value) noexcept
+    {
+      constexpr uint64_t linear_limit = uint64_t{1} << sub_bucket_bits;
+      constexpr uint64_t half = linear_limit / 2;
+      value = std::min(value, max_value);
+      if (value < linear_limit)
+      {
+        return static_cast<size_t>(value);
+      }
+      auto msb = 63u - static_cast<uint32_t>(__builtin_clzll(value));
+      auto shift = msb - (sub_bucket_bits - 1);
+      auto top = value >> shift;
+      return static_cast<size_t>(linear_limit + (shift - 1) * half + (top - half));
+    }
+
+    uint64_t histogram::bucket_upper_bound(size_t bucket) noexcept
+    {
+      constexpr size_t linear_limit = size_t{1} << sub_bucket_bits;
+      constexpr size_t half = linear_limit / 2;
+      if (bucket < linear_limit)
+      {
+        return bucket;
+      }
+      auto shift = (bucket - linear_limit) / half + 1;
+      auto top = static_cast<uint64_t>((bucket - linear_limit) % half + half);
+      return ((top + 1) << shift) - 1;
+    }
+
+    void histogram::record(uint64_t value) noexcept
+    {
+      auto &shard = shards_[detail::this_thread_shard() % detail::histogram_shard_count];
+      shard.buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+      shard.count.fetch_add(1, std::memory_order_relaxed);
+      shard.sum.fetch_add(value, std::memory_order_relaxed);
+
+      auto min = shard.min.load(std::memory_order_relaxed);
+      while (value < min && !shard.min.compare_exchange_weak(min, value, std::memory_order_relaxed))
+      {
+      }
+      auto max = shard.max.load(std::memory_order_relaxed);
+      while (value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    histogram_snapshot histogram::snapshot() const
+    {
+      histogram_snapshot result;
+      result.buckets.assign(bucket_count, 0);
+      result.min = UINT64_MAX;
+      for (const auto &shard : shards_)
+      {
+        result.count += shard.count.load(std::memory_order_relaxed);
+        result.sum += shard.sum.load(std::memory_order_relaxed);
+        result.min = std::min(result.min, shard.min.load(std::memory_order_relaxed));
+        result.max = std::max(result.max, shard.max.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < bucket_count; ++i)
+        {
+          result.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+      }
+      if (result.count == 0)
+      {
+        result.min = 0;
+      }
+      return result;
+    }
+
+    double histogram_snapshot::mean() const noexcept
+    {
+      return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+    }
+
+    uint64_t histogram_snapshot::percentile(double q) const noexcept
+    {
+      if (count == 0)
+      {
+        return 0;
+      }
+      q = std::clamp(q, 0.0, 1.0);
+      // Rank of the q-quantile, 1-based so q = 0 means the first value.
+      auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(count) + 0.5));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < buckets.size(); ++i)
+      {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+          return std::min(histogram::bucket_upper_bound(i), max);
+        }
+      }
+      return max;
+    }
+
+    void snapshot::write_prometheus(std::ostream &out) const
+    {
+      std::string last_name;
+      for (const auto &c : counters)
+      {
+        detail::write_header(out, c, "counter", last_name);
+        detail::write_series(out, c.name, c.labels);
+        out << ' ' << c.value << '\n';
+        last_name = c.name;
+      }
+      last_name.clear();
+      for (const auto &g : gauges)
+      {
+        detail::write_header(out, g, "gauge", last_name);
+        detail::write_series(out, g.name, g.labels);
+        out << ' ' << g.value << '\n';
+        last_name = g.name;
+      }
+      last_name.clear();
+      for (const auto &h : histograms)
+      {
+        detail::write_header(out, h, "histogram", last_name);
+        // Only the non-empty buckets are written; Prometheus buckets are
+        // cumulative so the skipped ones are implied.
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < h.value.buckets.size(); ++i)
+        {
+          if (h.value.buckets[i] == 0)
+          {
+            continue;
+          }
+          cumulative += h.value.buckets[i];
+          detail::write_series(out, h.name + "_bucket", h.labels,
+                               "le=\"" + std::to_string(histogram::bucket_upper_bound(i)) + "\"");
+          out << ' ' << cumulative << '\n';
+        }
+        detail::write_series(out, h.name + "_bucket", h.labels, "le=\"+Inf\"");
+        out << ' ' << h.value.count << '\n';
+        detail::write_series(out, h.name + "_sum", h.labels);
+        out << ' ' << h.value.sum << '\n';
+        detail::write_series(out, h.name + "_count", h.labels);
+        out << ' ' << h.value.count << '\n';
+        last_name = h.name;
+      }
+    }
+
+    void snapshot::write_json(std::ostream &out) const
+    {
+      auto write_key = [&out](const auto &entry)
+      {
+        out << "{\"name\":";
+        detail::write_json_string(out, entry.name);
+        out << ",\"labels\":";
+        detail::write_json_string(out, entry.labels);
+      };
+
+      out << "{\"counters\":[";
+      for (size_t i = 0; i < counters.size(); ++i)
+      {
+        out << (i == 0 ? "" : ",");
+        write_key(counters[i]);
+        out << ",\"value\":" << counters[i].value << '}';
+      }
+      out << "],\"gauges\":[";
+      for (size_t i = 0; i < gauges.size(); ++i)
+      {
+        out << (i == 0 ? "" : ",");
+        write_key(gauges[i]);
+        out << ",\"value\":" << gauges[i].value << '}';
+      }
+      out << "],\"histograms\":[";
+      for (size_t i = 0; i < histograms.size(); ++i)
+      {
+        const auto &h = histograms[i].value;
+        out << (i == 0 ? "" : ",");
+        write_key(histograms[i]);
+        out << ",\"count\":" << h.count
+            << ",\"sum\":" << h.sum
+            << ",\"min\":" << h.min
+            << ",\"max\":" << h.max
+            << ",\"mean\":" << h.mean()
+            << ",\"p50\":" << h.percentile(0.5)
+            << ",\"p90\":" << h.percentile(0.9)
+            << ",\"p99\":" << h.percentile(0.99)
+            << ",\"p999\":" << h.percentile(0.999) << '}';
+      }
+      out << "]}\n";
+    }
+
+    bool snapshot::export_to(const std::string &path, export_format format) const
+    {
+      auto tmp_path = path + ".tmp";
+      {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out)
+        {
+          return false;
+        }
+        switch (format)
+        {
+        case export_format::prometheus:
+          write_prometheus(out);
+          break;
+        case export_format::json:
+          write_json(out);
+          break;
+        }
+        if (!out.flush())
+        {
+          return false;
+        }
+      }
+      return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    template <typename M>
+    std::shared_ptr<M> registry::find_or_make(
+        std::vector<named<M>> &all, const std::string &name, const std::string &help, const std::string &labels)
+    {
+      auto it = std::find_if(all.begin(), all.end(), [&](const auto &n)
+                             { return n.name == name && n.labels == labels; });
+      if (it != all.end())
+      {
+        return it->metric;
+      }
+      // Keep series of the same name together so the exporters can write a
+      // single HELP/TYPE block for them.
+      auto last_of_name = std::find_if(all.rbegin(), all.rend(), [&](const auto &n)
+                                       { return n.name == name; });
+      auto position = last_of_name == all.rend() ? all.end() : last_of_name.base();
+      auto metric = std::make_shared<M>();
+      all.insert(position, named<M>{name, labels, help, metric});
+      return metric;
+    }
+
+    std::shared_ptr<counter> registry::make_counter(
+        const std::string &name, const std::string &help, const std::string &labels)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return find_or_make(counters_, name, help, labels);
+    }
+
+    std::shared_ptr<gauge> registry::make_gauge(
+        const std::string &name, const std::string &help, const std::string &labels)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return find_or_make(gauges_, name, help, labels);
+    }
+
+    std::shared_ptr<histogram> registry::make_histogram(
+        const std::string &name, const std::string &help, const std::string &labels)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return find_or_make(histograms_, name, help, labels);
+    }
+
+    metrics::snapshot registry::snapshot() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      metrics::snapshot result;
+      for (const auto &c : counters_)
+      {
+        result.counters.push_back({c.name, c.labels, c.help, c.metric->value()});
+      }
+      for (const auto &g : gauges_)
+      {
+        result.gauges.push_back({g.name, g.labels, g.help, g.metric->value()});
+      }
+      for (const auto &h : histograms_)
+      {
+        result.histograms.push_back({h.name, h.labels, h.help, h.metric->snapshot()});
+      }
+      return result;
+    }
+  }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace pa
+{
+  namespace metrics
+  {
+    namespace detail
+    {
+      // Number of shards a counter is spread over. Threads are assigned to a
+      // shard round-robin on their first record, so up to this many threads
+      // never share a cache line.
+      constexpr size_t counter_shard_count = 16;
+      // Histograms are much bigger than counters, so they use fewer shards.
+      constexpr size_t histogram_shard_count = 8;
+
+      // The shard of the calling thread. It's a thread_local index assigned
+      // once, so the recording path takes no lock and does no allocation.
+      size_t this_thread_shard() noexcept;
+    }
+
+    // Monotonic counter sharded per thread and merged on read.
+    class counter final
+    {
+    public:
+      void increment(uint64_t n = 1) noexcept
+      {
+        auto &shard = shards_[detail::this_thread_shard() % detail::counter_shard_count];
+        shard.value.fetch_add(n, std::memory_order_relaxed);
+      }
+
+      uint64_t value() const noexcept;
+
+    private:
+      struct alignas(64) shard
+      {
+        std::atomic<uint64_t> value{0};
+      };
+      std::array<shard, detail::counter_shard_count> shards_;
+    };
+
+    // Point-in-time value, e.g. a queue depth. Gauges are written with set()
+    // so they can't be sharded; they're a single atomic instead.
+    class gauge final
+    {
+    public:
+      void set(int64_t value) noexcept { value_.store(value, std::memory_order_relaxed); }
+      void add(int64_t delta) noexcept { value_.fetch_add(delta, std::memory_order_relaxed); }
+      int64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+    private:
+      std::atomic<int64_t> value_{0};
+    };
+
+    struct histogram_snapshot
+    {
+      uint64_t count = 0;
+      uint64_t sum = 0;
+      uint64_t min = 0;
+      uint64_t max = 0;
+      // Non-cumulative counts indexed like histogram buckets.
+      std::vector<uint64_t> buckets;
+
+      double mean() const noexcept;
+      // The highest value equivalent to the q-quantile, 0 <= q <= 1.
+      uint64_t percentile(double q) const noexcept;
+    };
+
+    // HDR-style log-linear histogram of non-negative integers (usually
+    // nanoseconds). Each power of two is split into sub-buckets so the relative
+    // error stays below 1 / 2^(sub_bucket_bits - 1). Values above max_value are
+    // clamped into the last bucket.
+    class histogram final
+    {
+    public:
+      static constexpr uint32_t sub_bucket_bits = 5;
+      static constexpr uint32_t max_value_bits = 40;
+      static constexpr uint64_t max_value = (uint64_t{1} << max_value_bits) - 1;
+      static constexpr size_t bucket_count =
+          (size_t{1} << sub_bucket_bits) +
+          (max_value_bits - sub_bucket_bits) * (size_t{1} << (sub_bucket_bits - 1));
+
+      static size_t bucket_of(uint64_t value) noexcept;
+      // The highest value that lands in the given bucket.
+      static uint64_t bucket_upper_bound(size_t bucket) noexcept;
+
+      void record(uint64_t value) noexcept;
+      void record_since(std::chrono::steady_clock::time_point start) noexcept
+      {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+      }
+
+      histogram_snapshot snapshot() const;
+
+    private:
+      struct alignas(64) shard
+      {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> min{UINT64_MAX};
+        std::atomic<uint64_t> max{0};
+        std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+      };
+      std::array<shard, detail::histogram_shard_count> shards_;
+    };
+
+    // Records the time elapsed between construction and destruction.
+    class scoped_timer final
+    {
+    public:
+      explicit scoped_timer(histogram &histogram) noexcept
+          : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+      ~scoped_timer() { histogram_.record_since(start_); }
+
+      scoped_timer(const scoped_timer &) = delete;
+      scoped_timer &operator=(const scoped_timer &) = delete;
+
+    private:
+      histogram &histogram_;
+      std::chrono::steady_clock::time_point start_;
+    };
+
+    enum class export_format
+    {
+      prometheus,
+      json
+    };
+
+    // A merged, immutable copy of every metric in a registry.
+    struct snapshot
+    {
+      template <typename V>
+      struct entry
+      {
+        std::string name;
+        // Prometheus label set without braces, e.g. stage="match".
+        std::string labels;
+        std::string help;
+        V value;
+      };
+
+      std::vector<entry<uint64_t>> counters;
+      std::vector<entry<int64_t>> gauges;
+      std::vector<entry<histogram_snapshot>> histograms;
+
+      void write_prometheus(std::ostream &out) const;
+      void write_json(std::ostream &out) const;
+      // Writes to a temporary file next to path and renames it over path, so
+      // a scraper never reads a half-written file. Returns false on I/O error.
+      bool export_to(const std::string &path, export_format format) const;
+    };
+
+    // Owns the metrics of a papaya instance and the factories it uses.
+    // Creating a metric allocates and takes a lock; recording into it doesn't.
+    // Asking twice for the same name and labels returns the same metric.
+    class registry final
+    {
+    public:
+      std::shared_ptr<counter> make_counter(
+          const std::string &name, const std::string &help = {}, const std::string &labels = {});
+      std::shared_ptr<gauge> make_gauge(
+          const std::string &name, const std::string &help = {}, const std::string &labels = {});
+      std::shared_ptr<histogram> make_histogram(
+          const std::string &name, const std::string &help = {}, const std::string &labels = {});
+
+      metrics::snapshot snapshot() const;
+
+    private:
+      template <typename M>
+      struct named
+      {
+        std::string name;
+        std::string labels;
+        std::string help;
+        std::shared_ptr<M> metric;
+      };
+
+      template <typename M>
+      static std::shared_ptr<M> find_or_make(
+          std::vector<named<M>> &all, const std::string &name, const std::string &help, const std::string &labels);
+
+      mutable std::mutex mutex_;
+      std::vector<named<counter>> counters_;
+      std::vector<named<gauge>> gauges_;
+      std::vector<named<histogram>> histograms_;
+    };
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <rxcpp/rx.hpp>
+
+#include "papaya/metrics/metrics.hpp"
+
+namespace pa
+{
+  namespace metrics
+  {
+    // Records how long each subscription to source takes to terminate, i.e.
+    // the duration of one pipeline stage. The clock starts on subscribe.
+    template <typename T, typename SourceOperator>
+    auto timed(rxcpp::observable<T, SourceOperator> source, std::shared_ptr<histogram> duration)
+        -> rxcpp::observable<T>
+    {
+      return rxcpp::observable<>::defer([source, duration]()
+                                        {
+        auto start = std::chrono::steady_clock::now();
+        return source.finally([start, duration]()
+                              { duration->record_since(start); }); })
+          .as_dynamic();
+    }
+  }
+}
@@ -1,24 +1,138 @@
 #include "papaya.hpp"
 
+#include <algorithm>
 #include <rxcpp/rx.hpp>
 
+#include "papaya/util/match.hpp"
+
 namespace pa
 {
 
   namespace detail
   {
-    // rxcpp::observable<>
+    template <typename Fn, typename... Args>
+    void invoke_timed(metrics::histogram &duration, Fn &fn, Args &&...args)
+    {
+      if (!fn)
+      {
+        return;
+      }
+      metrics::scoped_timer timer(duration);
+      fn(std::forward<Args>(args)...);
+    }
+
+    papaya::output to_output(const fl_factory::output &session_output)
+    {
+      papaya::output output{"fl", {}};
+      const auto &update = session_output.model_update_stats;
+      if (!session_output.model_update.empty())
+      {
+        output.metrics.emplace("model_update_bytes", static_cast<float>(update.encoded_bytes));
+        output.metrics.emplace("model_update_compression_ratio", static_cast<float>(update.compression_ratio()));
+        output.metrics.emplace("model_update_encode_bytes_per_second", static_cast<float>(update.bytes_per_second()));
+      }
+      return output;
+    }
   }
 
   papaya::papaya(
     size_t pending_request_size,
-    std::shared_ptr<pa::fl_factory> fl_factory) 
+    std::shared_ptr<pa::fl_factory> fl_factory,
+    options options,
+    std::shared_ptr<metrics::registry> metrics,
+    std::shared_ptr<concurrent::scheduler> scheduler)
     : pending_request_size_(pending_request_size),
-      fl_factory_(fl_factory) {}
+      fl_factory_(fl_factory),
+      options_(options),
+      scheduler_(scheduler),
+      pending_(options.starvation_limit),
+      metrics_(metrics),
+      runs_admitted_(metrics->make_counter(
+          "papaya_runs_admitted_total", "Runs accepted by papaya::run().")),
+      runs_rejected_(metrics->make_counter(
+          "papaya_runs_rejected_total", "Runs rejected because the pending queue was full.")),
+      sessions_completed_(metrics->make_counter(
+          "papaya_sessions_completed_total", "Run-sessions that completed successfully.")),
+      sessions_failed_(metrics->make_counter(
+          "papaya_sessions_failed_total", "Run-sessions that stopped with an error.")),
+      deadline_misses_(metrics->make_counter(
+          "papaya_deadline_misses_total", "Runs that finished after their input.deadline.")),
+      quota_exceeded_(metrics->make_counter(
+          "papaya_sessions_over_quota_total", "Run-sessions stopped for going over options.session_quota.")),
+      runs_over_budget_(metrics->make_counter(
+          "papaya_runs_over_budget_total", "Runs rejected because the sessions' memory was over options.budget.")),
+      pending_runs_(metrics->make_gauge(
+          "papaya_pending_runs", "Runs admitted but not yet started.")),
+      admission_latency_(metrics->make_histogram(
+          "papaya_session_admission_latency_nanoseconds", "Time from papaya::run() until the session starts.")),
+      callback_duration_(metrics->make_histogram(
+          "papaya_callback_duration_nanoseconds", "Time spent inside user callbacks.")),
+      session_cpu_time_(metrics->make_histogram(
+          "papaya_session_cpu_time_nanoseconds", "CPU time of each run-session on the threads it ran on.")),
+      session_peak_bytes_(metrics->make_histogram(
+          "papaya_session_peak_bytes", "Most bytes each run-session held at once.")),
+      alive_(std::make_shared<liveness>()),
+      dispatcher_(metrics)
+  {
+    alive_->self = this;
+    if (options_.budget)
+    {
+      // The waiter runs on whichever thread freed the slot, so only post.
+      budget_waiter_ = options_.budget->add_waiter([this]
+                                                   { dispatcher_.post([alive = alive_]
+                                                                      { if_alive(alive, [](papaya &self)
+                                                                                 {
+                                                                                   std::lock_guard<std::mutex> lock(self.mutex_);
+                                                                                   if (!self.running_)
+                                                                                   {
+                                                                                     self.start_next_locked();
+                                                                                   } }); }); });
+    }
+
+    if (options_.journal_path.empty())
+    {
+      return;
+    }
+    journal_ = std::make_unique<storage::journal>(options_.journal_path);
+    next_request_id_ = journal_->max_request_id() + 1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = scheduler_->now();
+    // The journal doesn't keep priorities or deadlines; recovered runs go
+    // in as normal ones, in their admission order.
+    std::vector<std::pair<uint64_t, run_state>> recovered;
+    for (const auto &entry : journal_->pending())
+    {
+      recovered.emplace_back(entry.request_id, run_state::pending);
+      pending_.push(
+          pending_run{
+              input{from_mask(entry.restrictions), entry.request_id},
+              std::make_shared<run_callbacks>(),
+              now,
+              {}},
+          static_cast<size_t>(run_priority::normal));
+    }
+    runs_.assign_batch(std::move(recovered));
+    pending_runs_->set(static_cast<int64_t>(pending_.size()));
+    start_next_locked();
+  }
 
   papaya::~papaya() noexcept
   {
-    this->stop();
+    if (options_.budget)
+    {
+      options_.budget->remove_waiter(budget_waiter_);
+    }
+    {
+      std::unique_lock<std::mutex> lock(alive_->mutex);
+      alive_->self = nullptr;
+      alive_->idle.wait(lock, [this]
+                        { return alive_->callers == 0; });
+    }
+    // Unlike stop(), leave the journal alone so the runs that didn't finish
+    // are recovered on the next start.
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_locked(false);
   }
 
   bool papaya::run(
@@ -27,11 +141,421 @@ namespace pa
       on_run_error &&on_run_error,
       on_run_complete &&on_run_complete)
   {
-    return false;
+    uint64_t ticket = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (running_ && pending_.size() >= pending_request_size_)
+      {
+        runs_rejected_->increment();
+        return false;
+      }
+      if (options_.budget && !options_.budget->admits())
+      {
+        runs_over_budget_->increment();
+        return false;
+      }
+
+      if (input.request_id == 0)
+      {
+        input.request_id = next_request_id_++;
+      }
+      else
+      {
+        next_request_id_ = std::max(next_request_id_, input.request_id + 1);
+      }
+      if (journal_)
+      {
+        ticket = journal_->admitted(input.request_id, to_mask(input.restrictions));
+      }
+
+      auto priority = static_cast<size_t>(input.priority);
+      auto deadline = input.deadline;
+      runs_.insert_or_assign(input.request_id, run_state::pending);
+      pending_.push(
+          pending_run{
+              std::move(input),
+              std::make_shared<run_callbacks>(run_callbacks{
+                  std::move(on_task_complete),
+                  std::move(on_run_error),
+                  std::move(on_run_complete)}),
+              scheduler_->now(),
+              {}},
+          priority,
+          deadline);
+      runs_admitted_->increment();
+      pending_runs_->set(static_cast<int64_t>(pending_.size()));
+
+      if (!running_)
+      {
+        start_next_locked();
+      }
+    }
+    if (journal_ && options_.journal_sync_admission)
+    {
+      journal_->wait_durable(ticket);
+    }
+    return true;
   }
 
   void papaya::stop()
   {
-    // TODO: Stop background threads.cibtdvejvhguvgejdkncbtdtfhnubgti
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_locked(true);
+  }
+
+  template <typename Fn>
+  void papaya::if_alive(const std::shared_ptr<liveness> &alive, Fn &&fn)
+  {
+    papaya *self;
+    {
+      std::lock_guard<std::mutex> lock(alive->mutex);
+      if (alive->self == nullptr)
+      {
+        return;
+      }
+      self = alive->self;
+      ++alive->callers;
+    }
+    struct leave
+    {
+      liveness &alive;
+      ~leave()
+      {
+        std::lock_guard<std::mutex> lock(alive.mutex);
+        if (--alive.callers == 0)
+        {
+          alive.idle.notify_all();
+        }
+      }
+    } leave{*alive};
+    fn(*self);
+  }
+
+  template <typename Fn>
+  void papaya::if_current(const std::shared_ptr<liveness> &alive, uint64_t generation, Fn &&fn)
+  {
+    if_alive(alive, [&](papaya &self)
+             {
+               {
+                 std::lock_guard<std::mutex> lock(self.mutex_);
+                 if (generation != self.generation_)
+                 {
+                   return;
+                 }
+               }
+               fn(self); });
+  }
+
+  void papaya::stop_active_locked()
+  {
+    lifetime_.unsubscribe();
+    // A composite_subscription can't be reused once unsubscribed.
+    lifetime_ = rxcpp::composite_subscription();
+    ++generation_;
+  }
+
+  void papaya::cancel_locked(bool journal_cancel)
+  {
+    stop_active_locked();
+    auto cancelled = pending_.drain();
+    std::vector<uint64_t> ended;
+    ended.reserve(cancelled.size() + 1);
+    for (const auto &run : cancelled)
+    {
+      ended.push_back(run.input.request_id);
+    }
+    if (active_)
+    {
+      ended.push_back(active_->input.request_id);
+    }
+    runs_.erase_batch(ended);
+    if (journal_ && journal_cancel)
+    {
+      if (active_)
+      {
+        journal_->completed(active_->input.request_id);
+      }
+      for (const auto &run : cancelled)
+      {
+        journal_->completed(run.input.request_id);
+      }
+    }
+    pending_runs_->set(0);
+    running_ = false;
+    active_.reset();
+  }
+
+  void papaya::start_next_locked()
+  {
+    // Runs wait in the queue until the budget has a slot; finish() on it
+    // wakes us to try again.
+    if (pending_.empty() || (options_.budget && !options_.budget->try_start()))
+    {
+      return;
+    }
+    auto run = std::make_shared<pending_run>();
+    if (!pending_.pop(*run))
+    {
+      if (options_.budget)
+      {
+        options_.budget->finish();
+      }
+      return;
+    }
+    // A weak_ptr, as the account is owned by run. The dispatcher takes the
+    // cancellation off the charging thread, which may be deep in the session.
+    if (options_.budget)
+    {
+      run->slot = std::make_unique<budget_slot>(options_.budget);
+    }
+    std::weak_ptr<pending_run> weak_run = run;
+    run->account = std::make_shared<resource::account>(
+        options_.session_quota,
+        options_.budget,
+        [alive = alive_, weak_run]
+        {
+          if_alive(alive, [&](papaya &self)
+                   { self.dispatcher_.post([alive, weak_run]
+                                           { if_alive(alive, [&](papaya &self)
+                                                      {
+                                                        if (auto run = weak_run.lock())
+                                                        {
+                                                          self.on_quota_exceeded(run);
+                                                        } }); }); });
+        });
+    run->task_batch = std::vector<output, resource::session_allocator<output>>(resource::session_allocator<output>(run->account));
+    if (run->admitted_ticks != 0)
+    {
+      trace::complete("papaya::pending", run->admitted_ticks, trace::now(), run->input.request_id);
+    }
+    pending_runs_->set(static_cast<int64_t>(pending_.size()));
+    runs_.insert_or_assign(run->input.request_id, run_state::running);
+    running_ = true;
+    active_ = run;
+    admission_latency_->record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(scheduler_->now() - run->admitted_at).count()));
+
+    switch (options_.session)
+    {
+    case options::session_api::rx:
+      start_rx_session(std::move(run));
+      break;
+    case options::session_api::coroutine:
+      start_coroutine_session(std::move(run));
+      break;
+    }
+  }
+
+  void papaya::start_rx_session(std::shared_ptr<pending_run> run)
+  {
+    // Unsubscribing doesn't stop a callback already on its way, so a
+    // session started before the last stop() drops what it still delivers.
+    auto generation = generation_;
+    // Wrapped so the synchronous part of the chain, which runs on the
+    // subscribe_on thread, is charged to the session.
+    rxcpp::observable<>::create<fl_factory::output>(
+        [factory = fl_factory_, account = run->account, restrictions = run->input.restrictions](rxcpp::subscriber<fl_factory::output> subscriber)
+        {
+          resource::session_scope scope(account);
+          fl_factory::input fl_input{restrictions};
+          factory->create(fl_input).subscribe(subscriber);
+        })
+        .subscribe_on(rxcpp::observe_on_event_loop())
+        .subscribe(
+            lifetime_,
+            [alive = alive_, run, generation](fl_factory::output session_output)
+            { if_current(alive, generation, [&](papaya &self)
+                         { self.on_session_task(run, detail::to_output(session_output)); }); },
+            [alive = alive_, run, generation](std::exception_ptr error)
+            { if_current(alive, generation, [&](papaya &self)
+                         { self.on_session_error(run, error); }); },
+            [alive = alive_, run, generation]()
+            { if_current(alive, generation, [&](papaya &self)
+                         { self.on_session_complete(run); }); });
+  }
+
+  void papaya::start_coroutine_session(std::shared_ptr<pending_run> run)
+  {
+    // stop() can't cancel a coroutine mid-flight, so a session started
+    // before the last stop() just drops its result.
+    auto generation = generation_;
+    run->session_scheduler = std::make_unique<resource::accounted_scheduler>(*scheduler_, run->account);
+    resource::session_scope scope(run->account);
+    // The callbacks live as long as the coroutine, so they keep the factory
+    // it runs in alive should papaya go first.
+    coro::spawn(
+        fl_factory_->co_create(fl_factory::input{run->input.restrictions}, *run->session_scheduler),
+        [alive = alive_, run, generation, factory = fl_factory_](fl_factory::output session_output)
+        {
+          if_current(alive, generation, [&](papaya &self)
+                     {
+                       self.on_session_task(run, detail::to_output(session_output));
+                       self.on_session_complete(run); });
+        },
+        [alive = alive_, run, generation](std::exception_ptr error)
+        {
+          if_current(alive, generation, [&](papaya &self)
+                     { self.on_session_error(run, error); });
+        });
+  }
+
+  void papaya::on_session_task(const std::shared_ptr<pending_run> &run, output output)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_ != run)
+    {
+      return;
+    }
+    add_usage(run, output);
+    run->task_batch.push_back(std::move(output));
+    if (run->task_batch.size() >= options_.task_complete_batch_size)
+    {
+      post_task_batch(run);
+    }
+  }
+
+  void papaya::on_session_error(const std::shared_ptr<pending_run> &run, std::exception_ptr error)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_ != run)
+    {
+      return;
+    }
+    run->slot.reset();
+    fail_session_locked(run, error);
+  }
+
+  void papaya::on_session_complete(const std::shared_ptr<pending_run> &run)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_ != run)
+    {
+      return;
+    }
+    run->slot.reset();
+    sessions_completed_->increment();
+    count_deadline_miss(run);
+    journal_completed(run);
+    post_task_batch(run);
+    dispatcher_.post([callbacks = run->callbacks, duration = callback_duration_]()
+                     { detail::invoke_timed(*duration, callbacks->on_run_complete); });
+    finish_session_locked(run);
+  }
+
+  void papaya::on_quota_exceeded(const std::shared_ptr<pending_run> &run)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_ != run)
+    {
+      return;
+    }
+    stop_active_locked();
+    quota_exceeded_->increment();
+    if (options_.on_quota_exceeded != options::quota_action::defer || run->deferrals >= options_.max_deferrals)
+    {
+      fail_session_locked(run, std::make_exception_ptr(resource::quota_exceeded_error("run-session went over its resource quota")));
+      return;
+    }
+
+    // The stopped session may still be running and holding run, so the
+    // retry is a new pending_run sharing its callbacks.
+    post_task_batch(run);
+    record_usage(run);
+    pending_run retry{run->input, run->callbacks, run->admitted_at, {}};
+    retry.deferrals = run->deferrals + 1;
+    runs_.insert_or_assign(retry.input.request_id, run_state::pending);
+    auto deadline = retry.input.deadline;
+    pending_.push(std::move(retry), static_cast<size_t>(run_priority::best_effort), deadline);
+    running_ = false;
+    active_.reset();
+    start_next_locked();
+  }
+
+  void papaya::fail_session_locked(const std::shared_ptr<pending_run> &run, std::exception_ptr error)
+  {
+    sessions_failed_->increment();
+    count_deadline_miss(run);
+    journal_completed(run);
+    post_task_batch(run);
+    dispatcher_.post([callbacks = run->callbacks, error, duration = callback_duration_]()
+                     {
+      try
+      {
+        std::rethrow_exception(error);
+      }
+      catch (const std::exception &e)
+      {
+        detail::invoke_timed(*duration, callbacks->on_run_error, e);
+      }
+      catch (...)
+      {
+        detail::invoke_timed(*duration, callbacks->on_run_error, std::exception{});
+      } });
+    finish_session_locked(run);
+  }
+
+  void papaya::post_task_batch(const std::shared_ptr<pending_run> &run)
+  {
+    if (run->task_batch.empty())
+    {
+      return;
+    }
+    dispatcher_.post([callbacks = run->callbacks, outputs = std::move(run->task_batch), duration = callback_duration_]() mutable
+                     {
+      for (auto &output : outputs)
+      {
+        detail::invoke_timed(*duration, callbacks->on_task_complete, std::move(output));
+      } });
+    run->task_batch.clear();
+  }
+
+  void papaya::journal_completed(const std::shared_ptr<pending_run> &run)
+  {
+    if (journal_)
+    {
+      journal_->completed(run->input.request_id);
+    }
+  }
+
+  void papaya::count_deadline_miss(const std::shared_ptr<pending_run> &run)
+  {
+    if (run->input.deadline && scheduler_->now() > *run->input.deadline)
+    {
+      deadline_misses_->increment();
+    }
+  }
+
+  void papaya::add_usage(const std::shared_ptr<pending_run> &run, output &output)
+  {
+    auto usage = run->account->usage();
+    output.metrics.emplace("session_cpu_seconds", std::chrono::duration<float>(usage.cpu_time).count());
+    output.metrics.emplace("session_allocated_bytes", static_cast<float>(usage.allocated_bytes));
+    output.metrics.emplace("session_peak_bytes", static_cast<float>(usage.peak_bytes));
+  }
+
+  void papaya::record_usage(const std::shared_ptr<pending_run> &run)
+  {
+    auto usage = run->account->usage();
+    session_cpu_time_->record(static_cast<uint64_t>(usage.cpu_time.count()));
+    session_peak_bytes_->record(usage.peak_bytes);
+  }
+
+  void papaya::finish_session_locked(const std::shared_ptr<pending_run> &run)
+  {
+    record_usage(run);
+    runs_.erase(run->input.request_id);
+    running_ = false;
+    active_.reset();
+    start_next_locked();
+  }
+
+  std::string to_string(const papaya::metric_value &value)
+  {
+    return util::match(
+        value,
+        [](float f)
+        { return std::to_string(f); },
+        [](const std::string &s)
+        { return s; });
   }
-}
\ No newline at end of file
+}
@@ -1,60 +1,167 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <exception>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 
+#include "papaya/concurrent/deadline_queue.hpp"
+#include "papaya/concurrent/dispatcher.hpp"
+#include "papaya/concurrent/scheduler.hpp"
+#include "papaya/concurrent/sharded_map.hpp"
+#include "papaya/concurrent/thread_pool.hpp"
+#include "papaya/coro/task.hpp"
 #include "papaya/factory/fl_factory.hpp"
+#include "papaya/metrics/metrics.hpp"
+#include "papaya/resource/accounting.hpp"
+#include "papaya/storage/journal.hpp"
+#include "papaya/trace/tracer.hpp"
+#include "papaya/util/unique_function.hpp"
 #include "restrictions.hpp"
 
 namespace pa
 {
 
+  // Declared outside papaya so it can be a default argument of papaya's
+  // constructor.
+  struct papaya_options
+  {
+    // Task outputs of a run-session are handed to the dispatcher in groups
+    // of this size (the rest on session end), so one dispatcher wake-up can
+    // deliver several on_task_complete calls. 1 delivers each immediately.
+    size_t task_complete_batch_size = 1;
+
+    enum class session_api
+    {
+      // fl_factory::create(), an rxcpp observable chain on rx's event loop.
+      rx,
+      // fl_factory::co_create(), a coroutine resumed on papaya's scheduler.
+      coroutine
+    };
+    session_api session = session_api::rx;
+
+    // When set, admitted and completed runs are journaled to this file, and
+    // runs still pending when the process died are re-admitted on startup.
+    std::string journal_path;
+    // Whether run() waits for the admission to be durable before returning.
+    bool journal_sync_admission = true;
+
+    // A pending run passed over this many times in a row for runs of higher
+    // priority is started next.
+    uint32_t starvation_limit = 8;
+
+    // Limits for each run-session. A session going over its quota is stopped
+    // and, per quota_action, fails with resource::quota_exceeded_error or is
+    // deferred: put back in the pending queue as best_effort to try again
+    // later, at most max_deferrals times before it fails.
+    resource::quota session_quota;
+    enum class quota_action
+    {
+      cancel,
+      defer
+    };
+    quota_action on_quota_exceeded = quota_action::cancel;
+    uint32_t max_deferrals = 1;
+
+    // Shared by the papaya instances on a host. run() rejects runs while the
+    // sessions' memory is over budget, and pending runs wait for a session
+    // slot. A session stopped by stop() or its quota keeps its slot until
+    // it has drained, as a coroutine session can't be cancelled mid-flight.
+    std::shared_ptr<resource::budget> budget;
+  };
+
+  // Pending runs of higher priority start first; within a priority, the
+  // earliest deadline starts first.
+  enum class run_priority : uint8_t
+  {
+    best_effort,
+    normal,
+    high,
+    critical
+  };
+
+  enum class run_state : uint8_t
+  {
+    pending,
+    running
+  };
+
   class papaya
   {
   public:
     struct input
     {
       std::set<restriction> restrictions;
+      // Identifies the run across restarts. 0 lets papaya assign one.
+      uint64_t request_id = 0;
+      run_priority priority = run_priority::normal;
+      // When the run should have finished, e.g. before a model push, on the
+      // clock of papaya's scheduler. Runs without one go after those with
+      // one of the same priority.
+      std::optional<std::chrono::steady_clock::time_point> deadline{};
     };
 
+    using metric_value = std::variant<float, std::string>;
+
+    // Each output also carries its session's resource usage so far as
+    // "session_cpu_seconds", "session_allocated_bytes" and
+    // "session_peak_bytes". Sessions that encoded a model update add
+    // "model_update_bytes", "model_update_compression_ratio" and
+    // "model_update_encode_bytes_per_second".
     struct output
     {
       std::string task_name;
-      std::unordered_map<std::string, std::variant<float, std::string>> metrics;
+      std::unordered_map<std::string, metric_value> metrics;
     };
 
+    using options = papaya_options;
+
+    // All callbacks are invoked on papaya's dispatcher thread, one at a
+    // time and in order, never on the pipeline threads. They're move-only and
+    // store captures up to 64 bytes (e.g. a few shared_ptr) without
+    // allocating.
+
     // Callback for specific task's complete. There might be more than one
     // tasks running in a run-session.
-    using on_task_complete = std::function<void(output)>;
+    using on_task_complete = util::unique_function<void(output)>;
     // Callback for error in a run-session. When the error callback is called
     // the run session also stops. This callback is mutually exclusive with
     // complete callback.
     // For example, you might see a sequnce of call back like below:
     // task 1 > error
-    using on_run_error = std::function<void(std::exception)>;
+    using on_run_error = util::unique_function<void(std::exception)>;
     // Callback for success of a run-session. For example, you might see a
     // sequence of callback like below:
     // task 1 > task 2 > complete
-    using on_run_complete = std::function<void()>;
+    using on_run_complete = util::unique_function<void()>;
 
   public:
     // TODO: Inject deps using Fruit
-    // TODO: Inject scheduler
     explicit papaya(
         size_t pending_request_size,
-        std::shared_ptr<pa::fl_factory> fl_factory);
+        std::shared_ptr<pa::fl_factory> fl_factory,
+        options options = {},
+        std::shared_ptr<metrics::registry> metrics = std::make_shared<metrics::registry>(),
+        std::shared_ptr<concurrent::scheduler> scheduler = std::make_shared<concurrent::thread_pool>());
     ~papaya() noexcept;
 
     // Start a run-session.
+    // Runs recovered from the journal are admitted on construction; their
+    // callbacks are gone, so only the journal and metrics see them finish.
     // If you start multiple runs before the previous run finishes,
-    // saying \on_run_complete is called, they will be cached in a LRU cache
-    // of size \pending_request_size_.
-    // It returns true when your request is accepted; vice versa.
+    // saying \on_run_complete is called, they wait in a queue of size
+    // \pending_request_size_, ordered by input.priority and input.deadline.
+    // It returns true when your request is accepted; vice versa. With
+    // journal_sync_admission, it throws the journal's std::system_error
+    // when the journal failed before the admission was durable.
     bool run(
         input input,
         on_task_complete &&on_task_complete,
@@ -62,11 +169,154 @@ namespace pa
         on_run_complete &&on_run_complete);
     void stop();
 
+    // Where the run with request_id is, or nullopt once it has finished,
+    // was stopped, or was never admitted. Doesn't take papaya's lock, so
+    // it's cheap to poll from any thread.
+    std::optional<run_state> state_of(uint64_t request_id) const { return runs_.find(request_id); }
+
+    // The registry papaya records into. Call snapshot() on it to export the
+    // admission, queue and callback metrics.
+    auto metrics() const -> std::shared_ptr<metrics::registry> { return metrics_; }
+
   private:
+    // Shared by a run and the retries it's deferred into.
+    struct run_callbacks
+    {
+      papaya::on_task_complete on_task_complete;
+      papaya::on_run_error on_run_error;
+      papaya::on_run_complete on_run_complete;
+    };
+
+    // Returns the budget slot a session took when it goes.
+    struct budget_slot
+    {
+      explicit budget_slot(std::shared_ptr<resource::budget> budget) : budget(std::move(budget)) {}
+      ~budget_slot() { budget->finish(); }
+
+      budget_slot(const budget_slot &) = delete;
+      budget_slot &operator=(const budget_slot &) = delete;
+
+      std::shared_ptr<resource::budget> budget;
+    };
+
+    struct pending_run
+    {
+      papaya::input input;
+      std::shared_ptr<run_callbacks> callbacks;
+      std::chrono::steady_clock::time_point admitted_at;
+      // Task outputs not yet handed to the dispatcher. Guarded by mutex_.
+      // Charged to account.
+      std::vector<output, resource::session_allocator<output>> task_batch;
+      // Set when the session starts.
+      std::shared_ptr<resource::account> account{};
+      // Resumes the coroutine session inside the account's scope.
+      std::unique_ptr<concurrent::scheduler> session_scheduler{};
+      // Set when the session starts with a budget. Released when the session
+      // ends; a stopped one may still be running and holding run, so it
+      // keeps the slot until it lets go.
+      std::unique_ptr<budget_slot> slot{};
+      uint32_t deferrals = 0;
+      // trace::now() at admission when tracing was on, else 0.
+      uint64_t admitted_ticks = trace::enabled() ? trace::now() : 0;
+    };
+
+    // Held by the session and dispatcher callbacks instead of this. They
+    // run papaya's handlers only while self is set, counted in callers;
+    // ~papaya clears self and waits for the handlers in progress. Counting
+    // rather than a reader lock lets a handler nest another, e.g. when it
+    // allocates over the session's quota.
+    struct liveness
+    {
+      std::mutex mutex;
+      std::condition_variable idle;
+      papaya *self = nullptr;
+      size_t callers = 0;
+    };
+    // Calls fn(papaya &) unless papaya is being destroyed.
+    template <typename Fn>
+    static void if_alive(const std::shared_ptr<liveness> &alive, Fn &&fn);
+    // Same, and only if no stop() came after the session of generation
+    // started.
+    template <typename Fn>
+    static void if_current(const std::shared_ptr<liveness> &alive, uint64_t generation, Fn &&fn);
+
+    // Pops the most urgent pending run and subscribes to its session. The caller
+    // must hold mutex_.
+    void start_next_locked();
+    void start_rx_session(std::shared_ptr<pending_run> run);
+    void start_coroutine_session(std::shared_ptr<pending_run> run);
+    // The session handlers ignore a run that's no longer the active one: a
+    // session stopped by stop() or its quota may still report in.
+    void on_session_task(const std::shared_ptr<pending_run> &run, output output);
+    void on_session_error(const std::shared_ptr<pending_run> &run, std::exception_ptr error);
+    void on_session_complete(const std::shared_ptr<pending_run> &run);
+    // Stops run's session, then fails it or defers a retry of it.
+    void on_quota_exceeded(const std::shared_ptr<pending_run> &run);
+    // Fails the active run's session. The caller must hold mutex_, and
+    // release the run's budget slot if its session is over.
+    void fail_session_locked(const std::shared_ptr<pending_run> &run, std::exception_ptr error);
+    // Ends the active run's session and starts the next. The caller must
+    // hold mutex_, and release the run's budget slot if its session is over.
+    void finish_session_locked(const std::shared_ptr<pending_run> &run);
+    // Stops the subscriptions and coroutines of the active session. The
+    // caller must hold mutex_.
+    void stop_active_locked();
+    // Adds the resource usage of run's session to output.metrics.
+    void add_usage(const std::shared_ptr<pending_run> &run, output &output);
+    // Records the resource usage of run's session in the session histograms.
+    void record_usage(const std::shared_ptr<pending_run> &run);
+    // Drops the pending and running runs; journal_cancel records them as
+    // completed so they aren't recovered on the next start.
+    void cancel_locked(bool journal_cancel);
+    void journal_completed(const std::shared_ptr<pending_run> &run);
+    void count_deadline_miss(const std::shared_ptr<pending_run> &run);
+    // Posts the buffered task outputs of run to the dispatcher. The caller
+    // must hold mutex_.
+    void post_task_batch(const std::shared_ptr<pending_run> &run);
+
     const size_t pending_request_size_;
     std::shared_ptr<pa::fl_factory> fl_factory_;
+    const options options_;
+    std::shared_ptr<concurrent::scheduler> scheduler_;
 
-    // TODO: declare a composite_subscription
+    std::mutex mutex_;
+    concurrent::deadline_queue<pending_run, 4> pending_;
+    bool running_ = false;
+    std::shared_ptr<pending_run> active_;
+    // The state of every admitted run by request_id. Written under mutex_,
+    // read without it by state_of().
+    concurrent::ConcurrentShardedMap<uint64_t, run_state> runs_;
+    uint64_t next_request_id_ = 1;
+    // Bumped by stop() so late results of stopped sessions are dropped.
+    uint64_t generation_ = 0;
+    rxcpp::composite_subscription lifetime_;
+
+    std::shared_ptr<metrics::registry> metrics_;
+    std::shared_ptr<metrics::counter> runs_admitted_;
+    std::shared_ptr<metrics::counter> runs_rejected_;
+    std::shared_ptr<metrics::counter> sessions_completed_;
+    std::shared_ptr<metrics::counter> sessions_failed_;
+    std::shared_ptr<metrics::counter> deadline_misses_;
+    std::shared_ptr<metrics::counter> quota_exceeded_;
+    std::shared_ptr<metrics::counter> runs_over_budget_;
+    std::shared_ptr<metrics::gauge> pending_runs_;
+    std::shared_ptr<metrics::histogram> admission_latency_;
+    std::shared_ptr<metrics::histogram> callback_duration_;
+    std::shared_ptr<metrics::histogram> session_cpu_time_;
+    std::shared_ptr<metrics::histogram> session_peak_bytes_;
+
+    std::unique_ptr<storage::journal> journal_;
+    // Wakes this papaya when another session releases its budget slot.
+    uint64_t budget_waiter_ = 0;
+
+    const std::shared_ptr<liveness> alive_;
+
+    // Declared last so it's destroyed first: queued callbacks still run, and
+    // they may touch the metrics above.
+    concurrent::dispatcher dispatcher_;
   };
 
-}
\ No newline at end of file
+  // Formats a task metric for logs and exports.
+  std::string to_string(const papaya::metric_value &value);
+
+}
@@ -0,0 +1,208 @@
+#include "papaya/resource/accounting.hpp"
+
+#include <algorithm>
+#include <ctime>
+
+namespace pa
+{
+  namespace resource
+  {
+    namespace detail
+    {
+      // The innermost session_scope of this thread and the thread CPU time
+      // its account was last charged up to.
+      struct thread_session
+      {
+        std::shared_ptr<resource::account> account;
+        std::chrono::nanoseconds charged_until{0};
+      };
+
+      thread_session &this_thread_session() noexcept
+      {
+        thread_local thread_session session;
+        return session;
+      }
+
+      // Charges the time since the last charge to the current account.
+      void charge_current(thread_session &session, std::chrono::nanoseconds now) noexcept
+      {
+        if (session.account)
+        {
+          session.account->charge_cpu(now - session.charged_until);
+        }
+        session.charged_until = now;
+      }
+    }
+
+    budget::budget(limits limits)
+        : limits_(limits)
+    {
+    }
+
+    bool budget::admits() const noexcept
+    {
+      return live_bytes() < limits_.live_bytes;
+    }
+
+    bool budget::try_start() noexcept
+    {
+      if (!admits())
+      {
+        return false;
+      }
+      auto running = running_.load(std::memory_order_relaxed);
+      do
+      {
+        if (running >= limits_.sessions)
+        {
+          return false;
+        }
+      } while (!running_.compare_exchange_weak(running, running + 1, std::memory_order_relaxed));
+      return true;
+    }
+
+    void budget::finish()
+    {
+      running_.fetch_sub(1, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto &[id, waiter] : waiters_)
+      {
+        waiter();
+      }
+    }
+
+    uint64_t budget::add_waiter(std::function<void()> waiter)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto id = next_waiter_++;
+      waiters_.emplace_back(id, std::move(waiter));
+      return id;
+    }
+
+    void budget::remove_waiter(uint64_t id)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::erase_if(waiters_, [id](const auto &waiter)
+                    { return waiter.first == id; });
+    }
+
+    void budget::charge(int64_t bytes) noexcept
+    {
+      live_bytes_.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed);
+    }
+
+    account::account(quota quota, std::shared_ptr<resource::budget> budget, on_exceeded on_exceeded)
+        : quota_(quota), budget_(std::move(budget)), on_exceeded_(std::move(on_exceeded))
+    {
+    }
+
+    account::~account()
+    {
+      if (budget_)
+      {
+        budget_->charge(-static_cast<int64_t>(live_bytes_.load(std::memory_order_relaxed)));
+      }
+    }
+
+    void account::charge_cpu(std::chrono::nanoseconds time) noexcept
+    {
+      auto cpu_nanos = cpu_nanos_.fetch_add(time.count(), std::memory_order_relaxed) + time.count();
+      check(cpu_nanos, live_bytes_.load(std::memory_order_relaxed));
+    }
+
+    void account::charge_allocation(size_t bytes) noexcept
+    {
+      allocated_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+      auto live = live_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+      auto peak = peak_bytes_.load(std::memory_order_relaxed);
+      while (peak < live && !peak_bytes_.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+      {
+      }
+      if (budget_)
+      {
+        budget_->charge(static_cast<int64_t>(bytes));
+      }
+      check(cpu_nanos_.load(std::memory_order_relaxed), live);
+    }
+
+    void account::charge_deallocation(size_t bytes) noexcept
+    {
+      live_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+      if (budget_)
+      {
+        budget_->charge(-static_cast<int64_t>(bytes));
+      }
+    }
+
+    usage account::usage() const noexcept
+    {
+      return {
+          std::chrono::nanoseconds(cpu_nanos_.load(std::memory_order_relaxed)),
+          allocated_bytes_.load(std::memory_order_relaxed),
+          live_bytes_.load(std::memory_order_relaxed),
+          peak_bytes_.load(std::memory_order_relaxed)};
+    }
+
+    void account::check(int64_t cpu_nanos, uint64_t live_bytes) noexcept
+    {
+      auto over = (quota_.cpu_time && cpu_nanos > quota_.cpu_time->count()) ||
+                  (quota_.live_bytes && live_bytes > *quota_.live_bytes);
+      if (!over || exceeded_.load(std::memory_order_relaxed) || exceeded_.exchange(true, std::memory_order_relaxed))
+      {
+        return;
+      }
+      if (on_exceeded_)
+      {
+        on_exceeded_();
+      }
+    }
+
+    std::chrono::nanoseconds thread_cpu_time() noexcept
+    {
+      timespec now{};
+      ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+      return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+    }
+
+    const std::shared_ptr<account> &current() noexcept
+    {
+      return detail::this_thread_session().account;
+    }
+
+    session_scope::session_scope(std::shared_ptr<account> account)
+    {
+      auto &session = detail::this_thread_session();
+      if (session.account == account)
+      {
+        return;
+      }
+      detail::charge_current(session, thread_cpu_time());
+      previous_ = std::exchange(session.account, std::move(account));
+      entered_ = true;
+    }
+
+    session_scope::~session_scope()
+    {
+      if (!entered_)
+      {
+        return;
+      }
+      auto &session = detail::this_thread_session();
+      detail::charge_current(session, thread_cpu_time());
+      session.account = std::move(previous_);
+    }
+
+    accounted_scheduler::accounted_scheduler(concurrent::scheduler &inner, std::shared_ptr<account> account)
+        : inner_(inner), account_(std::move(account))
+    {
+    }
+
+    void accounted_scheduler::schedule(job job)
+    {
+      inner_.schedule([account = account_, job = std::move(job)]() mutable
+                      {
+        session_scope scope(account);
+        job(); });
+    }
+  }
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "papaya/concurrent/scheduler.hpp"
+
+namespace pa
+{
+  namespace resource
+  {
+    /**
+     * @brief What one session may use. Unset limits are unlimited.
+     */
+    struct quota
+    {
+      // CPU time spent on the threads the session runs on, see session_scope.
+      std::optional<std::chrono::nanoseconds> cpu_time;
+      // Bytes held at once through the session's session_allocator.
+      std::optional<uint64_t> live_bytes;
+    };
+
+    class quota_exceeded_error : public std::runtime_error
+    {
+    public:
+      using std::runtime_error::runtime_error;
+    };
+
+    struct usage
+    {
+      std::chrono::nanoseconds cpu_time{0};
+      // Total allocated over the session's life, and held now and at most.
+      uint64_t allocated_bytes = 0;
+      uint64_t live_bytes = 0;
+      uint64_t peak_bytes = 0;
+    };
+
+    /**
+     * @brief The host-wide limits that sessions of every papaya sharing it
+     * are admitted against.
+     */
+    class budget final
+    {
+    public:
+      struct limits
+      {
+        // Bytes live across all sessions' accounts.
+        uint64_t live_bytes = std::numeric_limits<uint64_t>::max();
+        // Sessions running at once, e.g. the cores set aside for them.
+        size_t sessions = std::numeric_limits<size_t>::max();
+      };
+
+      explicit budget(limits limits);
+
+      // Whether new runs may be admitted: the sessions' live bytes are under
+      // the limit.
+      bool admits() const noexcept;
+      // Takes a session slot if the limits allow one more session.
+      bool try_start() noexcept;
+      // Returns a slot taken by try_start() and calls the waiters.
+      void finish();
+
+      uint64_t live_bytes() const noexcept { return live_bytes_.load(std::memory_order_relaxed); }
+      size_t running() const noexcept { return running_.load(std::memory_order_relaxed); }
+
+      // waiter is called on the thread calling finish(), with the budget's
+      // lock held, so it must not add or remove waiters.
+      uint64_t add_waiter(std::function<void()> waiter);
+      // Once this returns, the waiter isn't running and won't be called again.
+      void remove_waiter(uint64_t id);
+
+    private:
+      friend class account;
+      void charge(int64_t bytes) noexcept;
+
+      const limits limits_;
+      std::atomic<uint64_t> live_bytes_{0};
+      std::atomic<size_t> running_{0};
+
+      std::mutex mutex_;
+      std::vector<std::pair<uint64_t, std::function<void()>>> waiters_;
+      uint64_t next_waiter_ = 1;
+    };
+
+    /**
+     * @brief Usage of one session, checked against its quota as it's charged.
+     *
+     * Charging is lock-free so it can happen on every allocation. The first
+     * charge that goes over the quota calls on_exceeded, once, on the
+     * charging thread.
+     */
+    class account final
+    {
+    public:
+      using on_exceeded = std::function<void()>;
+
+      explicit account(quota quota = {}, std::shared_ptr<resource::budget> budget = nullptr, on_exceeded on_exceeded = nullptr);
+      // Returns the bytes still live to the budget.
+      ~account();
+
+      account(const account &) = delete;
+      account &operator=(const account &) = delete;
+
+      void charge_cpu(std::chrono::nanoseconds time) noexcept;
+      void charge_allocation(size_t bytes) noexcept;
+      void charge_deallocation(size_t bytes) noexcept;
+
+      resource::usage usage() const noexcept;
+      bool exceeded() const noexcept { return exceeded_.load(std::memory_order_relaxed); }
+
+    private:
+      void check(int64_t cpu_nanos, uint64_t live_bytes) noexcept;
+
+      const quota quota_;
+      const std::shared_ptr<resource::budget> budget_;
+      const on_exceeded on_exceeded_;
+      std::atomic<int64_t> cpu_nanos_{0};
+      std::atomic<uint64_t> allocated_bytes_{0};
+      std::atomic<uint64_t> live_bytes_{0};
+      std::atomic<uint64_t> peak_bytes_{0};
+      std::atomic<bool> exceeded_{false};
+    };
+
+    // CPU time the calling thread has used, from CLOCK_THREAD_CPUTIME_ID.
+    std::chrono::nanoseconds thread_cpu_time() noexcept;
+
+    // The account of the innermost session_scope on this thread, or null.
+    const std::shared_ptr<account> &current() noexcept;
+
+    /**
+     * @brief Charges the calling thread's CPU time to account until the
+     * scope ends, and makes it current().
+     *
+     * Scopes nest: entering one pauses the enclosing scope's account, and
+     * re-entering the current account is free.
+     */
+    class session_scope final
+    {
+    public:
+      explicit session_scope(std::shared_ptr<account> account);
+      ~session_scope();
+
+      session_scope(const session_scope &) = delete;
+      session_scope &operator=(const session_scope &) = delete;
+
+    private:
+      std::shared_ptr<account> previous_;
+      bool entered_ = false;
+    };
+
+    /**
+     * @brief std::allocator that charges its account, or current() when
+     * default-constructed inside a session_scope.
+     */
+    template <typename T>
+    class session_allocator
+    {
+    public:
+      using value_type = T;
+      using propagate_on_container_move_assignment = std::true_type;
+      using propagate_on_container_swap = std::true_type;
+
+      session_allocator() noexcept
+          : account_(current())
+      {
+      }
+
+      explicit session_allocator(std::shared_ptr<account> account) noexcept
+          : account_(std::move(account))
+      {
+      }
+
+      // Moves copy, so a moved-from container keeps charging the account.
+      session_allocator(const session_allocator &) noexcept = default;
+
+      template <typename U>
+      session_allocator(const session_allocator<U> &other) noexcept
+          : account_(other.owner())
+      {
+      }
+
+      T *allocate(size_t n)
+      {
+        auto *p = std::allocator<T>{}.allocate(n);
+        if (account_)
+        {
+          account_->charge_allocation(n * sizeof(T));
+        }
+        return p;
+      }
+
+      void deallocate(T *p, size_t n) noexcept
+      {
+        std::allocator<T>{}.deallocate(p, n);
+        if (account_)
+        {
+          account_->charge_deallocation(n * sizeof(T));
+        }
+      }
+
+      const std::shared_ptr<account> &owner() const noexcept { return account_; }
+
+      // Memory must go back to the account it was charged to.
+      template <typename U>
+      bool operator==(const session_allocator<U> &other) const noexcept
+      {
+        return account_ == other.owner();
+      }
+
+    private:
+      std::shared_ptr<account> account_;
+    };
+
+    /**
+     * @brief Runs every job of inner inside a session_scope of account, so a
+     * session's coroutines are charged wherever they resume.
+     */
+    class accounted_scheduler final : public concurrent::scheduler
+    {
+    public:
+      accounted_scheduler(concurrent::scheduler &inner, std::shared_ptr<account> account);
+
+      void schedule(job job) override;
+      std::chrono::steady_clock::time_point now() const override { return inner_.now(); }
+
+    private:
+      concurrent::scheduler &inner_;
+      const std::shared_ptr<account> account_;
+    };
+  }
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <set>
+
 namespace pa
 {
 
@@ -11,4 +14,29 @@ namespace pa
     is_cable_charged
   };
 
-}
\ No newline at end of file
+  // Packs a restriction set into one bit per restriction, for on-disk and
+  // wire formats.
+  inline uint32_t to_mask(const std::set<restriction> &restrictions)
+  {
+    uint32_t mask = 0;
+    for (auto r : restrictions)
+    {
+      mask |= uint32_t{1} << r;
+    }
+    return mask;
+  }
+
+  inline std::set<restriction> from_mask(uint32_t mask)
+  {
+    std::set<restriction> restrictions;
+    for (auto r : {using_wifi, using_cellular, is_idle, is_cable_charged})
+    {
+      if (mask & (uint32_t{1} << r))
+      {
+        restrictions.insert(r);
+      }
+    }
+    return restrictions;
+  }
+
+}
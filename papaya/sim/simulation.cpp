@@ -0,0 +1,199 @@
+#include "papaya/sim/simulation.hpp"
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "papaya/factory/fl_factory.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/sim/virtual_scheduler.hpp"
+
+namespace pa
+{
+  namespace sim
+  {
+    namespace detail
+    {
+      class stage_failure : public std::runtime_error
+      {
+      public:
+        using std::runtime_error::runtime_error;
+      };
+
+      enum class event : uint64_t
+      {
+        admitted,
+        rejected,
+        session_stage,
+        match_stage,
+        stage_failed
+      };
+
+      class harness final
+      {
+      public:
+        explicit harness(const sim::config &config)
+            : config_(config),
+              rng_(config.seed),
+              scheduler_(std::make_shared<virtual_scheduler>()),
+              registry_(std::make_shared<metrics::registry>())
+        {
+          auto hook = [this](std::string_view stage)
+          {
+            return stage == "match" ? run_stage(config_.match_stage, event::match_stage)
+                                    : run_stage(config_.session_stage, event::session_stage);
+          };
+          auto options = config_.options;
+          options.session = papaya::options::session_api::coroutine;
+          papaya_ = std::make_unique<papaya>(
+              config_.pending_request_size,
+              std::make_shared<fl_factory>(registry_, std::make_shared<match_factory>(hook), hook),
+              options,
+              registry_,
+              scheduler_);
+          priority_ = std::discrete_distribution<size_t>(config_.traffic.priority_mix.begin(), config_.traffic.priority_mix.end());
+        }
+
+        sim::report run()
+        {
+          auto start = scheduler_->now();
+          end_ = start + config_.traffic.duration;
+          if (config_.traffic.arrivals_per_second > 0)
+          {
+            schedule_arrival();
+          }
+          report_.scheduler_jobs = scheduler_->run();
+          report_.simulated = scheduler_->now() - start;
+
+          // Joins the dispatcher, so every callback has run.
+          papaya_.reset();
+          auto snapshot = registry_->snapshot();
+          for (const auto &counter : snapshot.counters)
+          {
+            if (counter.name == "papaya_sessions_completed_total")
+            {
+              report_.completed = counter.value;
+            }
+            else if (counter.name == "papaya_sessions_failed_total")
+            {
+              report_.failed = counter.value;
+            }
+            else if (counter.name == "papaya_deadline_misses_total")
+            {
+              report_.deadline_misses = counter.value;
+            }
+          }
+          for (const auto &histogram : snapshot.histograms)
+          {
+            if (histogram.name == "papaya_session_admission_latency_nanoseconds")
+            {
+              report_.admission_latency = histogram.value;
+            }
+          }
+          report_.trace_hash = trace_hash_;
+          return report_;
+        }
+
+      private:
+        void trace(event kind, uint64_t value)
+        {
+          auto mix = [this](uint64_t word)
+          {
+            for (int byte = 0; byte < 8; ++byte)
+            {
+              trace_hash_ ^= (word >> (8 * byte)) & 0xff;
+              trace_hash_ *= 1099511628211ull;
+            }
+          };
+          mix(static_cast<uint64_t>(scheduler_->now().time_since_epoch().count()));
+          mix(static_cast<uint64_t>(kind));
+          mix(value);
+        }
+
+        void schedule_arrival()
+        {
+          std::exponential_distribution<double> gap(config_.traffic.arrivals_per_second);
+          auto when = scheduler_->now() + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(gap(rng_)));
+          if (when >= end_)
+          {
+            return;
+          }
+          scheduler_->schedule_at(when, [this]
+                                  {
+                                    arrive();
+                                    schedule_arrival(); });
+        }
+
+        void arrive()
+        {
+          papaya::input input;
+          input.request_id = ++report_.runs;
+          input.priority = static_cast<run_priority>(priority_(rng_));
+          if (config_.traffic.deadline)
+          {
+            input.deadline = scheduler_->now() + *config_.traffic.deadline;
+          }
+          submit(std::move(input), 0);
+        }
+
+        void submit(papaya::input input, uint32_t attempt)
+        {
+          ++report_.submissions;
+          auto request_id = input.request_id;
+          if (papaya_->run(input, nullptr, nullptr, nullptr))
+          {
+            ++report_.admitted;
+            trace(event::admitted, request_id);
+            return;
+          }
+          ++report_.rejected;
+          trace(event::rejected, request_id);
+          if (attempt >= config_.traffic.max_retries)
+          {
+            ++report_.dropped;
+            return;
+          }
+          scheduler_->schedule_after(config_.traffic.retry_backoff * (int64_t{1} << std::min(attempt, 30u)),
+                                     [this, input = std::move(input), attempt]() mutable
+                                     { submit(std::move(input), attempt + 1); });
+        }
+
+        coro::task<void> run_stage(const stage_model &model, event kind)
+        {
+          auto latency = model.latency;
+          if (model.sigma > 0)
+          {
+            std::normal_distribution<double> spread(0, model.sigma);
+            latency = std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(model.latency.count()) * std::exp(spread(rng_))));
+          }
+          auto fails = model.failure_rate > 0 && std::bernoulli_distribution(model.failure_rate)(rng_);
+          trace(kind, static_cast<uint64_t>(latency.count()));
+          co_await scheduler_->sleep_for(latency);
+          if (fails)
+          {
+            trace(event::stage_failed, static_cast<uint64_t>(kind));
+            throw stage_failure("simulated stage failure");
+          }
+        }
+
+        const sim::config &config_;
+        std::mt19937_64 rng_;
+        std::discrete_distribution<size_t> priority_;
+        std::shared_ptr<virtual_scheduler> scheduler_;
+        std::shared_ptr<metrics::registry> registry_;
+        std::unique_ptr<papaya> papaya_;
+        virtual_scheduler::clock::time_point end_;
+        sim::report report_;
+        uint64_t trace_hash_ = 14695981039346656037ull;
+      };
+    }
+
+    report simulate(const config &config)
+    {
+      detail::harness harness(config);
+      return harness.run();
+    }
+  }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "papaya/metrics/metrics.hpp"
+#include "papaya/papaya.hpp"
+
+namespace pa
+{
+  namespace sim
+  {
+    /**
+     * @brief Latency and failures of one session stage.
+     */
+    struct stage_model
+    {
+      // The median latency; samples are log-normal around it with the given
+      // sigma, so 0 makes every sample equal to it.
+      std::chrono::nanoseconds latency{0};
+      double sigma = 0;
+      // Chance that the stage throws after its latency.
+      double failure_rate = 0;
+    };
+
+    /**
+     * @brief The runs submitted to papaya over the simulated period.
+     */
+    struct traffic
+    {
+      std::chrono::nanoseconds duration = std::chrono::hours(24);
+      // Poisson arrivals.
+      double arrivals_per_second = 10;
+      // Relative weights of each run_priority, best_effort first.
+      std::array<double, 4> priority_mix{0, 1, 0, 0};
+      // Each run's deadline, from its first submission. Unset for none.
+      std::optional<std::chrono::nanoseconds> deadline;
+      // A rejected run is submitted again after retry_backoff * 2^attempt,
+      // at most max_retries times.
+      uint32_t max_retries = 0;
+      std::chrono::nanoseconds retry_backoff = std::chrono::seconds(1);
+    };
+
+    struct config
+    {
+      uint64_t seed = 1;
+      sim::traffic traffic;
+      stage_model session_stage;
+      stage_model match_stage;
+      size_t pending_request_size = 16;
+      // session is always options::session_api::coroutine: rx sessions run
+      // on rxcpp's own threads and can't be simulated.
+      papaya::options options;
+    };
+
+    struct report
+    {
+      // Runs generated by the traffic, and their submissions including
+      // retries.
+      uint64_t runs = 0;
+      uint64_t submissions = 0;
+      uint64_t admitted = 0;
+      uint64_t rejected = 0;
+      // Runs that were rejected on every attempt.
+      uint64_t dropped = 0;
+      uint64_t completed = 0;
+      uint64_t failed = 0;
+      uint64_t deadline_misses = 0;
+      // Virtual nanoseconds from admission to session start.
+      metrics::histogram_snapshot admission_latency;
+      std::chrono::nanoseconds simulated{0};
+      uint64_t scheduler_jobs = 0;
+      // FNV-1a over every submission and stage event with its virtual time.
+      // Runs with equal configs, seeds included, have equal hashes.
+      uint64_t trace_hash = 0;
+    };
+
+    // Runs papaya on a virtual_scheduler against config.traffic, with the
+    // fl_factory and match_factory stages stubbed out by their models. Takes
+    // about as long as the sessions' bookkeeping, however long the
+    // simulated period.
+    report simulate(const config &config);
+  }
+}
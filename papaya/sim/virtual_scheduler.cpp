@@ -0,0 +1,88 @@
+#include "papaya/sim/virtual_scheduler.hpp"
+
+#include <algorithm>
+
+namespace pa
+{
+  namespace sim
+  {
+    namespace detail
+    {
+      // std::push_heap builds a max-heap, so "less" means "later".
+      template <typename Entry>
+      bool later(const Entry &a, const Entry &b) noexcept
+      {
+        return a.when != b.when ? a.when > b.when : a.sequence > b.sequence;
+      }
+    }
+
+    virtual_scheduler::virtual_scheduler(clock::time_point start)
+        : now_(start)
+    {
+    }
+
+    void virtual_scheduler::schedule(job job)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back({now_, next_sequence_++, std::move(job)});
+      std::push_heap(queue_.begin(), queue_.end(), detail::later<entry>);
+    }
+
+    void virtual_scheduler::schedule_at(clock::time_point when, job job)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back({std::max(when, now_), next_sequence_++, std::move(job)});
+      std::push_heap(queue_.begin(), queue_.end(), detail::later<entry>);
+    }
+
+    void virtual_scheduler::schedule_after(clock::duration delay, job job)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back({now_ + std::max(delay, clock::duration::zero()), next_sequence_++, std::move(job)});
+      std::push_heap(queue_.begin(), queue_.end(), detail::later<entry>);
+    }
+
+    virtual_scheduler::clock::time_point virtual_scheduler::now() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return now_;
+    }
+
+    bool virtual_scheduler::pop_due(clock::time_point until, entry &out)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.empty() || queue_.front().when > until)
+      {
+        return false;
+      }
+      std::pop_heap(queue_.begin(), queue_.end(), detail::later<entry>);
+      out = std::move(queue_.back());
+      queue_.pop_back();
+      now_ = out.when;
+      return true;
+    }
+
+    uint64_t virtual_scheduler::run()
+    {
+      return run_until(clock::time_point::max());
+    }
+
+    uint64_t virtual_scheduler::run_until(clock::time_point until)
+    {
+      uint64_t ran = 0;
+      entry next{};
+      while (pop_due(until, next))
+      {
+        next.job();
+        next.job = nullptr;
+        ++ran;
+      }
+      if (until != clock::time_point::max())
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        now_ = std::max(now_, until);
+      }
+      return ran;
+    }
+  }
+}
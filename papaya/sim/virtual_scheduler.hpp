@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "papaya/concurrent/scheduler.hpp"
+
+namespace pa
+{
+  namespace sim
+  {
+    /**
+     * @brief Scheduler whose clock only moves when the caller runs it.
+     *
+     * Jobs run one at a time on the thread calling run(), ordered by due time
+     * and then by the order they were scheduled, so a simulation driven only
+     * from inside its jobs replays exactly. When nothing is due the clock
+     * jumps straight to the next job, so an idle hour costs nothing.
+     */
+    class virtual_scheduler final : public concurrent::scheduler
+    {
+    public:
+      using clock = std::chrono::steady_clock;
+
+      explicit virtual_scheduler(clock::time_point start = clock::time_point{});
+
+      // Runs job at the current virtual time, after the jobs already due.
+      void schedule(job job) override;
+      void schedule_at(clock::time_point when, job job);
+      void schedule_after(clock::duration delay, job job);
+
+      clock::time_point now() const override;
+
+      // Runs jobs until none are left. Returns how many ran.
+      uint64_t run();
+      // Runs the jobs due up to until, then sets the clock to until.
+      uint64_t run_until(clock::time_point until);
+
+      // co_await sleep_for(delay) resumes the coroutine delay later in
+      // virtual time.
+      auto sleep_for(clock::duration delay) noexcept
+      {
+        struct awaiter
+        {
+          virtual_scheduler &scheduler;
+          clock::duration delay;
+
+          bool await_ready() const noexcept { return false; }
+
+          void await_suspend(std::coroutine_handle<> handle)
+          {
+            scheduler.schedule_after(delay, [handle]
+                                     { handle.resume(); });
+          }
+
+          void await_resume() const noexcept {}
+        };
+        return awaiter{*this, delay};
+      }
+
+    private:
+      struct entry
+      {
+        clock::time_point when;
+        uint64_t sequence;
+        concurrent::scheduler::job job;
+      };
+
+      // Pops the earliest entry due no later than until into out.
+      bool pop_due(clock::time_point until, entry &out);
+
+      mutable std::mutex mutex_;
+      clock::time_point now_;
+      uint64_t next_sequence_ = 0;
+      // Min-heap on (when, sequence).
+      std::vector<entry> queue_;
+    };
+  }
+}
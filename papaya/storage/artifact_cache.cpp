@@ -0,0 +1,384 @@
+#include "papaya/storage/artifact_cache.hpp"
+
+#include "papaya/storage/file_io.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+namespace pa
+{
+  namespace storage
+  {
+    namespace detail
+    {
+      struct mapping
+      {
+        std::string hash;
+        const char *data = nullptr;
+        size_t size = 0;
+
+        ~mapping()
+        {
+          if (size > 0)
+          {
+            ::munmap(const_cast<char *>(data), size);
+          }
+        }
+      };
+
+      constexpr std::array<uint32_t, 64> sha256_k = {
+          0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+          0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+          0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+          0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+          0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+          0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+          0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+          0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+      inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+      void sha256_block(std::array<uint32_t, 8> &state, const unsigned char *block)
+      {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+        {
+          w[i] = uint32_t{block[4 * i]} << 24 | uint32_t{block[4 * i + 1]} << 16 |
+                 uint32_t{block[4 * i + 2]} << 8 | uint32_t{block[4 * i + 3]};
+        }
+        for (int i = 16; i < 64; ++i)
+        {
+          auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+          auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+          w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        auto [a, b, c, d, e, f, g, h] = state;
+        for (int i = 0; i < 64; ++i)
+        {
+          auto s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+          auto choose = (e & f) ^ (~e & g);
+          auto t1 = h + s1 + choose + sha256_k[i] + w[i];
+          auto s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+          auto majority = (a & b) ^ (a & c) ^ (b & c);
+          auto t2 = s0 + majority;
+          h = g;
+          g = f;
+          f = e;
+          e = d + t1;
+          d = c;
+          c = b;
+          b = a;
+          a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+      }
+
+      bool is_hash(std::string_view name)
+      {
+        return name.size() == 64 && std::all_of(name.begin(), name.end(), [](char c)
+                                                { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+      }
+    }
+
+    std::string content_hash(std::string_view bytes)
+    {
+      std::array<uint32_t, 8> state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+      auto *data = reinterpret_cast<const unsigned char *>(bytes.data());
+      size_t full = bytes.size() / 64 * 64;
+      for (size_t offset = 0; offset < full; offset += 64)
+      {
+        detail::sha256_block(state, data + offset);
+      }
+
+      // The tail, a 1 bit, zeros, and the length in bits in one or two blocks.
+      unsigned char tail[128] = {};
+      auto rest = bytes.size() - full;
+      std::memcpy(tail, data + full, rest);
+      tail[rest] = 0x80;
+      size_t tail_size = rest + 1 + 8 <= 64 ? 64 : 128;
+      uint64_t bits = uint64_t{bytes.size()} * 8;
+      for (int i = 0; i < 8; ++i)
+      {
+        tail[tail_size - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+      }
+      for (size_t offset = 0; offset < tail_size; offset += 64)
+      {
+        detail::sha256_block(state, tail + offset);
+      }
+
+      static constexpr char digits[] = "0123456789abcdef";
+      std::string hex;
+      hex.reserve(64);
+      for (auto word : state)
+      {
+        for (int shift = 28; shift >= 0; shift -= 4)
+        {
+          hex.push_back(digits[(word >> shift) & 0xf]);
+        }
+      }
+      return hex;
+    }
+
+    std::string_view artifact::bytes() const noexcept
+    {
+      return mapping_ ? std::string_view(mapping_->data, mapping_->size) : std::string_view{};
+    }
+
+    const std::string &artifact::hash() const noexcept
+    {
+      static const std::string none;
+      return mapping_ ? mapping_->hash : none;
+    }
+
+    double artifact_cache::stats::hit_rate() const noexcept
+    {
+      auto lookups = hits + misses;
+      return lookups == 0 ? 0 : static_cast<double>(hits) / static_cast<double>(lookups);
+    }
+
+    artifact_cache::artifact_cache(std::string directory, options options)
+        : directory_(std::move(directory)), options_(options)
+    {
+      namespace fs = std::filesystem;
+      fs::create_directories(directory_);
+
+      std::vector<std::pair<fs::file_time_type, std::string>> found;
+      for (const auto &file : fs::directory_iterator(directory_))
+      {
+        auto name = file.path().filename().string();
+        if (name.find(".tmp.") != std::string::npos)
+        {
+          // Left behind by a put() that didn't finish.
+          std::error_code ignored;
+          fs::remove(file.path(), ignored);
+        }
+        else if (file.is_regular_file() && detail::is_hash(name))
+        {
+          found.emplace_back(file.last_write_time(), name);
+          entries_[name].size = file.file_size();
+          stats_.bytes += entries_[name].size;
+        }
+      }
+      std::sort(found.begin(), found.end());
+      for (auto &[time, hash] : found)
+      {
+        entries_[hash].recency = recency_.insert(recency_.end(), hash);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      evict_locked();
+    }
+
+    artifact artifact_cache::find(std::string_view hash)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(std::string(hash));
+      if (it == entries_.end())
+      {
+        ++stats_.misses;
+        return artifact();
+      }
+      ++stats_.hits;
+      touch_locked(it->second);
+      return open_locked(it->first, it->second);
+    }
+
+    artifact artifact_cache::put(std::string_view bytes)
+    {
+      auto hash = content_hash(bytes);
+      std::string temporary;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(hash);
+        if (it != entries_.end())
+        {
+          touch_locked(it->second);
+          return open_locked(it->first, it->second);
+        }
+        temporary = path_of(hash) + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(next_temporary_++);
+      }
+
+      // Written outside the lock; concurrent puts of the same bytes each
+      // write their own temporary and the last rename wins.
+      auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if (fd < 0)
+      {
+        detail::throw_errno("open " + temporary);
+      }
+      try
+      {
+        detail::write_all(fd, bytes.data(), bytes.size(), temporary);
+        detail::sync_data(fd);
+      }
+      catch (...)
+      {
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        throw;
+      }
+      ::close(fd);
+      auto path = path_of(hash);
+      if (::rename(temporary.c_str(), path.c_str()) != 0)
+      {
+        auto error = errno;
+        ::unlink(temporary.c_str());
+        throw std::system_error(error, std::generic_category(), "rename " + temporary);
+      }
+      detail::sync_parent_directory(path);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto [it, inserted] = entries_.try_emplace(hash);
+      if (inserted)
+      {
+        it->second.size = bytes.size();
+        it->second.recency = recency_.insert(recency_.end(), hash);
+        stats_.bytes += bytes.size();
+      }
+      else
+      {
+        touch_locked(it->second);
+      }
+      // Opened before evicting so the new artifact is in use and stays.
+      auto result = open_locked(it->first, it->second);
+      evict_locked();
+      return result;
+    }
+
+    artifact artifact_cache::get(std::string_view hash, const std::function<std::string()> &fetch)
+    {
+      std::promise<artifact> promise;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(std::string(hash));
+        if (it != entries_.end())
+        {
+          ++stats_.hits;
+          touch_locked(it->second);
+          return open_locked(it->first, it->second);
+        }
+        // Another session is fetching it: wait for that instead.
+        auto pending = fetching_.find(std::string(hash));
+        if (pending != fetching_.end())
+        {
+          ++stats_.hits;
+          auto future = pending->second;
+          lock.unlock();
+          return future.get();
+        }
+        ++stats_.misses;
+        fetching_.emplace(std::string(hash), promise.get_future().share());
+      }
+
+      try
+      {
+        auto bytes = fetch();
+        if (content_hash(bytes) != hash)
+        {
+          throw std::runtime_error("fetched artifact doesn't match hash " + std::string(hash));
+        }
+        auto result = put(bytes);
+        promise.set_value(result);
+        std::lock_guard<std::mutex> lock(mutex_);
+        fetching_.erase(std::string(hash));
+        return result;
+      }
+      catch (...)
+      {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(mutex_);
+        fetching_.erase(std::string(hash));
+        throw;
+      }
+    }
+
+    artifact_cache::stats artifact_cache::statistics() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto result = stats_;
+      result.artifacts = entries_.size();
+      return result;
+    }
+
+    artifact artifact_cache::open_locked(const std::string &hash, entry &entry)
+    {
+      if (auto shared = entry.mapping.lock())
+      {
+        return artifact(std::move(shared));
+      }
+
+      auto path = path_of(hash);
+      auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+      {
+        detail::throw_errno("open " + path);
+      }
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+      {
+        auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "stat " + path);
+      }
+      auto mapped = std::make_shared<detail::mapping>();
+      mapped->hash = hash;
+      mapped->size = static_cast<size_t>(st.st_size);
+      if (mapped->size > 0)
+      {
+        auto *data = ::mmap(nullptr, mapped->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+          auto error = errno;
+          ::close(fd);
+          mapped->size = 0;
+          throw std::system_error(error, std::generic_category(), "mmap " + path);
+        }
+        mapped->data = static_cast<const char *>(data);
+      }
+      // The mapping keeps the file's pages; the descriptor isn't needed.
+      ::close(fd);
+      entry.mapping = mapped;
+      return artifact(std::move(mapped));
+    }
+
+    void artifact_cache::touch_locked(entry &entry)
+    {
+      recency_.splice(recency_.end(), recency_, entry.recency);
+    }
+
+    void artifact_cache::evict_locked()
+    {
+      for (auto it = recency_.begin(); it != recency_.end() && stats_.bytes > options_.byte_budget;)
+      {
+        auto &entry = entries_.at(*it);
+        if (!entry.mapping.expired())
+        {
+          ++it;
+          continue;
+        }
+        ::unlink(path_of(*it).c_str());
+        stats_.bytes -= entry.size;
+        ++stats_.evictions;
+        entries_.erase(*it);
+        it = recency_.erase(it);
+      }
+    }
+
+    std::string artifact_cache::path_of(std::string_view hash) const
+    {
+      return directory_ + "/" + std::string(hash);
+    }
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace pa
+{
+  namespace storage
+  {
+    // Lowercase hex SHA-256 of bytes; artifacts are cached under it.
+    std::string content_hash(std::string_view bytes);
+
+    namespace detail
+    {
+      struct mapping;
+    }
+
+    /**
+     * @brief Refcounted handle to a cached artifact's read-only mapping.
+     *
+     * Handles of one artifact share a single mapping, which stays valid
+     * while any handle does, even if the cache evicts or is destroyed.
+     */
+    class artifact final
+    {
+    public:
+      artifact() = default;
+
+      std::string_view bytes() const noexcept;
+      // Empty for a default-constructed handle.
+      const std::string &hash() const noexcept;
+      explicit operator bool() const noexcept { return mapping_ != nullptr; }
+
+    private:
+      friend class artifact_cache;
+      explicit artifact(std::shared_ptr<const detail::mapping> mapping) : mapping_(std::move(mapping)) {}
+
+      std::shared_ptr<const detail::mapping> mapping_;
+    };
+
+    /**
+     * @brief On-disk cache of immutable artifacts, e.g. model graphs, keyed
+     * by content hash.
+     *
+     * Each artifact is one file named after its hash, written to a temporary
+     * file, synced and renamed into place, so readers never see a partial
+     * one. Reads map the file read-only and shared; sessions asking for the
+     * same artifact at once get the same mapping.
+     *
+     * Files are evicted least recently used first once they add up to more
+     * than byte_budget. Artifacts with live handles are skipped, so the
+     * cache can stay over budget while they're in use.
+     *
+     * Thread-safe. Misses for the same hash are coalesced into one fetch.
+     */
+    class artifact_cache final
+    {
+    public:
+      struct options
+      {
+        uint64_t byte_budget = uint64_t{1} << 30;
+      };
+
+      struct stats
+      {
+        // Lookups served without a fetch, including get()s that waited on
+        // another caller's fetch.
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        // Files on disk and their total size.
+        uint64_t artifacts = 0;
+        uint64_t bytes = 0;
+
+        double hit_rate() const noexcept;
+      };
+
+      // Opens or creates the cache in directory and indexes the files
+      // already there, oldest first.
+      // Throws std::system_error when the directory can't be created.
+      artifact_cache(std::string directory, options options);
+      explicit artifact_cache(std::string directory) : artifact_cache(std::move(directory), options{}) {}
+
+      artifact_cache(const artifact_cache &) = delete;
+      artifact_cache &operator=(const artifact_cache &) = delete;
+
+      // The cached artifact with this hash, or an empty handle.
+      artifact find(std::string_view hash);
+      // Caches bytes unless already there and returns the cached artifact.
+      artifact put(std::string_view bytes);
+      // find(hash), or else fetch() and put() what it returns. Throws
+      // std::runtime_error if the fetched bytes don't hash to hash.
+      artifact get(std::string_view hash, const std::function<std::string()> &fetch);
+
+      stats statistics() const;
+
+    private:
+      struct entry
+      {
+        uint64_t size;
+        // Shared by every live handle; expired when there are none.
+        std::weak_ptr<const detail::mapping> mapping;
+        std::list<std::string>::iterator recency;
+      };
+
+      // The caller must hold mutex_.
+      artifact open_locked(const std::string &hash, entry &entry);
+      void touch_locked(entry &entry);
+      void evict_locked();
+      std::string path_of(std::string_view hash) const;
+
+      const std::string directory_;
+      const options options_;
+
+      mutable std::mutex mutex_;
+      std::unordered_map<std::string, entry> entries_;
+      // Hashes, least recently used first.
+      std::list<std::string> recency_;
+      std::unordered_map<std::string, std::shared_future<artifact>> fetching_;
+      stats stats_;
+      uint64_t next_temporary_ = 0;
+    };
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+namespace pa
+{
+  namespace storage
+  {
+    // POSIX file helpers shared by the journal and the artifact cache.
+    namespace detail
+    {
+      [[noreturn]] inline void throw_errno(const std::string &what)
+      {
+        throw std::system_error(errno, std::generic_category(), what);
+      }
+
+      // Throws std::system_error when the data didn't reach the disk, e.g.
+      // on EIO or ENOSPC.
+      inline void sync_data(int fd)
+      {
+        // Linux tracks pages dirtied through a shared mapping, so this also
+        // flushes what was written into the mapping.
+#if defined(__APPLE__)
+        if (::fsync(fd) != 0)
+#else
+        if (::fdatasync(fd) != 0)
+#endif
+        {
+          throw_errno("fdatasync");
+        }
+      }
+
+      // Makes a rename durable. A directory that can't be opened is skipped;
+      // one that fails to sync throws std::system_error.
+      inline void sync_parent_directory(const std::string &path)
+      {
+        auto slash = path.find_last_of('/');
+        auto dir = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+        auto fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+          auto synced = ::fsync(fd) == 0;
+          auto error = errno;
+          ::close(fd);
+          if (!synced)
+          {
+            throw std::system_error(error, std::generic_category(), "fsync " + dir);
+          }
+        }
+      }
+
+      inline void write_all(int fd, const char *data, size_t size, const std::string &path)
+      {
+        while (size > 0)
+        {
+          auto written = ::write(fd, data, size);
+          if (written < 0)
+          {
+            if (errno == EINTR)
+            {
+              continue;
+            }
+            throw_errno("write " + path);
+          }
+          data += written;
+          size -= static_cast<size_t>(written);
+        }
+      }
+    }
+  }
+}
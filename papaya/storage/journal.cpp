@@ -0,0 +1,482 @@
+#include "papaya/storage/journal.hpp"
+
+#include "papaya/storage/file_io.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace pa
+{
+  namespace storage
+  {
+    namespace detail
+    {
+      constexpr char file_magic[8] = {'P', 'A', 'P', 'A', 'Y', 'A', 'J', '1'};
+      constexpr size_t header_size = 64;
+      constexpr uint32_t record_magic = 0x5041524eu;
+
+      enum record_type : uint32_t
+      {
+        admitted = 1,
+        completed = 2
+      };
+
+      struct record
+      {
+        uint32_t magic;
+        uint32_t type;
+        uint64_t request_id;
+        uint64_t sequence;
+        uint32_t restrictions;
+        // CRC-32 of every field above.
+        uint32_t crc;
+      };
+      static_assert(sizeof(record) == 32);
+      constexpr size_t crc_size = offsetof(record, crc);
+
+      constexpr std::array<uint32_t, 256> make_crc_table()
+      {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          auto c = i;
+          for (int k = 0; k < 8; ++k)
+          {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+          }
+          table[i] = c;
+        }
+        return table;
+      }
+      constexpr auto crc_table = make_crc_table();
+
+      uint32_t crc32(const void *data, size_t size)
+      {
+        auto *bytes = static_cast<const unsigned char *>(data);
+        uint32_t c = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i)
+        {
+          c = crc_table[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+        }
+        return c ^ 0xFFFFFFFFu;
+      }
+
+      record make_record(uint32_t type, uint64_t request_id, uint64_t sequence, uint32_t restrictions)
+      {
+        record r{record_magic, type, request_id, sequence, restrictions, 0};
+        r.crc = crc32(&r, crc_size);
+        return r;
+      }
+    }
+
+    journal::journal(std::string path, options options)
+        : path_(std::move(path)), options_(options)
+    {
+      open_file(path_, true);
+      committer_ = std::thread([this]
+                               { commit_loop(); });
+    }
+
+    journal::~journal() noexcept
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      work_.notify_one();
+      committer_.join();
+      close_file();
+    }
+
+    void journal::open_file(const std::string &path, bool replay)
+    {
+      fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (fd_ < 0)
+      {
+        detail::throw_errno("open " + path);
+      }
+      struct stat st;
+      if (::fstat(fd_, &st) != 0)
+      {
+        detail::throw_errno("fstat " + path);
+      }
+      auto file_size = static_cast<size_t>(st.st_size);
+      if (file_size < detail::header_size)
+      {
+        char header[detail::header_size] = {};
+        std::memcpy(header, detail::file_magic, sizeof(detail::file_magic));
+        if (::pwrite(fd_, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+        {
+          detail::throw_errno("write header " + path);
+        }
+        file_size = detail::header_size;
+      }
+      map(std::max(file_size, options_.grow_bytes));
+
+      if (std::memcmp(mapping_, detail::file_magic, sizeof(detail::file_magic)) != 0)
+      {
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument), path + " is not a papaya journal");
+      }
+      if (replay)
+      {
+        this->replay();
+      }
+    }
+
+    void journal::close_file() noexcept
+    {
+      if (mapping_ != nullptr)
+      {
+        ::munmap(mapping_, mapped_size_);
+        mapping_ = nullptr;
+      }
+      if (fd_ >= 0)
+      {
+        try
+        {
+          detail::sync_data(fd_);
+        }
+        catch (const std::system_error &)
+        {
+          // Closing anyway; what didn't reach the disk is lost either way.
+        }
+        ::close(fd_);
+        fd_ = -1;
+      }
+    }
+
+    void journal::map(size_t size)
+    {
+      // Round up to whole records past the header so a record never straddles
+      // the end of the mapping.
+      size = detail::header_size +
+             (size - detail::header_size + sizeof(detail::record) - 1) / sizeof(detail::record) * sizeof(detail::record);
+      if (::ftruncate(fd_, static_cast<off_t>(size)) != 0)
+      {
+        detail::throw_errno("ftruncate " + path_);
+      }
+      if (mapping_ != nullptr)
+      {
+        ::munmap(mapping_, mapped_size_);
+      }
+      auto *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+      if (mapping == MAP_FAILED)
+      {
+        mapping_ = nullptr;
+        detail::throw_errno("mmap " + path_);
+      }
+      mapping_ = static_cast<char *>(mapping);
+      mapped_size_ = size;
+    }
+
+    void journal::replay()
+    {
+      write_offset_ = detail::header_size;
+      record_count_ = 0;
+      live_.clear();
+      // Roughly one live run per two records in a busy journal.
+      live_.reserve((mapped_size_ - detail::header_size) / sizeof(detail::record) / 2);
+
+      while (write_offset_ + sizeof(detail::record) <= mapped_size_)
+      {
+        detail::record r;
+        std::memcpy(&r, mapping_ + write_offset_, sizeof(r));
+        if (r.magic != detail::record_magic || r.crc != detail::crc32(&r, detail::crc_size))
+        {
+          break;
+        }
+        if (r.type == detail::admitted)
+        {
+          live_[r.request_id] = live_run{r.restrictions, r.sequence};
+        }
+        else
+        {
+          live_.erase(r.request_id);
+        }
+        appended_ = std::max(appended_, r.sequence);
+        max_request_id_ = std::max(max_request_id_, r.request_id);
+        write_offset_ += sizeof(r);
+        ++record_count_;
+      }
+      durable_sequence_ = appended_;
+
+      // Clear whatever follows the last good record, e.g. records of a torn
+      // batch, so they can't resurface once new appends reach them. Only
+      // non-zero records are written to keep the clean tail's pages clean.
+      static constexpr char zero_record[sizeof(detail::record)] = {};
+      auto cleared = false;
+      for (auto offset = write_offset_; offset + sizeof(detail::record) <= mapped_size_; offset += sizeof(detail::record))
+      {
+        if (std::memcmp(mapping_ + offset, zero_record, sizeof(zero_record)) != 0)
+        {
+          std::memset(mapping_ + offset, 0, sizeof(zero_record));
+          cleared = true;
+        }
+      }
+      if (cleared)
+      {
+        detail::sync_data(fd_);
+      }
+    }
+
+    uint64_t journal::admitted(uint64_t request_id, uint32_t restrictions)
+    {
+      uint64_t ticket;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = append_locked(detail::admitted, request_id, restrictions);
+        live_[request_id] = live_run{restrictions, ticket};
+      }
+      work_.notify_one();
+      return ticket;
+    }
+
+    uint64_t journal::completed(uint64_t request_id)
+    {
+      uint64_t ticket;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = append_locked(detail::completed, request_id, 0);
+        live_.erase(request_id);
+      }
+      work_.notify_one();
+      return ticket;
+    }
+
+    uint64_t journal::append_locked(uint32_t type, uint64_t request_id, uint32_t restrictions)
+    {
+      if (error_)
+      {
+        // Nothing will make it durable, and the file may be gone with a
+        // failed compaction; the ticket's wait_durable() throws.
+        max_request_id_ = std::max(max_request_id_, request_id);
+        return ++appended_;
+      }
+      if (write_offset_ + sizeof(detail::record) > mapped_size_)
+      {
+        map(mapped_size_ + options_.grow_bytes);
+      }
+      auto sequence = ++appended_;
+      auto r = detail::make_record(type, request_id, sequence, restrictions);
+      std::memcpy(mapping_ + write_offset_, &r, sizeof(r));
+      write_offset_ += sizeof(r);
+      ++record_count_;
+      max_request_id_ = std::max(max_request_id_, request_id);
+      if (compacting_)
+      {
+        auto *bytes = reinterpret_cast<const char *>(&r);
+        appended_during_compaction_.insert(appended_during_compaction_.end(), bytes, bytes + sizeof(r));
+      }
+      return sequence;
+    }
+
+    void journal::wait_durable(uint64_t ticket)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_.notify_one();
+      durable_.wait(lock, [&]
+                    { return durable_sequence_ >= ticket || error_; });
+      if (durable_sequence_ < ticket)
+      {
+        std::rethrow_exception(error_);
+      }
+    }
+
+    std::vector<journal::entry> journal::pending() const
+    {
+      std::vector<std::pair<uint64_t, entry>> by_sequence;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        by_sequence.reserve(live_.size());
+        for (const auto &[request_id, run] : live_)
+        {
+          by_sequence.push_back({run.sequence, entry{request_id, run.restrictions}});
+        }
+      }
+      std::sort(by_sequence.begin(), by_sequence.end(), [](const auto &a, const auto &b)
+                { return a.first < b.first; });
+      std::vector<entry> result;
+      result.reserve(by_sequence.size());
+      for (const auto &e : by_sequence)
+      {
+        result.push_back(e.second);
+      }
+      return result;
+    }
+
+    uint64_t journal::max_request_id() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return max_request_id_;
+    }
+
+    void journal::compact()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto target = compactions_ + 1;
+      compaction_requested_ = true;
+      work_.notify_one();
+      durable_.wait(lock, [&]
+                    { return compactions_ >= target || error_; });
+      if (compactions_ < target)
+      {
+        std::rethrow_exception(error_);
+      }
+    }
+
+    bool journal::should_compact_locked() const
+    {
+      if (write_offset_ < options_.compaction_min_bytes || record_count_ == 0)
+      {
+        return false;
+      }
+      auto dead = record_count_ - std::min(record_count_, live_.size());
+      return static_cast<double>(dead) / static_cast<double>(record_count_) >= options_.compaction_dead_ratio;
+    }
+
+    void journal::compact_locked(std::unique_lock<std::mutex> &lock)
+    {
+      // Write the live runs into a new file without holding the lock; appends
+      // made meanwhile go to both files.
+      std::vector<std::pair<uint64_t, entry>> live;
+      live.reserve(live_.size());
+      for (const auto &[request_id, run] : live_)
+      {
+        live.push_back({run.sequence, entry{request_id, run.restrictions}});
+      }
+      compacting_ = true;
+      lock.unlock();
+
+      std::sort(live.begin(), live.end(), [](const auto &a, const auto &b)
+                { return a.first < b.first; });
+      std::vector<char> image(detail::header_size + live.size() * sizeof(detail::record), 0);
+      std::memcpy(image.data(), detail::file_magic, sizeof(detail::file_magic));
+      auto *out = image.data() + detail::header_size;
+      for (const auto &[sequence, e] : live)
+      {
+        auto r = detail::make_record(detail::admitted, e.request_id, sequence, e.restrictions);
+        std::memcpy(out, &r, sizeof(r));
+        out += sizeof(r);
+      }
+
+      auto tmp_path = path_ + ".compact";
+      auto tmp_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      auto ok = tmp_fd >= 0;
+      if (ok)
+      {
+        try
+        {
+          detail::write_all(tmp_fd, image.data(), image.size(), tmp_path);
+        }
+        catch (const std::system_error &)
+        {
+          ok = false;
+        }
+      }
+
+      lock.lock();
+      if (ok)
+      {
+        try
+        {
+          detail::write_all(tmp_fd, appended_during_compaction_.data(), appended_during_compaction_.size(), tmp_path);
+          detail::sync_data(tmp_fd);
+          ok = ::rename(tmp_path.c_str(), path_.c_str()) == 0;
+        }
+        catch (const std::system_error &)
+        {
+          ok = false;
+        }
+      }
+      if (tmp_fd >= 0)
+      {
+        ::close(tmp_fd);
+      }
+      auto compacted_records = live.size() + appended_during_compaction_.size() / sizeof(detail::record);
+      compacting_ = false;
+      appended_during_compaction_.clear();
+      ++compactions_;
+
+      if (!ok)
+      {
+        // Keep appending to the old file; it's still complete.
+        ::unlink(tmp_path.c_str());
+        return;
+      }
+      detail::sync_parent_directory(path_);
+      close_file();
+      open_file(path_, false);
+      write_offset_ = detail::header_size + compacted_records * sizeof(detail::record);
+      record_count_ = compacted_records;
+      // Everything in the new file was synced before the rename.
+      durable_sequence_ = appended_;
+    }
+
+    void journal::commit_loop()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      try
+      {
+        commit_batches(lock);
+      }
+      catch (...)
+      {
+        // Thrown with or without the lock; keep the error for the waiters
+        // and stop, as the file's state on disk is now unknown.
+        if (!lock.owns_lock())
+        {
+          lock.lock();
+        }
+        error_ = std::current_exception();
+        durable_.notify_all();
+      }
+    }
+
+    void journal::commit_batches(std::unique_lock<std::mutex> &lock)
+    {
+      while (true)
+      {
+        work_.wait(lock, [&]
+                   { return stopping_ || appended_ > durable_sequence_ || compaction_requested_; });
+
+        if (appended_ > durable_sequence_)
+        {
+          if (options_.commit_window.count() > 0 && !stopping_)
+          {
+            lock.unlock();
+            std::this_thread::sleep_for(options_.commit_window);
+            lock.lock();
+          }
+          // Everything appended so far goes into this batch; appends made
+          // while syncing wait for the next one.
+          auto target = appended_;
+          auto fd = fd_;
+          lock.unlock();
+          detail::sync_data(fd);
+          lock.lock();
+          durable_sequence_ = std::max(durable_sequence_, target);
+          durable_.notify_all();
+        }
+
+        if (compaction_requested_ || should_compact_locked())
+        {
+          compaction_requested_ = false;
+          compact_locked(lock);
+          durable_.notify_all();
+        }
+
+        if (stopping_ && appended_ == durable_sequence_)
+        {
+          return;
+        }
+      }
+    }
+  }
+}
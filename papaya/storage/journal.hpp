@@ -0,0 +1,130 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace pa
+{
+  namespace storage
+  {
+    /**
+     * @brief Append-only, memory-mapped log of admitted and completed runs.
+     *
+     * Each record is 32 fixed bytes with a CRC, written straight into a shared
+     * mapping of the file. A committer thread makes appends durable with one
+     * fdatasync per batch (group commit) and, when most records are dead,
+     * rewrites the live ones into a fresh file in the background.
+     *
+     * Opening a journal replays it in one sequential scan and stops at the
+     * first torn or corrupt record, so a crash mid-append loses at most the
+     * records that weren't durable yet.
+     *
+     * The first I/O error of the committer, e.g. a failed fdatasync, stops
+     * it for good: records not yet durable never will be, so their
+     * wait_durable() calls throw that error, as do later ones.
+     */
+    class journal final
+    {
+    public:
+      struct options
+      {
+        // The file and its mapping grow in steps of this many bytes.
+        size_t grow_bytes = size_t{4} << 20;
+        // The committer waits this long after the first append of a batch
+        // before syncing, trading latency for bigger batches.
+        std::chrono::microseconds commit_window{0};
+        // Compact once dead records make up this share of the file...
+        double compaction_dead_ratio = 0.5;
+        // ...and the file is at least this big.
+        size_t compaction_min_bytes = size_t{1} << 20;
+      };
+
+      struct entry
+      {
+        uint64_t request_id;
+        // restriction bit mask, see pa::to_mask().
+        uint32_t restrictions;
+      };
+
+      // Opens or creates the journal at path and replays it.
+      // Throws std::system_error when the file can't be opened or mapped.
+      explicit journal(std::string path, options options);
+      explicit journal(std::string path) : journal(std::move(path), options{}) {}
+      // Syncs what's been appended, then closes the file.
+      ~journal() noexcept;
+
+      journal(const journal &) = delete;
+      journal &operator=(const journal &) = delete;
+
+      // Both return a ticket for wait_durable(). They only copy 32 bytes into
+      // the mapping; durability comes with the next group commit.
+      uint64_t admitted(uint64_t request_id, uint32_t restrictions);
+      uint64_t completed(uint64_t request_id);
+      // Blocks until the record of ticket (and all before it) is on disk.
+      // Throws the committer's std::system_error if it failed first.
+      void wait_durable(uint64_t ticket);
+
+      // Runs admitted but not completed, in admission order.
+      std::vector<entry> pending() const;
+      // The largest request ID ever journaled, 0 if none.
+      uint64_t max_request_id() const;
+      // Rewrites the file with only the pending runs and waits for it.
+      // Throws the committer's std::system_error if it failed first.
+      void compact();
+
+    private:
+      struct live_run
+      {
+        uint32_t restrictions;
+        uint64_t sequence;
+      };
+
+      void open_file(const std::string &path, bool replay);
+      void close_file() noexcept;
+      void map(size_t size);
+      void replay();
+      uint64_t append_locked(uint32_t type, uint64_t request_id, uint32_t restrictions);
+      bool should_compact_locked() const;
+      void compact_locked(std::unique_lock<std::mutex> &lock);
+      void commit_loop();
+      void commit_batches(std::unique_lock<std::mutex> &lock);
+
+      const std::string path_;
+      const options options_;
+
+      mutable std::mutex mutex_;
+      std::condition_variable work_;
+      std::condition_variable durable_;
+
+      int fd_ = -1;
+      char *mapping_ = nullptr;
+      size_t mapped_size_ = 0;
+      size_t write_offset_ = 0;
+      size_t record_count_ = 0;
+
+      // Sequence numbers double as tickets: appended_ is the last record
+      // written into the mapping, durable_sequence_ the last one synced.
+      uint64_t appended_ = 0;
+      uint64_t durable_sequence_ = 0;
+      uint64_t max_request_id_ = 0;
+      std::unordered_map<uint64_t, live_run> live_;
+      // Records appended while a compaction writes the new file.
+      bool compacting_ = false;
+      std::vector<char> appended_during_compaction_;
+      bool compaction_requested_ = false;
+      uint64_t compactions_ = 0;
+
+      bool stopping_ = false;
+      // Set when the committer failed and stopped.
+      std::exception_ptr error_;
+      std::thread committer_;
+    };
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <rxcpp/rx.hpp>
+
+#include "papaya/trace/tracer.hpp"
+
+namespace pa
+{
+  namespace trace
+  {
+    // Records each subscription to source as a span named name, from
+    // subscribe until it terminates; the rx counterpart of a span around a
+    // coroutine stage. name must have static storage duration.
+    template <typename T, typename SourceOperator>
+    auto traced(rxcpp::observable<T, SourceOperator> source, const char *name) -> rxcpp::observable<T>
+    {
+      return rxcpp::observable<>::defer([source, name]()
+                                        {
+        // 0 when tracing was off at subscribe, so a span never starts at 0.
+        auto begin = enabled() ? now() : 0;
+        return source.finally([name, begin]()
+                              {
+          if (begin != 0)
+          {
+            complete(name, begin, now());
+          } }); })
+          .as_dynamic();
+    }
+  }
+}
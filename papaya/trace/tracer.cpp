@@ -0,0 +1,201 @@
+#include "papaya/trace/tracer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace pa
+{
+  namespace trace
+  {
+    namespace detail
+    {
+      struct buffer
+      {
+        uint32_t thread;
+        // Records ever written; the next goes to written % buffer_records.
+        std::atomic<uint64_t> written{0};
+        std::array<record, buffer_records> records;
+      };
+
+      // Buffers outlive their threads so their spans can still be dumped.
+      // Leaked, as threads may still record during static destruction.
+      std::mutex &buffers_mutex()
+      {
+        static auto *mutex = new std::mutex();
+        return *mutex;
+      }
+      std::vector<std::unique_ptr<buffer>> &buffers()
+      {
+        static auto *buffers = new std::vector<std::unique_ptr<buffer>>();
+        return *buffers;
+      }
+
+      buffer *register_thread()
+      {
+        std::lock_guard<std::mutex> lock(buffers_mutex());
+        auto &all = buffers();
+        all.push_back(std::make_unique<buffer>());
+        all.back()->thread = static_cast<uint32_t>(all.size());
+        return all.back().get();
+      }
+
+      void emit(const char *name, uint64_t begin, uint64_t end, uint64_t arg) noexcept
+      {
+        thread_local buffer *local = nullptr;
+        if (local == nullptr)
+        {
+          try
+          {
+            local = register_thread();
+          }
+          catch (...)
+          {
+            return;
+          }
+        }
+        auto n = local->written.load(std::memory_order_relaxed);
+        local->records[n % buffer_records] = record{name, begin, end, arg};
+        local->written.store(n + 1, std::memory_order_release);
+      }
+
+      double ticks_per_microsecond()
+      {
+#if defined(__x86_64__)
+        // The TSC runs at a constant rate on anything recent; measure it
+        // once against steady_clock.
+        static const double rate = []
+        {
+          auto start = std::chrono::steady_clock::now();
+          auto start_ticks = now();
+          while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10))
+          {
+          }
+          auto elapsed = std::chrono::steady_clock::now() - start;
+          auto ticks = now() - start_ticks;
+          return static_cast<double>(ticks) /
+                 std::chrono::duration<double, std::micro>(elapsed).count();
+        }();
+        return rate;
+#else
+        return 1000;
+#endif
+      }
+
+      void write_json_string(std::ostream &out, const char *s)
+      {
+        out << '"';
+        for (; *s != '\0'; ++s)
+        {
+          switch (*s)
+          {
+          case '"':
+            out << "\\\"";
+            break;
+          case '\\':
+            out << "\\\\";
+            break;
+          default:
+            if (static_cast<unsigned char>(*s) < 0x20)
+            {
+              char escaped[8];
+              std::snprintf(escaped, sizeof(escaped), "\\u%04x", *s);
+              out << escaped;
+            }
+            else
+            {
+              out << *s;
+            }
+          }
+        }
+        out << '"';
+      }
+    }
+
+    void enable() noexcept { detail::enabled.store(true, std::memory_order_relaxed); }
+    void disable() noexcept { detail::enabled.store(false, std::memory_order_relaxed); }
+
+    snapshot take_snapshot()
+    {
+      snapshot result;
+      result.ticks_per_microsecond = detail::ticks_per_microsecond();
+      std::lock_guard<std::mutex> lock(detail::buffers_mutex());
+      for (const auto &buffer : detail::buffers())
+      {
+        auto written = buffer->written.load(std::memory_order_acquire);
+        auto first = written > buffer_records ? written - buffer_records : 0;
+        result.overwritten += first;
+        std::vector<record> copied;
+        copied.reserve(written - first);
+        for (auto i = first; i < written; ++i)
+        {
+          copied.push_back(buffer->records[i % buffer_records]);
+        }
+        // Whatever the owner wrapped over while we copied may be torn, and
+        // if it's still writing, so may the slot it writes next.
+        auto after = buffer->written.load(std::memory_order_acquire);
+        auto valid_from = after > buffer_records ? after - buffer_records : 0;
+        if (after != written)
+        {
+          ++valid_from;
+        }
+        for (auto i = first; i < written; ++i)
+        {
+          if (i >= valid_from)
+          {
+            result.events.push_back(event{buffer->thread, copied[i - first]});
+          }
+        }
+      }
+      return result;
+    }
+
+    void clear() noexcept
+    {
+      std::lock_guard<std::mutex> lock(detail::buffers_mutex());
+      for (const auto &buffer : detail::buffers())
+      {
+        buffer->written.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void write_chrome_json(std::ostream &out, const snapshot &snapshot)
+    {
+      auto origin = std::numeric_limits<uint64_t>::max();
+      for (const auto &e : snapshot.events)
+      {
+        origin = std::min(origin, e.record.begin);
+      }
+      auto to_microseconds = [&](uint64_t ticks)
+      {
+        return static_cast<double>(ticks) / snapshot.ticks_per_microsecond;
+      };
+
+      // Fixed notation: the default would print large offsets as 1.2e+06.
+      auto flags = out.flags();
+      auto precision = out.precision();
+      out.setf(std::ios::fixed, std::ios::floatfield);
+      out.precision(3);
+      out << "{\"traceEvents\":[";
+      bool first = true;
+      for (const auto &e : snapshot.events)
+      {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":";
+        detail::write_json_string(out, e.record.name);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << to_microseconds(e.record.begin - origin)
+            << ",\"dur\":" << to_microseconds(e.record.end > e.record.begin ? e.record.end - e.record.begin : 0)
+            << ",\"args\":{\"id\":" << e.record.arg << "}}";
+      }
+      out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"overwritten\":" << snapshot.overwritten << "}}\n";
+      out.flags(flags);
+      out.precision(precision);
+    }
+  }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace pa
+{
+  namespace trace
+  {
+    /**
+     * @brief One finished span, as stored in a thread's ring buffer.
+     *
+     * Fixed-size so recording is four stores. Timestamps are raw now()
+     * ticks; take_snapshot() works out how long a tick is.
+     */
+    struct record
+    {
+      // Must have static storage duration, e.g. a string literal.
+      const char *name;
+      uint64_t begin;
+      uint64_t end;
+      // Shown in the trace as args.id, e.g. the request id.
+      uint64_t arg;
+    };
+
+    // Records each thread keeps; older ones are overwritten.
+    constexpr size_t buffer_records = 1 << 14;
+
+    namespace detail
+    {
+      inline std::atomic<bool> enabled{false};
+
+      // Appends to the calling thread's buffer, registering it on first use.
+      void emit(const char *name, uint64_t begin, uint64_t end, uint64_t arg) noexcept;
+    }
+
+    inline bool enabled() noexcept { return detail::enabled.load(std::memory_order_relaxed); }
+    void enable() noexcept;
+    void disable() noexcept;
+
+    // TSC ticks on x86-64, CLOCK_MONOTONIC_RAW nanoseconds elsewhere. Only
+    // meaningful relative to other now() values.
+    inline uint64_t now() noexcept
+    {
+#if defined(__x86_64__)
+      return __rdtsc();
+#else
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+    }
+
+    /**
+     * @brief Records the time from construction to destruction as one span.
+     *
+     * When tracing is off, construction is a relaxed load and a branch and
+     * destruction a branch on a member, so spans can stay in hot paths.
+     * A span that ends on another thread, e.g. in a coroutine that resumed
+     * elsewhere, is recorded on the thread it ends on.
+     */
+    class span final
+    {
+    public:
+      explicit span(const char *name, uint64_t arg = 0) noexcept
+      {
+        if (enabled()) [[unlikely]]
+        {
+          name_ = name;
+          arg_ = arg;
+          begin_ = now();
+        }
+      }
+
+      ~span()
+      {
+        if (name_ != nullptr) [[unlikely]]
+        {
+          detail::emit(name_, begin_, now(), arg_);
+        }
+      }
+
+      span(const span &) = delete;
+      span &operator=(const span &) = delete;
+
+    private:
+      const char *name_ = nullptr;
+      uint64_t begin_ = 0;
+      uint64_t arg_ = 0;
+    };
+
+    // Records a span whose ends can't be scoped, e.g. time spent queued.
+    inline void complete(const char *name, uint64_t begin, uint64_t end, uint64_t arg = 0) noexcept
+    {
+      if (enabled()) [[unlikely]]
+      {
+        detail::emit(name, begin, end, arg);
+      }
+    }
+
+    struct event
+    {
+      // Small sequential ids in the order threads first recorded.
+      uint32_t thread;
+      trace::record record;
+    };
+
+    struct snapshot
+    {
+      std::vector<event> events;
+      // Records lost because a buffer wrapped before the snapshot.
+      uint64_t overwritten = 0;
+      double ticks_per_microsecond = 1;
+    };
+
+    // Copies every thread's buffer. Meant to be taken after disable(): a
+    // record being written meanwhile is dropped, but not reliably.
+    snapshot take_snapshot();
+
+    // Empties every buffer. Tracing must be off.
+    void clear() noexcept;
+
+    // Chrome trace-event JSON, which chrome://tracing and Perfetto load.
+    // Spans become complete ("X") events with times relative to the
+    // earliest one.
+    void write_chrome_json(std::ostream &out, const snapshot &snapshot);
+  }
+}
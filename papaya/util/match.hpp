@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace pa
+{
+  namespace util
+  {
+    /**
+     * @brief Merges lambdas into one overload set.
+     */
+    template <typename... Fs>
+    struct overloaded : Fs...
+    {
+      using Fs::operator()...;
+    };
+    template <typename... Fs>
+    overloaded(Fs...) -> overloaded<Fs...>;
+
+    namespace detail
+    {
+      template <typename Variant>
+      using variant_of = std::remove_cv_t<std::remove_reference_t<Variant>>;
+
+      // The I-th alternative with Variant's value category and constness.
+      template <size_t I, typename Variant>
+      using alternative_ref = decltype(std::get<I>(std::declval<Variant>()));
+
+      template <typename Visitor, typename Variant, size_t... Is>
+      constexpr bool is_exhaustive(std::index_sequence<Is...>)
+      {
+        return (std::is_invocable<Visitor &, alternative_ref<Is, Variant>>::value && ...);
+      }
+
+      template <typename Visitor, typename Variant, size_t... Is>
+      auto common_result(std::index_sequence<Is...>)
+          -> std::common_type_t<std::invoke_result_t<Visitor &, alternative_ref<Is, Variant>>...>;
+
+      template <typename R, typename Visitor, typename Variant, size_t I>
+      R invoke_alternative(Visitor &visitor, Variant &&variant)
+      {
+        // The table only calls this when index() == I, so tell the compiler
+        // the null branch of get_if can't happen.
+        auto *alternative = std::get_if<I>(&variant);
+        if (alternative == nullptr)
+        {
+          __builtin_unreachable();
+        }
+        if constexpr (std::is_lvalue_reference<Variant>::value)
+        {
+          return visitor(*alternative);
+        }
+        else
+        {
+          return visitor(std::move(*alternative));
+        }
+      }
+
+      template <typename R, typename Visitor, typename Variant, size_t... Is>
+      constexpr auto make_table(std::index_sequence<Is...>)
+      {
+        return std::array<R (*)(Visitor &, Variant &&), sizeof...(Is)>{
+            &invoke_alternative<R, Visitor, Variant, Is>...};
+      }
+    }
+
+    /**
+     * @brief Calls the handler matching the active alternative of variant.
+     *
+     * A drop-in for std::visit(overloaded{handlers...}, variant) that
+     * dispatches through a constexpr table of function pointers indexed by
+     * variant.index(). The handlers are template parameters, so nothing is
+     * type-erased and each handler can be inlined into its table entry. A
+     * variant alternative without a handler is a compile error.
+     *
+     * @return The common type of every handler's result.
+     * @throws std::bad_variant_access if variant is valueless by exception.
+     */
+    template <typename Variant, typename... Handlers>
+    decltype(auto) match(Variant &&variant, Handlers &&...handlers)
+    {
+      using visitor_type = overloaded<std::decay_t<Handlers>...>;
+      using indices = std::make_index_sequence<std::variant_size<detail::variant_of<Variant>>::value>;
+      static_assert(detail::is_exhaustive<visitor_type, Variant>(indices{}),
+                    "match(): every variant alternative needs a handler");
+      using result_type = decltype(detail::common_result<visitor_type, Variant>(indices{}));
+
+      static constexpr auto table = detail::make_table<result_type, visitor_type, Variant>(indices{});
+
+      if (variant.valueless_by_exception())
+      {
+        throw std::bad_variant_access{};
+      }
+      visitor_type visitor{std::forward<Handlers>(handlers)...};
+      return table[variant.index()](visitor, std::forward<Variant>(variant));
+    }
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace pa
+{
+  namespace util
+  {
+    template <typename Signature, size_t Capacity = 64>
+    class unique_function;
+
+    /**
+     * @brief Move-only, type-erased callable with a small buffer.
+     *
+     * Unlike std::function it doesn't require the callable to be copyable and
+     * its inline buffer is big enough for a few captured smart pointers, so
+     * e.g. a lambda capturing a std::shared_ptr never allocates. Callables
+     * that don't fit (or may throw on move) are stored on the heap.
+     *
+     * @tparam R Return type.
+     * @tparam Args Argument types.
+     * @tparam Capacity Inline buffer size in bytes.
+     */
+    template <typename R, typename... Args, size_t Capacity>
+    class unique_function<R(Args...), Capacity>
+    {
+      static_assert(Capacity >= sizeof(void *), "the buffer must at least hold a pointer");
+
+      template <typename F>
+      static constexpr bool fits_inline =
+          sizeof(F) <= Capacity &&
+          alignof(F) <= alignof(std::max_align_t) &&
+          std::is_nothrow_move_constructible<F>::value;
+
+    public:
+      unique_function() noexcept = default;
+      unique_function(std::nullptr_t) noexcept {}
+
+      template <typename F,
+                typename Fn = std::decay_t<F>,
+                typename = std::enable_if_t<!std::is_same<Fn, unique_function>::value &&
+                                            std::is_invocable_r<R, Fn &, Args...>::value>>
+      unique_function(F &&f)
+      {
+        if constexpr (fits_inline<Fn>)
+        {
+          ::new (static_cast<void *>(storage_)) Fn(std::forward<F>(f));
+          vtable_ = &inline_vtable<Fn>;
+        }
+        else
+        {
+          ::new (static_cast<void *>(storage_)) Fn *(new Fn(std::forward<F>(f)));
+          vtable_ = &heap_vtable<Fn>;
+        }
+      }
+
+      unique_function(unique_function &&other) noexcept
+      {
+        move_from(other);
+      }
+
+      unique_function &operator=(unique_function &&other) noexcept
+      {
+        if (this != &other)
+        {
+          reset();
+          move_from(other);
+        }
+        return *this;
+      }
+
+      unique_function &operator=(std::nullptr_t) noexcept
+      {
+        reset();
+        return *this;
+      }
+
+      unique_function(const unique_function &) = delete;
+      unique_function &operator=(const unique_function &) = delete;
+
+      ~unique_function()
+      {
+        reset();
+      }
+
+      R operator()(Args... args)
+      {
+        return vtable_->invoke(storage_, std::forward<Args>(args)...);
+      }
+
+      explicit operator bool() const noexcept
+      {
+        return vtable_ != nullptr;
+      }
+
+      /**
+       * @brief Whether the callable lives in the inline buffer, i.e. whether
+       * constructing this function didn't allocate.
+       */
+      bool is_inline() const noexcept
+      {
+        return vtable_ != nullptr && vtable_->is_inline;
+      }
+
+    private:
+      struct vtable
+      {
+        R (*invoke)(void *, Args &&...);
+        // Move-constructs into dst and destroys src.
+        void (*relocate)(void *dst, void *src) noexcept;
+        void (*destroy)(void *) noexcept;
+        bool is_inline;
+      };
+
+      template <typename Fn>
+      static constexpr vtable inline_vtable{
+          [](void *self, Args &&...args) -> R
+          { return (*static_cast<Fn *>(self))(std::forward<Args>(args)...); },
+          [](void *dst, void *src) noexcept
+          {
+            ::new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+          },
+          [](void *self) noexcept
+          { static_cast<Fn *>(self)->~Fn(); },
+          true};
+
+      template <typename Fn>
+      static constexpr vtable heap_vtable{
+          [](void *self, Args &&...args) -> R
+          { return (**static_cast<Fn **>(self))(std::forward<Args>(args)...); },
+          [](void *dst, void *src) noexcept
+          { ::new (dst) Fn *(*static_cast<Fn **>(src)); },
+          [](void *self) noexcept
+          { delete *static_cast<Fn **>(self); },
+          false};
+
+      void move_from(unique_function &other) noexcept
+      {
+        if (other.vtable_ != nullptr)
+        {
+          other.vtable_->relocate(storage_, other.storage_);
+          vtable_ = other.vtable_;
+          other.vtable_ = nullptr;
+        }
+      }
+
+      void reset() noexcept
+      {
+        if (vtable_ != nullptr)
+        {
+          vtable_->destroy(storage_);
+          vtable_ = nullptr;
+        }
+      }
+
+      alignas(std::max_align_t) unsigned char storage_[Capacity];
+      const vtable *vtable_ = nullptr;
+    };
+  }
+}
@@ -0,0 +1,231 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "papaya/executor/executor.hpp"
+#include "papaya/storage/artifact_cache.hpp"
+#include "test_temp_path.hpp"
+
+namespace detail
+{
+  using pa::storage::artifact_cache;
+  using pa::storage::content_hash;
+
+  // Stands in for a downloaded model graph.
+  std::string model_graph(size_t size, char fill)
+  {
+    std::string graph(size, fill);
+    for (size_t i = 0; i < size; i += 4096)
+    {
+      graph[i] = '\n';
+    }
+    return graph;
+  }
+} // namespace detail
+
+SCENARIO("Content hashes are SHA-256", "[artifact_cache]")
+{
+  THEN("they match the FIPS 180-2 test vectors")
+  {
+    REQUIRE(detail::content_hash("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    REQUIRE(detail::content_hash("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    REQUIRE(detail::content_hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    REQUIRE(detail::content_hash(std::string(1000000, 'a')) ==
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+  }
+}
+
+SCENARIO("The artifact cache shares one mapping per artifact", "[artifact_cache]")
+{
+  detail::temp_path directory{"share", ".cache"};
+  detail::artifact_cache cache{directory.path};
+  auto graph = detail::model_graph(10000, 'g');
+  auto hash = detail::content_hash(graph);
+
+  GIVEN("an artifact that was put")
+  {
+    auto put = cache.put(graph);
+
+    THEN("it's on disk under its hash and every lookup maps the same bytes")
+    {
+      REQUIRE(std::filesystem::file_size(directory.path + "/" + hash) == graph.size());
+      auto found = cache.find(hash);
+      REQUIRE(found);
+      REQUIRE(found.hash() == hash);
+      REQUIRE(found.bytes() == graph);
+      REQUIRE(found.bytes().data() == put.bytes().data());
+      REQUIRE_FALSE(cache.find(detail::content_hash("other")));
+
+      auto stats = cache.statistics();
+      REQUIRE(stats.hits == 1);
+      REQUIRE(stats.misses == 1);
+      REQUIRE(stats.hit_rate() == 0.5);
+      REQUIRE(stats.artifacts == 1);
+      REQUIRE(stats.bytes == graph.size());
+    }
+
+    THEN("a session input can refer to it instead of owning a copy")
+    {
+      pa::IExecutor::Input input;
+      REQUIRE(input.modelGraphBytes().empty());
+      input.modelGraph = "owned";
+      REQUIRE(input.modelGraphBytes() == "owned");
+      input.modelArtifact = cache.find(hash);
+      REQUIRE(input.modelGraphBytes().data() == put.bytes().data());
+    }
+
+    WHEN("the cache is opened again")
+    {
+      detail::artifact_cache reopened{directory.path};
+
+      THEN("the artifact is still there")
+      {
+        REQUIRE(reopened.find(hash).bytes() == graph);
+        REQUIRE(reopened.statistics().bytes == graph.size());
+      }
+    }
+  }
+
+  GIVEN("many sessions asking for an artifact that isn't cached yet")
+  {
+    std::atomic<int> fetches{0};
+    std::vector<std::thread> sessions;
+    std::vector<pa::storage::artifact> artifacts(8);
+    for (size_t i = 0; i < artifacts.size(); ++i)
+    {
+      sessions.emplace_back([&, i]
+                            { artifacts[i] = cache.get(hash, [&]
+                                                       {
+                                                         fetches.fetch_add(1);
+                                                         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                                                         return graph; }); });
+    }
+    for (auto &session : sessions)
+    {
+      session.join();
+    }
+
+    THEN("it's fetched once and they all share its mapping")
+    {
+      REQUIRE(fetches == 1);
+      for (auto &artifact : artifacts)
+      {
+        REQUIRE(artifact.bytes().data() == artifacts[0].bytes().data());
+      }
+      REQUIRE(cache.statistics().misses == 1);
+      REQUIRE(cache.statistics().hits == 7);
+    }
+  }
+
+  GIVEN("a fetch that returns the wrong bytes")
+  {
+    THEN("get() throws and caches nothing")
+    {
+      REQUIRE_THROWS_AS(cache.get(hash, []
+                                  { return std::string("tampered"); }),
+                        std::runtime_error);
+      REQUIRE(cache.statistics().artifacts == 0);
+    }
+  }
+}
+
+SCENARIO("The artifact cache evicts least recently used artifacts over budget", "[artifact_cache]")
+{
+  detail::temp_path directory{"evict", ".cache"};
+  detail::artifact_cache::options options;
+  options.byte_budget = 2500;
+  detail::artifact_cache cache{directory.path, options};
+  auto a = detail::content_hash(detail::model_graph(1000, 'a'));
+  auto b = detail::content_hash(detail::model_graph(1000, 'b'));
+  auto c = detail::content_hash(detail::model_graph(1000, 'c'));
+
+  GIVEN("two unused artifacts, of which the older was used last")
+  {
+    cache.put(detail::model_graph(1000, 'a'));
+    cache.put(detail::model_graph(1000, 'b'));
+    cache.find(a);
+
+    WHEN("a third one goes over budget")
+    {
+      cache.put(detail::model_graph(1000, 'c'));
+
+      THEN("the least recently used one is evicted")
+      {
+        REQUIRE_FALSE(std::filesystem::exists(directory.path + "/" + b));
+        REQUIRE(cache.find(a));
+        REQUIRE(cache.find(c));
+        REQUIRE(cache.statistics().evictions == 1);
+        REQUIRE(cache.statistics().bytes == 2000);
+      }
+    }
+  }
+
+  GIVEN("artifacts still in use")
+  {
+    auto in_use_a = cache.put(detail::model_graph(1000, 'a'));
+    auto in_use_b = cache.put(detail::model_graph(1000, 'b'));
+    auto in_use_c = cache.put(detail::model_graph(1000, 'c'));
+
+    THEN("they aren't evicted, and their mappings stay valid")
+    {
+      REQUIRE(cache.statistics().evictions == 0);
+      REQUIRE(cache.statistics().bytes == 3000);
+      REQUIRE(in_use_a.bytes() == detail::model_graph(1000, 'a'));
+
+      AND_THEN("the next put evicts those let go of since")
+      {
+        in_use_a = {};
+        cache.put(detail::model_graph(10, 'd'));
+        REQUIRE(cache.statistics().evictions == 1);
+        REQUIRE_FALSE(cache.find(a));
+      }
+    }
+  }
+}
+
+TEST_CASE("Session startup with a cold and a warm artifact cache", "[artifact_cache][!benchmark]")
+{
+  detail::temp_path directory{"benchmark", ".cache"};
+  // A 4 MiB model graph that takes a copy to "download".
+  const auto graph = detail::model_graph(size_t{4} << 20, 'm');
+  const auto hash = detail::content_hash(graph);
+  auto fetch = [&]
+  { return graph; };
+
+  BENCHMARK_ADVANCED("cold: fetch, hash, write, map")
+  (Catch::Benchmark::Chronometer meter)
+  {
+    std::filesystem::remove_all(directory.path);
+    std::vector<std::unique_ptr<detail::artifact_cache>> caches;
+    for (int i = 0; i < meter.runs(); ++i)
+    {
+      caches.push_back(std::make_unique<detail::artifact_cache>(directory.path + "/" + std::to_string(i)));
+    }
+    meter.measure([&](int i)
+                  { return caches[i]->get(hash, fetch).bytes().size(); });
+  };
+
+  detail::artifact_cache warm{directory.path + "/warm"};
+  auto held = warm.get(hash, fetch);
+  BENCHMARK("warm, mapping shared with a running session")
+  {
+    return warm.get(hash, fetch).bytes().size();
+  };
+
+  held = {};
+  BENCHMARK("warm, remapped from disk")
+  {
+    return warm.get(hash, fetch).bytes().size();
+  };
+
+  BENCHMARK("no cache: fetch into an owned modelGraph")
+  {
+    pa::IExecutor::Input input;
+    input.modelGraph = fetch();
+    return input.modelGraphBytes().size();
+  };
+}
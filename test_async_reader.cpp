@@ -0,0 +1,285 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "papaya/coro/task.hpp"
+#include "papaya/io.hpp"
+#include "test_temp_path.hpp"
+
+namespace detail
+{
+  using pa::io::async_reader;
+
+  std::string random_bytes(size_t size)
+  {
+    std::mt19937_64 random(42);
+    std::string bytes(size, '\0');
+    for (auto &c : bytes)
+    {
+      c = static_cast<char>(random());
+    }
+    return bytes;
+  }
+
+  std::unique_ptr<async_reader> make_reader(bool use_io_uring, size_t buffer_count = 0)
+  {
+    detail::async_reader::options options;
+    options.use_io_uring = use_io_uring;
+    options.queue_depth = 8;
+    options.submit_batch = 4;
+    options.buffer_count = buffer_count;
+    options.buffer_size = 4096;
+    return pa::io::make_async_reader(options);
+  }
+
+  pa::coro::task<int64_t> read_twice(async_reader &reader, int fd, std::span<char> into)
+  {
+    auto first = co_await reader.read_async(fd, into.first(into.size() / 2), 0);
+    auto second = co_await reader.read_async(fd, into.subspan(into.size() / 2), into.size() / 2);
+    co_return first + second;
+  }
+
+  // Streams [0, size) of fd through depth buffers of chunk bytes, each
+  // refilled as soon as its read completes. Returns the bytes read.
+  uint64_t stream(async_reader &reader, int fd, uint64_t size, size_t chunk, size_t depth, bool fixed)
+  {
+    std::vector<pa::io::buffer> fixed_buffers;
+    std::vector<std::vector<char>> buffers(depth);
+    for (size_t i = 0; i < depth; ++i)
+    {
+      if (fixed)
+      {
+        fixed_buffers.push_back(std::move(*reader.acquire_buffer()));
+      }
+      else
+      {
+        buffers[i].resize(chunk);
+      }
+    }
+
+    std::atomic<uint64_t> next_offset{0};
+    std::atomic<uint64_t> total{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t active = depth;
+    std::function<void(size_t)> issue = [&](size_t i)
+    {
+      auto offset = next_offset.fetch_add(chunk);
+      if (offset >= size)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--active == 0)
+        {
+          finished.notify_all();
+        }
+        return;
+      }
+      auto done = [&, i](int64_t bytes)
+      {
+        total.fetch_add(bytes > 0 ? bytes : 0);
+        issue(i);
+        reader.submit();
+      };
+      if (fixed)
+      {
+        reader.read(fd, fixed_buffers[i], offset, std::move(done));
+      }
+      else
+      {
+        reader.read(fd, std::span<char>(buffers[i]), offset, std::move(done));
+      }
+    };
+    for (size_t i = 0; i < depth; ++i)
+    {
+      issue(i);
+    }
+    reader.submit();
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]
+                  { return active == 0; });
+    return total;
+  }
+} // namespace detail
+
+SCENARIO("The async reader reads files on either backend", "[async_io]")
+{
+  auto use_io_uring = GENERATE(true, false);
+  auto reader = detail::make_reader(use_io_uring, 4);
+  auto contents = detail::random_bytes(300000);
+  detail::temp_path file{"async_read", ".bin"};
+  std::ofstream(file.path, std::ios::binary).write(contents.data(), static_cast<std::streamsize>(contents.size()));
+
+  GIVEN((use_io_uring ? "io_uring, if the kernel has it" : "the thread-pool fallback"))
+  {
+    if (!use_io_uring)
+    {
+      REQUIRE(reader->kind() == detail::async_reader::backend::thread_pool);
+    }
+
+    THEN("read_file() keeps many chunk reads in flight and returns the whole file")
+    {
+      REQUIRE(pa::io::read_file(*reader, file.path, 4096) == contents);
+      REQUIRE(pa::io::read_file(*reader, file.path, 1 << 20) == contents);
+    }
+
+    THEN("fixed buffers can be read into and are returned when let go")
+    {
+      auto fd = ::open(file.path.c_str(), O_RDONLY);
+      std::vector<pa::io::buffer> buffers;
+      while (auto buffer = reader->acquire_buffer())
+      {
+        buffers.push_back(std::move(*buffer));
+      }
+      REQUIRE(buffers.size() == 4);
+
+      std::promise<int64_t> read;
+      reader->read(fd, buffers[1], 8192, [&](int64_t bytes)
+                   { read.set_value(bytes); });
+      reader->submit();
+      REQUIRE(read.get_future().get() == 4096);
+      REQUIRE(std::string(buffers[1].data().data(), 4096) == contents.substr(8192, 4096));
+
+      buffers.pop_back();
+      REQUIRE(reader->acquire_buffer());
+      ::close(fd);
+    }
+
+    THEN("a coroutine can await reads")
+    {
+      auto fd = ::open(file.path.c_str(), O_RDONLY);
+      std::string into(10000, '\0');
+      std::promise<int64_t> result;
+      pa::coro::spawn(
+          detail::read_twice(*reader, fd, std::span<char>(into)),
+          [&](int64_t bytes)
+          { result.set_value(bytes); },
+          [&](std::exception_ptr error)
+          { result.set_exception(error); });
+      REQUIRE(result.get_future().get() == 10000);
+      REQUIRE(into == contents.substr(0, 10000));
+      ::close(fd);
+    }
+
+    THEN("completions can fan out into more reads than the queue depth")
+    {
+      auto fd = ::open(file.path.c_str(), O_RDONLY);
+      const int total = 200;
+      std::vector<char> into(total);
+      std::atomic<int> issued{0};
+      std::atomic<int> completed{0};
+      std::promise<void> finished;
+      std::function<void()> issue = [&]
+      {
+        auto i = issued.fetch_add(1);
+        if (i >= total)
+        {
+          return;
+        }
+        reader->read(fd, std::span<char>(&into[i], 1), i, [&](int64_t)
+                     {
+                       // Each completion reads twice, so the reads wanted at
+                       // once outgrow queue_depth.
+                       issue();
+                       issue();
+                       reader->submit();
+                       if (completed.fetch_add(1) + 1 == total)
+                       {
+                         finished.set_value();
+                       } });
+      };
+      issue();
+      reader->submit();
+      finished.get_future().get();
+      REQUIRE(std::string(into.data(), total) == contents.substr(0, total));
+      ::close(fd);
+    }
+
+    THEN("errors come back as -errno")
+    {
+      char byte;
+      std::promise<int64_t> read;
+      reader->read(-1, std::span<char>(&byte, 1), 0, [&](int64_t bytes)
+                   { read.set_value(bytes); });
+      reader->submit();
+      REQUIRE(read.get_future().get() == -EBADF);
+      REQUIRE_THROWS_AS(pa::io::read_file(*reader, file.path + ".missing"), std::system_error);
+      REQUIRE_THROWS_AS(pa::io::read_file(*reader, file.path, 0), std::system_error);
+    }
+  }
+}
+
+TEST_CASE("Streaming a multi-GB dataset from disk", "[async_io][!benchmark]")
+{
+  // Page cache is dropped for the file before each run, so the reads hit
+  // the device.
+  const uint64_t size = uint64_t{2} << 30;
+  const size_t chunk = size_t{1} << 20;
+  detail::temp_path file{"dataset", ".bin"};
+  {
+    std::ofstream out(file.path, std::ios::binary);
+    auto block = detail::random_bytes(chunk);
+    for (uint64_t written = 0; written < size; written += chunk)
+    {
+      out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+  }
+  auto fd = ::open(file.path.c_str(), O_RDONLY);
+  auto drop_cache = [&]
+  {
+    ::fdatasync(fd);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  };
+
+  BENCHMARK_ADVANCED("pread loop, 1 MiB")
+  (Catch::Benchmark::Chronometer meter)
+  {
+    drop_cache();
+    std::vector<char> buffer(chunk);
+    meter.measure([&]
+                  {
+      uint64_t total = 0;
+      for (uint64_t offset = 0; offset < size; offset += chunk)
+      {
+        total += ::pread(fd, buffer.data(), chunk, static_cast<off_t>(offset));
+      }
+      return total; });
+  };
+
+  for (bool use_io_uring : {false, true})
+  {
+    detail::async_reader::options options;
+    options.use_io_uring = use_io_uring;
+    options.queue_depth = 32;
+    options.buffer_count = 32;
+    options.buffer_size = chunk;
+    auto reader = pa::io::make_async_reader(options);
+    auto name = std::string(reader->kind() == detail::async_reader::backend::io_uring ? "io_uring" : "thread pool (4)");
+
+    BENCHMARK_ADVANCED(name + ", 32 x 1 MiB in flight")
+    (Catch::Benchmark::Chronometer meter)
+    {
+      drop_cache();
+      meter.measure([&]
+                    { return detail::stream(*reader, fd, size, chunk, 32, false); });
+    };
+
+    BENCHMARK_ADVANCED(name + ", 32 x 1 MiB in flight, fixed buffers")
+    (Catch::Benchmark::Chronometer meter)
+    {
+      drop_cache();
+      meter.measure([&]
+                    { return detail::stream(*reader, fd, size, chunk, 32, true); });
+    };
+  }
+
+  ::close(fd);
+}
@@ -0,0 +1,348 @@
+#include <array>
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "papaya/codec/schemas.hpp"
+
+namespace detail
+{
+  std::string random_string(std::mt19937 &rng, size_t max_size)
+  {
+    std::uniform_int_distribution<size_t> size(0, max_size);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::string s(size(rng), '\0');
+    for (auto &c : s)
+    {
+      c = static_cast<char>(byte(rng));
+    }
+    return s;
+  }
+
+  pa::papaya::input random_input(std::mt19937 &rng)
+  {
+    pa::papaya::input input;
+    input.restrictions = pa::from_mask(std::uniform_int_distribution<uint32_t>(0, 15)(rng));
+    input.request_id = std::uniform_int_distribution<uint64_t>()(rng) >> std::uniform_int_distribution<int>(0, 63)(rng);
+    input.priority = static_cast<pa::run_priority>(rng() % 4);
+    if (rng() % 2 == 0)
+    {
+      input.deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(rng());
+    }
+    return input;
+  }
+
+  pa::papaya::output random_output(std::mt19937 &rng)
+  {
+    pa::papaya::output output;
+    output.task_name = random_string(rng, 40);
+    auto metrics = std::uniform_int_distribution<int>(0, 8)(rng);
+    for (int i = 0; i < metrics; ++i)
+    {
+      if (rng() % 2 == 0)
+      {
+        output.metrics[random_string(rng, 12)] = std::uniform_real_distribution<float>(-1e6f, 1e6f)(rng);
+      }
+      else
+      {
+        output.metrics[random_string(rng, 12)] = random_string(rng, 24);
+      }
+    }
+    return output;
+  }
+
+  std::vector<char> encode(const pa::papaya::output &output)
+  {
+    std::vector<char> buffer(pa::codec::encoded_size(output));
+    pa::codec::encode(output, buffer);
+    return buffer;
+  }
+
+  // What we'd write without the codec: JSON by hand, numbers via %g.
+  void to_json(const pa::papaya::output &output, std::string &json)
+  {
+    auto quote = [&json](std::string_view s)
+    {
+      json += '"';
+      for (char c : s)
+      {
+        if (c == '"' || c == '\\')
+        {
+          json += '\\';
+        }
+        json += c;
+      }
+      json += '"';
+    };
+    json += "{\"task_name\":";
+    quote(output.task_name);
+    json += ",\"metrics\":{";
+    auto first = true;
+    for (const auto &[name, value] : output.metrics)
+    {
+      if (!first)
+      {
+        json += ',';
+      }
+      first = false;
+      quote(name);
+      json += ':';
+      if (auto *number = std::get_if<float>(&value))
+      {
+        char digits[32];
+        json.append(digits, std::snprintf(digits, sizeof(digits), "%.9g", *number));
+      }
+      else
+      {
+        quote(std::get<std::string>(value));
+      }
+    }
+    json += "}}";
+  }
+} // namespace detail
+
+SCENARIO("Codec round-trips random papaya messages", "[codec]")
+{
+  std::mt19937 rng(20261019);
+
+  GIVEN("1000 random inputs")
+  {
+    THEN("each one decodes to itself")
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        auto input = detail::random_input(rng);
+        std::array<char, 32> buffer;
+        auto size = pa::codec::encode(input, buffer);
+        REQUIRE(size);
+        REQUIRE(*size == pa::codec::encoded_size(input));
+
+        auto view = pa::codec::decode<pa::papaya::input>({buffer.data(), *size});
+        REQUIRE(view);
+        auto decoded = pa::codec::materialize<pa::papaya::input>(*view);
+        REQUIRE(decoded.restrictions == input.restrictions);
+        REQUIRE(decoded.request_id == input.request_id);
+        REQUIRE(decoded.priority == input.priority);
+        REQUIRE(decoded.deadline == input.deadline);
+      }
+    }
+  }
+
+  GIVEN("1000 random outputs")
+  {
+    THEN("each one decodes to itself")
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        auto output = detail::random_output(rng);
+        auto buffer = detail::encode(output);
+
+        auto view = pa::codec::decode<pa::papaya::output>(buffer);
+        REQUIRE(view);
+        auto decoded = pa::codec::materialize<pa::papaya::output>(*view);
+        REQUIRE(decoded.task_name == output.task_name);
+        REQUIRE(decoded.metrics == output.metrics);
+      }
+    }
+  }
+
+  GIVEN("executor outputs")
+  {
+    pa::IExecutor::Output failure = pa::IExecutor::Failure{-42};
+    std::array<char, 8> buffer;
+    auto size = pa::codec::encode(failure, buffer);
+
+    THEN("the variant alternative survives")
+    {
+      REQUIRE(size == 2u);
+      auto decoded = pa::codec::materialize<pa::IExecutor::Output>(*pa::codec::decode<pa::IExecutor::Output>({buffer.data(), *size}));
+      REQUIRE(pa::error_code_of(decoded) == -42);
+    }
+  }
+
+  GIVEN("a session input with restrictions")
+  {
+    pa::fl_factory::input input{{pa::using_wifi, pa::is_idle}};
+    std::array<char, 8> buffer;
+    auto size = pa::codec::encode(input, buffer);
+
+    THEN("they reach the other end")
+    {
+      REQUIRE(size);
+      auto decoded = pa::codec::materialize<pa::fl_factory::input>(*pa::codec::decode<pa::fl_factory::input>({buffer.data(), *size}));
+      REQUIRE(decoded.restrictions == input.restrictions);
+    }
+  }
+}
+
+SCENARIO("Codec decodes into views of the source buffer", "[codec]")
+{
+  GIVEN("an encoded output")
+  {
+    pa::papaya::output output{"train", {{"loss", 0.25f}, {"device", std::string("pixel")}}};
+    auto buffer = detail::encode(output);
+
+    WHEN("decoding it")
+    {
+      auto view = pa::codec::decode<pa::papaya::output>(buffer);
+
+      THEN("strings point into the buffer")
+      {
+        REQUIRE(view);
+        auto task_name = std::get<0>(*view);
+        REQUIRE(task_name == "train");
+        REQUIRE(task_name.data() >= buffer.data());
+        REQUIRE(task_name.data() < buffer.data() + buffer.size());
+      }
+
+      THEN("metrics are iterated lazily")
+      {
+        auto metrics = std::get<1>(*view);
+        REQUIRE(metrics.size() == 2);
+        size_t seen = 0;
+        for (const auto &[name, value] : metrics)
+        {
+          ++seen;
+          if (name == "loss")
+          {
+            REQUIRE(std::get<float>(value) == 0.25f);
+          }
+          else
+          {
+            REQUIRE(name == "device");
+            REQUIRE(std::get<std::string_view>(value) == "pixel");
+          }
+        }
+        REQUIRE(seen == 2);
+      }
+    }
+  }
+}
+
+SCENARIO("Codec rejects malformed buffers", "[codec]")
+{
+  std::mt19937 rng(7);
+
+  GIVEN("random outputs")
+  {
+    THEN("no strict prefix of an encoding decodes")
+    {
+      for (int i = 0; i < 200; ++i)
+      {
+        auto buffer = detail::encode(detail::random_output(rng));
+        for (size_t size = 0; size < buffer.size(); ++size)
+        {
+          REQUIRE_FALSE(pa::codec::decode<pa::papaya::output>({buffer.data(), size}));
+        }
+      }
+    }
+
+    THEN("enum values past their last enumerator are rejected")
+    {
+      pa::papaya::input input;
+      input.restrictions = {pa::using_wifi};
+      input.request_id = 1;
+      input.priority = pa::run_priority::critical;
+      std::vector<char> buffer(pa::codec::encoded_size(input));
+      REQUIRE(pa::codec::encode(input, buffer));
+      // One restriction, request_id, priority and no deadline, a varint each.
+      REQUIRE(buffer == std::vector<char>{1, pa::using_wifi, 1, static_cast<char>(pa::run_priority::critical), 0});
+      REQUIRE(pa::codec::decode<pa::papaya::input>(buffer));
+
+      auto bad_restriction = buffer;
+      bad_restriction[1] = 32;
+      REQUIRE_FALSE(pa::codec::decode<pa::papaya::input>(bad_restriction));
+      auto bad_priority = buffer;
+      bad_priority[3] = static_cast<char>(pa::run_priority::critical) + 1;
+      REQUIRE_FALSE(pa::codec::decode<pa::papaya::input>(bad_priority));
+    }
+
+    THEN("trailing bytes are rejected")
+    {
+      auto buffer = detail::encode(detail::random_output(rng));
+      buffer.push_back(0);
+      REQUIRE_FALSE(pa::codec::decode<pa::papaya::output>(buffer));
+    }
+
+    THEN("a too small buffer fails to encode")
+    {
+      auto output = detail::random_output(rng);
+      std::vector<char> buffer(pa::codec::encoded_size(output) - 1);
+      REQUIRE_FALSE(pa::codec::encode(output, buffer));
+    }
+  }
+
+  GIVEN("an unknown variant tag")
+  {
+    std::array<char, 2> buffer{2, 0};
+
+    THEN("it doesn't decode")
+    {
+      REQUIRE_FALSE(pa::codec::decode<pa::IExecutor::Output>(buffer));
+    }
+  }
+}
+
+TEST_CASE("Codec vs JSON throughput", "[codec][!benchmark]")
+{
+  std::mt19937 rng(1);
+  std::vector<pa::papaya::output> outputs;
+  size_t codec_bytes = 0;
+  size_t json_bytes = 0;
+  for (int i = 0; i < 1000; ++i)
+  {
+    outputs.push_back(detail::random_output(rng));
+    codec_bytes += pa::codec::encoded_size(outputs.back());
+    std::string json;
+    detail::to_json(outputs.back(), json);
+    json_bytes += json.size();
+  }
+  WARN("1000 outputs: " << codec_bytes << " bytes encoded, " << json_bytes << " bytes as JSON");
+
+  std::vector<char> buffer(codec_bytes);
+  std::string json;
+  json.reserve(json_bytes);
+
+  BENCHMARK("codec encode 1000 outputs")
+  {
+    size_t offset = 0;
+    for (const auto &output : outputs)
+    {
+      offset += *pa::codec::encode(output, {buffer.data() + offset, buffer.size() - offset});
+    }
+    return offset;
+  };
+
+  BENCHMARK("json encode 1000 outputs")
+  {
+    json.clear();
+    for (const auto &output : outputs)
+    {
+      detail::to_json(output, json);
+    }
+    return json.size();
+  };
+
+  std::vector<std::vector<char>> encoded;
+  for (const auto &output : outputs)
+  {
+    encoded.push_back(detail::encode(output));
+  }
+
+  BENCHMARK("codec decode and visit 1000 outputs")
+  {
+    size_t metrics = 0;
+    for (const auto &bytes : encoded)
+    {
+      auto view = pa::codec::decode<pa::papaya::output>(bytes);
+      for (const auto &metric : std::get<1>(*view))
+      {
+        metrics += metric.first.size();
+      }
+    }
+    return metrics;
+  };
+}
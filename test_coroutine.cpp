@@ -0,0 +1,136 @@
+#include <catch2/catch.hpp>
+#include <rxcpp/rx.hpp>
+#include <stdexcept>
+#include <thread>
+
+#include "papaya/concurrent/thread_pool.hpp"
+#include "papaya/coro/task.hpp"
+#include "papaya/factory/fl_factory.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/papaya.hpp"
+#include "papaya/sim/virtual_scheduler.hpp"
+
+namespace detail
+{
+  pa::coro::task<int> answer()
+  {
+    co_return 42;
+  }
+
+  pa::coro::task<int> twice()
+  {
+    auto a = co_await answer();
+    auto b = co_await answer();
+    co_return a + b;
+  }
+
+  pa::coro::task<> fail()
+  {
+    throw std::runtime_error("boom");
+    co_return;
+  }
+
+  pa::coro::task<void> suspending_stage(pa::sim::virtual_scheduler &scheduler)
+  {
+    co_await scheduler.sleep_for(std::chrono::seconds(1));
+  }
+
+  pa::coro::task<std::thread::id> thread_after_resume_on(pa::concurrent::scheduler &scheduler)
+  {
+    co_await pa::coro::resume_on(scheduler);
+    co_return std::this_thread::get_id();
+  }
+} // namespace detail
+
+SCENARIO("Coroutine tasks compose with co_await", "[coroutine]")
+{
+  GIVEN("tasks awaiting other tasks")
+  {
+    THEN("values flow back to the awaiter")
+    {
+      REQUIRE(pa::coro::sync_wait(detail::twice()) == 84);
+    }
+
+    THEN("exceptions propagate to the awaiter")
+    {
+      REQUIRE_THROWS_AS(pa::coro::sync_wait(detail::fail()), std::runtime_error);
+    }
+  }
+
+  GIVEN("a thread pool")
+  {
+    pa::concurrent::thread_pool pool{2};
+
+    THEN("resume_on continues the coroutine on a pool thread")
+    {
+      auto id = pa::coro::sync_wait(detail::thread_after_resume_on(pool));
+      REQUIRE(id != std::this_thread::get_id());
+    }
+
+    THEN("an fl session runs to completion on it")
+    {
+      pa::fl_factory factory;
+      REQUIRE_NOTHROW(pa::coro::sync_wait(factory.co_create(pa::fl_factory::input{}, pool)));
+    }
+  }
+}
+
+SCENARIO("papaya can go away while a coroutine session is suspended", "[coroutine]")
+{
+  GIVEN("a session waiting on a scheduler that outlives papaya")
+  {
+    auto scheduler = std::make_shared<pa::sim::virtual_scheduler>();
+    auto hook = [scheduler](std::string_view)
+    { return detail::suspending_stage(*scheduler); };
+    pa::papaya::options options;
+    options.session = pa::papaya::options::session_api::coroutine;
+    auto completed = std::make_shared<int>(0);
+    {
+      pa::papaya papaya{
+          1,
+          std::make_shared<pa::fl_factory>(std::make_shared<pa::metrics::registry>(), std::make_shared<pa::match_factory>(hook), hook),
+          options,
+          std::make_shared<pa::metrics::registry>(),
+          scheduler};
+      REQUIRE(papaya.run({}, nullptr, nullptr, [completed]
+                         { ++*completed; }));
+      scheduler->run_until(scheduler->now() + std::chrono::milliseconds(500));
+    }
+
+    THEN("the session finishing afterwards doesn't call into it")
+    {
+      scheduler->run();
+      REQUIRE(*completed == 0);
+    }
+  }
+}
+
+TEST_CASE("Benchmark rx vs coroutine fl sessions", "[coroutine][rx][!benchmark]")
+{
+  pa::concurrent::thread_pool pool{1};
+  pa::fl_factory factory;
+
+  auto rx_session = [&]
+  {
+    pa::fl_factory::input input;
+    return factory.create(input)
+        .subscribe_on(rxcpp::observe_on_event_loop())
+        .as_blocking()
+        .first();
+  };
+  auto coroutine_session = [&]
+  {
+    return pa::coro::sync_wait(factory.co_create(pa::fl_factory::input{}, pool));
+  };
+
+  // Allocations per session are counted by the session_allocations
+  // target, which replaces the global operator new.
+  BENCHMARK("rx session latency")
+  {
+    return rx_session();
+  };
+  BENCHMARK("coroutine session latency")
+  {
+    return coroutine_session();
+  };
+}
@@ -0,0 +1,304 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/deadline_queue.hpp"
+
+namespace detail
+{
+  using pa::concurrent::deadline_queue;
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point at(int64_t microseconds)
+  {
+    return clock::time_point{} + std::chrono::microseconds(microseconds);
+  }
+
+  struct job
+  {
+    size_t priority;
+    int64_t arrival;
+    int64_t service;
+    std::optional<int64_t> deadline;
+  };
+
+  struct outcome
+  {
+    std::vector<size_t> served;
+    std::vector<size_t> missed;
+    std::vector<int64_t> max_wait;
+  };
+
+  // A single server working through jobs in virtual microseconds, taking the
+  // next one from pop() whenever it's idle. Jobs still queued at the end of
+  // the arrivals count as missed if they have a deadline.
+  template <typename Pop, typename Push>
+  outcome simulate(const std::vector<job> &jobs, size_t priorities, Push push, Pop pop)
+  {
+    outcome result{std::vector<size_t>(priorities), std::vector<size_t>(priorities), std::vector<int64_t>(priorities)};
+    int64_t now = 0;
+    size_t next = 0;
+    size_t index;
+    while (next < jobs.size())
+    {
+      while (next < jobs.size() && jobs[next].arrival <= now)
+      {
+        push(next);
+        ++next;
+      }
+      if (!pop(index))
+      {
+        now = jobs[next].arrival;
+        continue;
+      }
+      const auto &job = jobs[index];
+      now += job.service;
+      ++result.served[job.priority];
+      result.max_wait[job.priority] = std::max(result.max_wait[job.priority], now - job.service - job.arrival);
+      if (job.deadline && now > *job.deadline)
+      {
+        ++result.missed[job.priority];
+      }
+    }
+    while (pop(index))
+    {
+      if (jobs[index].deadline)
+      {
+        ++result.missed[jobs[index].priority];
+      }
+    }
+    return result;
+  }
+
+  std::string report(const char *policy, const outcome &outcome, const std::vector<size_t> &admitted)
+  {
+    std::ostringstream out;
+    out << policy << ":";
+    for (size_t p = outcome.served.size(); p-- > 0;)
+    {
+      out << " p" << p << " miss " << (100.0 * outcome.missed[p] / admitted[p]) << "% (max wait "
+          << outcome.max_wait[p] / 1000 << " ms)";
+    }
+    return out.str();
+  }
+} // namespace detail
+
+SCENARIO("deadline_queue serves priorities, then deadlines", "[deadline_queue]")
+{
+  GIVEN("runs of mixed priorities and deadlines")
+  {
+    detail::deadline_queue<int, 4> queue;
+    queue.push(1, 1);
+    queue.push(2, 1, detail::at(300));
+    queue.push(3, 1, detail::at(100));
+    queue.push(4, 3);
+    queue.push(5, 0, detail::at(1));
+    queue.push(6, 1);
+
+    THEN("the highest priority goes first, then the earliest deadline, then arrival order")
+    {
+      std::vector<int> order;
+      int value;
+      while (queue.pop(value))
+      {
+        order.push_back(value);
+      }
+      REQUIRE(order == std::vector<int>{4, 3, 2, 1, 6, 5});
+      REQUIRE(queue.empty());
+    }
+  }
+
+  GIVEN("a priority above the highest one")
+  {
+    detail::deadline_queue<int, 2> queue;
+    queue.push(1, 1);
+    queue.push(2, 7);
+
+    THEN("it's clamped to the highest")
+    {
+      int value;
+      REQUIRE(queue.pop(value));
+      REQUIRE(value == 1);
+    }
+  }
+
+  GIVEN("a queue that's drained")
+  {
+    detail::deadline_queue<int, 4> queue;
+    queue.push(1, 0);
+    queue.push(2, 2);
+    auto drained = queue.drain();
+
+    THEN("everything came out and it's empty")
+    {
+      REQUIRE(drained.size() == 2);
+      REQUIRE(queue.empty());
+      int value;
+      REQUIRE_FALSE(queue.pop(value));
+    }
+  }
+}
+
+SCENARIO("deadline_queue doesn't starve low priorities", "[deadline_queue]")
+{
+  GIVEN("a steady stream of high priority runs and one low priority run")
+  {
+    detail::deadline_queue<int, 2> queue(3);
+    queue.push(-1, 0);
+
+    THEN("the low priority one is served after 3 high priority ones")
+    {
+      int value;
+      for (int i = 0; i < 3; ++i)
+      {
+        queue.push(i, 1);
+        REQUIRE(queue.pop(value));
+        REQUIRE(value == i);
+      }
+      queue.push(3, 1);
+      REQUIRE(queue.pop(value));
+      REQUIRE(value == -1);
+      REQUIRE(queue.pop(value));
+      REQUIRE(value == 3);
+    }
+
+    THEN("a drain forgets how often the low priority one was passed over")
+    {
+      int value;
+      for (int i = 0; i < 3; ++i)
+      {
+        queue.push(i, 1);
+        REQUIRE(queue.pop(value));
+      }
+      REQUIRE(queue.drain() == std::vector<int>{-1});
+
+      queue.push(-2, 0);
+      queue.push(4, 1);
+      REQUIRE(queue.pop(value));
+      REQUIRE(value == 4);
+      REQUIRE(queue.pop(value));
+      REQUIRE(value == -2);
+    }
+  }
+}
+
+SCENARIO("deadline_queue takes pushes from many threads", "[deadline_queue]")
+{
+  GIVEN("8 producers of different priorities and a consumer")
+  {
+    constexpr int per_producer = 10000;
+    detail::deadline_queue<int, 4> queue;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 8; ++p)
+    {
+      producers.emplace_back([&queue, p]
+                             {
+        for (int i = 0; i < per_producer; ++i)
+        {
+          queue.push(p * per_producer + i, static_cast<size_t>(p % 4), detail::at(i));
+        } });
+    }
+
+    std::vector<bool> seen(8 * per_producer);
+    size_t popped = 0;
+    int value;
+    while (popped < seen.size())
+    {
+      if (queue.pop(value))
+      {
+        REQUIRE_FALSE(seen[value]);
+        seen[value] = true;
+        ++popped;
+      }
+    }
+    for (auto &producer : producers)
+    {
+      producer.join();
+    }
+
+    THEN("every run comes out exactly once")
+    {
+      REQUIRE(queue.empty());
+    }
+  }
+}
+
+TEST_CASE("deadline_queue vs FIFO under overload", "[deadline_queue][!benchmark]")
+{
+  // 130% load: Poisson arrivals every 770 us on average, 1 ms of service.
+  // 10% critical (5 ms slack), 20% high (20 ms), 40% normal (100 ms), 30%
+  // best effort without deadline.
+  constexpr size_t priorities = 4;
+  std::mt19937 rng(34);
+  std::exponential_distribution<double> gap(1.0 / 770);
+  std::exponential_distribution<double> service(1.0 / 1000);
+  std::discrete_distribution<size_t> priority({30, 40, 20, 10});
+  const int64_t slack[] = {0, 100000, 20000, 5000};
+
+  std::vector<detail::job> jobs;
+  std::vector<size_t> admitted(priorities);
+  double arrival = 0;
+  for (int i = 0; i < 20000; ++i)
+  {
+    arrival += gap(rng);
+    auto p = priority(rng);
+    auto t = static_cast<int64_t>(arrival);
+    jobs.push_back({p, t, static_cast<int64_t>(service(rng)), p == 0 ? std::nullopt : std::optional<int64_t>(t + slack[p])});
+    ++admitted[p];
+  }
+
+  std::deque<size_t> fifo;
+  auto fifo_outcome = detail::simulate(
+      jobs, priorities,
+      [&](size_t i)
+      { fifo.push_back(i); },
+      [&](size_t &i)
+      {
+        if (fifo.empty())
+        {
+          return false;
+        }
+        i = fifo.front();
+        fifo.pop_front();
+        return true;
+      });
+
+  detail::deadline_queue<size_t, priorities> queue;
+  auto edf_outcome = detail::simulate(
+      jobs, priorities,
+      [&](size_t i)
+      {
+        const auto &job = jobs[i];
+        queue.push(i, job.priority, job.deadline ? std::optional(detail::at(*job.deadline)) : std::nullopt);
+      },
+      [&](size_t &i)
+      { return queue.pop(i); });
+
+  WARN(detail::report("fifo", fifo_outcome, admitted));
+  WARN(detail::report("deadline_queue", edf_outcome, admitted));
+
+  REQUIRE(edf_outcome.missed[3] < fifo_outcome.missed[3]);
+  REQUIRE(edf_outcome.missed[2] < fifo_outcome.missed[2]);
+  // The starvation guard keeps best effort runs moving.
+  REQUIRE(edf_outcome.served[0] > 0);
+
+  BENCHMARK("push and pop 20000 runs")
+  {
+    detail::deadline_queue<size_t, priorities> q;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+      q.push(i, jobs[i].priority, detail::at(jobs[i].arrival));
+    }
+    size_t sum = 0, i;
+    while (q.pop(i))
+    {
+      sum += i;
+    }
+    return sum;
+  };
+}
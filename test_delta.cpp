@@ -0,0 +1,297 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "papaya/codec/delta.hpp"
+#include "papaya/codec/schemas.hpp"
+#include "papaya/papaya.hpp"
+
+namespace detail
+{
+  using pa::codec::delta_options;
+  using quantization = pa::codec::delta_options::quantization;
+
+  // A base model and the same model after a round of small updates, the way
+  // fine-tuning moves most weights a little and a few a lot.
+  struct model_pair
+  {
+    explicit model_pair(size_t weights)
+    {
+      std::mt19937 random(7);
+      std::normal_distribution<float> weight(0, 0.05f);
+      std::normal_distribution<float> step(0, 0.0005f);
+      base.resize(weights);
+      updated.resize(weights);
+      for (size_t i = 0; i < weights; ++i)
+      {
+        base[i] = weight(random);
+        updated[i] = base[i] + (i % 97 == 0 ? 100 : 1) * step(random);
+      }
+    }
+
+    std::vector<float> base;
+    std::vector<float> updated;
+  };
+
+  std::string bytes_of(const std::vector<float> &weights)
+  {
+    return std::string(reinterpret_cast<const char *>(weights.data()), weights.size() * sizeof(float));
+  }
+
+  // "Trains" by returning the updated model of a model_pair.
+  class training_executor final : public pa::IExecutor
+  {
+  public:
+    explicit training_executor(std::vector<float> trained) : trained_(std::move(trained)) {}
+
+    Output execute(const Input &) override
+    {
+      Success success;
+      success.trainedModel = bytes_of(trained_);
+      return success;
+    }
+
+  private:
+    std::vector<float> trained_;
+  };
+
+  delta_options options_of(quantization quantize, size_t chunk_weights = 1000)
+  {
+    delta_options options;
+    options.quantize = quantize;
+    options.chunk_weights = chunk_weights;
+    return options;
+  }
+} // namespace detail
+
+SCENARIO("Model updates round-trip through delta payloads", "[delta]")
+{
+  detail::model_pair models(10007);
+
+  GIVEN("no quantization")
+  {
+    pa::codec::delta_stats stats;
+    auto payload = pa::codec::encode_delta(models.base, models.updated, detail::options_of(detail::quantization::none), &stats);
+
+    THEN("the update is restored bit for bit, in fewer bytes")
+    {
+      REQUIRE(pa::codec::apply_delta(models.base, payload) == models.updated);
+      REQUIRE(stats.raw_bytes == models.updated.size() * sizeof(float));
+      REQUIRE(stats.encoded_bytes == payload.size());
+      REQUIRE(stats.compression_ratio() > 1.2);
+    }
+
+    THEN("the payload doesn't depend on how the update was sliced")
+    {
+      pa::codec::delta_encoder encoder(models.base, detail::options_of(detail::quantization::none));
+      std::span<const float> updated(models.updated);
+      for (size_t offset = 0; offset < updated.size(); offset += 333)
+      {
+        encoder.update(updated.subspan(offset, std::min<size_t>(333, updated.size() - offset)));
+      }
+      REQUIRE(encoder.finish() == payload);
+    }
+
+    THEN("an unchanged model takes a few bytes per chunk")
+    {
+      auto unchanged = pa::codec::encode_delta(models.base, models.base, detail::options_of(detail::quantization::none));
+      REQUIRE(unchanged.size() < 11 * 30);
+      REQUIRE(pa::codec::apply_delta(models.base, unchanged) == models.base);
+    }
+  }
+
+  GIVEN("8-bit quantization")
+  {
+    pa::codec::delta_stats stats;
+    auto payload = pa::codec::encode_delta(models.base, models.updated, detail::options_of(detail::quantization::int8), &stats);
+
+    THEN("every weight is within half a step of its chunk's scale")
+    {
+      auto restored = pa::codec::apply_delta(models.base, payload);
+      for (size_t chunk = 0; chunk < models.base.size(); chunk += 1000)
+      {
+        float largest = 0;
+        auto end = std::min<size_t>(chunk + 1000, models.base.size());
+        for (size_t i = chunk; i < end; ++i)
+        {
+          largest = std::max(largest, std::fabs(models.updated[i] - models.base[i]));
+        }
+        for (size_t i = chunk; i < end; ++i)
+        {
+          REQUIRE(std::fabs(restored[i] - models.updated[i]) <= largest / 127 * 0.51f + 1e-7f);
+        }
+      }
+      REQUIRE(stats.compression_ratio() > 3.5);
+    }
+  }
+
+  GIVEN("top-k sparsification")
+  {
+    auto options = detail::options_of(detail::quantization::top_k);
+    options.top_k_fraction = 0.01f;
+    pa::codec::delta_stats stats;
+    auto payload = pa::codec::encode_delta(models.base, models.updated, options, &stats);
+
+    THEN("the largest changes of each chunk are kept exactly and the rest dropped")
+    {
+      auto restored = pa::codec::apply_delta(models.base, payload);
+      for (size_t chunk = 0; chunk < models.base.size(); chunk += 1000)
+      {
+        auto end = std::min<size_t>(chunk + 1000, models.base.size());
+        size_t kept = 0;
+        float smallest_kept = INFINITY;
+        float largest_dropped = 0;
+        for (size_t i = chunk; i < end; ++i)
+        {
+          auto change = models.updated[i] - models.base[i];
+          if (restored[i] == models.base[i])
+          {
+            largest_dropped = std::max(largest_dropped, std::fabs(change));
+            continue;
+          }
+          ++kept;
+          smallest_kept = std::min(smallest_kept, std::fabs(change));
+          REQUIRE(restored[i] == models.base[i] + change);
+        }
+        REQUIRE(kept == (end - chunk + 99) / 100);
+        REQUIRE(smallest_kept >= largest_dropped);
+      }
+      REQUIRE(stats.compression_ratio() > 50);
+    }
+  }
+}
+
+SCENARIO("Bad delta inputs are rejected", "[delta]")
+{
+  detail::model_pair models(2000);
+  auto payload = pa::codec::encode_delta(models.base, models.updated);
+
+  THEN("updates of the wrong size throw")
+  {
+    pa::codec::delta_encoder encoder(models.base);
+    encoder.update(std::span<const float>(models.updated).first(1999));
+    REQUIRE_THROWS_AS(encoder.finish(), pa::codec::delta_error);
+    REQUIRE_THROWS_AS(encoder.update(models.updated), pa::codec::delta_error);
+  }
+
+  THEN("truncated or corrupted payloads throw instead of reading out of bounds")
+  {
+    REQUIRE_THROWS_AS(pa::codec::apply_delta(std::span<const float>(models.base).first(10), payload), pa::codec::delta_error);
+    for (size_t size = 0; size < payload.size(); size += 7)
+    {
+      REQUIRE_THROWS_AS(pa::codec::apply_delta(models.base, payload.substr(0, size)), pa::codec::delta_error);
+    }
+    std::mt19937 random(3);
+    for (int i = 0; i < 200; ++i)
+    {
+      auto corrupted = payload;
+      corrupted[random() % corrupted.size()] ^= static_cast<char>(1 + random() % 255);
+      try
+      {
+        auto restored = pa::codec::apply_delta(models.base, corrupted);
+        REQUIRE(restored.size() == models.base.size());
+      }
+      catch (const pa::codec::delta_error &)
+      {
+      }
+    }
+  }
+
+  THEN("model graphs are viewed as float32 only when they can be")
+  {
+    std::string graph(reinterpret_cast<const char *>(models.base.data()), models.base.size() * sizeof(float));
+    REQUIRE(pa::codec::weights_of(graph).size() == models.base.size());
+    REQUIRE_THROWS_AS(pa::codec::weights_of(std::string_view(graph).substr(0, 6)), pa::codec::delta_error);
+    REQUIRE_THROWS_AS(pa::codec::weights_of(std::string_view(graph).substr(1, 8)), pa::codec::delta_error);
+  }
+
+  THEN("a trained model goes over the wire with its executor's result")
+  {
+    pa::IExecutor::Success success;
+    success.trainedModel = detail::bytes_of(models.updated);
+    std::string bytes(pa::codec::encoded_size(success), '\0');
+    REQUIRE(pa::codec::encode(success, std::span<char>(bytes)));
+    auto decoded = pa::codec::decode<pa::IExecutor::Success>(bytes);
+    REQUIRE(decoded);
+    REQUIRE(std::get<1>(*decoded) == success.trainedModel);
+  }
+}
+
+SCENARIO("Sessions that train report their model update", "[delta][papaya]")
+{
+  detail::model_pair models(10007);
+
+  GIVEN("a papaya whose sessions execute a training executor")
+  {
+    pa::fl_factory::execution execution;
+    execution.executor = std::make_shared<detail::training_executor>(models.updated);
+    execution.input.modelGraph = detail::bytes_of(models.base);
+    execution.model_update.quantize = detail::quantization::int8;
+    pa::papaya::options options;
+    options.session = pa::papaya::options::session_api::coroutine;
+    pa::papaya papaya{
+        1,
+        std::make_shared<pa::fl_factory>(
+            std::make_shared<pa::metrics::registry>(), std::make_shared<pa::match_factory>(), nullptr, std::move(execution)),
+        options};
+
+    WHEN("a run completes")
+    {
+      std::promise<pa::papaya::output> output;
+      std::promise<void> completed;
+      REQUIRE(papaya.run({}, [&](pa::papaya::output task_output)
+                         { output.set_value(std::move(task_output)); }, nullptr, [&]
+                         { completed.set_value(); }));
+      auto completion = completed.get_future();
+      REQUIRE(completion.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+
+      THEN("on_task_complete carries the encoded update's size, ratio and throughput")
+      {
+        auto metrics = output.get_future().get().metrics;
+        auto metric = [&](const std::string &name)
+        {
+          REQUIRE(metrics.count(name) == 1);
+          return std::get<float>(metrics.at(name));
+        };
+        auto bytes = metric("model_update_bytes");
+        REQUIRE(bytes > 0);
+        REQUIRE(bytes < models.updated.size() * sizeof(float));
+        REQUIRE(metric("model_update_compression_ratio") == Approx(models.updated.size() * sizeof(float) / bytes));
+        REQUIRE(metric("model_update_encode_bytes_per_second") > 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Encoding a 64 MiB model update", "[delta][!benchmark]")
+{
+  detail::model_pair models(size_t{16} << 20);
+
+  for (auto quantize : {detail::quantization::none, detail::quantization::int8, detail::quantization::top_k})
+  {
+    detail::delta_options options;
+    options.quantize = quantize;
+    pa::codec::delta_stats stats;
+    pa::codec::encode_delta(models.base, models.updated, options, &stats);
+    auto name = std::string(quantize == detail::quantization::none   ? "exact"
+                            : quantize == detail::quantization::int8 ? "8-bit"
+                                                                     : "top 1%") +
+                ", ratio " + std::to_string(stats.compression_ratio());
+
+    BENCHMARK(name.c_str())
+    {
+      return pa::codec::encode_delta(models.base, models.updated, options).size();
+    };
+  }
+
+  BENCHMARK("decoding, exact")
+  {
+    static const auto payload = pa::codec::encode_delta(models.base, models.updated);
+    return pa::codec::apply_delta(models.base, payload).size();
+  };
+}
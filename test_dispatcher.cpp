@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/dispatcher.hpp"
+
+SCENARIO("Dispatcher runs posted jobs in order on its own thread", "[dispatcher]")
+{
+  GIVEN("a dispatcher")
+  {
+    auto metrics = std::make_shared<pa::metrics::registry>();
+    pa::concurrent::dispatcher dispatcher{metrics};
+
+    WHEN("N jobs are posted from one thread")
+    {
+      const auto test_size = 1000;
+      std::vector<int> seen;
+      std::thread::id worker_id;
+      for (auto i = 0; i < test_size; ++i)
+      {
+        dispatcher.post([&, i]
+                        {
+          seen.push_back(i);
+          worker_id = std::this_thread::get_id(); });
+      }
+      dispatcher.flush();
+
+      THEN("they ran in FIFO order off the posting thread")
+      {
+        REQUIRE(seen.size() == test_size);
+        for (auto i = 0; i < test_size; ++i)
+        {
+          REQUIRE(seen[i] == i);
+        }
+        REQUIRE(worker_id != std::this_thread::get_id());
+      }
+    }
+
+    WHEN("a job throws")
+    {
+      std::atomic<bool> ran_after{false};
+      dispatcher.post([]
+                      { throw std::runtime_error("boom"); });
+      dispatcher.post([&]
+                      { ran_after = true; });
+      dispatcher.flush();
+
+      THEN("the dispatcher keeps going and counts the exception")
+      {
+        REQUIRE(ran_after);
+        auto snapshot = metrics->snapshot();
+        auto it = std::find_if(snapshot.counters.begin(), snapshot.counters.end(), [](const auto &c)
+                               { return c.name == "papaya_dispatcher_callback_exceptions_total"; });
+        REQUIRE(it != snapshot.counters.end());
+        REQUIRE(it->value == 1);
+      }
+    }
+  }
+
+  GIVEN("jobs still queued when the dispatcher is destroyed")
+  {
+    std::atomic<int> ran{0};
+    {
+      pa::concurrent::dispatcher dispatcher;
+      dispatcher.post([&]
+                      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ++ran; });
+      dispatcher.post([&]
+                      { ++ran; });
+    }
+
+    THEN("they all ran before the destructor returned")
+    {
+      REQUIRE(ran == 2);
+    }
+  }
+}
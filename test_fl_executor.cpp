@@ -0,0 +1,161 @@
+#include <catch2/catch.hpp>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "papaya/executor/executor.hpp"
+
+namespace detail
+{
+  using pa::FlExecutor;
+  using pa::IExecutor;
+
+  constexpr int features = 16;
+
+  // "x0,x1,...,x15,label" per line.
+  std::string make_dataset(size_t records, uint32_t seed)
+  {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> x(0, 1);
+    std::string dataset;
+    char number[32];
+    for (size_t r = 0; r < records; ++r)
+    {
+      for (int f = 0; f < features; ++f)
+      {
+        auto [end, ec] = std::to_chars(number, number + sizeof(number), x(rng));
+        dataset.append(number, end);
+        dataset += ',';
+      }
+      dataset += (rng() % 2 == 0) ? '0' : '1';
+      dataset += '\n';
+    }
+    return dataset;
+  }
+
+  // Logistic loss of a fixed linear model: parse-heavy and branchy, like a
+  // real evaluation loop over text records.
+  IExecutor::Evaluation logistic_loss(std::string_view record)
+  {
+    double z = 0;
+    auto *cursor = record.data();
+    auto *end = record.data() + record.size();
+    for (int f = 0; f < features; ++f)
+    {
+      float x;
+      cursor = std::from_chars(cursor, end, x).ptr + 1;
+      z += x * (f % 3 == 0 ? 0.5 : -0.25);
+    }
+    auto label = *cursor == '1' ? 1.0 : 0.0;
+    auto p = 1 / (1 + std::exp(-z));
+    return {1, -(label * std::log(p + 1e-12) + (1 - label) * std::log(1 - p + 1e-12))};
+  }
+
+  IExecutor::Evaluation evaluation_of(const IExecutor::Output &output)
+  {
+    return std::get<IExecutor::Success>(output).evaluation;
+  }
+} // namespace detail
+
+SCENARIO("FlExecutor evaluates a dataset in parallel shards", "[fl_executor]")
+{
+  GIVEN("a dataset of 20000 records")
+  {
+    auto dataset = detail::make_dataset(20000, 35);
+    detail::IExecutor::Input input{"", dataset, "", "", ""};
+    auto sequential = detail::evaluation_of(detail::FlExecutor(detail::logistic_loss).execute(input));
+    REQUIRE(sequential.records == 20000);
+
+    WHEN("it's sharded over a pool, with shards much smaller than the dataset")
+    {
+      detail::FlExecutor::ParallelOptions options;
+      options.targetShardDuration = std::chrono::microseconds(50);
+      options.minShardBytes = 512;
+      detail::FlExecutor executor(detail::logistic_loss, std::make_shared<pa::concurrent::thread_pool>(4), options);
+
+      THEN("every record is evaluated exactly once, run after run")
+      {
+        for (int run = 0; run < 3; ++run)
+        {
+          auto parallel = detail::evaluation_of(executor.execute(input));
+          REQUIRE(parallel.records == sequential.records);
+          REQUIRE(parallel.lossSum == Approx(sequential.lossSum));
+        }
+        REQUIRE(executor.nanosecondsPerByte() > 0);
+      }
+    }
+
+    WHEN("a record can't be evaluated")
+    {
+      detail::FlExecutor executor(
+          [](std::string_view record)
+          {
+            if (record.front() == '-')
+            {
+              throw std::runtime_error("bad record");
+            }
+            return detail::IExecutor::Evaluation{1, 0};
+          },
+          std::make_shared<pa::concurrent::thread_pool>(4));
+
+      THEN("the execution fails")
+      {
+        REQUIRE(pa::error_code_of(executor.execute(input)) == detail::FlExecutor::EvaluationFailed);
+      }
+    }
+  }
+
+  GIVEN("records split across shard boundaries at every offset")
+  {
+    std::string dataset;
+    uint64_t non_empty = 0;
+    for (int i = 0; i < 500; ++i)
+    {
+      dataset += std::string(static_cast<size_t>(i % 7), 'r') + "\n";
+      non_empty += i % 7 != 0;
+    }
+    dataset += "last";
+    ++non_empty;
+
+    THEN("each non-empty record is counted once")
+    {
+      detail::FlExecutor::ParallelOptions options;
+      options.minShardBytes = 1;
+      options.targetShardDuration = std::chrono::microseconds(0);
+      detail::FlExecutor executor(
+          [](std::string_view)
+          { return detail::IExecutor::Evaluation{1, 0}; },
+          std::make_shared<pa::concurrent::thread_pool>(3), options);
+      auto evaluation = detail::evaluation_of(executor.execute({"", dataset, "", "", ""}));
+      REQUIRE(evaluation.records == non_empty);
+    }
+  }
+}
+
+TEST_CASE("FlExecutor scaling on an evaluation workload", "[fl_executor][!benchmark]")
+{
+  auto dataset = detail::make_dataset(400000, 1);
+  detail::IExecutor::Input input{"", dataset, "", "", ""};
+  WARN(std::thread::hardware_concurrency() << " hardware threads, " << dataset.size() / 1000000 << " MB dataset");
+
+  BENCHMARK("sequential")
+  {
+    return detail::evaluation_of(detail::FlExecutor(detail::logistic_loss).execute(input)).records;
+  };
+
+  for (size_t threads : {2, 4, 8, 16})
+  {
+    // The calling thread works too, so threads - 1 pool workers.
+    detail::FlExecutor executor(detail::logistic_loss, std::make_shared<pa::concurrent::thread_pool>(threads - 1));
+    executor.execute(input);
+    BENCHMARK(std::to_string(threads) + " threads")
+    {
+      return detail::evaluation_of(executor.execute(input)).records;
+    };
+  }
+}
@@ -0,0 +1,138 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include "papaya/storage/journal.hpp"
+#include "test_temp_path.hpp"
+
+SCENARIO("The journal replays pending runs after a restart", "[journal]")
+{
+  detail::temp_path file{"replay", ".journal"};
+
+  GIVEN("3 admitted runs of which 1 completed")
+  {
+    {
+      pa::storage::journal journal{file.path};
+      journal.admitted(1, 0b0001);
+      journal.admitted(2, 0b0010);
+      journal.admitted(3, 0b0100);
+      journal.wait_durable(journal.completed(2));
+    }
+
+    WHEN("the journal is opened again")
+    {
+      pa::storage::journal journal{file.path};
+
+      THEN("the other 2 are pending in admission order")
+      {
+        auto pending = journal.pending();
+        REQUIRE(pending.size() == 2);
+        REQUIRE(pending[0].request_id == 1);
+        REQUIRE(pending[0].restrictions == 0b0001);
+        REQUIRE(pending[1].request_id == 3);
+        REQUIRE(pending[1].restrictions == 0b0100);
+        REQUIRE(journal.max_request_id() == 3);
+      }
+    }
+
+    WHEN("the last record is torn")
+    {
+      {
+        // Header (64 bytes) + 4 records of 32 bytes; flip a byte of the last.
+        std::fstream f(file.path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(64 + 3 * 32 + 10);
+        f.put('\x7f');
+      }
+      pa::storage::journal journal{file.path};
+
+      THEN("replay stops before it, and new appends go in its place")
+      {
+        REQUIRE(journal.pending().size() == 3);
+        journal.wait_durable(journal.completed(3));
+        REQUIRE(journal.pending().size() == 2);
+      }
+    }
+  }
+}
+
+SCENARIO("Compaction keeps only pending runs", "[journal]")
+{
+  detail::temp_path file{"compaction", ".journal"};
+
+  GIVEN("a journal where most runs completed")
+  {
+    pa::storage::journal::options options;
+    options.grow_bytes = 4096;
+    {
+      pa::storage::journal journal{file.path, options};
+      for (uint64_t id = 1; id <= 1000; ++id)
+      {
+        journal.admitted(id, 0);
+        if (id % 10 != 0)
+        {
+          journal.completed(id);
+        }
+      }
+
+      WHEN("it's compacted")
+      {
+        journal.compact();
+        journal.wait_durable(journal.admitted(1001, 0));
+
+        THEN("the pending runs survive, and the file shrinks")
+        {
+          REQUIRE(journal.pending().size() == 101);
+          std::ifstream f(file.path, std::ios::binary | std::ios::ate);
+          REQUIRE(static_cast<size_t>(f.tellg()) < 64 + 1900 * 32);
+        }
+      }
+    }
+
+    THEN("a reopened journal sees the same pending runs")
+    {
+      pa::storage::journal journal{file.path, options};
+      auto pending = journal.pending();
+      REQUIRE(pending.size() >= 100);
+      REQUIRE(pending.front().request_id == 10);
+    }
+  }
+}
+
+TEST_CASE("Benchmark journal replay of 1M entries", "[journal][!benchmark]")
+{
+  detail::temp_path file{"replay_1m", ".journal"};
+  const uint64_t entries = 1000000;
+  {
+    pa::storage::journal::options options;
+    options.grow_bytes = size_t{64} << 20;
+    pa::storage::journal journal{file.path, options};
+    uint64_t ticket = 0;
+    // Half admitted, half completed: 500k runs, 250k still pending.
+    for (uint64_t id = 1; id <= entries / 2; ++id)
+    {
+      ticket = journal.admitted(id, 0b0101);
+    }
+    for (uint64_t id = 1; id <= entries / 2; id += 2)
+    {
+      ticket = journal.completed(id);
+    }
+    journal.wait_durable(ticket);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t pending = 0;
+  {
+    pa::storage::journal journal{file.path};
+    pending = journal.pending().size();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(pending == entries / 4);
+  REQUIRE(elapsed < std::chrono::seconds(1));
+
+  BENCHMARK("open and replay 1M entries")
+  {
+    pa::storage::journal journal{file.path};
+    return journal.max_request_id();
+  };
+}
@@ -0,0 +1,206 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "papaya/executor/executor.hpp"
+#include "papaya/executor/kernels.hpp"
+
+namespace detail
+{
+  namespace kernels = pa::kernels;
+
+  constexpr kernels::isa all_isas[] = {kernels::isa::scalar, kernels::isa::sse2, kernels::isa::avx2, kernels::isa::avx512};
+
+  std::vector<float> random_floats(size_t size, uint32_t seed, float low, float high)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> value(low, high);
+    std::vector<float> values(size);
+    std::generate(values.begin(), values.end(), [&]
+                  { return value(rng); });
+    return values;
+  }
+
+  std::vector<float> random_labels(size_t size, uint32_t seed)
+  {
+    std::mt19937 rng(seed);
+    std::vector<float> labels(size);
+    std::generate(labels.begin(), labels.end(), [&]
+                  { return static_cast<float>(rng() % 2); });
+    return labels;
+  }
+} // namespace detail
+
+SCENARIO("Every kernel table agrees with the scalar reference", "[kernels]")
+{
+  auto &reference = detail::kernels::scalar();
+
+  GIVEN("inputs of awkward sizes, so every vector tail path runs")
+  {
+    for (size_t size : {0, 1, 3, 7, 15, 16, 17, 31, 63, 65, 4095, 4097, 100003})
+    {
+      auto predictions = detail::random_floats(size, static_cast<uint32_t>(size), -4, 4);
+      auto targets = detail::random_floats(size, static_cast<uint32_t>(size) + 1, 0, 1);
+      auto labels = detail::random_labels(size, static_cast<uint32_t>(size) + 2);
+
+      for (auto isa : detail::all_isas)
+      {
+        auto *table = detail::kernels::table_for(isa);
+        if (table == nullptr)
+        {
+          continue;
+        }
+        INFO(detail::kernels::to_string(isa) << " with " << size << " elements");
+        REQUIRE(table->isa == isa);
+
+        THEN("sums and squared errors match within float rounding")
+        {
+          REQUIRE(table->sum(predictions.data(), size) == Approx(reference.sum(predictions.data(), size)).epsilon(1e-5).margin(1e-3));
+          REQUIRE(table->squared_error(predictions.data(), targets.data(), size) ==
+                  Approx(reference.squared_error(predictions.data(), targets.data(), size)).epsilon(1e-5).margin(1e-3));
+        }
+
+        THEN("min, max and counts match exactly")
+        {
+          auto expected = reference.minmax(predictions.data(), size);
+          auto actual = table->minmax(predictions.data(), size);
+          REQUIRE(actual.min == expected.min);
+          REQUIRE(actual.max == expected.max);
+          REQUIRE(table->count_correct(predictions.data(), labels.data(), size, 0.5f) ==
+                  reference.count_correct(predictions.data(), labels.data(), size, 0.5f));
+        }
+      }
+    }
+  }
+
+  THEN("the active table is the best one supported")
+  {
+    auto active = detail::kernels::active().isa;
+    for (auto isa : detail::all_isas)
+    {
+      if (static_cast<int>(isa) > static_cast<int>(active))
+      {
+        REQUIRE(detail::kernels::table_for(isa) == nullptr);
+      }
+    }
+  }
+}
+
+SCENARIO("FlExecutor reduces predictions with the kernels", "[kernels][fl_executor]")
+{
+  GIVEN("a dataset of \"prediction,label\" records")
+  {
+    auto predictions = detail::random_floats(30000, 36, 0, 1);
+    auto labels = detail::random_labels(30000, 37);
+    std::string dataset;
+    for (size_t i = 0; i < predictions.size(); ++i)
+    {
+      dataset += std::to_string(predictions[i]) + "," + (labels[i] == 1 ? "1" : "0") + "\n";
+    }
+    auto predict = [](std::string_view record)
+    {
+      return pa::FlExecutor::Prediction{std::stof(std::string(record.substr(0, record.find(',')))), record.back() == '1' ? 1.0f : 0.0f};
+    };
+
+    // to_string rounds, so the expectations come from the parsed values.
+    for (auto &prediction : predictions)
+    {
+      prediction = std::stof(std::to_string(prediction));
+    }
+    auto &reference = detail::kernels::scalar();
+    auto expected_sum = reference.sum(predictions.data(), predictions.size());
+    auto expected_error = reference.squared_error(predictions.data(), labels.data(), predictions.size());
+    auto expected_correct = reference.count_correct(predictions.data(), labels.data(), predictions.size(), 0.5f);
+    auto expected_range = reference.minmax(predictions.data(), predictions.size());
+
+    auto matches_reference = [&](pa::FlExecutor &executor)
+    {
+      auto evaluation = std::get<pa::IExecutor::Success>(executor.execute({"", dataset, "", "", ""})).evaluation;
+      REQUIRE(evaluation.records == predictions.size());
+      REQUIRE(evaluation.correct == expected_correct);
+      REQUIRE(evaluation.predictionSum == Approx(expected_sum));
+      REQUIRE(evaluation.squaredError == Approx(expected_error));
+      REQUIRE(evaluation.predictionMin == expected_range.min);
+      REQUIRE(evaluation.predictionMax == expected_range.max);
+    };
+
+    THEN("sequential evaluation matches the scalar reference")
+    {
+      pa::FlExecutor executor(predict);
+      matches_reference(executor);
+    }
+
+    THEN("evaluation in parallel shards matches the scalar reference")
+    {
+      pa::FlExecutor::ParallelOptions options;
+      options.minShardBytes = 1024;
+      pa::FlExecutor executor(predict, std::make_shared<pa::concurrent::thread_pool>(3), options);
+      matches_reference(executor);
+      matches_reference(executor);
+    }
+  }
+}
+
+TEST_CASE("Metric kernel throughput per instruction set", "[kernels][!benchmark]")
+{
+  for (size_t size : {size_t{1} << 20, size_t{100} << 20})
+  {
+    auto predictions = detail::random_floats(size, 1, 0, 1);
+    auto labels = detail::random_labels(size, 2);
+    auto bytes = static_cast<double>(size * sizeof(float));
+
+    for (auto isa : detail::all_isas)
+    {
+      auto *table = detail::kernels::table_for(isa);
+      if (table == nullptr)
+      {
+        continue;
+      }
+      auto name = std::string(detail::kernels::to_string(isa)) + " " + std::to_string(size >> 20) + "M ";
+
+      // GB/s from a plain timed loop as well, since the benchmark report
+      // only has times.
+      auto report = [&](const char *kernel, double bytes_per_call, auto &&call)
+      {
+        auto started = std::chrono::steady_clock::now();
+        int calls = 0;
+        do
+        {
+          call();
+          ++calls;
+        } while (std::chrono::steady_clock::now() - started < std::chrono::milliseconds(200));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        WARN(name << kernel << ": " << bytes_per_call * calls / elapsed.count() / 1e9 << " GB/s");
+      };
+
+      BENCHMARK(name + "sum")
+      {
+        return table->sum(predictions.data(), size);
+      };
+      report("sum", bytes, [&]
+             { volatile auto sink = table->sum(predictions.data(), size); (void)sink; });
+      BENCHMARK(name + "minmax")
+      {
+        return table->minmax(predictions.data(), size).max;
+      };
+      report("minmax", bytes, [&]
+             { volatile auto sink = table->minmax(predictions.data(), size).max; (void)sink; });
+      BENCHMARK(name + "squared_error")
+      {
+        return table->squared_error(predictions.data(), labels.data(), size);
+      };
+      report("squared_error", 2 * bytes, [&]
+             { volatile auto sink = table->squared_error(predictions.data(), labels.data(), size); (void)sink; });
+      BENCHMARK(name + "count_correct")
+      {
+        return table->count_correct(predictions.data(), labels.data(), size, 0.5f);
+      };
+      report("count_correct", 2 * bytes, [&]
+             { volatile auto sink = table->count_correct(predictions.data(), labels.data(), size, 0.5f); (void)sink; });
+    }
+  }
+}
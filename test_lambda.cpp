@@ -1,6 +1,9 @@
 #include <catch2/catch.hpp>
+#include <array>
 #include <memory>
 
+#include "papaya/util/unique_function.hpp"
+
 struct Foo : public std::enable_shared_from_this<Foo> {
 };
 
@@ -19,3 +22,32 @@ SCENARIO("lambda should be cheap", "[lambda]") {
         }
     }
 }
+
+SCENARIO("unique_function stores a shared_ptr capture inline", "[lambda]") {
+    GIVEN("a shared instance") {
+        auto foo = std::make_shared<Foo>();
+
+        WHEN("capture the shared pointer in lambda and move it into a unique_function") {
+            pa::util::unique_function<void()> fn_1 = [shared = foo->shared_from_this()]() {};
+            auto fn_2 = std::move(fn_1);
+
+            fn_2();
+
+            THEN("the lambda is stored without allocating and moved without copying") {
+                REQUIRE(fn_2.is_inline());
+                REQUIRE_FALSE(fn_1);
+                REQUIRE(foo.use_count() == 2);
+            }
+        }
+
+        WHEN("the captures don't fit the inline buffer") {
+            std::array<char, 128> big{};
+            pa::util::unique_function<size_t()> fn = [shared = foo, big]() { return big.size(); };
+
+            THEN("the lambda falls back to the heap") {
+                REQUIRE_FALSE(fn.is_inline());
+                REQUIRE(fn() == 128);
+            }
+        }
+    }
+}
@@ -8,143 +8,12 @@
 #include <thread>
 #include <type_traits>
 
+#include "papaya/concurrent/fixed_size_queue.hpp"
+
 namespace detail
 {
-  /**
-   * @brief Thread-safe lock-free queue.
-   *
-   * @tparam T Trivially copyable type (guard by std::is_trivially_copyable).
-   * @tparam size fixed size of the ring buffer under the hood.
-   */
-  template <typename T, size_t size>
-  class ConcurrentFixedSizeQueue
-  {
-    static_assert(std::is_trivially_copyable<T>::value);
-    // TODO: Apply a static-check for size > 0
-
-  public:
-    bool push(const T &newElement)
-    {
-      while (true)
-      {
-        auto old_write_pos = write_pos_.load();
-        auto old_read_pos = read_pos_.load();
-        auto new_write_pos = getPositionAfter(old_write_pos);
-        // When new W and R points to the same slot, it's full.
-        if (new_write_pos == old_read_pos)
-        {
-          return false;
-        }
-
-        if (write_pos_.compare_exchange_strong(old_write_pos, new_write_pos))
-        {
-          ring_buffer_[old_write_pos].store(newElement);
-          return true;
-        }
-      }
-    }
-
-    bool pop(T &returnedElement)
-    {
-      while (true)
-      {
-        auto old_write_pos = write_pos_.load();
-        auto old_read_pos = read_pos_.load();
-        // When W and R points to the same slot, it's empty.
-        if (old_write_pos == old_read_pos)
-        {
-          return false;
-        }
-
-        returnedElement = ring_buffer_[old_read_pos].load();
-
-        if (read_pos_.compare_exchange_strong(old_read_pos, getPositionAfter(old_read_pos)))
-        {
-          return true;
-        }
-      }
-    }
-
-    bool is_empty()
-    {
-      return read_pos_.load() == write_pos_.load();
-    }
-
-    size_t effective_size()
-    {
-      auto read_pos = read_pos_.load();
-      auto write_pos = write_pos_.load();
-      if (write_pos >= read_pos)
-      {
-        return write_pos - read_pos;
-      }
-      else
-      {
-        return buffer_size_ - read_pos + write_pos;
-      }
-    }
-
-  private:
-    static constexpr size_t buffer_size_ = size + 1;
-    std::atomic<size_t> read_pos_{0};
-    std::atomic<size_t> write_pos_{0};
-    std::array<std::atomic<T>, buffer_size_> ring_buffer_;
-
-  private:
-    template <typename FRIEND_T, size_t friend_size>
-    friend class Verifier;
-
-    /**
-     * @brief Get the position after pos in the ring buffer.
-     *
-     * @param pos The current position.
-     * @return size_t new position in the ring buffer.
-     */
-    static constexpr auto getPositionAfter(size_t pos) -> size_t
-    {
-      return ++pos == buffer_size_ ? 0 : pos;
-    }
-  };
-
-  /**
-   * @brief A helper to verify the content of ConcurrentFixedSizeQueue.
-   */
-  template <typename T, size_t size>
-  class Verifier
-  {
-  public:
-    /**
-     * @brief Validate function that takes index and element.
-     *
-     * @param i The index of the element in testee's std::array.
-     * @param element The element on the index.
-     */
-    template <typename TT>
-    using ValidateElementFn = std::function<void(const size_t, const TT &)>;
-
-    Verifier(const ConcurrentFixedSizeQueue<T, size> &queue, ValidateElementFn<T> ValidateFn)
-    {
-      auto read_pos = queue.read_pos_.load();
-      auto write_pos = queue.write_pos_.load();
-      for (auto i = 0; i < queue.ring_buffer_.size(); ++i)
-      {
-        if (write_pos > read_pos)
-        {
-          if (i >= read_pos && i < write_pos)
-          {
-            ValidateFn(i, queue.ring_buffer_[i]);
-          }
-        }
-        else
-        {
-          if (i >= read_pos || i < write_pos)
-          {
-            ValidateFn(i, queue.ring_buffer_[i]);
-          }
-        }
-      }
-    }
-  };
+  using pa::concurrent::ConcurrentFixedSizeQueue;
+  using pa::concurrent::Verifier;
 } // namespace detail
 
 SCENARIO("Test dry pop", "[lock-free]")
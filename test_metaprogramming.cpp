@@ -1,7 +1,12 @@
 #include <catch2/catch.hpp>
 #include <functional>
 #include <iostream>
+#include <string>
+#include <utility>
 #include <variant>
+#include <vector>
+
+#include "papaya/util/match.hpp"
 
 struct poly_visitor
 {
@@ -41,4 +46,143 @@ SCENARIO("Visit std::variant with std::visit()", "[meta programming][runtime pol
 SCENARIO("Visit std::variant with template function", "[meta programming][runtime polymorphism]")
 {
     with_if<int>(std::variant<int, std::string>(111), [](const auto &v) { /* std::cerr << "visiting " << v << std::endl; */ });
-}
\ No newline at end of file
+}
+SCENARIO("Visit std::variant with a constexpr jump table", "[meta programming][runtime polymorphism]")
+{
+    GIVEN("a variant holding each alternative")
+    {
+        using variant = std::variant<int, std::string, float>;
+
+        THEN("match() calls the matching handler")
+        {
+            auto describe = [](const variant &v)
+            {
+                return pa::util::match(
+                    v,
+                    [](int i) { return "int " + std::to_string(i); },
+                    [](const std::string &s) { return "string " + s; },
+                    [](float) { return std::string("float"); });
+            };
+            REQUIRE(describe(variant(111)) == "int 111");
+            REQUIRE(describe(variant("hello")) == "string hello");
+            REQUIRE(describe(variant(1.f)) == "float");
+        }
+
+        THEN("a generic handler covers the remaining alternatives")
+        {
+            auto size = pa::util::match(
+                variant("hello"),
+                [](const std::string &s) { return s.size(); },
+                [](const auto &) { return size_t{0}; });
+            REQUIRE(size == 5);
+        }
+
+        THEN("an rvalue variant moves its alternative into the handler")
+        {
+            auto moved = pa::util::match(
+                variant("hello"),
+                [](std::string &&s) { return std::string(std::move(s)); },
+                [](auto &&) { return std::string(); });
+            REQUIRE(moved == "hello");
+        }
+    }
+}
+
+namespace detail
+{
+    template <size_t I>
+    struct alternative
+    {
+        int value;
+    };
+
+    template <typename Indices>
+    struct make_variant;
+    template <size_t... Is>
+    struct make_variant<std::index_sequence<Is...>>
+    {
+        using type = std::variant<alternative<Is>...>;
+    };
+    template <size_t N>
+    using variant_of = typename make_variant<std::make_index_sequence<N>>::type;
+
+    // Each alternative gets a distinct handler body so the compiler can't
+    // merge the branches.
+    template <size_t I>
+    int handle(const alternative<I> &a)
+    {
+        return a.value * static_cast<int>(I + 1);
+    }
+
+    template <size_t N, size_t... Is>
+    variant_of<N> make_alternative(size_t index, int value, std::index_sequence<Is...>)
+    {
+        variant_of<N> v;
+        ((index == Is ? (v = alternative<Is>{value}, true) : false) || ...);
+        return v;
+    }
+
+    template <size_t N>
+    std::vector<variant_of<N>> make_variants(size_t count)
+    {
+        std::vector<variant_of<N>> all;
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < count; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            auto index = (seed >> 16) % N;
+            all.push_back(make_alternative<N>(index, static_cast<int>(i), std::make_index_sequence<N>{}));
+        }
+        return all;
+    }
+
+    template <size_t N, size_t... Is>
+    int get_if_chain(const variant_of<N> &v, std::index_sequence<Is...>)
+    {
+        int result = 0;
+        ((std::get_if<Is>(&v) != nullptr ? (result = handle(*std::get_if<Is>(&v)), true) : false) || ...);
+        return result;
+    }
+
+    template <size_t N>
+    void benchmark_dispatch(const char *name)
+    {
+        auto variants = make_variants<N>(4096);
+        auto generic = [](const auto &a) { return handle(a); };
+
+        BENCHMARK(std::string(name) + " std::visit")
+        {
+            int sum = 0;
+            for (const auto &v : variants)
+            {
+                sum += std::visit(generic, v);
+            }
+            return sum;
+        };
+        BENCHMARK(std::string(name) + " get_if chain")
+        {
+            int sum = 0;
+            for (const auto &v : variants)
+            {
+                sum += get_if_chain<N>(v, std::make_index_sequence<N>{});
+            }
+            return sum;
+        };
+        BENCHMARK(std::string(name) + " match")
+        {
+            int sum = 0;
+            for (const auto &v : variants)
+            {
+                sum += pa::util::match(v, generic);
+            }
+            return sum;
+        };
+    }
+} // namespace detail
+
+TEST_CASE("Benchmark variant dispatch", "[meta programming][!benchmark]")
+{
+    detail::benchmark_dispatch<2>("2 alternatives");
+    detail::benchmark_dispatch<8>("8 alternatives");
+    detail::benchmark_dispatch<32>("32 alternatives");
+}
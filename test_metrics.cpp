@@ -0,0 +1,127 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "papaya/metrics/metrics.hpp"
+
+SCENARIO("Counters are sharded per thread and merged on read", "[metrics]")
+{
+  GIVEN("a counter shared by N threads")
+  {
+    pa::metrics::registry registry;
+    auto counter = registry.make_counter("test_total");
+    const auto thread_size = 8;
+    const auto increments = 10000;
+
+    WHEN("every thread increments it concurrently")
+    {
+      std::vector<std::thread> all;
+      for (auto i = 0; i < thread_size; ++i)
+      {
+        all.emplace_back([&]
+                         {
+          for (auto j = 0; j < increments; ++j)
+          {
+            counter->increment();
+          } });
+      }
+      for (auto &t : all)
+      {
+        t.join();
+      }
+
+      THEN("no increment is lost")
+      {
+        REQUIRE(counter->value() == thread_size * increments);
+        REQUIRE(registry.snapshot().counters[0].value == thread_size * increments);
+      }
+    }
+
+    WHEN("the same name is registered twice")
+    {
+      THEN("the same counter is returned")
+      {
+        REQUIRE(registry.make_counter("test_total") == counter);
+        REQUIRE(registry.make_counter("test_total", "", "stage=\"other\"") != counter);
+      }
+    }
+  }
+}
+
+SCENARIO("Histogram buckets keep a bounded relative error", "[metrics]")
+{
+  using pa::metrics::histogram;
+
+  GIVEN("any value below the max value")
+  {
+    THEN("it lands in a bucket whose bounds contain it")
+    {
+      for (uint64_t v : std::vector<uint64_t>{0, 1, 31, 32, 33, 1000, 123456789, histogram::max_value})
+      {
+        auto bucket = histogram::bucket_of(v);
+        REQUIRE(bucket < histogram::bucket_count);
+        REQUIRE(histogram::bucket_upper_bound(bucket) >= v);
+        if (bucket > 0)
+        {
+          REQUIRE(histogram::bucket_upper_bound(bucket - 1) < v);
+        }
+      }
+      REQUIRE(histogram::bucket_of(histogram::max_value) == histogram::bucket_count - 1);
+      REQUIRE(histogram::bucket_of(UINT64_MAX) == histogram::bucket_count - 1);
+    }
+  }
+
+  GIVEN("1..10000 recorded into a histogram")
+  {
+    histogram h;
+    for (uint64_t v = 1; v <= 10000; ++v)
+    {
+      h.record(v);
+    }
+
+    THEN("the snapshot summarizes them")
+    {
+      auto s = h.snapshot();
+      REQUIRE(s.count == 10000);
+      REQUIRE(s.min == 1);
+      REQUIRE(s.max == 10000);
+      REQUIRE(s.mean() == Approx(5000.5));
+      REQUIRE(s.percentile(0.5) == Approx(5000).epsilon(1.0 / 16));
+      REQUIRE(s.percentile(0.99) == Approx(9900).epsilon(1.0 / 16));
+      REQUIRE(s.percentile(1.0) == 10000);
+    }
+  }
+}
+
+SCENARIO("A registry snapshot exports to Prometheus text and JSON", "[metrics]")
+{
+  GIVEN("a registry with one metric of each kind")
+  {
+    pa::metrics::registry registry;
+    registry.make_counter("runs_total", "Runs.")->increment(3);
+    registry.make_gauge("pending_runs")->set(2);
+    registry.make_histogram("stage_duration_nanoseconds", "", "stage=\"match\"")->record(100);
+
+    THEN("the Prometheus exposition has every series")
+    {
+      std::ostringstream out;
+      registry.snapshot().write_prometheus(out);
+      auto text = out.str();
+      REQUIRE(text.find("# HELP runs_total Runs.\n") != std::string::npos);
+      REQUIRE(text.find("runs_total 3\n") != std::string::npos);
+      REQUIRE(text.find("pending_runs 2\n") != std::string::npos);
+      REQUIRE(text.find("stage_duration_nanoseconds_bucket{stage=\"match\",le=\"+Inf\"} 1\n") != std::string::npos);
+      REQUIRE(text.find("stage_duration_nanoseconds_count{stage=\"match\"} 1\n") != std::string::npos);
+    }
+
+    THEN("the JSON export has every series")
+    {
+      std::ostringstream out;
+      registry.snapshot().write_json(out);
+      auto json = out.str();
+      REQUIRE(json.find("{\"name\":\"runs_total\",\"labels\":\"\",\"value\":3}") != std::string::npos);
+      REQUIRE(json.find("\"labels\":\"stage=\\\"match\\\"\",\"count\":1") != std::string::npos);
+    }
+  }
+}
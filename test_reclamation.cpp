@@ -0,0 +1,322 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/epoch.hpp"
+#include "papaya/concurrent/hazard_pointer.hpp"
+#include "papaya/concurrent/thread_pool.hpp"
+
+namespace detail
+{
+  using pa::concurrent::epoch_domain;
+  using pa::concurrent::hazard_domain;
+
+  constexpr uint64_t alive = 0xa11ce;
+
+  // Counts live instances and poisons itself on destruction, so a reader
+  // that gets to a freed node fails the canary check even without ASan.
+  struct node
+  {
+    explicit node(uint64_t value, std::atomic<int64_t> &live) : value(value), live(live) { live.fetch_add(1); }
+    ~node()
+    {
+      canary = 0;
+      live.fetch_sub(1);
+    }
+
+    uint64_t value;
+    uint64_t canary = alive;
+    node *next = nullptr;
+    std::atomic<int64_t> &live;
+  };
+
+  // Treiber stack whose pop() retires into an epoch domain.
+  class stack
+  {
+  public:
+    explicit stack(epoch_domain &domain) : domain_(domain) {}
+    ~stack()
+    {
+      for (auto *n = head_.load(); n != nullptr;)
+      {
+        auto *next = n->next;
+        delete n;
+        n = next;
+      }
+    }
+
+    void push(node *n)
+    {
+      n->next = head_.load(std::memory_order_relaxed);
+      while (!head_.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    // Returns false when empty, or when a popped node was already freed.
+    bool pop(uint64_t &value)
+    {
+      auto guard = domain_.pin();
+      auto *n = head_.load(std::memory_order_acquire);
+      while (n != nullptr && !head_.compare_exchange_weak(n, n->next, std::memory_order_acquire, std::memory_order_acquire))
+      {
+      }
+      if (n == nullptr || n->canary != alive)
+      {
+        return false;
+      }
+      value = n->value;
+      domain_.retire(n);
+      return true;
+    }
+
+  private:
+    epoch_domain &domain_;
+    std::atomic<node *> head_{nullptr};
+  };
+} // namespace detail
+
+SCENARIO("Epoch-based reclamation frees only what no pinned thread can see", "[reclamation]")
+{
+  GIVEN("a Treiber stack hammered by 4 threads")
+  {
+    std::atomic<int64_t> live{0};
+    {
+      detail::epoch_domain domain;
+      detail::stack stack(domain);
+      std::atomic<uint64_t> popped{0};
+      std::atomic<bool> corrupted{false};
+      std::vector<std::thread> threads;
+      for (uint64_t t = 0; t < 4; ++t)
+      {
+        threads.emplace_back([&, t]
+                             {
+          uint64_t value;
+          for (uint64_t i = 0; i < 20000; ++i)
+          {
+            stack.push(new detail::node(t << 32 | i, live));
+            if (stack.pop(value))
+            {
+              popped.fetch_add(1);
+            }
+            else
+            {
+              corrupted = true;
+            }
+          } });
+      }
+      for (auto &thread : threads)
+      {
+        thread.join();
+      }
+
+      THEN("no reader saw a freed node, and most retired nodes were freed along the way")
+      {
+        REQUIRE_FALSE(corrupted);
+        REQUIRE(popped == 80000);
+        REQUIRE(live < 80000 / 2);
+      }
+    }
+
+    THEN("the domain frees the rest when destroyed")
+    {
+      REQUIRE(live == 0);
+    }
+  }
+
+  GIVEN("a thread pinned while another retires")
+  {
+    std::atomic<int64_t> live{0};
+    detail::epoch_domain domain;
+    std::atomic<bool> pinned{false};
+    std::atomic<bool> unpin{false};
+    std::thread reader([&]
+                       {
+      auto guard = domain.pin();
+      pinned = true;
+      while (!unpin)
+      {
+        std::this_thread::yield();
+      }
+    });
+    while (!pinned)
+    {
+      std::this_thread::yield();
+    }
+
+    domain.retire(new detail::node(1, live));
+    for (int i = 0; i < 10; ++i)
+    {
+      domain.collect();
+    }
+
+    THEN("nothing is freed until it unpins")
+    {
+      REQUIRE(live == 1);
+      unpin = true;
+      reader.join();
+      domain.collect();
+      REQUIRE(live == 0);
+    }
+  }
+
+  GIVEN("a thread that retires and exits")
+  {
+    std::atomic<int64_t> live{0};
+    detail::epoch_domain domain;
+    std::thread([&]
+                { domain.retire(new detail::node(1, live)); })
+        .join();
+
+    THEN("its retire list is handed over and freed by another thread's collect()")
+    {
+      REQUIRE(live == 1);
+      domain.collect();
+      REQUIRE(live == 0);
+    }
+  }
+
+  GIVEN("jobs on a thread pool that retire into the global domain")
+  {
+    std::atomic<int64_t> live{0};
+    pa::concurrent::thread_pool pool(2);
+    for (int i = 0; i < 10; ++i)
+    {
+      pool.schedule([&]
+                    { detail::epoch_domain::global().retire(new detail::node(1, live)); });
+    }
+
+    THEN("idle workers free them without anyone calling collect()")
+    {
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+      while (live != 0 && std::chrono::steady_clock::now() < deadline)
+      {
+        // Wakes a worker so it goes idle, and collects, once more.
+        pool.schedule([] {});
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      REQUIRE(live == 0);
+    }
+  }
+}
+
+SCENARIO("Hazard pointers keep protected objects alive", "[reclamation]")
+{
+  GIVEN("a protected object that is unlinked and retired")
+  {
+    std::atomic<int64_t> live{0};
+    detail::hazard_domain domain;
+    std::atomic<detail::node *> shared{new detail::node(1, live)};
+    auto holder = std::make_unique<detail::hazard_domain::holder>(domain);
+    auto *protected_node = holder->protect(shared);
+    domain.retire(shared.exchange(nullptr));
+
+    THEN("collect() leaves it alone until the holder lets go")
+    {
+      REQUIRE(domain.collect() == 0);
+      REQUIRE(protected_node->canary == detail::alive);
+      holder.reset();
+      REQUIRE(domain.collect() == 1);
+      REQUIRE(live == 0);
+    }
+  }
+
+  GIVEN("readers protecting a pointer that writers keep replacing")
+  {
+    std::atomic<int64_t> live{0};
+    {
+      detail::hazard_domain domain;
+      std::atomic<detail::node *> shared{new detail::node(0, live)};
+      std::atomic<bool> stop{false};
+      std::atomic<bool> corrupted{false};
+      std::vector<std::thread> threads;
+      for (int r = 0; r < 3; ++r)
+      {
+        threads.emplace_back([&]
+                             {
+          detail::hazard_domain::holder holder(domain);
+          while (!stop)
+          {
+            auto *n = holder.protect(shared);
+            if (n->canary != detail::alive)
+            {
+              corrupted = true;
+            }
+            holder.reset();
+          } });
+      }
+      threads.emplace_back([&]
+                           {
+        for (uint64_t i = 1; i <= 50000; ++i)
+        {
+          domain.retire(shared.exchange(new detail::node(i, live)));
+        }
+        stop = true; });
+      for (auto &thread : threads)
+      {
+        thread.join();
+      }
+      delete shared.load();
+
+      THEN("no reader saw a freed node, and retired nodes were freed in batches")
+      {
+        REQUIRE_FALSE(corrupted);
+        REQUIRE(live < 1000);
+      }
+    }
+
+    THEN("the domain frees the rest when destroyed")
+    {
+      REQUIRE(live == 0);
+    }
+  }
+}
+
+TEST_CASE("Cost of protecting and retiring", "[reclamation][!benchmark]")
+{
+  std::atomic<int64_t> live{0};
+  detail::epoch_domain epochs;
+  detail::hazard_domain hazards;
+  std::atomic<detail::node *> shared{new detail::node(0, live)};
+  detail::hazard_domain::holder holder(hazards);
+
+  BENCHMARK("epoch pin + read + unpin")
+  {
+    auto guard = epochs.pin();
+    return shared.load(std::memory_order_acquire)->value;
+  };
+
+  BENCHMARK("hazard protect + read + reset")
+  {
+    auto value = holder.protect(shared)->value;
+    holder.reset();
+    return value;
+  };
+
+  auto counted = std::make_shared<detail::node>(0, live);
+  BENCHMARK("shared_ptr atomic load + read, for reference")
+  {
+    return std::atomic_load(&counted)->value;
+  };
+
+  BENCHMARK("epoch retire (amortized collect) + new/delete")
+  {
+    epochs.retire(new detail::node(0, live));
+  };
+
+  BENCHMARK("hazard retire (amortized scan) + new/delete")
+  {
+    hazards.retire(new detail::node(0, live));
+  };
+
+  BENCHMARK("plain new/delete, for reference")
+  {
+    delete new detail::node(0, live);
+  };
+
+  holder.reset();
+  delete shared.load();
+}
@@ -0,0 +1,361 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/thread_pool.hpp"
+#include "papaya/factory/fl_factory.hpp"
+#include "papaya/papaya.hpp"
+#include "papaya/resource/accounting.hpp"
+#include "papaya/sim/virtual_scheduler.hpp"
+
+namespace detail
+{
+  using namespace pa::resource;
+
+  // Spins on the calling thread until it has used at least cpu_time.
+  double burn_cpu(std::chrono::nanoseconds cpu_time)
+  {
+    auto until = thread_cpu_time() + cpu_time;
+    volatile double x = 1;
+    while (thread_cpu_time() < until)
+    {
+      for (int i = 0; i < 1000; ++i)
+      {
+        x = std::sqrt(x + i);
+      }
+    }
+    return x;
+  }
+
+  template <typename T>
+  using accounted_vector = std::vector<T, session_allocator<T>>;
+
+  // A session stage that allocates bytes on the session's account, then
+  // takes a virtual second.
+  pa::coro::task<void> hungry_stage(pa::sim::virtual_scheduler &scheduler, size_t bytes)
+  {
+    if (bytes > 0)
+    {
+      accounted_vector<char> values;
+      values.reserve(bytes);
+    }
+    co_await scheduler.sleep_for(std::chrono::seconds(1));
+  }
+
+  struct quota_outcome
+  {
+    int attempts = 0;
+    int errors = 0;
+    int completions = 0;
+    // Sessions in the session histograms.
+    uint64_t sessions_recorded = 0;
+    // Budget slots taken when papaya reported, and once all drained.
+    size_t slots_when_reported = 0;
+    size_t slots_after = 0;
+  };
+
+  // Runs one coroutine session whose first hungry_attempts attempts go over
+  // a 1 KB quota, on a budget of one session, until papaya reports how it
+  // ended and the stopped sessions have drained.
+  quota_outcome run_over_quota(pa::papaya::options::quota_action action, int hungry_attempts)
+  {
+    auto scheduler = std::make_shared<pa::sim::virtual_scheduler>();
+    auto attempts = std::make_shared<std::atomic<int>>(0);
+    auto hook = [scheduler, attempts, hungry_attempts](std::string_view stage)
+    {
+      auto hungry = stage == "session" && ++*attempts <= hungry_attempts;
+      return hungry_stage(*scheduler, hungry ? 4096 : 0);
+    };
+    pa::papaya::options options;
+    options.session = pa::papaya::options::session_api::coroutine;
+    options.session_quota.live_bytes = 1024;
+    options.on_quota_exceeded = action;
+    options.max_deferrals = 1;
+    options.budget = std::make_shared<budget>(budget::limits{std::numeric_limits<uint64_t>::max(), 1});
+    auto metrics = std::make_shared<pa::metrics::registry>();
+
+    std::atomic<int> errors{0};
+    std::atomic<int> completions{0};
+    pa::papaya papaya{
+        1,
+        std::make_shared<pa::fl_factory>(std::make_shared<pa::metrics::registry>(), std::make_shared<pa::match_factory>(), hook),
+        options,
+        metrics,
+        scheduler};
+    REQUIRE(papaya.run({}, nullptr, [&](std::exception)
+                       { ++errors; }, [&]
+                       { ++completions; }));
+    // The quota handler runs on papaya's dispatcher while the sessions run
+    // here, so give it a moment between steps of virtual time.
+    for (int i = 0; i < 2000 && errors + completions == 0; ++i)
+    {
+      scheduler->run_until(scheduler->now() + std::chrono::milliseconds(100));
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto slots_when_reported = options.budget->running();
+    scheduler->run();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE_FALSE(papaya.state_of(1));
+    return {attempts->load(),
+            errors.load(),
+            completions.load(),
+            metrics->make_histogram("papaya_session_peak_bytes")->snapshot().count,
+            slots_when_reported,
+            options.budget->running()};
+  }
+} // namespace detail
+
+SCENARIO("A session_scope charges the thread's CPU time to its account", "[resource]")
+{
+  using namespace std::chrono_literals;
+
+  GIVEN("two accounts")
+  {
+    auto outer = std::make_shared<detail::account>();
+    auto inner = std::make_shared<detail::account>();
+
+    WHEN("a scope of one encloses a scope of the other")
+    {
+      {
+        detail::session_scope outer_scope(outer);
+        REQUIRE(detail::current() == outer);
+        detail::burn_cpu(20ms);
+        {
+          detail::session_scope inner_scope(inner);
+          REQUIRE(detail::current() == inner);
+          detail::burn_cpu(40ms);
+          // Re-entering the current account neither pauses nor double counts.
+          detail::session_scope again(inner);
+          detail::burn_cpu(10ms);
+        }
+        REQUIRE(detail::current() == outer);
+      }
+
+      THEN("each is charged only while it's innermost")
+      {
+        REQUIRE(detail::current() == nullptr);
+        REQUIRE(outer->usage().cpu_time >= 20ms);
+        REQUIRE(outer->usage().cpu_time < 45ms);
+        REQUIRE(inner->usage().cpu_time >= 50ms);
+        REQUIRE(inner->usage().cpu_time < 75ms);
+      }
+    }
+  }
+
+  GIVEN("an accounted_scheduler over a thread pool")
+  {
+    pa::concurrent::thread_pool pool(2);
+    auto account = std::make_shared<detail::account>();
+    detail::accounted_scheduler scheduler(pool, account);
+
+    THEN("jobs are charged to the account on whichever worker runs them")
+    {
+      std::vector<std::future<void>> done;
+      for (int i = 0; i < 4; ++i)
+      {
+        auto promise = std::make_shared<std::promise<void>>();
+        done.push_back(promise->get_future());
+        scheduler.schedule([promise]
+                           {
+          detail::burn_cpu(10ms);
+          promise->set_value(); });
+      }
+      for (auto &job : done)
+      {
+        job.get();
+      }
+      // The scope ends just after set_value().
+      while (account->usage().cpu_time < 40ms)
+      {
+        std::this_thread::yield();
+      }
+      REQUIRE(account->usage().cpu_time >= 40ms);
+    }
+  }
+}
+
+SCENARIO("A session_allocator charges its account", "[resource]")
+{
+  GIVEN("a vector charged to an account")
+  {
+    auto account = std::make_shared<detail::account>();
+    detail::accounted_vector<uint64_t> values{detail::session_allocator<uint64_t>(account)};
+
+    WHEN("it grows and is then freed")
+    {
+      values.reserve(1000);
+      values.reserve(4000);
+      REQUIRE(account->usage().live_bytes == 4000 * sizeof(uint64_t));
+      values = detail::accounted_vector<uint64_t>{detail::session_allocator<uint64_t>(account)};
+
+      THEN("total, live and peak bytes follow")
+      {
+        auto usage = account->usage();
+        REQUIRE(usage.allocated_bytes == 5000 * sizeof(uint64_t));
+        REQUIRE(usage.live_bytes == 0);
+        REQUIRE(usage.peak_bytes == 5000 * sizeof(uint64_t));
+      }
+    }
+
+    WHEN("it's moved from and used again")
+    {
+      values.push_back(1);
+      auto moved = std::move(values);
+      values.clear();
+      values.reserve(10);
+
+      THEN("the moved-from vector still charges the account")
+      {
+        REQUIRE(values.get_allocator().owner() == account);
+        REQUIRE(account->usage().live_bytes == (1 + 10) * sizeof(uint64_t));
+      }
+    }
+  }
+
+  THEN("a default-constructed allocator charges the current session")
+  {
+    auto account = std::make_shared<detail::account>();
+    detail::accounted_vector<char> outside;
+    REQUIRE(outside.get_allocator().owner() == nullptr);
+    {
+      detail::session_scope scope(account);
+      detail::accounted_vector<char> inside(100);
+      REQUIRE(account->usage().live_bytes == 100);
+    }
+    REQUIRE(account->usage().live_bytes == 0);
+  }
+}
+
+SCENARIO("Quotas and the budget limit sessions", "[resource]")
+{
+  using namespace std::chrono_literals;
+
+  GIVEN("an account with a memory and a CPU quota")
+  {
+    int exceeded = 0;
+    detail::quota quota;
+    quota.live_bytes = 1024;
+    quota.cpu_time = 30ms;
+    auto account = std::make_shared<detail::account>(quota, nullptr, [&]
+                                                     { ++exceeded; });
+
+    THEN("going over the memory quota reports it once")
+    {
+      detail::accounted_vector<char> values{detail::session_allocator<char>(account)};
+      values.reserve(1024);
+      REQUIRE(exceeded == 0);
+      values.reserve(2048);
+      values.reserve(4096);
+      REQUIRE(exceeded == 1);
+      REQUIRE(account->exceeded());
+    }
+
+    THEN("going over the CPU quota is reported when the scope charges it")
+    {
+      {
+        detail::session_scope scope(account);
+        detail::burn_cpu(40ms);
+      }
+      REQUIRE(exceeded == 1);
+    }
+  }
+
+  GIVEN("a budget of 2 sessions and 1 MB")
+  {
+    auto budget = std::make_shared<detail::budget>(detail::budget::limits{1 << 20, 2});
+    std::atomic<int> woken{0};
+    auto waiter = budget->add_waiter([&]
+                                     { ++woken; });
+
+    THEN("a third session waits for a slot")
+    {
+      REQUIRE(budget->try_start());
+      REQUIRE(budget->try_start());
+      REQUIRE_FALSE(budget->try_start());
+      budget->finish();
+      REQUIRE(woken == 1);
+      REQUIRE(budget->try_start());
+      REQUIRE(budget->running() == 2);
+    }
+
+    THEN("nothing is admitted while the sessions hold more than 1 MB")
+    {
+      auto account = std::make_shared<detail::account>(detail::quota{}, budget);
+      {
+        detail::accounted_vector<char> values{detail::session_allocator<char>(account)};
+        values.reserve(2 << 20);
+        REQUIRE(budget->live_bytes() == 2 << 20);
+        REQUIRE_FALSE(budget->admits());
+        REQUIRE_FALSE(budget->try_start());
+      }
+      REQUIRE(budget->admits());
+    }
+
+    THEN("an account returns what it still holds when it's destroyed")
+    {
+      auto account = std::make_shared<detail::account>(detail::quota{}, budget);
+      account->charge_allocation(4096);
+      REQUIRE(budget->live_bytes() == 4096);
+      account.reset();
+      REQUIRE(budget->live_bytes() == 0);
+    }
+
+    THEN("a removed waiter isn't called")
+    {
+      REQUIRE(budget->try_start());
+      budget->remove_waiter(waiter);
+      budget->finish();
+      REQUIRE(woken == 0);
+    }
+  }
+}
+
+SCENARIO("papaya stops run-sessions that go over their quota", "[resource]")
+{
+  using quota_action = pa::papaya::options::quota_action;
+
+  GIVEN("a run whose first session goes over it")
+  {
+    THEN("cancel fails the run and drops what the stopped session reports")
+    {
+      auto outcome = detail::run_over_quota(quota_action::cancel, 1);
+      REQUIRE(outcome.attempts == 1);
+      REQUIRE(outcome.errors == 1);
+      REQUIRE(outcome.completions == 0);
+      REQUIRE(outcome.sessions_recorded == 1);
+      // The stopped session keeps its slot until it has drained.
+      REQUIRE(outcome.slots_when_reported == 1);
+      REQUIRE(outcome.slots_after == 0);
+    }
+
+    THEN("defer retries it, and the retry completes")
+    {
+      auto outcome = detail::run_over_quota(quota_action::defer, 1);
+      REQUIRE(outcome.attempts == 2);
+      REQUIRE(outcome.errors == 0);
+      REQUIRE(outcome.completions == 1);
+      REQUIRE(outcome.sessions_recorded == 2);
+      REQUIRE(outcome.slots_after == 0);
+    }
+  }
+
+  GIVEN("a run whose retry goes over it too")
+  {
+    THEN("defer fails it once max_deferrals retries are used up")
+    {
+      auto outcome = detail::run_over_quota(quota_action::defer, 2);
+      REQUIRE(outcome.attempts == 2);
+      REQUIRE(outcome.errors == 1);
+      REQUIRE(outcome.completions == 0);
+      REQUIRE(outcome.sessions_recorded == 2);
+      REQUIRE(outcome.slots_after == 0);
+    }
+  }
+}
@@ -9,50 +9,12 @@
 #include <type_traits>
 #include <variant>
 
+#include "papaya/executor/executor.hpp"
+
 namespace detail
 {
-  /// Abstract class that executes the primary training or evaluation loop.
-  class IExecutor
-  {
-  public:
-    struct Input final
-    {
-      std::string executionConfig;
-      std::string dataset;
-      std::string localInfo;
-      std::string modelGraph;
-      std::string dataDirectoryPath;
-    };
-
-    struct Success final
-    {
-    };
-
-    struct Failure final
-    {
-      int32_t errorCode;
-    };
-
-    using Output = std::variant<Success, Failure>;
-
-  public:
-    virtual ~IExecutor() = default;
-
-    virtual Output execute(const Input &) = 0;
-  };
-
-  /// FL (Federated Learning) executor
-  class FlExecutor final : public IExecutor
-  {
-  public:
-    FlExecutor() = default;
-    // ~FlExecutor() = default;
-
-    Output execute(const Input &input) override
-    {
-      return std::variant<Success, Failure>{Success{}};
-    }
-  };
+  using pa::FlExecutor;
+  using pa::IExecutor;
 } // namespace detail
 
 SCENARIO("Simulate an engine that uses executors via inheritance based runtime-polymorphism", "[runtime-polymorphism]")
@@ -62,5 +24,12 @@ SCENARIO("Simulate an engine that uses executors via inheritance based runtime-p
     std::vector<std::unique_ptr<detail::IExecutor>> executors;
 
     executors.push_back(std::make_unique<detail::FlExecutor>());
+
+    THEN("Its output is matched without a std::get_if chain")
+    {
+      auto output = executors[0]->execute(detail::IExecutor::Input{});
+      REQUIRE(pa::error_code_of(output) == 0);
+      REQUIRE(pa::error_code_of(detail::IExecutor::Output{detail::IExecutor::Failure{42}}) == 42);
+    }
   }
 }
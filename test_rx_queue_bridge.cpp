@@ -0,0 +1,157 @@
+#include <catch2/catch.hpp>
+#include <memory>
+#include <rxcpp/rx.hpp>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/rx_queue_bridge.hpp"
+
+using pa::concurrent::overflow_policy;
+
+template <size_t size>
+using int_channel = pa::concurrent::queue_channel<int, size>;
+
+SCENARIO("A full queue_channel applies its overflow policy", "[lock-free][rx]")
+{
+  GIVEN("a channel of size 3 that already holds 0, 1, 2")
+  {
+    auto fill = [](auto &channel)
+    {
+      for (auto i = 0; i < 3; ++i)
+      {
+        REQUIRE(channel.offer(i));
+      }
+    };
+    auto drain_all = [](auto &channel)
+    {
+      std::vector<int> all;
+      int value;
+      while (channel.poll(value))
+      {
+        all.push_back(value);
+      }
+      return all;
+    };
+
+    WHEN("the policy is drop_oldest")
+    {
+      int_channel<3> channel{overflow_policy::drop_oldest};
+      fill(channel);
+      REQUIRE(channel.offer(3));
+
+      THEN("0 is evicted")
+      {
+        REQUIRE(channel.dropped() == 1);
+        REQUIRE(drain_all(channel) == std::vector<int>{1, 2, 3});
+      }
+    }
+
+    WHEN("the policy is drop_newest")
+    {
+      int_channel<3> channel{overflow_policy::drop_newest};
+      fill(channel);
+      REQUIRE(channel.offer(3));
+
+      THEN("3 is discarded")
+      {
+        REQUIRE(channel.dropped() == 1);
+        REQUIRE(drain_all(channel) == std::vector<int>{0, 1, 2});
+      }
+    }
+
+    WHEN("the policy is fail")
+    {
+      int_channel<3> channel{overflow_policy::fail};
+      fill(channel);
+
+      THEN("the offer is rejected")
+      {
+        REQUIRE_FALSE(channel.offer(3));
+        REQUIRE(channel.dropped() == 1);
+        REQUIRE(drain_all(channel) == std::vector<int>{0, 1, 2});
+      }
+    }
+
+    WHEN("the policy is block and a consumer drains concurrently")
+    {
+      int_channel<3> channel{overflow_policy::block};
+      const auto test_size = 10000;
+      std::vector<int> received;
+      std::thread consumer([&]
+                           {
+        int value;
+        while (received.size() < test_size)
+        {
+          if (channel.poll(value))
+          {
+            received.push_back(value);
+          }
+        } });
+      for (auto i = 0; i < test_size; ++i)
+      {
+        channel.offer(i);
+      }
+      consumer.join();
+
+      THEN("nothing is dropped and order is kept")
+      {
+        REQUIRE(channel.dropped() == 0);
+        REQUIRE(channel.published() == test_size);
+        for (auto i = 0; i < test_size; ++i)
+        {
+          REQUIRE(received[i] == i);
+        }
+      }
+    }
+
+    WHEN("the policy is block and the consumer cancels")
+    {
+      int_channel<3> channel{overflow_policy::block};
+      fill(channel);
+      channel.cancel();
+
+      THEN("the producer stops waiting and counts a drop")
+      {
+        REQUIRE(channel.offer(3));
+        REQUIRE(channel.dropped() == 1);
+      }
+    }
+  }
+}
+
+SCENARIO("rx pipelines cross threads through a bounded channel", "[lock-free][rx]")
+{
+  GIVEN("a fast producer publishing into a blocking channel")
+  {
+    const auto test_size = 10000;
+    auto channel = std::make_shared<int_channel<16>>(overflow_policy::block);
+
+    auto producer = rxcpp::observable<>::range(0, test_size - 1) |
+                    pa::concurrent::publish_to(channel);
+
+    WHEN("a consumer drains it on another thread")
+    {
+      std::vector<int> received;
+      std::thread::id consumer_thread;
+      auto done = pa::concurrent::drain(channel)
+                      .subscribe_on(rxcpp::observe_on_new_thread())
+                      .tap([&](int value)
+                           {
+                             consumer_thread = std::this_thread::get_id();
+                             received.push_back(value); });
+      producer.subscribe_on(rxcpp::observe_on_new_thread()).subscribe([](int) {});
+      done.as_blocking().subscribe([](int) {});
+
+      THEN("every element arrives in order without drops")
+      {
+        REQUIRE(channel->dropped() == 0);
+        REQUIRE(received.size() == test_size);
+        for (auto i = 0; i < test_size; ++i)
+        {
+          REQUIRE(received[i] == i);
+        }
+        REQUIRE(consumer_thread != std::this_thread::get_id());
+      }
+    }
+  }
+}
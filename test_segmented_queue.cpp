@@ -0,0 +1,418 @@
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/fixed_size_queue.hpp"
+#include "papaya/concurrent/segmented_queue.hpp"
+
+namespace detail
+{
+  using pa::concurrent::ConcurrentFixedSizeQueue;
+  using pa::concurrent::ConcurrentSegmentedQueue;
+
+  // Small segments, so the scenarios below cross many segment boundaries.
+  template <typename T>
+  using SmallSegmentQueue = ConcurrentSegmentedQueue<T, 8>;
+
+  template <typename Queue>
+  void spawn_and_join(size_t count, Queue &q, bool writers)
+  {
+    std::vector<std::thread> all;
+    for (size_t i = 0; i < count; ++i)
+    {
+      try
+      {
+        if (writers)
+        {
+          all.emplace_back([&, unique_i = (int)i]
+                           { q.push(unique_i); });
+        }
+        else
+        {
+          all.emplace_back([&]
+                           {
+            int read_element;
+            q.pop(read_element); });
+        }
+      }
+      catch (const std::system_error &ignored)
+      {
+        // no-op bc thread may not start due to low resource
+      }
+    }
+    for (auto &t : all)
+    {
+      if (t.joinable())
+      {
+        t.join();
+      }
+    }
+  }
+
+  // Producers and consumers each run for a fixed number of operations,
+  // like the benchmark's workload.
+  template <typename Queue>
+  void transfer(Queue &q, size_t producers, size_t consumers, size_t per_producer)
+  {
+    std::atomic<size_t> remaining{producers * per_producer};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+      threads.emplace_back([&]
+                           {
+        for (size_t i = 0; i < per_producer; ++i)
+        {
+          while (!q.push((int)i))
+          {
+            std::this_thread::yield();
+          }
+        } });
+    }
+    for (size_t c = 0; c < consumers; ++c)
+    {
+      threads.emplace_back([&]
+                           {
+        int read_element;
+        while (remaining.load(std::memory_order_relaxed) > 0)
+        {
+          if (q.pop(read_element))
+          {
+            remaining.fetch_sub(1, std::memory_order_relaxed);
+          }
+          else
+          {
+            std::this_thread::yield();
+          }
+        } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+  }
+
+  // The baseline the lock-free queues should beat.
+  class LockedQueue
+  {
+  public:
+    bool push(int value)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      values_.push_back(value);
+      return true;
+    }
+
+    bool pop(int &value)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (values_.empty())
+      {
+        return false;
+      }
+      value = values_.front();
+      values_.pop_front();
+      return true;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::deque<int> values_;
+  };
+} // namespace detail
+
+SCENARIO("Test dry pop in a segmented queue", "[lock-free][segmented]")
+{
+  detail::SmallSegmentQueue<int> q;
+
+  WHEN("0 data in the queue and N concurrent reader reads in parallel")
+  {
+    detail::spawn_and_join(10000, q, false);
+
+    THEN("the queue should still be empty, and pushes still come out")
+    {
+      REQUIRE(q.is_empty());
+      REQUIRE(q.effective_size() == 0);
+
+      q.push(7);
+      int read_element = 0;
+      REQUIRE(q.pop(read_element));
+      REQUIRE(read_element == 7);
+    }
+  }
+}
+
+SCENARIO("Test 1-N concurrent interactions in a segmented queue", "[lock-free][segmented]")
+{
+  WHEN("1 writer pushes N elements in sequence, more than any fixed-size queue here holds")
+  {
+    const auto test_size = 10000;
+    detail::SmallSegmentQueue<int> q;
+
+    for (auto i = 0; i < test_size; ++i)
+    {
+      REQUIRE(q.push(i));
+    }
+
+    THEN("they come out in order")
+    {
+      REQUIRE(test_size == q.effective_size());
+      int read_element;
+      for (auto i = 0; i < test_size; ++i)
+      {
+        REQUIRE(q.pop(read_element));
+        REQUIRE(read_element == i);
+      }
+      REQUIRE_FALSE(q.pop(read_element));
+    }
+
+    THEN("2 * N concurrent readers should exhaust the queue")
+    {
+      detail::spawn_and_join(2 * test_size, q, false);
+
+      REQUIRE(q.is_empty());
+      REQUIRE(q.effective_size() == 0);
+    }
+  }
+}
+
+SCENARIO("Test N-N concurrent interactions in a segmented queue", "[lock-free][segmented]")
+{
+  WHEN("N concurrent writer pushes 1 elements individually in parellel")
+  {
+    const auto test_size = 10000;
+    detail::SmallSegmentQueue<int> q;
+    detail::spawn_and_join(test_size, q, true);
+
+    THEN("nothing is dropped and all elements are unique")
+    {
+      REQUIRE(test_size == q.effective_size());
+      std::set<int> cache;
+      int read_element;
+      while (q.pop(read_element))
+      {
+        REQUIRE(0 == cache.count(read_element));
+        cache.insert(read_element);
+      }
+      REQUIRE(cache.size() == test_size);
+    }
+
+    THEN("N concurrent readers that pop 1 element individually in parellel exhaust the queue")
+    {
+      detail::spawn_and_join(test_size, q, false);
+
+      REQUIRE(q.is_empty());
+      REQUIRE(q.effective_size() == 0);
+    }
+  }
+
+  WHEN("N concurrent writer pushes N elements in total while N- concurrent readers read in parellel")
+  {
+    const auto stress_test_attmpts = 100;
+    const auto thread_size = 400;
+    detail::SmallSegmentQueue<int> q;
+    for (auto i = 0; i < stress_test_attmpts; ++i)
+    {
+      GIVEN("Stree run #" << i)
+      {
+        std::atomic<size_t> popped{0};
+        std::vector<std::thread> all;
+        size_t pushed = 0;
+        for (size_t i = 0; i < thread_size; ++i)
+        {
+          try
+          {
+            if (i < (size_t)(thread_size * 2.0 / 3.0))
+            {
+              all.emplace_back([&, unique_i = (int)i]
+                               { q.push(unique_i); });
+              ++pushed;
+            }
+            else
+            {
+              all.emplace_back([&]
+                               {
+                int read_element;
+                if (q.pop(read_element))
+                {
+                  popped.fetch_add(1);
+                } });
+            }
+          }
+          catch (const std::system_error &ignored)
+          {
+            // no-op bc thread may not start due to low resource
+          }
+        }
+        for (auto &t : all)
+        {
+          if (t.joinable())
+          {
+            t.join();
+          }
+        }
+        const auto expected = pushed - popped;
+
+        THEN("every push that wasn't popped is still in the queue")
+        {
+          REQUIRE(q.effective_size() == expected);
+        }
+      }
+    }
+  }
+
+  WHEN("producers and consumers run concurrently for longer")
+  {
+    detail::SmallSegmentQueue<int> q;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::vector<std::vector<int>> seen(4);
+    std::atomic<size_t> remaining{4 * 20000};
+    for (int p = 0; p < 4; ++p)
+    {
+      threads.emplace_back([&, p]
+                           {
+        for (int i = 0; i < 20000; ++i)
+        {
+          q.push(p << 24 | i);
+        } });
+    }
+    for (int c = 0; c < 4; ++c)
+    {
+      threads.emplace_back([&]
+                           {
+        std::vector<int> mine;
+        int read_element;
+        while (remaining.load() > 0)
+        {
+          if (q.pop(read_element))
+          {
+            remaining.fetch_sub(1);
+            mine.push_back(read_element);
+          }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto v : mine)
+        {
+          seen[v >> 24].push_back(v & 0xffffff);
+        } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+
+    THEN("every element comes out exactly once")
+    {
+      for (auto &values : seen)
+      {
+        std::set<int> unique(values.begin(), values.end());
+        REQUIRE(values.size() == 20000);
+        REQUIRE(unique.size() == 20000);
+      }
+      REQUIRE(q.is_empty());
+    }
+  }
+}
+
+SCENARIO("A segmented queue holds non-trivial types", "[lock-free][segmented]")
+{
+  GIVEN("a queue of shared_ptrs that is destroyed with elements still in it")
+  {
+    auto tracker = std::make_shared<int>(0);
+    {
+      detail::SmallSegmentQueue<std::shared_ptr<int>> q;
+      for (int i = 0; i < 100; ++i)
+      {
+        q.push(tracker);
+      }
+      std::shared_ptr<int> read_element;
+      for (int i = 0; i < 50; ++i)
+      {
+        REQUIRE(q.pop(read_element));
+      }
+      read_element.reset();
+
+      THEN("popping moves elements out")
+      {
+        REQUIRE(tracker.use_count() == 1 + 50);
+      }
+    }
+
+    THEN("the rest are destroyed with the queue")
+    {
+      REQUIRE(tracker.use_count() == 1);
+    }
+  }
+
+  GIVEN("move-only elements")
+  {
+    detail::SmallSegmentQueue<std::unique_ptr<std::string>> q;
+    q.push(std::make_unique<std::string>("stop"));
+    std::unique_ptr<std::string> read_element;
+
+    THEN("they can be pushed and popped")
+    {
+      REQUIRE(q.pop(read_element));
+      REQUIRE(*read_element == "stop");
+    }
+  }
+}
+
+SCENARIO("A segmented queue stops allocating in steady state", "[lock-free][segmented]")
+{
+  GIVEN("a queue whose length stays bounded")
+  {
+    detail::SmallSegmentQueue<int> q;
+    int read_element;
+    for (int i = 0; i < 100000; ++i)
+    {
+      q.push(i);
+      q.push(i);
+      q.pop(read_element);
+      q.pop(read_element);
+    }
+    auto warm = q.allocated_segments();
+    for (int i = 0; i < 100000; ++i)
+    {
+      q.push(i);
+      q.pop(read_element);
+    }
+
+    THEN("no more segments are allocated after warm-up")
+    {
+      REQUIRE(q.allocated_segments() == warm);
+      REQUIRE(warm <= 8);
+    }
+  }
+}
+
+TEST_CASE("Throughput of the MPMC queues", "[lock-free][segmented][!benchmark]")
+{
+  const size_t per_producer = 100000;
+  for (size_t threads : {1, 4})
+  {
+    BENCHMARK("ConcurrentFixedSizeQueue<int, 1024>, " + std::to_string(threads) + "P" + std::to_string(threads) + "C")
+    {
+      auto q = std::make_unique<detail::ConcurrentFixedSizeQueue<int, 1024>>();
+      detail::transfer(*q, threads, threads, per_producer);
+    };
+
+    BENCHMARK("ConcurrentSegmentedQueue<int>, " + std::to_string(threads) + "P" + std::to_string(threads) + "C")
+    {
+      detail::ConcurrentSegmentedQueue<int> q;
+      detail::transfer(q, threads, threads, per_producer);
+    };
+
+    BENCHMARK("mutex + std::deque, " + std::to_string(threads) + "P" + std::to_string(threads) + "C")
+    {
+      detail::LockedQueue q;
+      detail::transfer(q, threads, threads, per_producer);
+    };
+  }
+}
@@ -0,0 +1,349 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "papaya/concurrent/sharded_map.hpp"
+#include "papaya/factory/fl_factory.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/papaya.hpp"
+#include "papaya/sim/virtual_scheduler.hpp"
+
+namespace detail
+{
+  using pa::concurrent::ConcurrentShardedMap;
+
+  // Few shards, so the tests go through rehashes and shared shards.
+  template <typename T>
+  using small_map = ConcurrentShardedMap<uint64_t, T, std::hash<uint64_t>, 4>;
+
+  // The baseline the benchmark compares against.
+  class locked_map
+  {
+  public:
+    std::optional<uint64_t> find(uint64_t key) const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = map_.find(key);
+      return it == map_.end() ? std::nullopt : std::optional<uint64_t>(it->second);
+    }
+    bool insert_or_assign(uint64_t key, uint64_t value)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return map_.insert_or_assign(key, value).second;
+    }
+    bool erase(uint64_t key)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return map_.erase(key) > 0;
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, uint64_t> map_;
+  };
+
+  // ops_per_thread operations on each of threads threads; reads_percent of
+  // them look up a random key, the rest insert or erase one.
+  template <typename Map>
+  uint64_t mixed_workload(Map &map, size_t threads, size_t ops_per_thread, uint32_t reads_percent, uint64_t keys)
+  {
+    std::atomic<uint64_t> found{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+      workers.emplace_back([&, t]
+                           {
+        std::mt19937_64 random(t + 1);
+        uint64_t hits = 0;
+        for (size_t i = 0; i < ops_per_thread; ++i)
+        {
+          auto roll = random();
+          auto key = (roll >> 8) % keys;
+          if (roll % 100 < reads_percent)
+          {
+            hits += map.find(key).has_value();
+          }
+          else if (roll & 0x80)
+          {
+            map.insert_or_assign(key, key);
+          }
+          else
+          {
+            map.erase(key);
+          }
+        }
+        found.fetch_add(hits); });
+    }
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+    return found;
+  }
+
+  pa::coro::task<void> slow_stage(pa::sim::virtual_scheduler &scheduler)
+  {
+    co_await scheduler.sleep_for(std::chrono::seconds(1));
+  }
+} // namespace detail
+
+SCENARIO("The sharded map behaves like a map", "[sharded_map]")
+{
+  detail::small_map<std::string> map;
+
+  GIVEN("more keys than fit the initial tables")
+  {
+    for (uint64_t key = 0; key < 1000; ++key)
+    {
+      REQUIRE(map.insert(key, std::to_string(key)));
+    }
+
+    THEN("every one is found, and only those")
+    {
+      REQUIRE(map.size() == 1000);
+      for (uint64_t key = 0; key < 1000; ++key)
+      {
+        REQUIRE(map.find(key) == std::to_string(key));
+      }
+      REQUIRE_FALSE(map.contains(1000));
+      REQUIRE_FALSE(map.insert(7, "other"));
+      REQUIRE(map.find(7) == "7");
+    }
+
+    WHEN("half are erased and the rest reassigned")
+    {
+      for (uint64_t key = 0; key < 1000; key += 2)
+      {
+        REQUIRE(map.erase(key));
+      }
+      for (uint64_t key = 1; key < 1000; key += 2)
+      {
+        REQUIRE_FALSE(map.insert_or_assign(key, "odd"));
+      }
+
+      THEN("lookups go past the tombstones")
+      {
+        REQUIRE(map.size() == 500);
+        REQUIRE_FALSE(map.erase(0));
+        REQUIRE_FALSE(map.contains(998));
+        REQUIRE(map.find(999) == "odd");
+      }
+    }
+
+    WHEN("keys are erased and inserted over and over")
+    {
+      for (int round = 0; round < 50; ++round)
+      {
+        for (uint64_t key = 0; key < 1000; ++key)
+        {
+          map.erase(key);
+          map.insert(key + 1000 * (round + 1), "churn");
+        }
+        for (uint64_t key = 0; key < 1000; ++key)
+        {
+          map.erase(key + 1000 * (round + 1));
+          map.insert(key, "back");
+        }
+      }
+
+      THEN("tombstones are reclaimed instead of filling the tables")
+      {
+        REQUIRE(map.size() == 1000);
+        REQUIRE(map.find(500) == "back");
+        REQUIRE_FALSE(map.contains(1500));
+      }
+    }
+  }
+
+  GIVEN("batches")
+  {
+    std::vector<std::pair<uint64_t, std::string>> entries;
+    for (uint64_t key = 0; key < 100; ++key)
+    {
+      entries.emplace_back(key % 90, std::to_string(key));
+    }
+
+    THEN("each shard's share is applied in order under one lock")
+    {
+      REQUIRE(map.assign_batch(entries) == 90);
+      REQUIRE(map.find(5) == "95");
+      REQUIRE(map.find(50) == "50");
+      std::vector<uint64_t> keys{1, 2, 3, 200};
+      REQUIRE(map.erase_batch(keys) == 3);
+      REQUIRE(map.size() == 87);
+    }
+  }
+}
+
+SCENARIO("The sharded map reads without locks while writers churn", "[sharded_map]")
+{
+  GIVEN("stable keys, churning keys, and readers of both")
+  {
+    detail::small_map<std::shared_ptr<uint64_t>> map;
+    for (uint64_t key = 0; key < 256; ++key)
+    {
+      map.insert(key, std::make_shared<uint64_t>(key));
+    }
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> torn{0};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < 2; ++w)
+    {
+      threads.emplace_back([&, w]
+                           {
+        for (uint64_t i = 0; i < 20000; ++i)
+        {
+          auto key = 1000 + (i * 2 + w) % 3000;
+          map.insert_or_assign(key, std::make_shared<uint64_t>(key));
+          map.erase(1000 + (i * 7 + w) % 3000);
+          if (i % 64 == 0)
+          {
+            map.insert_or_assign(i % 256, std::make_shared<uint64_t>(i % 256));
+          }
+        } });
+    }
+    for (int r = 0; r < 2; ++r)
+    {
+      threads.emplace_back([&]
+                           {
+        uint64_t i = 0;
+        while (!done.load(std::memory_order_relaxed))
+        {
+          auto stable = map.find(i % 256);
+          if (!stable)
+          {
+            misses.fetch_add(1);
+          }
+          else if (**stable != i % 256)
+          {
+            torn.fetch_add(1);
+          }
+          auto key = 1000 + i % 3000;
+          map.visit(key, [&](const std::shared_ptr<uint64_t> &value)
+                    {
+                      if (*value != key)
+                      {
+                        torn.fetch_add(1);
+                      } });
+          ++i;
+        } });
+    }
+    threads[0].join();
+    threads[1].join();
+    done = true;
+    threads[2].join();
+    threads[3].join();
+
+    THEN("stable keys are never missed and no value is seen under the wrong key")
+    {
+      REQUIRE(misses == 0);
+      REQUIRE(torn == 0);
+    }
+  }
+}
+
+SCENARIO("papaya reports where each run is", "[sharded_map]")
+{
+  GIVEN("coroutine sessions that take a virtual second")
+  {
+    auto scheduler = std::make_shared<pa::sim::virtual_scheduler>();
+    auto hook = [scheduler](std::string_view)
+    { return detail::slow_stage(*scheduler); };
+    pa::papaya::options options;
+    options.session = pa::papaya::options::session_api::coroutine;
+    pa::papaya papaya{
+        4,
+        std::make_shared<pa::fl_factory>(std::make_shared<pa::metrics::registry>(), std::make_shared<pa::match_factory>(hook), hook),
+        options,
+        std::make_shared<pa::metrics::registry>(),
+        scheduler};
+
+    for (uint64_t id = 1; id <= 3; ++id)
+    {
+      pa::papaya::input input;
+      input.request_id = id;
+      REQUIRE(papaya.run(input, nullptr, nullptr, nullptr));
+    }
+
+    THEN("the first runs while the others wait")
+    {
+      REQUIRE(papaya.state_of(1) == pa::run_state::running);
+      REQUIRE(papaya.state_of(2) == pa::run_state::pending);
+      REQUIRE(papaya.state_of(3) == pa::run_state::pending);
+      REQUIRE_FALSE(papaya.state_of(4));
+    }
+
+    WHEN("the first session finishes")
+    {
+      scheduler->run_until(scheduler->now() + std::chrono::milliseconds(2500));
+
+      THEN("it's gone and the next one runs")
+      {
+        REQUIRE_FALSE(papaya.state_of(1));
+        REQUIRE(papaya.state_of(2) == pa::run_state::running);
+        REQUIRE(papaya.state_of(3) == pa::run_state::pending);
+      }
+    }
+
+    WHEN("papaya is stopped")
+    {
+      papaya.stop();
+
+      THEN("no run is left")
+      {
+        REQUIRE_FALSE(papaya.state_of(1));
+        REQUIRE_FALSE(papaya.state_of(3));
+      }
+    }
+
+    // Lets the suspended sessions finish before papaya goes away.
+    scheduler->run();
+  }
+}
+
+TEST_CASE("Sharded map against a locked unordered_map", "[sharded_map][!benchmark]")
+{
+  constexpr uint64_t keys = 1 << 16;
+  constexpr size_t total_ops = 1 << 18;
+
+  for (size_t threads : {1, 4, 16, 64})
+  {
+    for (uint32_t reads : {95, 50})
+    {
+      auto suffix = std::to_string(threads) + " threads, " + std::to_string(reads) + "% reads";
+
+      BENCHMARK_ADVANCED("sharded map, " + suffix)
+      (Catch::Benchmark::Chronometer meter)
+      {
+        detail::ConcurrentShardedMap<uint64_t, uint64_t> map(keys);
+        for (uint64_t key = 0; key < keys; key += 2)
+        {
+          map.insert(key, key);
+        }
+        meter.measure([&]
+                      { return detail::mixed_workload(map, threads, total_ops / threads, reads, keys); });
+      };
+
+      BENCHMARK_ADVANCED("mutex + unordered_map, " + suffix)
+      (Catch::Benchmark::Chronometer meter)
+      {
+        detail::locked_map map;
+        for (uint64_t key = 0; key < keys; key += 2)
+        {
+          map.insert_or_assign(key, key);
+        }
+        meter.measure([&]
+                      { return detail::mixed_workload(map, threads, total_ops / threads, reads, keys); });
+      };
+    }
+  }
+}
@@ -0,0 +1,252 @@
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "papaya/concurrent/fixed_size_queue.hpp"
+#include "papaya/concurrent/sharded_queue.hpp"
+
+namespace detail
+{
+  using pa::concurrent::ConcurrentFixedSizeQueue;
+  using pa::concurrent::ConcurrentShardedQueue;
+
+  // Producers split total elements between them and consumers pop until all
+  // of them are out.
+  template <typename Queue>
+  void transfer_total(Queue &q, size_t producers, size_t consumers, size_t total)
+  {
+    std::atomic<size_t> remaining{total};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+      threads.emplace_back([&, p]
+                           {
+        for (size_t i = p; i < total; i += producers)
+        {
+          while (!q.push((int)i))
+          {
+            std::this_thread::yield();
+          }
+        } });
+    }
+    for (size_t c = 0; c < consumers; ++c)
+    {
+      threads.emplace_back([&]
+                           {
+        int read_element;
+        while (remaining.load(std::memory_order_relaxed) > 0)
+        {
+          if (q.pop(read_element))
+          {
+            remaining.fetch_sub(1, std::memory_order_relaxed);
+          }
+          else
+          {
+            std::this_thread::yield();
+          }
+        } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+  }
+} // namespace detail
+
+SCENARIO("A sharded queue spills over when one shard fills up", "[lock-free][sharded]")
+{
+  detail::ConcurrentShardedQueue<int, 8> q(4);
+
+  GIVEN("one thread pushing more than its shard holds")
+  {
+    for (int i = 0; i < 32; ++i)
+    {
+      REQUIRE(q.push(i));
+    }
+
+    THEN("the other shards take the rest until all are full")
+    {
+      REQUIRE(q.capacity() == 32);
+      REQUIRE(q.effective_size() == 32);
+      REQUIRE_FALSE(q.push(32));
+    }
+
+    THEN("popping drains every shard, the home shard first and in order")
+    {
+      int read_element = -1;
+      for (int i = 0; i < 8; ++i)
+      {
+        REQUIRE(q.pop(read_element));
+        REQUIRE(read_element == i);
+      }
+      std::set<int> rest;
+      while (q.pop(read_element))
+      {
+        rest.insert(read_element);
+      }
+      REQUIRE(rest.size() == 24);
+      REQUIRE(*rest.begin() == 8);
+      REQUIRE(*rest.rbegin() == 31);
+      REQUIRE(q.is_empty());
+    }
+  }
+
+  GIVEN("a single shard")
+  {
+    detail::ConcurrentShardedQueue<int, 8> single(1);
+    for (int i = 0; i < 8; ++i)
+    {
+      REQUIRE(single.push(i));
+    }
+
+    THEN("it behaves like one ring")
+    {
+      REQUIRE_FALSE(single.push(8));
+      int read_element;
+      for (int i = 0; i < 8; ++i)
+      {
+        REQUIRE(single.pop(read_element));
+        REQUIRE(read_element == i);
+      }
+      REQUIRE_FALSE(single.pop(read_element));
+    }
+  }
+}
+
+SCENARIO("Test N-N concurrent interactions in a sharded queue", "[lock-free][sharded]")
+{
+  GIVEN("more producers than shards, and consumers stealing from each other")
+  {
+    const size_t producers = 6;
+    const int per_producer = 20000;
+    detail::ConcurrentShardedQueue<int, 64> q(4);
+    std::atomic<int> remaining{producers * per_producer};
+    std::vector<std::vector<int>> seen(producers);
+    std::mutex seen_mutex;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+      threads.emplace_back([&, p]
+                           {
+        for (int i = 0; i < per_producer; ++i)
+        {
+          while (!q.push((int)(p << 24) | i))
+          {
+            std::this_thread::yield();
+          }
+        } });
+    }
+    for (int c = 0; c < 3; ++c)
+    {
+      threads.emplace_back([&]
+                           {
+        std::vector<int> mine;
+        int read_element;
+        while (remaining.load() > 0)
+        {
+          if (q.pop(read_element))
+          {
+            mine.push_back(read_element);
+            remaining.fetch_sub(1);
+          }
+          else
+          {
+            std::this_thread::yield();
+          }
+        }
+        std::lock_guard<std::mutex> lock(seen_mutex);
+        for (auto v : mine)
+        {
+          seen[v >> 24].push_back(v & 0xffffff);
+        } });
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+
+    THEN("every element comes out exactly once")
+    {
+      for (auto &values : seen)
+      {
+        std::set<int> unique(values.begin(), values.end());
+        REQUIRE(values.size() == per_producer);
+        REQUIRE(unique.size() == per_producer);
+      }
+      REQUIRE(q.is_empty());
+    }
+  }
+
+  GIVEN("producers that never fill their shard and one consumer")
+  {
+    const size_t producers = 4;
+    const int per_producer = 1000;
+    detail::ConcurrentShardedQueue<int, 4096> q(4);
+    std::atomic<bool> full{false};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+      threads.emplace_back([&, p]
+                           {
+        for (int i = 0; i < per_producer; ++i)
+        {
+          if (!q.push((int)(p << 24) | i))
+          {
+            full = true;
+          }
+        } });
+    }
+    std::vector<int> last(producers, -1);
+    bool ordered = true;
+    int read_element;
+    for (int popped = 0; popped < (int)producers * per_producer && !full;)
+    {
+      if (!q.pop(read_element))
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      auto &previous = last[read_element >> 24];
+      ordered = ordered && (read_element & 0xffffff) > previous;
+      previous = read_element & 0xffffff;
+      ++popped;
+    }
+    for (auto &t : threads)
+    {
+      t.join();
+    }
+
+    THEN("each producer's elements come out in push order")
+    {
+      REQUIRE_FALSE(full);
+      REQUIRE(ordered);
+      REQUIRE(q.is_empty());
+    }
+  }
+}
+
+TEST_CASE("Scaling of a sharded queue against one ring", "[lock-free][sharded][!benchmark]")
+{
+  const size_t total = 1 << 18;
+  for (size_t threads : {1, 2, 4, 8, 16, 32, 64})
+  {
+    auto suffix = ", " + std::to_string(threads) + "P" + std::to_string(threads) + "C";
+
+    BENCHMARK("ConcurrentFixedSizeQueue<int, 1024>" + suffix)
+    {
+      auto q = std::make_unique<detail::ConcurrentFixedSizeQueue<int, 1024>>();
+      detail::transfer_total(*q, threads, threads, total);
+    };
+
+    BENCHMARK("ConcurrentShardedQueue<int, 1024>, one shard per producer" + suffix)
+    {
+      detail::ConcurrentShardedQueue<int, 1024> q(threads);
+      detail::transfer_total(q, threads, threads, total);
+    };
+  }
+}
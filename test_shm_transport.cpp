@@ -0,0 +1,276 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "papaya/codec/schemas.hpp"
+#include "papaya/ipc/shm_transport.hpp"
+
+namespace detail
+{
+  constexpr uint32_t echo_tag = 1;
+  constexpr uint32_t ack_tag = 2;
+  constexpr uint32_t stop_tag = 3;
+
+  // Child side of the benchmarks: replies to echo_tag with the same bytes
+  // and to anything else with an empty ack, until stop_tag.
+  [[noreturn]] void run_shm_peer(int fd)
+  {
+    auto endpoint = pa::ipc::shm_endpoint::attach(fd);
+    while (true)
+    {
+      auto message = endpoint->receive(std::chrono::seconds(10));
+      if (!message || message->tag == stop_tag)
+      {
+        break;
+      }
+      if (message->tag == echo_tag)
+      {
+        while (!endpoint->try_send(message->payload, echo_tag))
+        {
+        }
+      }
+      else
+      {
+        while (!endpoint->try_send({}, ack_tag))
+        {
+        }
+      }
+      endpoint->release(*message);
+    }
+    endpoint.reset();
+    ::_exit(0);
+  }
+
+  bool read_all(int fd, char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      auto n = ::read(fd, data, size);
+      if (n <= 0)
+      {
+        return false;
+      }
+      data += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  bool write_all(int fd, const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      auto n = ::write(fd, data, size);
+      if (n <= 0)
+      {
+        return false;
+      }
+      data += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  // The same protocol over a stream socket: [tag, size] then the payload.
+  [[noreturn]] void run_socket_peer(int fd)
+  {
+    std::vector<char> buffer;
+    uint64_t frame[2];
+    while (read_all(fd, reinterpret_cast<char *>(frame), sizeof(frame)) && frame[0] != stop_tag)
+    {
+      buffer.resize(frame[1]);
+      read_all(fd, buffer.data(), buffer.size());
+      if (frame[0] == echo_tag)
+      {
+        write_all(fd, reinterpret_cast<char *>(frame), sizeof(frame));
+        write_all(fd, buffer.data(), buffer.size());
+      }
+      else
+      {
+        uint64_t ack[2] = {ack_tag, 0};
+        write_all(fd, reinterpret_cast<char *>(ack), sizeof(ack));
+      }
+    }
+    ::_exit(0);
+  }
+} // namespace detail
+
+SCENARIO("shm endpoints exchange messages through the shared heap", "[shm]")
+{
+  GIVEN("an owner and a peer attached to its region")
+  {
+    auto owner = pa::ipc::shm_endpoint::create(8192);
+    auto peer = pa::ipc::shm_endpoint::attach(owner->fd());
+    REQUIRE(owner->wait_for_peer(std::chrono::milliseconds(0)));
+    REQUIRE(owner->peer_alive());
+    REQUIRE(peer->peer_alive());
+
+    WHEN("the owner sends an executor input")
+    {
+      pa::IExecutor::Input input{"{}", std::string(3000, 'd'), "local", std::string(2000, 'g'), "/data"};
+      REQUIRE(owner->try_send_encoded(input, 7));
+      auto message = peer->try_receive();
+
+      THEN("the peer reads it in place")
+      {
+        REQUIRE(message);
+        REQUIRE(message->tag == 7);
+        auto view = pa::ipc::decode<pa::IExecutor::Input>(*message);
+        REQUIRE(view);
+        auto dataset = std::get<1>(*view);
+        REQUIRE(dataset == input.dataset);
+        REQUIRE(dataset.data() >= message->payload.data());
+        REQUIRE(dataset.data() < message->payload.data() + message->payload.size());
+      }
+    }
+
+    WHEN("the heap fills up")
+    {
+      std::vector<char> payload(3000, 'x');
+      REQUIRE(owner->try_send(payload, 1));
+      REQUIRE(owner->try_send(payload, 2));
+      REQUIRE_FALSE(owner->try_send(payload, 3));
+
+      THEN("releasing a message makes room, also across the heap's end")
+      {
+        auto first = peer->try_receive();
+        peer->release(*first);
+        REQUIRE(owner->try_send(payload, 3));
+
+        auto second = peer->try_receive();
+        auto third = peer->try_receive();
+        REQUIRE(second->tag == 2);
+        REQUIRE(third->tag == 3);
+        REQUIRE(std::memcmp(third->payload.data(), payload.data(), payload.size()) == 0);
+        REQUIRE_FALSE(peer->try_receive());
+      }
+    }
+
+    WHEN("the peer closes its end")
+    {
+      peer.reset();
+
+      THEN("the owner notices")
+      {
+        REQUIRE_FALSE(owner->peer_alive());
+        REQUIRE_THROWS_AS(owner->receive(std::chrono::milliseconds(50)), pa::ipc::peer_lost_error);
+      }
+    }
+  }
+
+  GIVEN("a region that already has a peer")
+  {
+    auto owner = pa::ipc::shm_endpoint::create(4096);
+    auto peer = pa::ipc::shm_endpoint::attach(owner->fd());
+
+    THEN("a second peer is turned away")
+    {
+      REQUIRE_THROWS_AS(pa::ipc::shm_endpoint::attach(owner->fd()), std::runtime_error);
+    }
+  }
+}
+
+SCENARIO("shm endpoints detect a crashed peer process", "[shm]")
+{
+  GIVEN("a child that attaches and then dies without closing")
+  {
+    auto owner = pa::ipc::shm_endpoint::create(4096);
+    auto child = ::fork();
+    if (child == 0)
+    {
+      auto peer = pa::ipc::shm_endpoint::attach(owner->fd());
+      peer.release();
+      ::_exit(1);
+    }
+    REQUIRE(owner->wait_for_peer(std::chrono::seconds(5)));
+
+    THEN("the owner stops waiting on it, even before reaping it")
+    {
+      REQUIRE_THROWS_AS(owner->receive(std::chrono::seconds(5)), pa::ipc::peer_lost_error);
+      ::waitpid(child, nullptr, 0);
+    }
+  }
+}
+
+TEST_CASE("shm transport vs Unix domain socket", "[shm][!benchmark]")
+{
+  constexpr size_t small = 64;
+  constexpr size_t large = size_t{4} << 20;
+  std::vector<char> small_payload(small, 's');
+  std::vector<char> large_payload(large, 'l');
+
+  {
+    auto owner = pa::ipc::shm_endpoint::create(2 * large + 4096);
+    auto child = ::fork();
+    if (child == 0)
+    {
+      detail::run_shm_peer(owner->fd());
+    }
+    REQUIRE(owner->wait_for_peer(std::chrono::seconds(5)));
+
+    auto round_trip = [&owner](const std::vector<char> &payload, uint32_t tag)
+    {
+      while (!owner->try_send(payload, tag))
+      {
+      }
+      auto reply = owner->receive(std::chrono::seconds(5));
+      auto size = reply->payload.size();
+      owner->release(*reply);
+      return size;
+    };
+
+    BENCHMARK("shm: 64 B echo round trip")
+    {
+      return round_trip(small_payload, detail::echo_tag);
+    };
+    BENCHMARK("shm: 4 MiB one way + ack")
+    {
+      return round_trip(large_payload, detail::ack_tag);
+    };
+
+    owner->try_send({}, detail::stop_tag);
+    ::waitpid(child, nullptr, 0);
+  }
+
+  {
+    int fds[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    auto child = ::fork();
+    if (child == 0)
+    {
+      ::close(fds[0]);
+      detail::run_socket_peer(fds[1]);
+    }
+    ::close(fds[1]);
+
+    std::vector<char> reply(large);
+    auto round_trip = [&](const std::vector<char> &payload, uint64_t tag)
+    {
+      uint64_t frame[2] = {tag, payload.size()};
+      detail::write_all(fds[0], reinterpret_cast<char *>(frame), sizeof(frame));
+      detail::write_all(fds[0], payload.data(), payload.size());
+      detail::read_all(fds[0], reinterpret_cast<char *>(frame), sizeof(frame));
+      detail::read_all(fds[0], reply.data(), frame[1]);
+      return frame[1];
+    };
+
+    BENCHMARK("uds: 64 B echo round trip")
+    {
+      return round_trip(small_payload, detail::echo_tag);
+    };
+    BENCHMARK("uds: 4 MiB one way + ack")
+    {
+      return round_trip(large_payload, detail::ack_tag);
+    };
+
+    uint64_t stop[2] = {detail::stop_tag, 0};
+    detail::write_all(fds[0], reinterpret_cast<char *>(stop), sizeof(stop));
+    ::close(fds[0]);
+    ::waitpid(child, nullptr, 0);
+  }
+}
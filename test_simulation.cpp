@@ -0,0 +1,171 @@
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "papaya/coro/task.hpp"
+#include "papaya/sim/simulation.hpp"
+#include "papaya/sim/virtual_scheduler.hpp"
+
+namespace detail
+{
+  using namespace std::chrono_literals;
+  using pa::sim::virtual_scheduler;
+
+  pa::coro::task<void> sleeper(virtual_scheduler &scheduler, std::chrono::seconds delay, std::vector<std::string> &log)
+  {
+    co_await scheduler.sleep_for(delay);
+    log.push_back("slept " + std::to_string(delay.count()) + "s");
+  }
+
+  // An hour of traffic at ~70% load: sessions take 0.35 s at the median and
+  // runs arrive twice a second.
+  pa::sim::config busy_hour(uint64_t seed)
+  {
+    pa::sim::config config;
+    config.seed = seed;
+    config.traffic.duration = 1h;
+    config.traffic.arrivals_per_second = 2;
+    config.traffic.priority_mix = {1, 4, 1, 0};
+    config.traffic.deadline = 30s;
+    config.session_stage = {250ms, 0.5, 0.01};
+    config.match_stage = {100ms, 0.3, 0.02};
+    config.pending_request_size = 8;
+    return config;
+  }
+} // namespace detail
+
+SCENARIO("The virtual scheduler steps time instantly", "[sim]")
+{
+  using namespace std::chrono_literals;
+
+  GIVEN("jobs scheduled out of order")
+  {
+    detail::virtual_scheduler scheduler;
+    auto start = scheduler.now();
+    std::vector<std::string> log;
+    scheduler.schedule_after(2h, [&]
+                             { log.push_back("2h"); });
+    scheduler.schedule_after(1s, [&]
+                             { log.push_back("1s a"); });
+    scheduler.schedule_after(1s, [&]
+                             { log.push_back("1s b");
+                               scheduler.schedule([&] { log.push_back("1s c"); }); });
+    scheduler.schedule([&]
+                       { log.push_back("now"); });
+
+    WHEN("it runs up to an hour in")
+    {
+      REQUIRE(scheduler.run_until(start + 1h) == 4);
+
+      THEN("the due jobs ran by time, then in scheduling order, and the clock is at the hour")
+      {
+        REQUIRE(log == std::vector<std::string>{"now", "1s a", "1s b", "1s c"});
+        REQUIRE(scheduler.now() == start + 1h);
+      }
+
+      AND_WHEN("it runs the rest")
+      {
+        scheduler.run();
+
+        THEN("the clock jumped to the last job")
+        {
+          REQUIRE(log.back() == "2h");
+          REQUIRE(scheduler.now() == start + 2h);
+        }
+      }
+    }
+  }
+
+  GIVEN("coroutines sleeping on virtual time")
+  {
+    detail::virtual_scheduler scheduler;
+    std::vector<std::string> log;
+    auto done = 0;
+    for (auto delay : {3s, 1s, 2s})
+    {
+      pa::coro::spawn(
+          detail::sleeper(scheduler, delay, log), [&]
+          { ++done; },
+          [](std::exception_ptr) {});
+    }
+    scheduler.run();
+
+    THEN("they wake in order of their deadlines")
+    {
+      REQUIRE(done == 3);
+      REQUIRE(log == std::vector<std::string>{"slept 1s", "slept 2s", "slept 3s"});
+      REQUIRE(scheduler.now() == std::chrono::steady_clock::time_point{} + 3s);
+    }
+  }
+}
+
+SCENARIO("A simulation replays exactly from its seed", "[sim]")
+{
+  GIVEN("an hour of busy traffic")
+  {
+    auto first = pa::sim::simulate(detail::busy_hour(38));
+
+    THEN("every run is accounted for")
+    {
+      REQUIRE(first.runs > 6000);
+      REQUIRE(first.submissions == first.admitted + first.rejected);
+      REQUIRE(first.admitted == first.completed + first.failed);
+      REQUIRE(first.failed > 0);
+      REQUIRE(first.admission_latency.count == first.admitted);
+      REQUIRE(first.simulated >= std::chrono::hours(1));
+    }
+
+    THEN("the same seed gives the same trace, and another seed doesn't")
+    {
+      auto again = pa::sim::simulate(detail::busy_hour(38));
+      REQUIRE(again.trace_hash == first.trace_hash);
+      REQUIRE(again.admitted == first.admitted);
+      REQUIRE(again.deadline_misses == first.deadline_misses);
+      REQUIRE(again.admission_latency.sum == first.admission_latency.sum);
+      REQUIRE(pa::sim::simulate(detail::busy_hour(39)).trace_hash != first.trace_hash);
+    }
+  }
+
+  GIVEN("bursts that overflow a short pending queue, with and without client retries")
+  {
+    auto config = detail::busy_hour(38);
+    config.pending_request_size = 1;
+    auto no_retries = pa::sim::simulate(config);
+    config.traffic.max_retries = 3;
+    config.traffic.retry_backoff = std::chrono::seconds(5);
+    auto retries = pa::sim::simulate(config);
+
+    THEN("retries drop fewer runs at the cost of more submissions")
+    {
+      REQUIRE(no_retries.dropped == no_retries.rejected);
+      REQUIRE(retries.dropped < no_retries.dropped);
+      REQUIRE(retries.submissions > retries.runs);
+    }
+  }
+}
+
+TEST_CASE("Simulating a day of traffic", "[sim][!benchmark]")
+{
+  using namespace std::chrono_literals;
+
+  // ~1.7M runs over 24 virtual hours.
+  auto config = detail::busy_hour(1);
+  config.traffic.duration = 24h;
+  config.traffic.arrivals_per_second = 20;
+  config.session_stage = {25ms, 0.5, 0.01};
+  config.match_stage = {10ms, 0.3, 0.02};
+
+  for (auto starvation_limit : {2u, 8u, 64u})
+  {
+    config.options.starvation_limit = starvation_limit;
+    auto started = std::chrono::steady_clock::now();
+    auto report = pa::sim::simulate(config);
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - started;
+    WARN("starvation_limit " << starvation_limit << ": " << report.runs << " runs, "
+                             << report.completed << " completed, " << report.failed << " failed, "
+                             << report.dropped << " dropped, " << report.deadline_misses << " deadline misses, p99 admission "
+                             << report.admission_latency.percentile(0.99) / 1000000 << " ms; "
+                             << wall.count() << " s wall, " << report.runs / wall.count() << " runs/s");
+  }
+}
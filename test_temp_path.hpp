@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+namespace detail
+{
+  // A path under /tmp unique to this process, for the tests that need a
+  // file or a directory on disk. Whatever is at the path, and anything next
+  // to it named after it (e.g. a journal's path.compact), is removed when
+  // it's created and on scope exit.
+  struct temp_path
+  {
+    temp_path(const std::string &name, const std::string &extension)
+        : path("/tmp/papaya_" + name + "_" + std::to_string(::getpid()) + extension)
+    {
+      remove();
+    }
+    ~temp_path() { remove(); }
+
+    temp_path(const temp_path &) = delete;
+    temp_path &operator=(const temp_path &) = delete;
+
+    std::string path;
+
+  private:
+    void remove() noexcept
+    {
+      std::error_code error;
+      std::filesystem::path self(path);
+      auto prefix = self.filename().string();
+      std::filesystem::directory_iterator end;
+      for (std::filesystem::directory_iterator it(self.parent_path(), error); !error && it != end; it.increment(error))
+      {
+        if (it->path().filename().string().rfind(prefix, 0) == 0)
+        {
+          std::error_code ignored;
+          std::filesystem::remove_all(it->path(), ignored);
+        }
+      }
+    }
+  };
+} // namespace detail
@@ -0,0 +1,168 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "papaya/coro/task.hpp"
+#include "papaya/executor/executor.hpp"
+#include "papaya/factory/match_factory.hpp"
+#include "papaya/trace/tracer.hpp"
+
+namespace detail
+{
+  namespace trace = pa::trace;
+
+  // Tracing is process-wide, so each scenario starts from empty buffers
+  // and leaves tracing off.
+  struct tracing
+  {
+    tracing()
+    {
+      trace::disable();
+      trace::clear();
+      trace::enable();
+    }
+    ~tracing() { trace::disable(); }
+  };
+
+  std::vector<trace::event> events_named(const trace::snapshot &snapshot, const std::string &name)
+  {
+    std::vector<trace::event> found;
+    std::copy_if(snapshot.events.begin(), snapshot.events.end(), std::back_inserter(found),
+                 [&](const trace::event &e)
+                 { return name == e.record.name; });
+    return found;
+  }
+} // namespace detail
+
+SCENARIO("Spans are recorded only while tracing is on", "[trace]")
+{
+  GIVEN("tracing off")
+  {
+    pa::trace::disable();
+    pa::trace::clear();
+    {
+      pa::trace::span span("off");
+    }
+
+    THEN("nothing is recorded")
+    {
+      REQUIRE(detail::events_named(pa::trace::take_snapshot(), "off").empty());
+    }
+  }
+
+  GIVEN("tracing on and nested spans on two threads")
+  {
+    detail::tracing tracing;
+    {
+      pa::trace::span outer("outer", 42);
+      pa::trace::span inner("inner");
+    }
+    std::thread([]
+                { pa::trace::span span("other thread"); })
+        .join();
+    pa::trace::disable();
+    auto snapshot = pa::trace::take_snapshot();
+
+    THEN("each span is one record, nested in time, tagged with its thread")
+    {
+      auto outer = detail::events_named(snapshot, "outer");
+      auto inner = detail::events_named(snapshot, "inner");
+      auto other = detail::events_named(snapshot, "other thread");
+      REQUIRE(outer.size() == 1);
+      REQUIRE(inner.size() == 1);
+      REQUIRE(other.size() == 1);
+      REQUIRE(outer[0].record.arg == 42);
+      REQUIRE(outer[0].record.begin <= inner[0].record.begin);
+      REQUIRE(inner[0].record.end <= outer[0].record.end);
+      REQUIRE(outer[0].thread == inner[0].thread);
+      REQUIRE(other[0].thread != outer[0].thread);
+      REQUIRE(snapshot.ticks_per_microsecond > 0);
+    }
+
+    THEN("the Chrome trace lists them as complete events")
+    {
+      std::ostringstream out;
+      pa::trace::write_chrome_json(out, snapshot);
+      auto json = out.str();
+      REQUIRE(json.rfind("{\"traceEvents\":[", 0) == 0);
+      REQUIRE(json.find("{\"name\":\"outer\",\"ph\":\"X\",\"pid\":1,") != std::string::npos);
+      REQUIRE(json.find("\"args\":{\"id\":42}") != std::string::npos);
+      REQUIRE(json.find("\"name\":\"other thread\"") != std::string::npos);
+      REQUIRE(json.find("e+") == std::string::npos);
+    }
+  }
+
+  GIVEN("more spans than a thread's buffer holds")
+  {
+    detail::tracing tracing;
+    for (size_t i = 0; i < pa::trace::buffer_records + 10; ++i)
+    {
+      pa::trace::span span("wrapped", i);
+    }
+    pa::trace::disable();
+    auto snapshot = pa::trace::take_snapshot();
+
+    THEN("the oldest are overwritten and counted")
+    {
+      auto wrapped = detail::events_named(snapshot, "wrapped");
+      REQUIRE(wrapped.size() == pa::trace::buffer_records);
+      REQUIRE(wrapped.front().record.arg == 10);
+      REQUIRE(snapshot.overwritten == 10);
+    }
+  }
+
+  GIVEN("an FlExecutor")
+  {
+    detail::tracing tracing;
+    pa::FlExecutor executor;
+    executor.execute(pa::IExecutor::Input{"", "", "", "", ""});
+    pa::trace::disable();
+
+    THEN("execute() shows up in the trace")
+    {
+      REQUIRE(detail::events_named(pa::trace::take_snapshot(), "FlExecutor::execute").size() == 1);
+    }
+  }
+
+  GIVEN("a match_factory")
+  {
+    detail::tracing tracing;
+    pa::match_factory factory;
+    factory.create(pa::match::input{}).subscribe([](pa::match::output) {});
+    pa::coro::sync_wait(factory.co_create(pa::match::input{}));
+    pa::trace::disable();
+    auto snapshot = pa::trace::take_snapshot();
+
+    THEN("both the rx and the coroutine stage show up, each under its own name")
+    {
+      REQUIRE(detail::events_named(snapshot, "match_factory::create").size() == 1);
+      REQUIRE(detail::events_named(snapshot, "match_factory::co_create").size() == 1);
+    }
+  }
+}
+
+TEST_CASE("Cost of a trace span", "[trace][!benchmark]")
+{
+  pa::trace::disable();
+  BENCHMARK("span, tracing off")
+  {
+    pa::trace::span span("benchmark");
+  };
+
+  pa::trace::enable();
+  BENCHMARK("span, tracing on")
+  {
+    pa::trace::span span("benchmark");
+  };
+  pa::trace::disable();
+  pa::trace::clear();
+
+  BENCHMARK("now(), for reference")
+  {
+    return pa::trace::now();
+  };
+}